@@ -0,0 +1,147 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#include "bench-utils.h"
+
+struct _BenchRun {
+        char *name;
+        guint iterations;
+
+        gint64 start_time;
+        gint64 elapsed;
+        guint64 start_allocations;
+        guint64 allocations;
+
+        gint64 sample_start_time;
+        GArray *samples;
+};
+
+static int iterations;
+
+static GOptionEntry bench_entries[] = {
+        { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+          "Number of iterations of every benchmark", "N" },
+        { NULL }
+};
+
+/* Allocations are only counted when the tests are built with
+ * -Dalloc_tracking=true, see alloc-tracker.c
+ */
+guint64
+bench_get_allocations (void)
+{
+        AllocCounters counters;
+
+        alloc_tracker_get_thread_counters (&counters);
+        return counters.allocs;
+}
+
+void
+bench_init (int    argc,
+            char **argv)
+{
+        test_init (argc, argv, bench_entries);
+}
+
+guint
+bench_get_iterations (guint default_iterations)
+{
+        return iterations > 0 ? (guint)iterations : default_iterations;
+}
+
+BenchRun *
+bench_run_new (const char *name,
+               guint       iterations)
+{
+        BenchRun *run;
+
+        run = g_new0 (BenchRun, 1);
+        run->name = g_strdup (name);
+        run->iterations = iterations;
+        run->samples = g_array_sized_new (FALSE, FALSE, sizeof (gint64), iterations);
+
+        return run;
+}
+
+void
+bench_run_start (BenchRun *run)
+{
+        run->start_allocations = bench_get_allocations ();
+        run->start_time = g_get_monotonic_time ();
+}
+
+void
+bench_run_stop (BenchRun *run)
+{
+        run->elapsed = g_get_monotonic_time () - run->start_time;
+        run->allocations = bench_get_allocations () - run->start_allocations;
+}
+
+void
+bench_run_sample_start (BenchRun *run)
+{
+        run->sample_start_time = g_get_monotonic_time ();
+}
+
+void
+bench_run_sample_stop (BenchRun *run)
+{
+        gint64 sample = g_get_monotonic_time () - run->sample_start_time;
+
+        g_array_append_val (run->samples, sample);
+}
+
+static int
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+        gint64 sample_a = *(const gint64 *)a;
+        gint64 sample_b = *(const gint64 *)b;
+
+        return sample_a < sample_b ? -1 : sample_a > sample_b;
+}
+
+static gint64
+get_percentile (GArray *samples,
+                double  percentile)
+{
+        guint index;
+
+        index = (guint)(percentile * (samples->len - 1) + 0.5);
+        return g_array_index (samples, gint64, index);
+}
+
+void
+bench_run_report_and_free (BenchRun *run)
+{
+        GString *report;
+        double per_op;
+
+        report = g_string_new (NULL);
+        g_string_append_printf (report, "%-40s iterations=%-8u", run->name, run->iterations);
+
+        if (run->samples->len) {
+                g_array_sort (run->samples, compare_samples);
+                g_string_append_printf (report, " req/s=%-10.1f p50=%" G_GINT64_FORMAT "us p99=%" G_GINT64_FORMAT "us",
+                                        run->iterations * (double)G_USEC_PER_SEC / MAX (run->elapsed, 1),
+                                        get_percentile (run->samples, 0.5),
+                                        get_percentile (run->samples, 0.99));
+        } else {
+                per_op = run->elapsed * 1000.0 / MAX (run->iterations, 1);
+                g_string_append_printf (report, " ns/op=%-10.1f", per_op);
+        }
+
+        if (alloc_tracker_is_available ()) {
+                g_string_append_printf (report, " allocs/op=%.1f",
+                                        run->allocations / (double)MAX (run->iterations, 1));
+        }
+
+        g_print ("%s\n", report->str);
+        g_string_free (report, TRUE);
+
+        g_array_unref (run->samples);
+        g_free (run->name);
+        g_free (run);
+}
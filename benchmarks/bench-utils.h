@@ -0,0 +1,33 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "test-utils.h"
+#include "alloc-tracker.h"
+
+G_BEGIN_DECLS
+
+typedef struct _BenchRun BenchRun;
+
+void      bench_init                (int          argc,
+                                     char       **argv);
+guint     bench_get_iterations      (guint        default_iterations);
+
+/* Micro benchmarks time a whole batch of operations */
+BenchRun *bench_run_new             (const char  *name,
+                                     guint        iterations);
+void      bench_run_start           (BenchRun    *run);
+void      bench_run_stop            (BenchRun    *run);
+
+/* Macro benchmarks additionally time every single request */
+void      bench_run_sample_start    (BenchRun    *run);
+void      bench_run_sample_stop     (BenchRun    *run);
+
+void      bench_run_report_and_free (BenchRun    *run);
+
+guint64   bench_get_allocations     (void);
+
+G_END_DECLS
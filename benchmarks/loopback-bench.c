@@ -0,0 +1,212 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#include "bench-utils.h"
+
+static void
+server_callback (SoupServer        *server,
+                 SoupServerMessage *msg,
+                 const char        *path,
+                 GHashTable        *query,
+                 gpointer           user_data)
+{
+        soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+        soup_server_message_set_response (msg, "text/plain",
+                                          SOUP_MEMORY_STATIC,
+                                          "Hello world\r\n", 13);
+}
+
+static void
+websocket_echo (SoupWebsocketConnection *conn,
+                SoupWebsocketDataType    type,
+                GBytes                  *message,
+                gpointer                 user_data)
+{
+        soup_websocket_connection_send_message (conn, type, message);
+}
+
+static void
+websocket_closed (SoupWebsocketConnection *conn,
+                  gpointer                 user_data)
+{
+        g_object_unref (conn);
+}
+
+static void
+websocket_callback (SoupServer              *server,
+                    SoupServerMessage       *msg,
+                    const char              *path,
+                    SoupWebsocketConnection *conn,
+                    gpointer                 user_data)
+{
+        g_signal_connect (conn, "message",
+                          G_CALLBACK (websocket_echo), NULL);
+        g_signal_connect (conn, "closed",
+                          G_CALLBACK (websocket_closed), NULL);
+        g_object_ref (conn);
+}
+
+static void
+run_requests (const char  *name,
+              SoupSession *session,
+              GUri        *uri,
+              guint        n)
+{
+        BenchRun *run;
+        AllocTracker *tracker;
+        SoupMessage *msg;
+        GBytes *body;
+        guint i;
+
+        /* Warm up the connection, so that only keep-alive requests are measured */
+        msg = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+        body = soup_test_session_async_send (session, msg, NULL, NULL);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_bytes_unref (body);
+        g_object_unref (msg);
+
+        tracker = alloc_tracker_new (session);
+        run = bench_run_new (name, n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                bench_run_sample_start (run);
+                msg = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+                body = soup_test_session_async_send (session, msg, NULL, NULL);
+                bench_run_sample_stop (run);
+
+                soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+                g_bytes_unref (body);
+                g_object_unref (msg);
+        }
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+
+        if (alloc_tracker_is_available ()) {
+                char *report = alloc_tracker_to_string (tracker);
+                char **lines = g_strsplit (report, "\n", -1);
+                guint j;
+
+                for (j = 0; lines[j]; j++)
+                        g_print ("  %s\n", lines[j]);
+                g_strfreev (lines);
+                g_free (report);
+        }
+        alloc_tracker_free (tracker);
+}
+
+static void
+bench_http1 (SoupServer *server)
+{
+        SoupSession *session;
+        GUri *uri;
+
+        uri = soup_test_server_get_uri (server, "http", "127.0.0.1");
+        session = soup_test_session_new (NULL);
+        run_requests ("loopback/http1-keepalive-get", session, uri, bench_get_iterations (5000));
+        soup_test_session_abort_unref (session);
+        g_uri_unref (uri);
+}
+
+static void
+bench_http2 (void)
+{
+        SoupSession *session;
+        GUri *uri;
+
+        if (!tls_available || !quart_init ()) {
+                g_print ("%-40s skipped (needs TLS and the quart test server)\n", "loopback/http2-get");
+                return;
+        }
+
+        uri = g_uri_parse ("https://127.0.0.1:5000/", SOUP_HTTP_URI_FLAGS, NULL);
+        session = soup_test_session_new (NULL);
+        run_requests ("loopback/http2-get", session, uri, bench_get_iterations (5000));
+        soup_test_session_abort_unref (session);
+        g_uri_unref (uri);
+}
+
+static void
+websocket_connected (SoupSession              *session,
+                     GAsyncResult             *result,
+                     SoupWebsocketConnection **client)
+{
+        GError *error = NULL;
+
+        *client = soup_session_websocket_connect_finish (session, result, &error);
+        g_assert_no_error (error);
+}
+
+static void
+websocket_message_received (SoupWebsocketConnection *conn,
+                            SoupWebsocketDataType    type,
+                            GBytes                  *message,
+                            guint                   *received)
+{
+        (*received)++;
+}
+
+static void
+bench_websocket (SoupServer *server)
+{
+        SoupSession *session;
+        SoupWebsocketConnection *client = NULL;
+        SoupMessage *msg;
+        GUri *uri;
+        BenchRun *run;
+        guint received = 0;
+        guint i, n = bench_get_iterations (10000);
+
+        uri = soup_test_server_get_uri (server, "http", "127.0.0.1");
+        msg = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+        session = soup_test_session_new (NULL);
+        soup_session_websocket_connect_async (session, msg, NULL, NULL, G_PRIORITY_DEFAULT, NULL,
+                                              (GAsyncReadyCallback)websocket_connected, &client);
+        while (!client)
+                g_main_context_iteration (NULL, TRUE);
+        g_signal_connect (client, "message",
+                          G_CALLBACK (websocket_message_received), &received);
+
+        run = bench_run_new ("loopback/websocket-echo", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                bench_run_sample_start (run);
+                soup_websocket_connection_send_text (client, "Hello world");
+                while (received <= i)
+                        g_main_context_iteration (NULL, TRUE);
+                bench_run_sample_stop (run);
+        }
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+
+        soup_websocket_connection_close (client, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+        while (soup_websocket_connection_get_state (client) != SOUP_WEBSOCKET_STATE_CLOSED)
+                g_main_context_iteration (NULL, TRUE);
+
+        g_object_unref (client);
+        g_object_unref (msg);
+        soup_test_session_abort_unref (session);
+        g_uri_unref (uri);
+}
+
+int
+main (int argc, char **argv)
+{
+        SoupServer *server;
+
+        bench_init (argc, argv);
+
+        server = soup_test_server_new (SOUP_TEST_SERVER_IN_THREAD);
+        soup_server_add_handler (server, NULL, server_callback, NULL, NULL);
+        soup_server_add_websocket_handler (server, NULL, NULL, NULL,
+                                           websocket_callback, NULL, NULL);
+
+        bench_http1 (server);
+        bench_http2 ();
+        bench_websocket (server);
+
+        soup_test_server_quit_unref (server);
+        test_cleanup ();
+        return 0;
+}
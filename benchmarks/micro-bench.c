@@ -0,0 +1,308 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#include "bench-utils.h"
+#include "soup-path-map.h"
+
+#ifdef G_OS_UNIX
+#include <sys/socket.h>
+#endif
+
+static const char request_headers[] =
+        "GET /index.html?foo=bar HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/15.0 Safari/605.1.15\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: session=0123456789abcdef; theme=dark\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "\r\n";
+
+static const char response_headers[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Date: Tue, 09 Nov 2021 10:00:00 GMT\r\n"
+        "Server: Apache/2.4.51\r\n"
+        "Last-Modified: Mon, 08 Nov 2021 09:00:00 GMT\r\n"
+        "ETag: \"2aa6-5d0437b4f4b00\"\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "Content-Length: 10918\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "Cache-Control: public, max-age=3600\r\n"
+        "Content-Type: text/html; charset=UTF-8\r\n"
+        "X-Frame-Options: SAMEORIGIN\r\n"
+        "\r\n";
+
+static void
+bench_headers_parse_request (void)
+{
+        BenchRun *run;
+        guint i, n = bench_get_iterations (200000);
+
+        run = bench_run_new ("micro/headers-parse-request", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                SoupMessageHeaders *headers;
+                char *method, *path;
+                SoupHTTPVersion version;
+                guint status;
+
+                headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_REQUEST);
+                status = soup_headers_parse_request (request_headers, sizeof (request_headers) - 1,
+                                                     headers, &method, &path, &version);
+                g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+                g_free (method);
+                g_free (path);
+                soup_message_headers_unref (headers);
+        }
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+}
+
+static void
+bench_headers_parse_response (void)
+{
+        BenchRun *run;
+        guint i, n = bench_get_iterations (200000);
+
+        run = bench_run_new ("micro/headers-parse-response", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                SoupMessageHeaders *headers;
+                SoupHTTPVersion version;
+                guint status_code;
+                char *reason_phrase;
+
+                headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+                g_assert_true (soup_headers_parse_response (response_headers, sizeof (response_headers) - 1,
+                                                            headers, &version, &status_code, &reason_phrase));
+                g_free (reason_phrase);
+                soup_message_headers_unref (headers);
+        }
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+}
+
+static void
+bench_message_headers_lookup (void)
+{
+        SoupMessageHeaders *headers;
+        SoupHTTPVersion version;
+        guint status_code;
+        BenchRun *run;
+        guint i, n = bench_get_iterations (1000000);
+
+        headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+        g_assert_true (soup_headers_parse_response (response_headers, sizeof (response_headers) - 1,
+                                                    headers, &version, &status_code, NULL));
+        soup_message_headers_append (headers, "X-Request-Id", "7f4c9a2e");
+        soup_message_headers_append (headers, "X-Cache", "HIT");
+
+        run = bench_run_new ("micro/message-headers-lookup", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                g_assert_nonnull (soup_message_headers_get_one (headers, "Content-Type"));
+                g_assert_nonnull (soup_message_headers_get_one (headers, "x-cache"));
+                g_assert_nonnull (soup_message_headers_get_list (headers, "Cache-Control"));
+                g_assert_true (soup_message_headers_header_contains (headers, "Vary", "Accept-Encoding"));
+                g_assert_null (soup_message_headers_get_one (headers, "Set-Cookie"));
+        }
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+
+        soup_message_headers_unref (headers);
+}
+
+static void
+bench_date_parse (void)
+{
+        static const char *dates[] = {
+                "Sun, 06 Nov 1994 08:49:37 GMT",
+                "Sunday, 06-Nov-94 08:49:37 GMT",
+                "Sun Nov  6 08:49:37 1994",
+                "Sun, 06-Nov-1994 08:49:37 GMT"
+        };
+        BenchRun *run;
+        guint i, n = bench_get_iterations (200000);
+
+        run = bench_run_new ("micro/date-parse", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                GDateTime *date;
+
+                date = soup_date_time_new_from_http_string (dates[i % G_N_ELEMENTS (dates)]);
+                g_assert_nonnull (date);
+                g_date_time_unref (date);
+        }
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+}
+
+static void
+bench_cookie_match (void)
+{
+        SoupCookieJar *jar;
+        GUri *uri;
+        BenchRun *run;
+        guint i, n = bench_get_iterations (50000);
+
+        /* 50 sites with 4 cookies each, half of them on the super-domain */
+        jar = soup_cookie_jar_new ();
+        for (i = 0; i < 200; i++) {
+                char *name = g_strdup_printf ("cookie%u", i);
+                char *domain = i % 2 ?
+                        g_strdup_printf ("www.site%u.example.com", i / 4) :
+                        g_strdup_printf (".site%u.example.com", i / 4);
+
+                soup_cookie_jar_add_cookie (jar, soup_cookie_new (name, "value", domain, "/", SOUP_COOKIE_MAX_AGE_ONE_DAY));
+                g_free (name);
+                g_free (domain);
+        }
+        uri = g_uri_parse ("https://www.site25.example.com/path/to/page", SOUP_HTTP_URI_FLAGS, NULL);
+
+        run = bench_run_new ("micro/cookie-match", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                GSList *cookies;
+
+                cookies = soup_cookie_jar_get_cookie_list (jar, uri, TRUE);
+                g_assert_cmpuint (g_slist_length (cookies), ==, 4);
+                g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+        }
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+
+        g_uri_unref (uri);
+        g_object_unref (jar);
+}
+
+static void
+bench_path_map_lookup (void)
+{
+        static const char *lookups[] = {
+                "/",
+                "/api/v1/users/42/profile",
+                "/static/css/site.css",
+                "/api/v2/orders/1234/items/5",
+                "/unknown/path/that/falls/back"
+        };
+        SoupPathMap *map;
+        BenchRun *run;
+        guint i, n = bench_get_iterations (500000);
+
+        map = soup_path_map_new (NULL);
+        soup_path_map_add (map, "/", GUINT_TO_POINTER (1));
+        for (i = 0; i < 100; i++) {
+                char *path = g_strdup_printf ("/api/v%u/resource%u", i % 3, i);
+
+                soup_path_map_add (map, path, GUINT_TO_POINTER (i + 2));
+                g_free (path);
+        }
+        soup_path_map_add (map, "/api/v1/users", GUINT_TO_POINTER (200));
+        soup_path_map_add (map, "/api/v2/orders", GUINT_TO_POINTER (201));
+        soup_path_map_add (map, "/static", GUINT_TO_POINTER (202));
+
+        run = bench_run_new ("micro/path-map-lookup", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++)
+                g_assert_nonnull (soup_path_map_lookup (map, lookups[i % G_N_ELEMENTS (lookups)]));
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+
+        soup_path_map_free (map);
+}
+
+#ifdef G_OS_UNIX
+static void
+websocket_message_received (SoupWebsocketConnection *conn,
+                            SoupWebsocketDataType    type,
+                            GBytes                  *message,
+                            guint                   *received)
+{
+        (*received)++;
+}
+
+static SoupWebsocketConnection *
+websocket_connection_new_from_fd (int                         fd,
+                                  SoupWebsocketConnectionType type)
+{
+        SoupWebsocketConnection *ws;
+        GSocketConnection *conn;
+        GSocket *socket;
+        GUri *uri;
+
+        socket = g_socket_new_from_fd (fd, NULL);
+        g_assert_nonnull (socket);
+        conn = g_socket_connection_factory_create_connection (socket);
+        uri = g_uri_parse ("http://127.0.0.1/", SOUP_HTTP_URI_FLAGS, NULL);
+        ws = soup_websocket_connection_new (G_IO_STREAM (conn), uri, type, NULL, NULL, NULL);
+        g_uri_unref (uri);
+        g_object_unref (conn);
+        g_object_unref (socket);
+
+        return ws;
+}
+
+static void
+bench_websocket_framing (void)
+{
+        SoupWebsocketConnection *client, *server;
+        guint8 payload[1024];
+        int fds[2];
+        guint received = 0;
+        BenchRun *run;
+        guint i, n = bench_get_iterations (20000);
+
+        g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+        client = websocket_connection_new_from_fd (fds[0], SOUP_WEBSOCKET_CONNECTION_CLIENT);
+        server = websocket_connection_new_from_fd (fds[1], SOUP_WEBSOCKET_CONNECTION_SERVER);
+        g_signal_connect (server, "message",
+                          G_CALLBACK (websocket_message_received), &received);
+
+        for (i = 0; i < sizeof (payload); i++)
+                payload[i] = i & 0xff;
+
+        /* Client frames are masked, so this covers both framing and masking
+         * on the way out and unmasking on the way in.
+         */
+        run = bench_run_new ("micro/websocket-framing-1k", n);
+        bench_run_start (run);
+        for (i = 0; i < n; i++) {
+                soup_websocket_connection_send_binary (client, payload, sizeof (payload));
+                if (i % 64 == 63) {
+                        while (received <= i)
+                                g_main_context_iteration (NULL, TRUE);
+                }
+        }
+        while (received < n)
+                g_main_context_iteration (NULL, TRUE);
+        bench_run_stop (run);
+        bench_run_report_and_free (run);
+
+        g_object_unref (client);
+        g_object_unref (server);
+}
+#endif
+
+int
+main (int argc, char **argv)
+{
+        bench_init (argc, argv);
+
+        bench_headers_parse_request ();
+        bench_headers_parse_response ();
+        bench_message_headers_lookup ();
+        bench_date_parse ();
+        bench_cookie_match ();
+        bench_path_map_lookup ();
+#ifdef G_OS_UNIX
+        bench_websocket_framing ();
+#endif
+
+        test_cleanup ();
+        return 0;
+}
@@ -74,6 +74,11 @@ typedef struct {
 	GPtrArray *auth_types;
 	gboolean auto_ntlm;
 
+	/* A session with several I/O threads runs the handlers of its
+	 * messages from all of them.
+	 */
+	GRecMutex lock;
+
 	SoupAuth *proxy_auth;
 	GHashTable *auth_hosts;
 } SoupAuthManagerPrivate;
@@ -99,6 +104,7 @@ soup_auth_manager_init (SoupAuthManager *manager)
 {
 	SoupAuthManagerPrivate *priv = soup_auth_manager_get_instance_private (manager);
 
+	g_rec_mutex_init (&priv->lock);
 	priv->auth_types = g_ptr_array_new_with_free_func ((GDestroyNotify)g_type_class_unref);
 	priv->auth_hosts = g_hash_table_new_full (soup_uri_host_hash,
 						  soup_uri_host_equal,
@@ -117,6 +123,8 @@ soup_auth_manager_finalize (GObject *object)
 
 	g_clear_object (&priv->proxy_auth);
 
+	g_rec_mutex_clear (&priv->lock);
+
 	G_OBJECT_CLASS (soup_auth_manager_parent_class)->finalize (object);
 }
 
@@ -174,6 +182,7 @@ soup_auth_manager_add_feature (SoupSessionFeature *feature, GType type)
 		return FALSE;
 
 	auth_class = g_type_class_ref (type);
+	g_rec_mutex_lock (&priv->lock);
 	g_ptr_array_add (priv->auth_types, auth_class);
 	g_ptr_array_sort (priv->auth_types, auth_type_compare_func);
 
@@ -183,6 +192,7 @@ soup_auth_manager_add_feature (SoupSessionFeature *feature, GType type)
 	if (type == SOUP_TYPE_AUTH_NTLM &&
 	    G_TYPE_FROM_INSTANCE (priv->session) != SOUP_TYPE_SESSION)
 		priv->auto_ntlm = TRUE;
+	g_rec_mutex_unlock (&priv->lock);
 
 	return TRUE;
 }
@@ -199,15 +209,18 @@ soup_auth_manager_remove_feature (SoupSessionFeature *feature, GType type)
 
 	auth_class = g_type_class_peek (type);
 
+	g_rec_mutex_lock (&priv->lock);
 	for (i = 0; i < priv->auth_types->len; i++) {
 		if (priv->auth_types->pdata[i] == (gpointer)auth_class) {
 			if (type == SOUP_TYPE_AUTH_NTLM)
 				priv->auto_ntlm = FALSE;
 
 			g_ptr_array_remove_index (priv->auth_types, i);
+			g_rec_mutex_unlock (&priv->lock);
 			return TRUE;
 		}
 	}
+	g_rec_mutex_unlock (&priv->lock);
 
 	return FALSE;
 }
@@ -217,17 +230,22 @@ soup_auth_manager_has_feature (SoupSessionFeature *feature, GType type)
 {
         SoupAuthManagerPrivate *priv = soup_auth_manager_get_instance_private ((SoupAuthManager*)feature);
 	SoupAuthClass *auth_class;
+	gboolean found;
 	guint i;
 
 	if (!g_type_is_a (type, SOUP_TYPE_AUTH))
 		return FALSE;
 
 	auth_class = g_type_class_peek (type);
+	g_rec_mutex_lock (&priv->lock);
 	for (i = 0; i < priv->auth_types->len; i++) {
 		if (priv->auth_types->pdata[i] == (gpointer)auth_class)
-			return TRUE;
+			break;
 	}
-	return FALSE;
+	found = i < priv->auth_types->len;
+	g_rec_mutex_unlock (&priv->lock);
+
+	return found;
 }
 
 static void
@@ -635,6 +653,8 @@ auth_got_headers (SoupMessage *msg, gpointer manager)
 	SoupAuth *auth, *prior_auth;
 	gboolean prior_auth_failed = FALSE;
 
+	g_rec_mutex_lock (&priv->lock);
+
 	/* See if we used auth last time */
 	prior_auth = soup_message_get_auth (msg);
 	if (prior_auth && check_auth (msg, prior_auth)) {
@@ -643,8 +663,10 @@ auth_got_headers (SoupMessage *msg, gpointer manager)
 			prior_auth_failed = TRUE;
 	} else {
 		auth = create_auth (priv, msg);
-		if (!auth)
+		if (!auth) {
+			g_rec_mutex_unlock (&priv->lock);
 			return;
+		}
 	}
 
 	if (!soup_message_query_flags (msg, SOUP_MESSAGE_DO_NOT_USE_AUTH_CACHE)) {
@@ -656,6 +678,11 @@ auth_got_headers (SoupMessage *msg, gpointer manager)
 		auth = g_object_ref (new_auth);
 	}
 
+	/* The application handles SoupMessage::authenticate, so
+	 * no lock can be held while it's emitted.
+	 */
+	g_rec_mutex_unlock (&priv->lock);
+
 	/* If we need to authenticate, try to do it. */
 	authenticate_auth (manager, auth, msg,
 			   prior_auth_failed, FALSE, TRUE);
@@ -668,7 +695,9 @@ auth_got_body (SoupMessage *msg, gpointer manager)
 {
         SoupAuthManagerPrivate *priv = soup_auth_manager_get_instance_private (manager);
 	SoupAuth *auth;
+	gboolean requeue = FALSE;
 
+	g_rec_mutex_lock (&priv->lock);
 	auth = lookup_auth (priv, msg);
 	if (auth && soup_auth_is_ready (auth, msg)) {
 		if (SOUP_IS_CONNECTION_AUTH (auth))
@@ -680,8 +709,12 @@ auth_got_body (SoupMessage *msg, gpointer manager)
 		if (soup_message_query_flags (msg, SOUP_MESSAGE_DO_NOT_USE_AUTH_CACHE))
 			update_authorization_header (msg, auth, FALSE);
 
-		soup_session_requeue_message (priv->session, msg);
+		requeue = TRUE;
 	}
+	g_rec_mutex_unlock (&priv->lock);
+
+	if (requeue)
+		soup_session_requeue_message (priv->session, msg);
 }
 
 static void
@@ -691,6 +724,8 @@ proxy_auth_got_headers (SoupMessage *msg, gpointer manager)
 	SoupAuth *auth = NULL, *prior_auth;
 	gboolean prior_auth_failed = FALSE;
 
+	g_rec_mutex_lock (&priv->lock);
+
 	/* See if we used auth last time */
 	prior_auth = soup_message_get_proxy_auth (msg);
 	if (prior_auth && check_auth (msg, prior_auth)) {
@@ -703,13 +738,17 @@ proxy_auth_got_headers (SoupMessage *msg, gpointer manager)
 
 	if (!auth) {
 		auth = create_auth (priv, msg);
-		if (!auth)
+		if (!auth) {
+			g_rec_mutex_unlock (&priv->lock);
 			return;
+		}
 
 		if (!soup_message_query_flags (msg, SOUP_MESSAGE_DO_NOT_USE_AUTH_CACHE))
 			priv->proxy_auth = g_object_ref (auth);
 	}
 
+	g_rec_mutex_unlock (&priv->lock);
+
 	/* If we need to authenticate, try to do it. */
 	authenticate_auth (manager, auth, msg,
 			   prior_auth_failed, TRUE, TRUE);
@@ -722,7 +761,9 @@ proxy_auth_got_body (SoupMessage *msg, gpointer manager)
 {
         SoupAuthManagerPrivate *priv = soup_auth_manager_get_instance_private (manager);
 	SoupAuth *auth;
+	gboolean requeue = FALSE;
 
+	g_rec_mutex_lock (&priv->lock);
 	auth = lookup_proxy_auth (priv, msg);
 	if (auth && soup_auth_is_ready (auth, msg)) {
 		/* When not using cached credentials, update the Authorization header
@@ -730,38 +771,57 @@ proxy_auth_got_body (SoupMessage *msg, gpointer manager)
 		 */
 		if (soup_message_query_flags (msg, SOUP_MESSAGE_DO_NOT_USE_AUTH_CACHE))
 			update_authorization_header (msg, auth, TRUE);
-		soup_session_requeue_message (priv->session, msg);
+		requeue = TRUE;
 	}
+	g_rec_mutex_unlock (&priv->lock);
+
+	if (requeue)
+		soup_session_requeue_message (priv->session, msg);
 }
 
 static void
 auth_msg_starting (SoupMessage *msg, gpointer manager)
 {
         SoupAuthManagerPrivate *priv = soup_auth_manager_get_instance_private (manager);
-	SoupAuth *auth;
+	SoupAuth *auth = NULL, *proxy_auth;
+	gboolean is_connect;
 
 	if (soup_message_query_flags (msg, SOUP_MESSAGE_DO_NOT_USE_AUTH_CACHE))
 		return;
 
-	if (soup_message_get_method (msg) != SOUP_METHOD_CONNECT) {
+	is_connect = soup_message_get_method (msg) == SOUP_METHOD_CONNECT;
+
+	/* Only the lookups need the lock, see auth_got_headers() */
+	g_rec_mutex_lock (&priv->lock);
+	if (!is_connect) {
 		auth = lookup_auth (priv, msg);
+		if (auth)
+			g_object_ref (auth);
+	}
+	proxy_auth = lookup_proxy_auth (priv, msg);
+	if (proxy_auth)
+		g_object_ref (proxy_auth);
+	g_rec_mutex_unlock (&priv->lock);
+
+	if (!is_connect) {
 		if (auth) {
 			authenticate_auth (manager, auth, msg, FALSE, FALSE, FALSE);
 			if (!soup_auth_is_ready (auth, msg))
-				auth = NULL;
+				g_clear_object (&auth);
 		}
 		soup_message_set_auth (msg, auth);
 		update_authorization_header (msg, auth, FALSE);
+		g_clear_object (&auth);
 	}
 
-	auth = lookup_proxy_auth (priv, msg);
-	if (auth) {
-		authenticate_auth (manager, auth, msg, FALSE, TRUE, FALSE);
-		if (!soup_auth_is_ready (auth, msg))
-			auth = NULL;
+	if (proxy_auth) {
+		authenticate_auth (manager, proxy_auth, msg, FALSE, TRUE, FALSE);
+		if (!soup_auth_is_ready (proxy_auth, msg))
+			g_clear_object (&proxy_auth);
 	}
-	soup_message_set_proxy_auth (msg, auth);
-	update_authorization_header (msg, auth, TRUE);
+	soup_message_set_proxy_auth (msg, proxy_auth);
+	update_authorization_header (msg, proxy_auth, TRUE);
+	g_clear_object (&proxy_auth);
 }
 
 static void
@@ -818,7 +878,9 @@ soup_auth_manager_use_auth (SoupAuthManager *manager,
 {
         SoupAuthManagerPrivate *priv = soup_auth_manager_get_instance_private (manager);
 
+	g_rec_mutex_lock (&priv->lock);
 	record_auth_for_uri (priv, uri, auth, FALSE);
+	g_rec_mutex_unlock (&priv->lock);
 }
 
 /**
@@ -835,7 +897,9 @@ soup_auth_manager_clear_cached_credentials (SoupAuthManager *manager)
 
 	g_return_if_fail (SOUP_IS_AUTH_MANAGER (manager));
 
+	g_rec_mutex_lock (&priv->lock);
 	g_hash_table_remove_all (priv->auth_hosts);
+	g_rec_mutex_unlock (&priv->lock);
 }
 
 static void
@@ -51,6 +51,10 @@
  * @short_description: Caching support
  *
  * #SoupCache implements a file-based cache for HTTP resources.
+ *
+ * The #SoupCache functions, like soup_cache_clear() or
+ * soup_cache_dump(), can be called from any thread while a
+ * #SoupSession:thread-safe session is using the cache.
  */
 
 /**
@@ -120,6 +124,7 @@ typedef struct _SoupCacheEntry {
 
 typedef struct {
 	char *cache_dir;
+	GRecMutex lock; /* for the entries, their sizes and n_pending */
 	GHashTable *cache;
 	guint n_pending;
 	SoupSession *session;
@@ -702,6 +707,9 @@ soup_cache_send_response (SoupCache *cache, SoupMessage *msg)
 	SoupCacheEntry *entry;
 	GInputStream *file_stream, *body_stream, *cache_stream, *client_stream;
 	GFile *file;
+	SoupMessageHeaders *headers;
+	gsize length;
+	guint16 status_code;
         SoupMessageMetrics *metrics;
 
 	g_return_val_if_fail (SOUP_IS_CACHE (cache), NULL);
@@ -709,30 +717,47 @@ soup_cache_send_response (SoupCache *cache, SoupMessage *msg)
 
         soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_REQUEST_START);
 
+	g_rec_mutex_lock (&priv->lock);
+
 	entry = soup_cache_entry_lookup (cache, msg);
-	g_return_val_if_fail (entry, NULL);
+	if (!entry) {
+		g_rec_mutex_unlock (&priv->lock);
+		g_return_val_if_reached (NULL);
+	}
 
 	file = get_file_from_entry (cache, entry);
 	file_stream = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
 	g_object_unref (file);
 
 	/* Do not change the original message if there is no resource */
-	if (!file_stream)
+	if (!file_stream) {
+		g_rec_mutex_unlock (&priv->lock);
 		return NULL;
+	}
+
+	/* If we are told to send a response from cache any validation
+	   in course is over by now */
+	entry->being_validated = FALSE;
+
+	/* The message signals are emitted without the lock */
+	length = entry->length;
+	status_code = entry->status_code;
+	headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+	copy_end_to_end_headers (entry->headers, headers);
 
-	body_stream = soup_body_input_stream_new (file_stream, SOUP_ENCODING_CONTENT_LENGTH, entry->length);
+	g_rec_mutex_unlock (&priv->lock);
+
+	body_stream = soup_body_input_stream_new (file_stream, SOUP_ENCODING_CONTENT_LENGTH, length);
 	g_object_unref (file_stream);
 
-	if (!body_stream)
+	if (!body_stream) {
+		soup_message_headers_unref (headers);
 		return NULL;
+	}
 
         metrics = soup_message_get_metrics (msg);
         if (metrics)
-                metrics->response_body_size = entry->length;
-
-	/* If we are told to send a response from cache any validation
-	   in course is over by now */
-	entry->being_validated = FALSE;
+                metrics->response_body_size = length;
 
 	/* Message starting */
 	soup_message_starting (msg);
@@ -740,10 +765,11 @@ soup_cache_send_response (SoupCache *cache, SoupMessage *msg)
         soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_RESPONSE_START);
 
 	/* Status */
-	soup_message_set_status (msg, entry->status_code, NULL);
+	soup_message_set_status (msg, status_code, NULL);
 
 	/* Headers */
-	copy_end_to_end_headers (entry->headers, soup_message_get_response_headers (msg));
+	copy_end_to_end_headers (headers, soup_message_get_response_headers (msg));
+	soup_message_headers_unref (headers);
 
 	/* Create the cache stream. */
 	soup_message_disable_feature (msg, SOUP_TYPE_CACHE);
@@ -812,6 +838,8 @@ istream_caching_finished (SoupCacheInputStream *istream,
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 	SoupCacheEntry *entry = helper->entry;
 
+	g_rec_mutex_lock (&priv->lock);
+
 	--priv->n_pending;
 
 	entry->dirty = FALSE;
@@ -840,17 +868,17 @@ istream_caching_finished (SoupCacheInputStream *istream,
 	}
 
  cleanup:
+	g_rec_mutex_unlock (&priv->lock);
+
 	g_object_unref (helper->cache);
 	g_slice_free (StreamHelper, helper);
 }
 
-static GInputStream*
-soup_cache_content_processor_wrap_input (SoupContentProcessor *processor,
-					 GInputStream *base_stream,
-					 SoupMessage *msg,
-					 GError **error)
+static GInputStream *
+wrap_input (SoupCache    *cache,
+	    GInputStream *base_stream,
+	    SoupMessage  *msg)
 {
-	SoupCache *cache = (SoupCache*) processor;
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 	SoupCacheEntry *entry;
 	SoupCacheability cacheability;
@@ -919,6 +947,23 @@ soup_cache_content_processor_wrap_input (SoupContentProcessor *processor,
 	return istream;
 }
 
+static GInputStream*
+soup_cache_content_processor_wrap_input (SoupContentProcessor *processor,
+					 GInputStream *base_stream,
+					 SoupMessage *msg,
+					 GError **error)
+{
+	SoupCache *cache = (SoupCache*) processor;
+	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	GInputStream *istream;
+
+	g_rec_mutex_lock (&priv->lock);
+	istream = wrap_input (cache, base_stream, msg);
+	g_rec_mutex_unlock (&priv->lock);
+
+	return istream;
+}
+
 static void
 soup_cache_content_processor_init (SoupContentProcessorInterface *processor_interface,
 				   gpointer interface_data)
@@ -935,6 +980,7 @@ soup_cache_init (SoupCache *cache)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 
+	g_rec_mutex_init (&priv->lock);
 	priv->cache = g_hash_table_new (g_direct_hash, g_direct_equal);
 	/* LRU */
 	priv->lru_start = NULL;
@@ -970,6 +1016,7 @@ soup_cache_finalize (GObject *object)
 	g_free (priv->cache_dir);
 
 	g_list_free (priv->lru_start);
+	g_rec_mutex_clear (&priv->lock);
 
 	G_OBJECT_CLASS (soup_cache_parent_class)->finalize (object);
 }
@@ -1088,36 +1135,17 @@ soup_cache_new (const char *cache_dir, SoupCacheType cache_type)
 			     NULL);
 }
 
-/**
- * soup_cache_has_response:
- * @cache: a #SoupCache
- * @msg: a #SoupMessage
- *
- * This function calculates whether the @cache object has a proper
- * response for the request @msg given the flags both in the request
- * and the cached reply and the time ellapsed since it was cached.
- *
- * Returns: whether or not the @cache has a valid response for @msg
- *
- */
-SoupCacheResponse
-soup_cache_has_response (SoupCache *cache, SoupMessage *msg)
+static SoupCacheResponse
+entry_has_response (SoupCache      *cache,
+		    SoupCacheEntry *entry,
+		    SoupMessage    *msg)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
-	SoupCacheEntry *entry;
 	const char *cache_control;
 	gpointer value;
 	int max_age, max_stale, min_fresh;
 	GList *lru_item, *item;
 
-	entry = soup_cache_entry_lookup (cache, msg);
-
-	/* 1. The presented Request-URI and that of stored response
-	 * match
-	 */
-	if (!entry)
-		return SOUP_CACHE_RESPONSE_STALE;
-
 	/* Increase hit count. Take sorting into account */
 	entry->hits++;
 	lru_item = g_list_find (priv->lru_start, entry);
@@ -1248,6 +1276,42 @@ soup_cache_has_response (SoupCache *cache, SoupMessage *msg)
 	return SOUP_CACHE_RESPONSE_FRESH;
 }
 
+/**
+ * soup_cache_has_response:
+ * @cache: a #SoupCache
+ * @msg: a #SoupMessage
+ *
+ * This function calculates whether the @cache object has a proper
+ * response for the request @msg given the flags both in the request
+ * and the cached reply and the time ellapsed since it was cached.
+ *
+ * Returns: whether or not the @cache has a valid response for @msg
+ *
+ */
+SoupCacheResponse
+soup_cache_has_response (SoupCache *cache, SoupMessage *msg)
+{
+	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	SoupCacheEntry *entry;
+	SoupCacheResponse response;
+
+	g_rec_mutex_lock (&priv->lock);
+
+	entry = soup_cache_entry_lookup (cache, msg);
+
+	/* 1. The presented Request-URI and that of stored response
+	 * match
+	 */
+	if (!entry)
+		response = SOUP_CACHE_RESPONSE_STALE;
+	else
+		response = entry_has_response (cache, entry, msg);
+
+	g_rec_mutex_unlock (&priv->lock);
+
+	return response;
+}
+
 /**
  * soup_cache_get_cacheability:
  * @cache: a #SoupCache
@@ -1267,6 +1331,19 @@ soup_cache_get_cacheability (SoupCache *cache, SoupMessage *msg)
 	return SOUP_CACHE_GET_CLASS (cache)->get_cacheability (cache, msg);
 }
 
+static guint
+get_n_pending (SoupCache *cache)
+{
+	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	guint n_pending;
+
+	g_rec_mutex_lock (&priv->lock);
+	n_pending = priv->n_pending;
+	g_rec_mutex_unlock (&priv->lock);
+
+	return n_pending;
+}
+
 static gboolean
 force_flush_timeout (gpointer data)
 {
@@ -1306,13 +1383,13 @@ soup_cache_flush (SoupCache *cache)
 	/* We give cache 10 secs to finish */
 	timeout = soup_add_timeout (async_context, 10000, force_flush_timeout, &forced);
 
-	while (!forced && priv->n_pending > 0)
+	while (!forced && get_n_pending (cache) > 0)
 		g_main_context_iteration (async_context, FALSE);
 
 	if (!forced)
 		g_source_destroy (timeout);
 	else
-		g_warning ("Cache flush finished despite %d pending requests", priv->n_pending);
+		g_warning ("Cache flush finished despite %d pending requests", get_n_pending (cache));
 
         g_source_unref (timeout);
 }
@@ -1376,6 +1453,8 @@ soup_cache_clear (SoupCache *cache)
 	g_return_if_fail (SOUP_IS_CACHE (cache));
 	g_return_if_fail (priv->cache);
 
+	g_rec_mutex_lock (&priv->lock);
+
 	/* Cannot use g_hash_table_foreach as callbacks must not modify the hash table */
 	entries = g_hash_table_get_values (priv->cache);
 	g_list_foreach (entries, clear_cache_item, cache);
@@ -1383,32 +1462,44 @@ soup_cache_clear (SoupCache *cache)
 
 	/* Remove also any file not associated with a cache entry. */
 	clear_cache_files (cache);
+
+	g_rec_mutex_unlock (&priv->lock);
 }
 
 SoupMessage *
 soup_cache_generate_conditional_request (SoupCache *cache, SoupMessage *original)
 {
+	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 	SoupMessage *msg;
 	GUri *uri;
 	SoupCacheEntry *entry;
-	const char *last_modified, *etag;
+	char *last_modified, *etag;
 	GList *disabled_features, *f;
 
 	g_return_val_if_fail (SOUP_IS_CACHE (cache), NULL);
 	g_return_val_if_fail (SOUP_IS_MESSAGE (original), NULL);
 
+	g_rec_mutex_lock (&priv->lock);
+
 	/* Add the validator entries in the header from the cached data */
 	entry = soup_cache_entry_lookup (cache, original);
-	g_return_val_if_fail (entry, NULL);
+	if (!entry) {
+		g_rec_mutex_unlock (&priv->lock);
+		g_return_val_if_reached (NULL);
+	}
 
-	last_modified = soup_message_headers_get_one_common (entry->headers, SOUP_HEADER_LAST_MODIFIED);
-	etag = soup_message_headers_get_one_common (entry->headers, SOUP_HEADER_ETAG);
+	last_modified = g_strdup (soup_message_headers_get_one_common (entry->headers, SOUP_HEADER_LAST_MODIFIED));
+	etag = g_strdup (soup_message_headers_get_one_common (entry->headers, SOUP_HEADER_ETAG));
 
-	if (!last_modified && !etag)
+	if (!last_modified && !etag) {
+		g_rec_mutex_unlock (&priv->lock);
 		return NULL;
+	}
 
 	entry->being_validated = TRUE;
 
+	g_rec_mutex_unlock (&priv->lock);
+
 	/* Copy the data we need from the original message */
 	uri = soup_message_get_uri (original);
 	msg = soup_message_new_from_uri (soup_message_get_method (original), uri);
@@ -1433,6 +1524,9 @@ soup_cache_generate_conditional_request (SoupCache *cache, SoupMessage *original
                                                     SOUP_HEADER_IF_NONE_MATCH,
                                                     etag);
 
+	g_free (last_modified);
+	g_free (etag);
+
 	return msg;
 }
 
@@ -1443,9 +1537,11 @@ soup_cache_cancel_conditional_request (SoupCache   *cache,
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 	SoupCacheEntry *entry;
 
+	g_rec_mutex_lock (&priv->lock);
 	entry = soup_cache_entry_lookup (cache, msg);
 	if (entry)
 		entry->being_validated = FALSE;
+	g_rec_mutex_unlock (&priv->lock);
 
 	soup_session_cancel_message (priv->session, msg);
 }
@@ -1454,9 +1550,16 @@ void
 soup_cache_update_from_conditional_request (SoupCache   *cache,
 					    SoupMessage *msg)
 {
-	SoupCacheEntry *entry = soup_cache_entry_lookup (cache, msg);
-	if (!entry)
+	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	SoupCacheEntry *entry;
+
+	g_rec_mutex_lock (&priv->lock);
+
+	entry = soup_cache_entry_lookup (cache, msg);
+	if (!entry) {
+		g_rec_mutex_unlock (&priv->lock);
 		return;
+	}
 
 	entry->being_validated = FALSE;
 
@@ -1468,6 +1571,8 @@ soup_cache_update_from_conditional_request (SoupCache   *cache,
 
 		soup_cache_entry_set_freshness (entry, msg, cache);
 	}
+
+	g_rec_mutex_unlock (&priv->lock);
 }
 
 static void
@@ -1525,8 +1630,12 @@ soup_cache_dump (SoupCache *cache)
 	GVariantBuilder entries_builder;
 	GVariant *cache_variant;
 
-	if (!g_list_length (priv->lru_start))
+	g_rec_mutex_lock (&priv->lock);
+
+	if (!g_list_length (priv->lru_start)) {
+		g_rec_mutex_unlock (&priv->lock);
 		return;
+	}
 
 	/* Create the builder and iterate over all entries */
 	g_variant_builder_init (&entries_builder, G_VARIANT_TYPE (SOUP_CACHE_ENTRIES_FORMAT));
@@ -1535,6 +1644,8 @@ soup_cache_dump (SoupCache *cache)
 	g_list_foreach (priv->lru_start, pack_entry, &entries_builder);
 	g_variant_builder_close (&entries_builder);
 
+	g_rec_mutex_unlock (&priv->lock);
+
 	/* Serialize and dump */
 	cache_variant = g_variant_builder_end (&entries_builder);
 	g_variant_ref_sink (cache_variant);
@@ -1605,6 +1716,8 @@ soup_cache_load (SoupCache *cache)
 	}
 	g_free (filename);
 
+	g_rec_mutex_lock (&priv->lock);
+
 	cache_variant = g_variant_new_from_data (G_VARIANT_TYPE (SOUP_CACHE_ENTRIES_FORMAT),
 						 (const char *) contents, length, FALSE, g_free, contents);
 	g_variant_get (cache_variant, SOUP_CACHE_ENTRIES_FORMAT, &version, &entries_iter);
@@ -1612,6 +1725,7 @@ soup_cache_load (SoupCache *cache)
 		g_variant_iter_free (entries_iter);
 		g_variant_unref (cache_variant);
 		clear_cache_files (cache);
+		g_rec_mutex_unlock (&priv->lock);
 		return;
 	}
 
@@ -1665,6 +1779,8 @@ soup_cache_load (SoupCache *cache)
 
 	priv->lru_start = g_list_reverse (priv->lru_start);
 
+	g_rec_mutex_unlock (&priv->lock);
+
 	/* frees */
 	g_variant_iter_free (entries_iter);
 	g_variant_unref (cache_variant);
@@ -1683,8 +1799,11 @@ soup_cache_set_max_size (SoupCache *cache,
 			 guint      max_size)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+
+	g_rec_mutex_lock (&priv->lock);
 	priv->max_size = max_size;
 	priv->max_entry_data_size = priv->max_size / MAX_ENTRY_DATA_PERCENTAGE;
+	g_rec_mutex_unlock (&priv->lock);
 }
 
 /**
@@ -32,6 +32,10 @@
  *
  * Note that the base #SoupCookieJar class does not support any form
  * of long-term cookie persistence.
+ *
+ * The cookies in a jar can be read and modified from several threads
+ * at once, for example by a #SoupSession:thread-safe session and by
+ * the application.
  **/
 
 /**
@@ -60,8 +64,11 @@ static GParamSpec *properties[LAST_PROPERTY] = { NULL, };
 
 typedef struct {
 	gboolean constructed, read_only;
+	GRecMutex lock; /* for domains, serials and changes */
 	GHashTable *domains, *serials;
 	guint serial;
+	GQueue changes; /* of SoupCookieJarChange */
+	GRecMutex emit_lock; /* keeps the ::changed emissions in order */
 	SoupCookieJarAcceptPolicy accept_policy;
 } SoupCookieJarPrivate;
 
@@ -81,6 +88,8 @@ soup_cookie_jar_init (SoupCookieJar *jar)
 					       soup_str_case_equal,
 					       g_free, NULL);
 	priv->serials = g_hash_table_new (NULL, NULL);
+	g_rec_mutex_init (&priv->lock);
+	g_rec_mutex_init (&priv->emit_lock);
 	priv->accept_policy = SOUP_COOKIE_JAR_ACCEPT_ALWAYS;
 }
 
@@ -106,6 +115,8 @@ soup_cookie_jar_finalize (GObject *object)
 		soup_cookies_free (value);
 	g_hash_table_destroy (priv->domains);
 	g_hash_table_destroy (priv->serials);
+	g_rec_mutex_clear (&priv->lock);
+	g_rec_mutex_clear (&priv->emit_lock);
 
 	G_OBJECT_CLASS (soup_cookie_jar_parent_class)->finalize (object);
 }
@@ -234,11 +245,22 @@ soup_cookie_jar_new (void)
 	return g_object_new (SOUP_TYPE_COOKIE_JAR, NULL);
 }
 
+typedef struct {
+	SoupCookie *old_cookie;
+	SoupCookie *new_cookie;
+} SoupCookieJarChange;
+
+/* Called with the lock held. @old is no longer in the jar and is
+ * freed here. The ::changed signal is emitted by
+ * soup_cookie_jar_emit_changes() once the lock has been released, so
+ * it gets a copy of @new.
+ */
 static void
 soup_cookie_jar_changed (SoupCookieJar *jar,
 			 SoupCookie *old, SoupCookie *new)
 {
 	SoupCookieJarPrivate *priv = soup_cookie_jar_get_instance_private (jar);
+	SoupCookieJarChange *change;
 
 	if (old && old != new)
 		g_hash_table_remove (priv->serials, old);
@@ -247,10 +269,48 @@ soup_cookie_jar_changed (SoupCookieJar *jar,
 		g_hash_table_insert (priv->serials, new, GUINT_TO_POINTER (priv->serial));
 	}
 
-	if (priv->read_only || !priv->constructed)
+	if (priv->read_only || !priv->constructed) {
+		if (old)
+			soup_cookie_free (old);
+		return;
+	}
+
+	change = g_new (SoupCookieJarChange, 1);
+	change->old_cookie = old;
+	change->new_cookie = new ? soup_cookie_copy (new) : NULL;
+	g_queue_push_tail (&priv->changes, change);
+}
+
+/* Must be called without the lock held. Whichever thread gets here
+ * first emits all the pending changes, in the order they were made.
+ */
+static void
+soup_cookie_jar_emit_changes (SoupCookieJar *jar)
+{
+	SoupCookieJarPrivate *priv = soup_cookie_jar_get_instance_private (jar);
+	SoupCookieJarChange *change;
+	gboolean pending;
+
+	g_rec_mutex_lock (&priv->lock);
+	pending = !g_queue_is_empty (&priv->changes);
+	g_rec_mutex_unlock (&priv->lock);
+	if (!pending)
 		return;
 
-	g_signal_emit (jar, signals[CHANGED], 0, old, new);
+	g_rec_mutex_lock (&priv->emit_lock);
+	while (TRUE) {
+		g_rec_mutex_lock (&priv->lock);
+		change = g_queue_pop_head (&priv->changes);
+		g_rec_mutex_unlock (&priv->lock);
+		if (!change)
+			break;
+
+		g_signal_emit (jar, signals[CHANGED], 0, change->old_cookie, change->new_cookie);
+		g_clear_pointer (&change->old_cookie, soup_cookie_free);
+		g_clear_pointer (&change->new_cookie, soup_cookie_free);
+		g_free (change);
+	}
+	g_rec_mutex_unlock (&priv->emit_lock);
 }
 
 static int
@@ -332,6 +392,8 @@ get_cookies (SoupCookieJar *jar,
 	 * cookies for ".www.foo.com", "www.foo.com", ".foo.com", and
 	 * ".com", in that order. (Logic stolen from Mozilla.)
 	 */
+	g_rec_mutex_lock (&priv->lock);
+
 	cookies = NULL;
         if (host[0]) {
                 domain = cur = g_strdup_printf (".%s", host);
@@ -373,11 +435,13 @@ get_cookies (SoupCookieJar *jar,
 		SoupCookie *cookie = p->data;
 
 		soup_cookie_jar_changed (jar, cookie, NULL);
-		soup_cookie_free (cookie);
 	}
 	g_slist_free (cookies_to_remove);
 
-	return g_slist_sort_with_data (cookies, compare_cookies, jar);
+	cookies = g_slist_sort_with_data (cookies, compare_cookies, jar);
+	g_rec_mutex_unlock (&priv->lock);
+
+	return cookies;
 }
 
 /**
@@ -406,24 +470,31 @@ char *
 soup_cookie_jar_get_cookies (SoupCookieJar *jar, GUri *uri,
 			     gboolean for_http)
 {
+	SoupCookieJarPrivate *priv;
 	GSList *cookies;
+	char *result = NULL;
 
 	g_return_val_if_fail (SOUP_IS_COOKIE_JAR (jar), NULL);
 	g_return_val_if_fail (uri != NULL, NULL);
 
-	cookies = get_cookies (jar, uri, NULL, NULL, TRUE, for_http, FALSE, FALSE);
+	priv = soup_cookie_jar_get_instance_private (jar);
 
+	/* The cookies are not copied, so keep them from changing */
+	g_rec_mutex_lock (&priv->lock);
+	cookies = get_cookies (jar, uri, NULL, NULL, TRUE, for_http, FALSE, FALSE);
 	if (cookies) {
-		char *result = soup_cookies_to_cookie_header (cookies);
+		result = soup_cookies_to_cookie_header (cookies);
 		g_slist_free (cookies);
+	}
+	g_rec_mutex_unlock (&priv->lock);
 
-		if (!*result) {
-			g_free (result);
-			result = NULL;
-		}
-		return result;
-	} else
-		return NULL;
+	soup_cookie_jar_emit_changes (jar);
+
+	if (result && !*result) {
+		g_free (result);
+		result = NULL;
+	}
+	return result;
 }
 
 /**
@@ -451,10 +522,15 @@ soup_cookie_jar_get_cookies (SoupCookieJar *jar, GUri *uri,
 GSList *
 soup_cookie_jar_get_cookie_list (SoupCookieJar *jar, GUri *uri, gboolean for_http)
 {
+	GSList *cookies;
+
 	g_return_val_if_fail (SOUP_IS_COOKIE_JAR (jar), NULL);
 	g_return_val_if_fail (uri != NULL, NULL);
 
-	return get_cookies (jar, uri, NULL, NULL, TRUE, for_http, FALSE, TRUE);
+	cookies = get_cookies (jar, uri, NULL, NULL, TRUE, for_http, FALSE, TRUE);
+	soup_cookie_jar_emit_changes (jar);
+
+	return cookies;
 }
 
 /**
@@ -487,10 +563,15 @@ soup_cookie_jar_get_cookie_list_with_same_site_info (SoupCookieJar *jar,
                                                      gboolean       is_safe_method,
                                                      gboolean       is_top_level_navigation)
 {
+	GSList *cookies;
+
 	g_return_val_if_fail (SOUP_IS_COOKIE_JAR (jar), NULL);
 	g_return_val_if_fail (uri != NULL, NULL);
 
-	return get_cookies (jar,  uri, top_level, site_for_cookies, is_safe_method, for_http, is_top_level_navigation, TRUE);
+	cookies = get_cookies (jar,  uri, top_level, site_for_cookies, is_safe_method, for_http, is_top_level_navigation, TRUE);
+	soup_cookie_jar_emit_changes (jar);
+
+	return cookies;
 }
 
 static const char *
@@ -552,36 +633,13 @@ incoming_cookie_is_third_party (SoupCookieJar            *jar,
 	return !g_hash_table_lookup (priv->domains, soup_cookie_get_domain (cookie));
 }
 
-/**
- * soup_cookie_jar_add_cookie_full:
- * @jar: a #SoupCookieJar
- * @cookie: (transfer full): a #SoupCookie
- * @uri: (nullable): the URI setting the cookie
- * @first_party: (nullable): the URI for the main document
- *
- * Adds @cookie to @jar, emitting the 'changed' signal if we are modifying
- * an existing cookie or adding a valid new cookie ('valid' means
- * that the cookie's expire date is not in the past).
- *
- * @first_party will be used to reject cookies coming from third party
- * resources in case such a security policy is set in the @jar.
- *
- * @uri will be used to reject setting or overwriting secure cookies
- * from insecure origins. %NULL is treated as secure.
- * 
- * @cookie will be 'stolen' by the jar, so don't free it afterwards.
- *
- **/
-void
-soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *uri, GUri *first_party)
+static void
+add_cookie (SoupCookieJar *jar, SoupCookie *cookie, GUri *uri, GUri *first_party)
 {
 	SoupCookieJarPrivate *priv;
 	GSList *old_cookies, *oc, *last = NULL;
 	SoupCookie *old_cookie;
 
-	g_return_if_fail (SOUP_IS_COOKIE_JAR (jar));
-	g_return_if_fail (cookie != NULL);
-
 	/* Never accept cookies for public domains. */
 	if (!g_hostname_is_ip_address (soup_cookie_get_domain (cookie)) &&
 	    soup_tld_domain_is_public_suffix (soup_cookie_get_domain (cookie))) {
@@ -626,12 +684,10 @@ soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *u
 						     g_strdup (soup_cookie_get_domain (cookie)),
 						     old_cookies);
 				soup_cookie_jar_changed (jar, old_cookie, NULL);
-				soup_cookie_free (old_cookie);
 				soup_cookie_free (cookie);
 			} else {
 				oc->data = cookie;
 				soup_cookie_jar_changed (jar, old_cookie, cookie);
-				soup_cookie_free (old_cookie);
 			}
 
 			return;
@@ -656,6 +712,43 @@ soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *u
 	soup_cookie_jar_changed (jar, NULL, cookie);
 }
 
+/**
+ * soup_cookie_jar_add_cookie_full:
+ * @jar: a #SoupCookieJar
+ * @cookie: (transfer full): a #SoupCookie
+ * @uri: (nullable): the URI setting the cookie
+ * @first_party: (nullable): the URI for the main document
+ *
+ * Adds @cookie to @jar, emitting the 'changed' signal if we are modifying
+ * an existing cookie or adding a valid new cookie ('valid' means
+ * that the cookie's expire date is not in the past).
+ *
+ * @first_party will be used to reject cookies coming from third party
+ * resources in case such a security policy is set in the @jar.
+ *
+ * @uri will be used to reject setting or overwriting secure cookies
+ * from insecure origins. %NULL is treated as secure.
+ * 
+ * @cookie will be 'stolen' by the jar, so don't free it afterwards.
+ *
+ **/
+void
+soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *uri, GUri *first_party)
+{
+	SoupCookieJarPrivate *priv;
+
+	g_return_if_fail (SOUP_IS_COOKIE_JAR (jar));
+	g_return_if_fail (cookie != NULL);
+
+	priv = soup_cookie_jar_get_instance_private (jar);
+
+	g_rec_mutex_lock (&priv->lock);
+	add_cookie (jar, cookie, uri, first_party);
+	g_rec_mutex_unlock (&priv->lock);
+
+	soup_cookie_jar_emit_changes (jar);
+}
+
 /**
  * soup_cookie_jar_add_cookie:
  * @jar: a #SoupCookieJar
@@ -880,6 +973,7 @@ soup_cookie_jar_all_cookies (SoupCookieJar *jar)
 
 	priv = soup_cookie_jar_get_instance_private (jar);
 
+	g_rec_mutex_lock (&priv->lock);
 	g_hash_table_iter_init (&iter, priv->domains);
 
 	while (g_hash_table_iter_next (&iter, &key, &value)) {
@@ -887,6 +981,7 @@ soup_cookie_jar_all_cookies (SoupCookieJar *jar)
 		for (p = cookies; p; p = p->next)
 			l = g_slist_prepend (l, soup_cookie_copy (p->data));
 	}
+	g_rec_mutex_unlock (&priv->lock);
 
 	return l;
 }
@@ -911,9 +1006,8 @@ soup_cookie_jar_delete_cookie (SoupCookieJar *jar,
 
 	priv = soup_cookie_jar_get_instance_private (jar);
 
+	g_rec_mutex_lock (&priv->lock);
 	cookies = g_hash_table_lookup (priv->domains, soup_cookie_get_domain (cookie));
-	if (cookies == NULL)
-		return;
 
 	for (p = cookies; p; p = p->next ) {
 		SoupCookie *c = (SoupCookie*)p->data;
@@ -923,10 +1017,12 @@ soup_cookie_jar_delete_cookie (SoupCookieJar *jar,
 					     g_strdup (soup_cookie_get_domain (cookie)),
 					     cookies);
 			soup_cookie_jar_changed (jar, c, NULL);
-			soup_cookie_free (c);
-			return;
+			break;
 		}
 	}
+	g_rec_mutex_unlock (&priv->lock);
+
+	soup_cookie_jar_emit_changes (jar);
 }
 
 /**
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+
+# Generates a minimal perfect hash table of the HSTS preload list, using
+# the hash and displace method: keys are first spread into buckets, and
+# each bucket gets the seed that sends all of its keys to free slots.
+# Lookups are then one hash for the bucket, one for the slot and a
+# single string comparison, with no heap and no relocations.
+
+import sys
+
+preload = {}
+with open('soup-hsts-preload.in') as i:
+    for line in i.readlines():
+        line = line.strip()
+        if not line or line[0] == '#':
+            continue
+
+        fields = line.split()
+        if len(fields) > 2 or (len(fields) == 2 and fields[1] != 'include_subdomains'):
+            sys.exit('Invalid line: %s' % line)
+
+        # Lookups are done on canonicalized, unicode host names
+        domain = fields[0].rstrip('.').lower().encode('ascii').decode('idna')
+        preload[domain.encode('utf-8')] = len(fields) == 2
+
+if not preload:
+    sys.exit('The preload list is empty')
+
+def fnv1a(name):
+    h = 0xcbf29ce484222325
+    for c in name:
+        if ord('A') <= c <= ord('Z'):
+            c += ord('a') - ord('A')
+        h = ((h ^ c) * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+def mix(h):
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xffffffff
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+def bucket_of(h):
+    return mix((h ^ (h >> 32)) & 0xffffffff)
+
+def slot_of(h, seed):
+    return mix(((h & 0xffffffff) + seed * ((h >> 32) | 1)) & 0xffffffff)
+
+names = sorted(preload)
+# A few spare slots keep the search for the seeds of the last buckets short
+n_entries = len(names) * 20 // 19 + 1
+n_buckets = (len(names) + 3) // 4
+
+hashes = {name: fnv1a(name) for name in names}
+if len(set(hashes.values())) != len(names):
+    sys.exit('Hash collision in the preload list')
+
+buckets = [[] for i in range(n_buckets)]
+for name in names:
+    buckets[bucket_of(hashes[name]) % n_buckets].append(name)
+
+seeds = [0] * n_buckets
+slots = [None] * n_entries
+for b in sorted(range(n_buckets), key=lambda b: -len(buckets[b])):
+    if not buckets[b]:
+        continue
+
+    seed = 1
+    while True:
+        positions = [slot_of(hashes[name], seed) % n_entries for name in buckets[b]]
+        if len(set(positions)) == len(positions) and all(slots[p] is None for p in positions):
+            break
+        seed += 1
+
+    seeds[b] = seed
+    for name, p in zip(buckets[b], positions):
+        slots[p] = name
+
+offsets = {}
+strings = b''
+for name in names:
+    offsets[name] = len(strings)
+    strings += name + b'\0'
+
+def c_string(data):
+    s = ''
+    for c in data:
+        if c == 0:
+            s += '\\0'
+        elif 0x20 <= c < 0x7f and chr(c) not in '"\\?':
+            s += chr(c)
+        else:
+            s += '\\%03o' % c
+    return '"%s"' % s
+
+output = '''/* This file has been generated with generate-hsts-preload.py script, do not edit */
+#include "soup-hsts-preload.h"
+
+#define N_BUCKETS %d
+#define N_ENTRIES %d
+
+static const char soup_hsts_preload_strings[] =
+''' % (n_buckets, n_entries)
+
+for name in names:
+    output += '  %s\n' % c_string(name + b'\0')
+
+output += ''';
+
+static const guint32 soup_hsts_preload_seeds[N_BUCKETS] = {
+'''
+
+for i in range(0, n_buckets, 8):
+    output += '  %s,\n' % ', '.join('%d' % s for s in seeds[i:i + 8])
+
+output += '''};
+
+/* Offset of the domain in soup_hsts_preload_strings, shifted left by
+ * one, ORed with whether the policy includes subdomains.
+ */
+#define EMPTY G_MAXUINT32
+
+static const guint32 soup_hsts_preload_entries[N_ENTRIES] = {
+'''
+
+for i in range(0, n_entries, 8):
+    output += '  %s,\n' % ', '.join('%d' % (offsets[name] << 1 | preload[name]) if name else 'EMPTY' for name in slots[i:i + 8])
+
+output += '''};
+
+static guint64
+soup_hsts_preload_hash (const char *name,
+                        gsize       length)
+{
+        guint64 h = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+        gsize i;
+
+        for (i = 0; i < length; i++) {
+                h ^= (guchar)g_ascii_tolower (name[i]);
+                h *= G_GUINT64_CONSTANT (0x100000001b3);
+        }
+
+        return h;
+}
+
+static guint32
+soup_hsts_preload_mix (guint32 h)
+{
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+
+        return h;
+}
+
+gboolean
+soup_hsts_preload_lookup (const char *domain,
+                          gsize       length,
+                          gboolean   *include_subdomains)
+{
+        guint64 hash;
+        guint32 low, high, seed, entry;
+        const char *name;
+
+        hash = soup_hsts_preload_hash (domain, length);
+        low = (guint32)hash;
+        high = (guint32)(hash >> 32);
+
+        seed = soup_hsts_preload_seeds[soup_hsts_preload_mix (low ^ high) % N_BUCKETS];
+        entry = soup_hsts_preload_entries[soup_hsts_preload_mix (low + seed * (high | 1)) % N_ENTRIES];
+        if (entry == EMPTY)
+                return FALSE;
+
+        name = soup_hsts_preload_strings + (entry >> 1);
+
+        if (g_ascii_strncasecmp (name, domain, length) != 0 || name[length] != '\\0')
+                return FALSE;
+
+        if (include_subdomains)
+                *include_subdomains = entry & 1;
+        return TRUE;
+}
+
+gboolean
+soup_hsts_preload_must_enforce (const char *host)
+{
+        gsize length = strlen (host);
+        const char *dot;
+        gboolean include_subdomains;
+
+        while (length > 0 && host[length - 1] == '.')
+                length--;
+
+        if (soup_hsts_preload_lookup (host, length, NULL))
+                return TRUE;
+
+        while ((dot = memchr (host, '.', length))) {
+                length -= dot + 1 - host;
+                host = dot + 1;
+                if (soup_hsts_preload_lookup (host, length, &include_subdomains) &&
+                    include_subdomains)
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+'''
+
+with open('soup-hsts-preload.c', 'w+') as o:
+    o.write(output)
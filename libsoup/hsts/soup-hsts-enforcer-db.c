@@ -16,7 +16,10 @@
 #include <sqlite3.h>
 
 #include "soup-hsts-enforcer-db.h"
+#include "soup-hsts-enforcer-private.h"
 #include "soup.h"
+#include "soup-misc.h"
+#include "soup-session-feature-private.h"
 
 /**
  * SECTION:soup-hsts-enforcer-db
@@ -46,19 +49,61 @@ struct _SoupHSTSEnforcerDB {
 	SoupHSTSEnforcer parent;
 };
 
+/* How long the worker waits for more changes before writing them */
+#define WRITE_BEHIND_INTERVAL (500 * G_TIME_SPAN_MILLISECOND)
+
 typedef struct {
 	char *filename;
+
+	/* Only used from the worker thread */
 	sqlite3 *db;
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *delete_stmt;
+
+	GMutex mutex;
+	GCond cond;
+	GThread *worker;
+	gboolean stop;
+	GHashTable *pending_writes;
+
+	/* The policies read from the database are handed over to the
+	 * enforcer in the thread it was created in, or earlier by
+	 * whoever needs them first. The enforcer waits for them before
+	 * its policies are looked up or changed.
+	 */
+	GMainContext *context;
+	GSource *load_source;
+	GPtrArray *loaded_policies;
+	gboolean load_done;
+	gboolean loaded; /* atomic, set with the enforcer's lock held */
 } SoupHSTSEnforcerDBPrivate;
 
+typedef struct {
+	gboolean delete;
+	gulong max_age;
+	gint64 expiry;
+	gboolean include_subdomains;
+} PendingWrite;
+
+static void soup_hsts_enforcer_db_session_feature_init (SoupSessionFeatureInterface *feature_interface, gpointer interface_data);
+
 G_DEFINE_TYPE_WITH_CODE (SoupHSTSEnforcerDB, soup_hsts_enforcer_db, SOUP_TYPE_HSTS_ENFORCER,
-			 G_ADD_PRIVATE(SoupHSTSEnforcerDB))
+			 G_ADD_PRIVATE(SoupHSTSEnforcerDB)
+			 G_IMPLEMENT_INTERFACE (SOUP_TYPE_SESSION_FEATURE,
+						soup_hsts_enforcer_db_session_feature_init))
+
+static SoupSessionFeatureInterface *soup_hsts_enforcer_db_feature_parent_iface;
 
-static void load (SoupHSTSEnforcer *hsts_enforcer);
+static gpointer worker_thread (gpointer user_data);
 
 static void
 soup_hsts_enforcer_db_init (SoupHSTSEnforcerDB *db)
 {
+        SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private (db);
+
+	g_mutex_init (&priv->mutex);
+	g_cond_init (&priv->cond);
+	priv->pending_writes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 }
 
 static void
@@ -66,8 +111,26 @@ soup_hsts_enforcer_db_finalize (GObject *object)
 {
         SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)object);
 
+	/* The worker writes whatever is still pending before exiting */
+	if (priv->worker) {
+		g_mutex_lock (&priv->mutex);
+		priv->stop = TRUE;
+		g_cond_signal (&priv->cond);
+		g_mutex_unlock (&priv->mutex);
+		g_thread_join (priv->worker);
+	}
+
+	if (priv->load_source) {
+		g_source_destroy (priv->load_source);
+		g_source_unref (priv->load_source);
+	}
+	g_clear_pointer (&priv->context, g_main_context_unref);
+	g_clear_pointer (&priv->loaded_policies, g_ptr_array_unref);
+	g_hash_table_destroy (priv->pending_writes);
+	g_mutex_clear (&priv->mutex);
+	g_cond_clear (&priv->cond);
+
 	g_free (priv->filename);
-	sqlite3_close (priv->db);
 
 	G_OBJECT_CLASS (soup_hsts_enforcer_db_parent_class)->finalize (object);
 }
@@ -81,7 +144,11 @@ soup_hsts_enforcer_db_set_property (GObject *object, guint prop_id,
 	switch (prop_id) {
 	case PROP_FILENAME:
 		priv->filename = g_value_dup_string (value);
-		load (SOUP_HSTS_ENFORCER (object));
+		if (priv->filename) {
+			priv->context = g_main_context_ref_thread_default ();
+			priv->worker = g_thread_new ("soup-hsts-db", worker_thread, object);
+		} else
+			priv->loaded = TRUE;
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -111,12 +178,17 @@ soup_hsts_enforcer_db_get_property (GObject *object, guint prop_id,
  *
  * Creates a #SoupHSTSEnforcerDB.
  *
- * @filename will be read in during the initialization of a
+ * @filename will be read in the background after the creation of a
  * #SoupHSTSEnforcerDB, in order to create an initial set of HSTS
- * policies. If the file doesn't exist, a new database will be created
- * and initialized. Changes to the policies during the lifetime of a
- * #SoupHSTSEnforcerDB will be written to @filename when
- * #SoupHSTSEnforcer::changed is emitted.
+ * policies; they are all in place before the first message is
+ * processed or the policies are queried or changed, and they don't
+ * emit #SoupHSTSEnforcer::changed. If the file doesn't exist, a new
+ * database will be created and initialized. Changes to the policies
+ * during the lifetime of a #SoupHSTSEnforcerDB will be written to
+ * @filename in the background,
+ * batched together shortly after #SoupHSTSEnforcer::changed is
+ * emitted, and at the latest when the #SoupHSTSEnforcerDB is
+ * finalized.
  *
  * Returns: the new #SoupHSTSEnforcer
  *
@@ -132,9 +204,9 @@ soup_hsts_enforcer_db_new (const char *filename)
 }
 
 #define QUERY_ALL "SELECT id, host, max_age, expiry, include_subdomains FROM soup_hsts_policies;"
-#define CREATE_TABLE "CREATE TABLE soup_hsts_policies (id INTEGER PRIMARY KEY, host TEXT UNIQUE, max_age INTEGER, expiry INTEGER, include_subdomains INTEGER)"
-#define QUERY_INSERT "INSERT OR REPLACE INTO soup_hsts_policies VALUES((SELECT id FROM soup_hsts_policies WHERE host=%Q), %Q, %lu, %lu, %u);"
-#define QUERY_DELETE "DELETE FROM soup_hsts_policies WHERE host=%Q;"
+#define CREATE_TABLE "CREATE TABLE IF NOT EXISTS soup_hsts_policies (id INTEGER PRIMARY KEY, host TEXT UNIQUE, max_age INTEGER, expiry INTEGER, include_subdomains INTEGER)"
+#define QUERY_INSERT "INSERT OR REPLACE INTO soup_hsts_policies VALUES((SELECT id FROM soup_hsts_policies WHERE host=?1), ?1, ?2, ?3, ?4);"
+#define QUERY_DELETE "DELETE FROM soup_hsts_policies WHERE host=?1;"
 
 enum {
 	COL_ID,
@@ -145,113 +217,242 @@ enum {
 	N_COL,
 };
 
-static int
-query_all_callback (void *data, int argc, char **argv, char **colname)
+static void
+exec_query (sqlite3    *db,
+	    const char *sql)
 {
-	SoupHSTSPolicy *policy = NULL;
-	SoupHSTSEnforcer *hsts_enforcer = SOUP_HSTS_ENFORCER (data);
+	char *error = NULL;
 
-	char *host;
-	gulong expire_time;
-	unsigned long max_age;
-	time_t now;
-	GDateTime *expires;
-	gboolean include_subdomains = FALSE;
+	if (sqlite3_exec (db, sql, NULL, NULL, &error)) {
+		g_warning ("Failed to execute query: %s", error);
+		sqlite3_free (error);
+	}
+}
 
-	now = time (NULL);
+static sqlite3_stmt *
+prepare_statement (sqlite3    *db,
+		   const char *sql)
+{
+	sqlite3_stmt *stmt = NULL;
 
-	host = argv[COL_HOST];
-	expire_time = strtoul (argv[COL_EXPIRY], NULL, 10);
+	if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		g_warning ("Failed to prepare query: %s", sqlite3_errmsg (db));
+		return NULL;
+	}
 
-	if (now >= expire_time)
-		return 0;
+	return stmt;
+}
 
-	expires = g_date_time_new_from_unix_utc (expire_time);
-	max_age = strtoul (argv[COL_MAX_AGE], NULL, 10);
-	include_subdomains = (g_strcmp0 (argv[COL_SUBDOMAINS], "1") == 0);
+/* Follows sqlite3 convention; returns TRUE on error */
+static gboolean
+open_db (SoupHSTSEnforcerDBPrivate *priv)
+{
+	if (sqlite3_open (priv->filename, &priv->db)) {
+		sqlite3_close (priv->db);
+		priv->db = NULL;
+		g_warning ("Can't open %s", priv->filename);
+		return TRUE;
+	}
 
-	policy = soup_hsts_policy_new_full (host, max_age, expires, include_subdomains);
+	exec_query (priv->db, "PRAGMA synchronous = OFF; PRAGMA secure_delete = 1;");
+	exec_query (priv->db, CREATE_TABLE);
 
-	if (policy) {
-		soup_hsts_enforcer_set_policy (hsts_enforcer, policy);
-		soup_hsts_policy_free (policy);
-	} else
-		g_date_time_unref (expires);
+	priv->insert_stmt = prepare_statement (priv->db, QUERY_INSERT);
+	priv->delete_stmt = prepare_statement (priv->db, QUERY_DELETE);
 
-	return 0;
+	return FALSE;
 }
 
 static void
-try_create_table (sqlite3 *db)
+close_db (SoupHSTSEnforcerDBPrivate *priv)
 {
-	char *error = NULL;
+	g_clear_pointer (&priv->insert_stmt, sqlite3_finalize);
+	g_clear_pointer (&priv->delete_stmt, sqlite3_finalize);
+	g_clear_pointer (&priv->db, sqlite3_close);
+}
 
-	if (sqlite3_exec (db, CREATE_TABLE, NULL, NULL, &error)) {
-		g_warning ("Failed to execute query: %s", error);
-		sqlite3_free (error);
+static GPtrArray *
+read_policies (sqlite3 *db)
+{
+	GPtrArray *policies = g_ptr_array_new_with_free_func ((GDestroyNotify)soup_hsts_policy_free);
+	sqlite3_stmt *stmt;
+	gint64 now = time (NULL);
+
+	stmt = prepare_statement (db, QUERY_ALL);
+	if (!stmt)
+		return policies;
+
+	while (sqlite3_step (stmt) == SQLITE_ROW) {
+		SoupHSTSPolicy *policy;
+		const char *host;
+		gint64 expire_time;
+		GDateTime *expires;
+
+		expire_time = sqlite3_column_int64 (stmt, COL_EXPIRY);
+		if (now >= expire_time)
+			continue;
+
+		host = (const char *)sqlite3_column_text (stmt, COL_HOST);
+		if (!host)
+			continue;
+
+		expires = g_date_time_new_from_unix_utc (expire_time);
+		policy = soup_hsts_policy_new_full (host,
+						    (unsigned long)sqlite3_column_int64 (stmt, COL_MAX_AGE),
+						    expires,
+						    sqlite3_column_int (stmt, COL_SUBDOMAINS) == 1);
+		g_date_time_unref (expires);
+
+		if (policy)
+			g_ptr_array_add (policies, policy);
 	}
-}
 
-typedef int (*ExecQueryCallback) (void *, int, char**, char**);
+	sqlite3_finalize (stmt);
+
+	return policies;
+}
 
 static void
-exec_query_with_try_create_table (sqlite3 *db,
-				  const char *sql,
-				  ExecQueryCallback callback,
-				  void *argument)
+write_policies (SoupHSTSEnforcerDBPrivate *priv,
+		GHashTable                *writes)
 {
-	char *error = NULL;
-	gboolean try_create = TRUE;
-
-try_exec:
-	if (sqlite3_exec (db, sql, callback, argument, &error)) {
-		if (try_create) {
-			try_create = FALSE;
-			try_create_table (db);
-			sqlite3_free (error);
-			error = NULL;
-			goto try_exec;
+	GHashTableIter iter;
+	const char *host;
+	PendingWrite *write;
+
+	if (!priv->insert_stmt || !priv->delete_stmt)
+		return;
+
+	exec_query (priv->db, "BEGIN TRANSACTION;");
+
+	g_hash_table_iter_init (&iter, writes);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&host, (gpointer *)&write)) {
+		sqlite3_stmt *stmt;
+
+		if (write->delete) {
+			stmt = priv->delete_stmt;
+			sqlite3_bind_text (stmt, 1, host, -1, SQLITE_STATIC);
 		} else {
-			g_warning ("Failed to execute query: %s", error);
-			sqlite3_free (error);
+			stmt = priv->insert_stmt;
+			sqlite3_bind_text (stmt, 1, host, -1, SQLITE_STATIC);
+			sqlite3_bind_int64 (stmt, 2, write->max_age);
+			sqlite3_bind_int64 (stmt, 3, write->expiry);
+			sqlite3_bind_int (stmt, 4, write->include_subdomains);
 		}
+
+		if (sqlite3_step (stmt) != SQLITE_DONE)
+			g_warning ("Failed to execute query: %s", sqlite3_errmsg (priv->db));
+		sqlite3_reset (stmt);
+		sqlite3_clear_bindings (stmt);
 	}
+
+	exec_query (priv->db, "COMMIT;");
 }
 
-/* Follows sqlite3 convention; returns TRUE on error */
-static gboolean
-open_db (SoupHSTSEnforcer *hsts_enforcer)
+static void
+soup_hsts_enforcer_db_ensure_loaded (SoupHSTSEnforcer *hsts_enforcer)
 {
-	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)hsts_enforcer);
+	SoupHSTSEnforcerDB *db = SOUP_HSTS_ENFORCER_DB (hsts_enforcer);
+	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private (db);
+	GRecMutex *lock;
+	GPtrArray *policies;
+	guint i;
 
-	char *error = NULL;
+	if (g_atomic_int_get (&priv->loaded))
+		return;
 
-	if (sqlite3_open (priv->filename, &priv->db)) {
-		sqlite3_close (priv->db);
-		priv->db = NULL;
-		g_warning ("Can't open %s", priv->filename);
-		return TRUE;
+	/* Holding the enforcer's lock keeps the other threads from
+	 * looking at the policies until they are all in place.
+	 */
+	lock = soup_hsts_enforcer_get_lock (SOUP_HSTS_ENFORCER (db));
+	g_rec_mutex_lock (lock);
+	if (priv->loaded) {
+		g_rec_mutex_unlock (lock);
+		return;
 	}
 
-	if (sqlite3_exec (priv->db, "PRAGMA synchronous = OFF; PRAGMA secure_delete = 1;", NULL, NULL, &error)) {
-		g_warning ("Failed to execute query: %s", error);
-		sqlite3_free (error);
+	g_mutex_lock (&priv->mutex);
+	while (!priv->load_done)
+		g_cond_wait (&priv->cond, &priv->mutex);
+	policies = g_steal_pointer (&priv->loaded_policies);
+	if (priv->load_source) {
+		g_source_destroy (priv->load_source);
+		g_clear_pointer (&priv->load_source, g_source_unref);
 	}
+	g_mutex_unlock (&priv->mutex);
 
-	return FALSE;
+	for (i = 0; policies && i < policies->len; i++)
+		soup_hsts_enforcer_add_stored_policy (hsts_enforcer, policies->pdata[i]);
+
+	g_atomic_int_set (&priv->loaded, TRUE);
+	g_rec_mutex_unlock (lock);
+
+	g_clear_pointer (&policies, g_ptr_array_unref);
 }
 
-static void
-load (SoupHSTSEnforcer *hsts_enforcer)
+static gboolean
+apply_loaded_policies_cb (gpointer user_data)
 {
-	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)hsts_enforcer);
+	soup_hsts_enforcer_db_ensure_loaded (user_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gpointer
+worker_thread (gpointer user_data)
+{
+	SoupHSTSEnforcerDB *db = user_data;
+	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private (db);
+	GPtrArray *policies = NULL;
+	GHashTable *writes;
+	gint64 deadline;
+
+	/* The enforcer is not referenced here; it stops and joins
+	 * this thread before it goes away.
+	 */
+	if (!open_db (priv))
+		policies = read_policies (priv->db);
+
+	g_mutex_lock (&priv->mutex);
+	priv->loaded_policies = policies;
+	priv->load_done = TRUE;
+	g_cond_broadcast (&priv->cond);
+	if (!priv->stop) {
+		priv->load_source = g_idle_source_new ();
+		g_source_set_name (priv->load_source, "SoupHSTSEnforcerDB load");
+		g_source_set_callback (priv->load_source, apply_loaded_policies_cb, db, NULL);
+		g_source_attach (priv->load_source, priv->context);
+	}
+
+	while (TRUE) {
+		while (!priv->stop && !g_hash_table_size (priv->pending_writes))
+			g_cond_wait (&priv->cond, &priv->mutex);
+
+		/* Give the changes some time to pile up */
+		deadline = g_get_monotonic_time () + WRITE_BEHIND_INTERVAL;
+		while (!priv->stop) {
+			if (!g_cond_wait_until (&priv->cond, &priv->mutex, deadline))
+				break;
+		}
+
+		if (!g_hash_table_size (priv->pending_writes))
+			break;
+
+		writes = priv->pending_writes;
+		priv->pending_writes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+		g_mutex_unlock (&priv->mutex);
+
+		if (priv->db)
+			write_policies (priv, writes);
+		g_hash_table_destroy (writes);
 
-	if (priv->db == NULL) {
-		if (open_db (hsts_enforcer))
-			return;
+		g_mutex_lock (&priv->mutex);
 	}
+	g_mutex_unlock (&priv->mutex);
 
-	exec_query_with_try_create_table (priv->db, QUERY_ALL, query_all_callback, hsts_enforcer);
+	close_db (priv);
+
+	return NULL;
 }
 
 static void
@@ -260,61 +461,61 @@ soup_hsts_enforcer_db_changed (SoupHSTSEnforcer *hsts_enforcer,
 			       SoupHSTSPolicy   *new_policy)
 {
 	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)hsts_enforcer);
-	char *query;
+	PendingWrite *write;
+	const char *domain;
 
 	/* Session policies do not need to be stored in the database. */
 	if ((old_policy && soup_hsts_policy_is_session_policy (old_policy)) ||
 	    (new_policy && soup_hsts_policy_is_session_policy (new_policy)))
 		return;
 
-	if (priv->db == NULL) {
-		if (open_db (hsts_enforcer))
-			return;
-	}
+	if (!priv->worker)
+		return;
 
 	if (old_policy && !new_policy) {
-		query = sqlite3_mprintf (QUERY_DELETE,
-					 soup_hsts_policy_get_domain (old_policy));
-		g_assert (query);
-		exec_query_with_try_create_table (priv->db, query, NULL, NULL);
-		sqlite3_free (query);
-	}
+		write = g_new0 (PendingWrite, 1);
+		write->delete = TRUE;
+		domain = soup_hsts_policy_get_domain (old_policy);
+	} else if (new_policy && soup_hsts_policy_get_expires (new_policy)) {
+		/* Insert the new policy or update the existing one. */
+		write = g_new0 (PendingWrite, 1);
+		write->max_age = soup_hsts_policy_get_max_age (new_policy);
+		write->expiry = g_date_time_to_unix (soup_hsts_policy_get_expires (new_policy));
+		write->include_subdomains = soup_hsts_policy_includes_subdomains (new_policy);
+		domain = soup_hsts_policy_get_domain (new_policy);
+	} else
+		return;
 
-	/* Insert the new policy or update the existing one. */
-	if (new_policy && soup_hsts_policy_get_expires (new_policy)) {
-		gulong expires;
-
-		expires = (gulong)g_date_time_to_unix (soup_hsts_policy_get_expires (new_policy));
-		query = sqlite3_mprintf (QUERY_INSERT,
-					 soup_hsts_policy_get_domain (new_policy),
-					 soup_hsts_policy_get_domain (new_policy),
-					 soup_hsts_policy_get_max_age (new_policy),
-					 expires,
-					 soup_hsts_policy_includes_subdomains (new_policy));
-		g_assert (query);
-		exec_query_with_try_create_table (priv->db, query, NULL, NULL);
-		sqlite3_free (query);
-	}
+	/* Only the last change of every host needs to be written */
+	g_mutex_lock (&priv->mutex);
+	g_hash_table_replace (priv->pending_writes, g_strdup (domain), write);
+	g_cond_signal (&priv->cond);
+	g_mutex_unlock (&priv->mutex);
 }
 
-static gboolean
-soup_hsts_enforcer_db_is_persistent (SoupHSTSEnforcer *hsts_enforcer)
+static void
+soup_hsts_enforcer_db_request_queued (SoupSessionFeature *feature,
+				      SoupMessage        *msg)
 {
-	return TRUE;
+	/* Messages must not be sent before the stored policies are known */
+	soup_hsts_enforcer_db_ensure_loaded (SOUP_HSTS_ENFORCER (feature));
+
+	soup_hsts_enforcer_db_feature_parent_iface->request_queued (feature, msg);
 }
 
-static gboolean
-soup_hsts_enforcer_db_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
-					const char *domain)
+static void
+soup_hsts_enforcer_db_session_feature_init (SoupSessionFeatureInterface *feature_interface,
+					    gpointer interface_data)
 {
-	/* TODO: In the future we should not load the full contents of
-	   this database into the enforcer, and instead query the
-	   database on request here. Loading the entire database for a
-	   potentially large amount of domains is probably not the
-	   best approach.
-	*/
+	soup_hsts_enforcer_db_feature_parent_iface = g_type_interface_peek_parent (feature_interface);
 
-	return SOUP_HSTS_ENFORCER_CLASS (soup_hsts_enforcer_db_parent_class)->has_valid_policy (hsts_enforcer, domain);
+	feature_interface->request_queued = soup_hsts_enforcer_db_request_queued;
+}
+
+static gboolean
+soup_hsts_enforcer_db_is_persistent (SoupHSTSEnforcer *hsts_enforcer)
+{
+	return TRUE;
 }
 
 static void
@@ -325,7 +526,13 @@ soup_hsts_enforcer_db_class_init (SoupHSTSEnforcerDBClass *db_class)
 	GObjectClass *object_class = G_OBJECT_CLASS (db_class);
 
 	hsts_enforcer_class->is_persistent = soup_hsts_enforcer_db_is_persistent;
-	hsts_enforcer_class->has_valid_policy = soup_hsts_enforcer_db_has_valid_policy;
+	hsts_enforcer_class->ensure_loaded = soup_hsts_enforcer_db_ensure_loaded;
+	/* TODO: In the future we should not load the full contents of
+	   this database into the enforcer, and instead query the
+	   database on request by overriding has_valid_policy. Loading
+	   the entire database for a potentially large amount of
+	   domains is probably not the best approach.
+	*/
 	hsts_enforcer_class->changed       = soup_hsts_enforcer_db_changed;
 
 	object_class->finalize     = soup_hsts_enforcer_db_finalize;
@@ -0,0 +1,17 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2016, 2017, 2018 Igalia S.L.
+ */
+
+#pragma once
+
+#include "soup-hsts-enforcer.h"
+
+G_BEGIN_DECLS
+
+GRecMutex *soup_hsts_enforcer_get_lock          (SoupHSTSEnforcer *hsts_enforcer);
+
+void       soup_hsts_enforcer_add_stored_policy (SoupHSTSEnforcer *hsts_enforcer,
+						 SoupHSTSPolicy   *policy);
+
+G_END_DECLS
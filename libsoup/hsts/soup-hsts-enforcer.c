@@ -10,7 +10,10 @@
 #include <config.h>
 #endif
 
-#include "soup-hsts-enforcer.h"
+#include <string.h>
+
+#include "soup-hsts-enforcer-private.h"
+#include "soup-hsts-preload.h"
 #include "soup-misc.h"
 #include "soup.h"
 #include "soup-session-private.h"
@@ -40,10 +43,18 @@
  * #SoupHSTSEnforcer are advised to listen to changes in
  * SoupMessage:uri in order to be aware of changes in the message URI.
  *
+ * A built-in list of preloaded HSTS hosts is enforced in addition to
+ * the policies learnt from the network, so that the very first request
+ * to those hosts is already secure, unless
+ * #SoupHSTSEnforcer:use-preload-list is unset.
+ *
  * Note that #SoupHSTSEnforcer does not support any form of long-term
  * HSTS policy persistence. See #SoupHSTSEnforcerDB for a persistent
  * enforcer.
  *
+ * The policies can be looked up and changed from several threads at
+ * once.
+ *
  **/
 
 /**
@@ -61,10 +72,50 @@ enum {
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+enum {
+	PROP_0,
+
+	PROP_USE_PRELOAD_LIST,
+
+	LAST_PROPERTY
+};
+
+static GParamSpec *properties[LAST_PROPERTY] = { NULL, };
+
+/* Every domain with a policy has a node for each of its labels, from
+ * right to left, so that a host and all its super domains are
+ * checked in a single walk down from the top level domain. The nodes
+ * of the domains with a host policy also form a binary min-heap
+ * ordered by expiry, so that expired policies are pruned without
+ * looking at the others.
+ */
+typedef struct _SoupHSTSLabelNode SoupHSTSLabelNode;
+
+struct _SoupHSTSLabelNode {
+	SoupHSTSLabelNode *parent;
+	char              *label;
+	guint              n_children;
+
+	SoupHSTSPolicy    *host_policy;
+	SoupHSTSPolicy    *session_policy;
+
+	gint64             expires;
+	guint              heap_index;
+};
+
 typedef struct {
 	SoupSession *session;
+	GRecMutex lock; /* for the policies, labels, heap and changes */
 	GHashTable *host_policies;
 	GHashTable *session_policies;
+
+	GHashTable *labels; /* set of SoupHSTSLabelNode */
+	GPtrArray *expiry_heap; /* SoupHSTSLabelNode with a host policy */
+
+	GQueue changes; /* of SoupHSTSEnforcerChange */
+	GRecMutex emit_lock; /* keeps the ::changed emissions in order */
+
+	int use_preload_list; /* atomic */
 } SoupHSTSEnforcerPrivate;
 
 G_DEFINE_TYPE_WITH_CODE (SoupHSTSEnforcer, soup_hsts_enforcer, G_TYPE_OBJECT,
@@ -72,6 +123,256 @@ G_DEFINE_TYPE_WITH_CODE (SoupHSTSEnforcer, soup_hsts_enforcer, G_TYPE_OBJECT,
 						soup_hsts_enforcer_session_feature_init)
 			 G_ADD_PRIVATE(SoupHSTSEnforcer))
 
+GRecMutex *
+soup_hsts_enforcer_get_lock (SoupHSTSEnforcer *hsts_enforcer)
+{
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+
+	return &priv->lock;
+}
+
+static void
+ensure_loaded (SoupHSTSEnforcer *hsts_enforcer)
+{
+	SoupHSTSEnforcerClass *klass = SOUP_HSTS_ENFORCER_GET_CLASS (hsts_enforcer);
+
+	if (klass->ensure_loaded)
+		klass->ensure_loaded (hsts_enforcer);
+}
+
+static guint
+label_node_hash (gconstpointer key)
+{
+	const SoupHSTSLabelNode *node = key;
+
+	return g_str_hash (node->label) ^ g_direct_hash (node->parent);
+}
+
+static gboolean
+label_node_equal (gconstpointer a,
+		  gconstpointer b)
+{
+	const SoupHSTSLabelNode *node_a = a, *node_b = b;
+
+	return node_a->parent == node_b->parent && !strcmp (node_a->label, node_b->label);
+}
+
+static void
+label_node_free (SoupHSTSLabelNode *node)
+{
+	g_free (node->label);
+	g_slice_free (SoupHSTSLabelNode, node);
+}
+
+/* Calls @func with each label of @domain, lowercased, from right to
+ * left, until it returns %FALSE.
+ */
+static void
+foreach_label (const char *domain,
+	       gboolean  (*func) (const char *label, gboolean is_last, gpointer data),
+	       gpointer    data)
+{
+	char *name = g_ascii_strdown (domain, -1);
+	gsize start, end = strlen (name);
+
+	while (TRUE) {
+		while (end > 0 && name[end - 1] == '.')
+			end--;
+		if (end == 0)
+			break;
+
+		for (start = end; start > 0 && name[start - 1] != '.'; start--);
+		name[end] = '\0';
+
+		if (!func (name + start, start == 0, data))
+			break;
+		end = start;
+	}
+
+	g_free (name);
+}
+
+typedef struct {
+	SoupHSTSEnforcerPrivate *priv;
+	SoupHSTSLabelNode *node;
+	gboolean create;
+} LabelLookup;
+
+static gboolean
+lookup_label (const char *label,
+	      gboolean    is_last,
+	      gpointer    data)
+{
+	LabelLookup *lookup = data;
+	SoupHSTSLabelNode probe, *node;
+
+	probe.parent = lookup->node;
+	probe.label = (char *)label;
+	node = g_hash_table_lookup (lookup->priv->labels, &probe);
+	if (!node && lookup->create) {
+		node = g_slice_new0 (SoupHSTSLabelNode);
+		node->parent = lookup->node;
+		node->label = g_strdup (label);
+		if (node->parent)
+			node->parent->n_children++;
+		g_hash_table_add (lookup->priv->labels, node);
+	}
+
+	lookup->node = node;
+	return node != NULL;
+}
+
+static SoupHSTSLabelNode *
+get_label_node (SoupHSTSEnforcerPrivate *priv,
+		const char              *domain,
+		gboolean                 create)
+{
+	LabelLookup lookup = { priv, NULL, create };
+
+	foreach_label (domain, lookup_label, &lookup);
+	return lookup.node;
+}
+
+/* Frees @node and its ancestors once they lead to no policy */
+static void
+prune_label_node (SoupHSTSEnforcerPrivate *priv,
+		  SoupHSTSLabelNode       *node)
+{
+	SoupHSTSLabelNode *parent;
+
+	while (node && !node->n_children && !node->host_policy && !node->session_policy) {
+		parent = node->parent;
+		if (parent)
+			parent->n_children--;
+		g_hash_table_remove (priv->labels, node);
+		node = parent;
+	}
+}
+
+#define HEAP_NODE(priv, i) ((SoupHSTSLabelNode *)g_ptr_array_index ((priv)->expiry_heap, (i)))
+
+static void
+heap_set (SoupHSTSEnforcerPrivate *priv,
+	  guint                    index,
+	  SoupHSTSLabelNode       *node)
+{
+	priv->expiry_heap->pdata[index] = node;
+	node->heap_index = index;
+}
+
+static void
+heap_sift_up (SoupHSTSEnforcerPrivate *priv,
+	      SoupHSTSLabelNode       *node)
+{
+	guint index = node->heap_index, parent;
+
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (HEAP_NODE (priv, parent)->expires <= node->expires)
+			break;
+		heap_set (priv, index, HEAP_NODE (priv, parent));
+		index = parent;
+	}
+	heap_set (priv, index, node);
+}
+
+static void
+heap_sift_down (SoupHSTSEnforcerPrivate *priv,
+		SoupHSTSLabelNode       *node)
+{
+	guint index = node->heap_index, child;
+	guint len = priv->expiry_heap->len;
+
+	while ((child = 2 * index + 1) < len) {
+		if (child + 1 < len && HEAP_NODE (priv, child + 1)->expires < HEAP_NODE (priv, child)->expires)
+			child++;
+		if (node->expires <= HEAP_NODE (priv, child)->expires)
+			break;
+		heap_set (priv, index, HEAP_NODE (priv, child));
+		index = child;
+	}
+	heap_set (priv, index, node);
+}
+
+static void
+heap_remove (SoupHSTSEnforcerPrivate *priv,
+	     SoupHSTSLabelNode       *node)
+{
+	SoupHSTSLabelNode *last;
+
+	last = g_ptr_array_steal_index_fast (priv->expiry_heap, priv->expiry_heap->len - 1);
+	if (last == node)
+		return;
+
+	last->heap_index = node->heap_index;
+	heap_set (priv, last->heap_index, last);
+	heap_sift_up (priv, last);
+	heap_sift_down (priv, last);
+}
+
+static gint64
+get_policy_expires (SoupHSTSPolicy *policy)
+{
+	GDateTime *expires = soup_hsts_policy_get_expires (policy);
+
+	if (!expires)
+		return G_MAXINT64;
+
+	/* See soup_date_time_is_past() */
+	if (g_date_time_get_year (expires) < 2020)
+		return G_MININT64;
+
+	return g_date_time_to_unix (expires);
+}
+
+/* Indexes @policy, which was just stored in one of the tables */
+static void
+track_policy (SoupHSTSEnforcer *hsts_enforcer,
+	      SoupHSTSPolicy   *policy)
+{
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	SoupHSTSLabelNode *node;
+
+	node = get_label_node (priv, soup_hsts_policy_get_domain (policy), TRUE);
+	if (!node)
+		return;
+
+	if (soup_hsts_policy_is_session_policy (policy)) {
+		node->session_policy = policy;
+		return;
+	}
+
+	node->expires = get_policy_expires (policy);
+	if (!node->host_policy) {
+		node->heap_index = priv->expiry_heap->len;
+		g_ptr_array_add (priv->expiry_heap, node);
+	}
+	node->host_policy = policy;
+	heap_sift_up (priv, node);
+	heap_sift_down (priv, node);
+}
+
+static void
+untrack_policy (SoupHSTSEnforcer *hsts_enforcer,
+		const char       *domain,
+		gboolean          is_session_policy)
+{
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	SoupHSTSLabelNode *node;
+
+	node = get_label_node (priv, domain, FALSE);
+	if (!node)
+		return;
+
+	if (is_session_policy) {
+		node->session_policy = NULL;
+	} else if (node->host_policy) {
+		heap_remove (priv, node);
+		node->host_policy = NULL;
+	}
+	prune_label_node (priv, node);
+}
+
 static void
 soup_hsts_enforcer_init (SoupHSTSEnforcer *hsts_enforcer)
 {
@@ -84,6 +385,45 @@ soup_hsts_enforcer_init (SoupHSTSEnforcer *hsts_enforcer)
 	priv->session_policies = g_hash_table_new_full (soup_str_case_hash,
 								       soup_str_case_equal,
 								       g_free, NULL);
+
+	priv->labels = g_hash_table_new_full (label_node_hash, label_node_equal,
+					      (GDestroyNotify)label_node_free, NULL);
+	priv->expiry_heap = g_ptr_array_new ();
+	g_rec_mutex_init (&priv->lock);
+	g_rec_mutex_init (&priv->emit_lock);
+	priv->use_preload_list = TRUE;
+}
+
+static void
+soup_hsts_enforcer_set_property (GObject *object, guint prop_id,
+				 const GValue *value, GParamSpec *pspec)
+{
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private ((SoupHSTSEnforcer*)object);
+
+	switch (prop_id) {
+	case PROP_USE_PRELOAD_LIST:
+		g_atomic_int_set (&priv->use_preload_list, g_value_get_boolean (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+soup_hsts_enforcer_get_property (GObject *object, guint prop_id,
+				 GValue *value, GParamSpec *pspec)
+{
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private ((SoupHSTSEnforcer*)object);
+
+	switch (prop_id) {
+	case PROP_USE_PRELOAD_LIST:
+		g_value_set_boolean (value, g_atomic_int_get (&priv->use_preload_list));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
 }
 
 static void
@@ -103,6 +443,11 @@ soup_hsts_enforcer_finalize (GObject *object)
 		soup_hsts_policy_free (value);
 	g_hash_table_destroy (priv->session_policies);
 
+	g_ptr_array_free (priv->expiry_heap, TRUE);
+	g_hash_table_destroy (priv->labels);
+	g_rec_mutex_clear (&priv->lock);
+	g_rec_mutex_clear (&priv->emit_lock);
+
 	G_OBJECT_CLASS (soup_hsts_enforcer_parent_class)->finalize (object);
 }
 
@@ -132,8 +477,13 @@ static gboolean
 soup_hsts_enforcer_real_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
 					  const char *domain)
 {
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
 	SoupHSTSPolicy *policy;
 
+	if (g_atomic_int_get (&priv->use_preload_list) &&
+	    soup_hsts_preload_lookup (domain, strlen (domain), NULL))
+		return TRUE;
+
 	if (soup_hsts_enforcer_get_session_policy (hsts_enforcer, domain))
 		return TRUE;
 
@@ -150,6 +500,8 @@ soup_hsts_enforcer_class_init (SoupHSTSEnforcerClass *hsts_enforcer_class)
 	GObjectClass *object_class = G_OBJECT_CLASS (hsts_enforcer_class);
 
 	object_class->finalize = soup_hsts_enforcer_finalize;
+	object_class->set_property = soup_hsts_enforcer_set_property;
+	object_class->get_property = soup_hsts_enforcer_get_property;
 
 	hsts_enforcer_class->is_persistent = soup_hsts_enforcer_real_is_persistent;
 	hsts_enforcer_class->has_valid_policy = soup_hsts_enforcer_real_has_valid_policy;
@@ -168,8 +520,10 @@ soup_hsts_enforcer_class_init (SoupHSTSEnforcerClass *hsts_enforcer_class)
 	 * @old_policy will contain its old value, and @new_policy its
 	 * new value.
 	 *
-	 * Note that you shouldn't modify the policies from a callback to
-	 * this signal.
+	 * The signal is emitted once the enforcer has been unlocked,
+	 * in the order the changes were made, so handlers may look at
+	 * the policies from any thread. Note that you shouldn't modify
+	 * the policies from a callback to this signal.
 	 **/
 	signals[CHANGED] =
 		g_signal_new ("changed",
@@ -181,6 +535,22 @@ soup_hsts_enforcer_class_init (SoupHSTSEnforcerClass *hsts_enforcer_class)
 			      G_TYPE_NONE, 2,
 			      SOUP_TYPE_HSTS_POLICY | G_SIGNAL_TYPE_STATIC_SCOPE,
 			      SOUP_TYPE_HSTS_POLICY | G_SIGNAL_TYPE_STATIC_SCOPE);
+
+	/**
+	 * SoupHSTSEnforcer:use-preload-list:
+	 *
+	 * Whether the built-in list of preloaded HSTS hosts is
+	 * enforced, in addition to the policies of the enforcer.
+	 */
+	properties[PROP_USE_PRELOAD_LIST] =
+		g_param_spec_boolean ("use-preload-list",
+				      "Use preload list",
+				      "Whether the built-in list of preloaded HSTS hosts is enforced",
+				      TRUE,
+				      G_PARAM_READWRITE |
+				      G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
 
 /**
@@ -199,41 +569,83 @@ soup_hsts_enforcer_new (void)
 	return g_object_new (SOUP_TYPE_HSTS_ENFORCER, NULL);
 }
 
+typedef struct {
+	SoupHSTSPolicy *old_policy;
+	SoupHSTSPolicy *new_policy;
+} SoupHSTSEnforcerChange;
+
+/* Called with the lock held. The ::changed signal is emitted by
+ * soup_hsts_enforcer_emit_changes() once the lock has been released,
+ * so it gets copies of the policies.
+ */
 static void
 soup_hsts_enforcer_changed (SoupHSTSEnforcer *hsts_enforcer,
 			    SoupHSTSPolicy *old, SoupHSTSPolicy *new)
 {
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	SoupHSTSEnforcerChange *change;
+
 	g_assert (old || new);
 
-	g_signal_emit (hsts_enforcer, signals[CHANGED], 0, old, new);
+	change = g_new (SoupHSTSEnforcerChange, 1);
+	change->old_policy = old ? soup_hsts_policy_copy (old) : NULL;
+	change->new_policy = new ? soup_hsts_policy_copy (new) : NULL;
+	g_queue_push_tail (&priv->changes, change);
 }
 
-static gboolean
-should_remove_expired_host_policy (G_GNUC_UNUSED gpointer key,
-				   SoupHSTSPolicy *policy,
-				   SoupHSTSEnforcer *enforcer)
-{
-	if (soup_hsts_policy_is_expired (policy)) {
-		/* This will emit the ::changed signal before the
-		   policy is actually removed from the policies hash
-		   table, which could be problematic, or not.
-		*/
-		soup_hsts_enforcer_changed (enforcer, policy, NULL);
-		soup_hsts_policy_free (policy);
+/* Must be called without the lock held. Whichever thread gets here
+ * first emits all the pending changes, in the order they were made.
+ */
+static void
+soup_hsts_enforcer_emit_changes (SoupHSTSEnforcer *hsts_enforcer)
+{
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	SoupHSTSEnforcerChange *change;
+	gboolean pending;
 
-		return TRUE;
-	}
+	g_rec_mutex_lock (&priv->lock);
+	pending = !g_queue_is_empty (&priv->changes);
+	g_rec_mutex_unlock (&priv->lock);
+	if (!pending)
+		return;
 
-	return FALSE;
+	g_rec_mutex_lock (&priv->emit_lock);
+	while (TRUE) {
+		g_rec_mutex_lock (&priv->lock);
+		change = g_queue_pop_head (&priv->changes);
+		g_rec_mutex_unlock (&priv->lock);
+		if (!change)
+			break;
+
+		g_signal_emit (hsts_enforcer, signals[CHANGED], 0, change->old_policy, change->new_policy);
+		g_clear_pointer (&change->old_policy, soup_hsts_policy_free);
+		g_clear_pointer (&change->new_policy, soup_hsts_policy_free);
+		g_free (change);
+	}
+	g_rec_mutex_unlock (&priv->emit_lock);
 }
 
 static void
 remove_expired_host_policies (SoupHSTSEnforcer *hsts_enforcer)
 {
         SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
-	g_hash_table_foreach_remove (priv->host_policies,
-				     (GHRFunc)should_remove_expired_host_policy,
-				     hsts_enforcer);
+	SoupHSTSLabelNode *node;
+	SoupHSTSPolicy *policy;
+	gint64 now = time (NULL);
+
+	/* Only the expired policies are visited */
+	while (priv->expiry_heap->len && HEAP_NODE (priv, 0)->expires < now) {
+		node = HEAP_NODE (priv, 0);
+		policy = node->host_policy;
+
+		heap_remove (priv, node);
+		node->host_policy = NULL;
+		prune_label_node (priv, node);
+
+		g_hash_table_remove (priv->host_policies, soup_hsts_policy_get_domain (policy));
+		soup_hsts_enforcer_changed (hsts_enforcer, policy, NULL);
+		soup_hsts_policy_free (policy);
+	}
 }
 
 static void
@@ -248,6 +660,7 @@ soup_hsts_enforcer_remove_host_policy (SoupHSTSEnforcer *hsts_enforcer,
 	if (!policy)
 		return;
 
+	untrack_policy (hsts_enforcer, domain, FALSE);
 	g_hash_table_remove (priv->host_policies, domain);
 	soup_hsts_enforcer_changed (hsts_enforcer, policy, NULL);
 	soup_hsts_policy_free (policy);
@@ -277,6 +690,7 @@ soup_hsts_enforcer_replace_policy (SoupHSTSEnforcer *hsts_enforcer,
 	g_assert (old_policy);
 
 	g_hash_table_replace (policies, g_strdup (domain), soup_hsts_policy_copy (new_policy));
+	track_policy (hsts_enforcer, g_hash_table_lookup (policies, domain));
 	if (!soup_hsts_policy_equal (old_policy, new_policy))
 		soup_hsts_enforcer_changed (hsts_enforcer, old_policy, new_policy);
 	soup_hsts_policy_free (old_policy);
@@ -309,6 +723,7 @@ soup_hsts_enforcer_insert_policy (SoupHSTSEnforcer *hsts_enforcer,
 	g_assert (!g_hash_table_contains (policies, domain));
 
 	g_hash_table_insert (policies, g_strdup (domain), soup_hsts_policy_copy (policy));
+	track_policy (hsts_enforcer, g_hash_table_lookup (policies, domain));
 	soup_hsts_enforcer_changed (hsts_enforcer, NULL, policy);
 }
 
@@ -346,17 +761,46 @@ soup_hsts_enforcer_set_policy (SoupHSTSEnforcer *hsts_enforcer,
 	policies = is_session_policy ? priv->session_policies :
 				  priv->host_policies;
 
+	/* Changes are made on top of the stored policies */
+	ensure_loaded (hsts_enforcer);
+
+	g_rec_mutex_lock (&priv->lock);
+
 	if (!is_session_policy && soup_hsts_policy_is_expired (policy)) {
 		soup_hsts_enforcer_remove_host_policy (hsts_enforcer, domain);
-		return;
+	} else {
+		current_policy = g_hash_table_lookup (policies, domain);
+
+		if (current_policy)
+			soup_hsts_enforcer_replace_policy (hsts_enforcer, policy);
+		else
+			soup_hsts_enforcer_insert_policy (hsts_enforcer, policy);
 	}
 
-	current_policy = g_hash_table_lookup (policies, domain);
+	g_rec_mutex_unlock (&priv->lock);
 
-	if (current_policy)
-		soup_hsts_enforcer_replace_policy (hsts_enforcer, policy);
-	else
-		soup_hsts_enforcer_insert_policy (hsts_enforcer, policy);
+	soup_hsts_enforcer_emit_changes (hsts_enforcer);
+}
+
+/* Adds a policy read from persistent storage, without emitting
+ * ::changed.
+ */
+void
+soup_hsts_enforcer_add_stored_policy (SoupHSTSEnforcer *hsts_enforcer,
+				      SoupHSTSPolicy   *policy)
+{
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	const char *domain = soup_hsts_policy_get_domain (policy);
+
+	if (soup_hsts_policy_is_session_policy (policy) || soup_hsts_policy_is_expired (policy))
+		return;
+
+	g_rec_mutex_lock (&priv->lock);
+	if (!g_hash_table_contains (priv->host_policies, domain)) {
+		g_hash_table_insert (priv->host_policies, g_strdup (domain), soup_hsts_policy_copy (policy));
+		track_policy (hsts_enforcer, g_hash_table_lookup (priv->host_policies, domain));
+	}
+	g_rec_mutex_unlock (&priv->lock);
 }
 
 /**
@@ -389,12 +833,15 @@ static gboolean
 soup_hsts_enforcer_host_includes_subdomains (SoupHSTSEnforcer *hsts_enforcer,
 					     const char *domain)
 {
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
 	SoupHSTSPolicy *policy;
 	gboolean include_subdomains = FALSE;
 
 	g_return_val_if_fail (SOUP_IS_HSTS_ENFORCER (hsts_enforcer), FALSE);
 	g_return_val_if_fail (domain != NULL, FALSE);
 
+	g_rec_mutex_lock (&priv->lock);
+
 	policy = soup_hsts_enforcer_get_session_policy (hsts_enforcer, domain);
 	if (policy)
 		include_subdomains |= soup_hsts_policy_includes_subdomains (policy);
@@ -403,6 +850,8 @@ soup_hsts_enforcer_host_includes_subdomains (SoupHSTSEnforcer *hsts_enforcer,
 	if (policy)
 		include_subdomains |= soup_hsts_policy_includes_subdomains (policy);
 
+	g_rec_mutex_unlock (&priv->lock);
+
 	return include_subdomains;
 }
 
@@ -422,14 +871,82 @@ super_domain_of (const char *domain)
 	return iter;
 }
 
+typedef struct {
+	SoupHSTSEnforcerPrivate *priv;
+	SoupHSTSLabelNode *node;
+	gint64 now;
+	gboolean enforce;
+} EnforceLookup;
+
+static gboolean
+check_label (const char *label,
+	     gboolean    is_last,
+	     gpointer    data)
+{
+	EnforceLookup *lookup = data;
+	SoupHSTSLabelNode probe, *node;
+	gboolean valid, include_subdomains;
+
+	probe.parent = lookup->node;
+	probe.label = (char *)label;
+	node = g_hash_table_lookup (lookup->priv->labels, &probe);
+	if (!node)
+		return FALSE;
+
+	valid = node->session_policy ||
+		(node->host_policy && node->expires >= lookup->now);
+	include_subdomains = (node->session_policy && soup_hsts_policy_includes_subdomains (node->session_policy)) ||
+		(node->host_policy && soup_hsts_policy_includes_subdomains (node->host_policy));
+
+	if (valid && (is_last || include_subdomains)) {
+		lookup->enforce = TRUE;
+		return FALSE;
+	}
+
+	lookup->node = node;
+	return TRUE;
+}
+
 static gboolean
 soup_hsts_enforcer_must_enforce_secure_transport (SoupHSTSEnforcer *hsts_enforcer,
 						  const char *domain)
 {
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
 	const char *super_domain = domain;
+	gboolean use_preload_list;
 
 	g_return_val_if_fail (domain != NULL, FALSE);
 
+	use_preload_list = g_atomic_int_get (&priv->use_preload_list);
+	ensure_loaded (hsts_enforcer);
+
+	/* Unless a subclass has its own idea of which policies are
+	 * valid, look the host and its super domains up in one go.
+	 */
+	if (SOUP_HSTS_ENFORCER_GET_CLASS (hsts_enforcer)->has_valid_policy == soup_hsts_enforcer_real_has_valid_policy) {
+		EnforceLookup lookup = { priv, NULL, time (NULL), FALSE };
+		char *canonicalized = NULL;
+
+		if (g_hostname_is_ascii_encoded (domain)) {
+			canonicalized = g_hostname_to_unicode (domain);
+			g_return_val_if_fail (canonicalized, FALSE);
+		}
+
+		if (use_preload_list && soup_hsts_preload_must_enforce (canonicalized ? canonicalized : domain)) {
+			lookup.enforce = TRUE;
+		} else {
+			g_rec_mutex_lock (&lookup.priv->lock);
+			foreach_label (canonicalized ? canonicalized : domain, check_label, &lookup);
+			g_rec_mutex_unlock (&lookup.priv->lock);
+		}
+		g_free (canonicalized);
+
+		return lookup.enforce;
+	}
+
+	if (use_preload_list && soup_hsts_preload_must_enforce (domain))
+		return TRUE;
+
 	if (soup_hsts_enforcer_has_valid_policy (hsts_enforcer, domain))
 		return TRUE;
 
@@ -606,6 +1123,7 @@ gboolean
 soup_hsts_enforcer_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
 				     const char *domain)
 {
+	SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
 	char *canonicalized = NULL;
 	gboolean retval;
 
@@ -617,8 +1135,12 @@ soup_hsts_enforcer_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
 		g_return_val_if_fail (canonicalized, FALSE);
 	}
 
+	ensure_loaded (hsts_enforcer);
+
+	g_rec_mutex_lock (&priv->lock);
 	retval = SOUP_HSTS_ENFORCER_GET_CLASS (hsts_enforcer)->has_valid_policy (hsts_enforcer,
 										 canonicalized ? canonicalized : domain);
+	g_rec_mutex_unlock (&priv->lock);
 
 	g_free (canonicalized);
 
@@ -655,9 +1177,13 @@ soup_hsts_enforcer_get_domains (SoupHSTSEnforcer *hsts_enforcer,
 
 	g_return_val_if_fail (SOUP_IS_HSTS_ENFORCER (hsts_enforcer), NULL);
 
+	ensure_loaded (hsts_enforcer);
+
+	g_rec_mutex_lock (&priv->lock);
 	g_hash_table_foreach (priv->host_policies, add_domain_to_list, &domains);
 	if (session_policies)
 		g_hash_table_foreach (priv->session_policies, add_domain_to_list, &domains);
+	g_rec_mutex_unlock (&priv->lock);
 
 	return domains;
 }
@@ -693,9 +1219,13 @@ soup_hsts_enforcer_get_policies (SoupHSTSEnforcer *hsts_enforcer,
 
 	g_return_val_if_fail (SOUP_IS_HSTS_ENFORCER (hsts_enforcer), NULL);
 
+	ensure_loaded (hsts_enforcer);
+
+	g_rec_mutex_lock (&priv->lock);
 	g_hash_table_foreach (priv->host_policies, add_policy_to_list, &policies);
 	if (session_policies)
 		g_hash_table_foreach (priv->session_policies, add_policy_to_list, &policies);
+	g_rec_mutex_unlock (&priv->lock);
 
 	return policies;
 }
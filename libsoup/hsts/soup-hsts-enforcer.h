@@ -25,6 +25,9 @@ G_DECLARE_DERIVABLE_TYPE (SoupHSTSEnforcer, soup_hsts_enforcer, SOUP, HSTS_ENFOR
  * chain up to the @has_valid_policy in the parent class to check, for instance, for runtime
  * policies.
  * @changed: The class closure for the #SoupHSTSEnforcer::changed signal.
+ * @ensure_loaded: The @ensure_loaded function is called before the policies
+ * are looked up. Implementations that read their policies in the background
+ * must have them all in place when it returns.
  *
  * Class structure for #SoupHSTSEnforcer.
  **/
@@ -39,8 +42,10 @@ struct _SoupHSTSEnforcerClass {
 			 SoupHSTSPolicy	  *old_policy,
 			 SoupHSTSPolicy	  *new_policy);
 
+	void (*ensure_loaded) (SoupHSTSEnforcer *hsts_enforcer);
+
         /* <private> */
-	gpointer padding[4];
+	gpointer padding[3];
 };
 
 SOUP_AVAILABLE_IN_ALL
@@ -0,0 +1,120 @@
+/* This file has been generated with generate-hsts-preload.py script, do not edit */
+#include "soup-hsts-preload.h"
+
+#define N_BUCKETS 5
+#define N_ENTRIES 19
+
+static const char soup_hsts_preload_strings[] =
+  "app\0"
+  "bank\0"
+  "boo\0"
+  "day\0"
+  "dev\0"
+  "esq\0"
+  "foo\0"
+  "ing\0"
+  "insurance\0"
+  "meet\0"
+  "mov\0"
+  "new\0"
+  "nexus\0"
+  "page\0"
+  "phd\0"
+  "prof\0"
+  "rsvp\0"
+  "zip\0"
+;
+
+static const guint32 soup_hsts_preload_seeds[N_BUCKETS] = {
+  3, 2, 20, 78, 90,
+};
+
+/* Offset of the domain in soup_hsts_preload_strings, shifted left by
+ * one, ORed with whether the policy includes subdomains.
+ */
+#define EMPTY G_MAXUINT32
+
+static const guint32 soup_hsts_preload_entries[N_ENTRIES] = {
+  59, 35, EMPTY, 125, 27, 135, 143, 43,
+  51, 87, 153, 113, 97, 67, 9, 1,
+  163, 105, 19,
+};
+
+static guint64
+soup_hsts_preload_hash (const char *name,
+                        gsize       length)
+{
+        guint64 h = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+        gsize i;
+
+        for (i = 0; i < length; i++) {
+                h ^= (guchar)g_ascii_tolower (name[i]);
+                h *= G_GUINT64_CONSTANT (0x100000001b3);
+        }
+
+        return h;
+}
+
+static guint32
+soup_hsts_preload_mix (guint32 h)
+{
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+
+        return h;
+}
+
+gboolean
+soup_hsts_preload_lookup (const char *domain,
+                          gsize       length,
+                          gboolean   *include_subdomains)
+{
+        guint64 hash;
+        guint32 low, high, seed, entry;
+        const char *name;
+
+        hash = soup_hsts_preload_hash (domain, length);
+        low = (guint32)hash;
+        high = (guint32)(hash >> 32);
+
+        seed = soup_hsts_preload_seeds[soup_hsts_preload_mix (low ^ high) % N_BUCKETS];
+        entry = soup_hsts_preload_entries[soup_hsts_preload_mix (low + seed * (high | 1)) % N_ENTRIES];
+        if (entry == EMPTY)
+                return FALSE;
+
+        name = soup_hsts_preload_strings + (entry >> 1);
+
+        if (g_ascii_strncasecmp (name, domain, length) != 0 || name[length] != '\0')
+                return FALSE;
+
+        if (include_subdomains)
+                *include_subdomains = entry & 1;
+        return TRUE;
+}
+
+gboolean
+soup_hsts_preload_must_enforce (const char *host)
+{
+        gsize length = strlen (host);
+        const char *dot;
+        gboolean include_subdomains;
+
+        while (length > 0 && host[length - 1] == '.')
+                length--;
+
+        if (soup_hsts_preload_lookup (host, length, NULL))
+                return TRUE;
+
+        while ((dot = memchr (host, '.', length))) {
+                length -= dot + 1 - host;
+                host = dot + 1;
+                if (soup_hsts_preload_lookup (host, length, &include_subdomains) &&
+                    include_subdomains)
+                        return TRUE;
+        }
+
+        return FALSE;
+}
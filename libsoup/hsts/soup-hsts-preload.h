@@ -0,0 +1,18 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+
+#pragma once
+
+#include <string.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The tables are generated from soup-hsts-preload.in by
+ * generate-hsts-preload.py.
+ */
+gboolean soup_hsts_preload_lookup       (const char *domain,
+                                         gsize       length,
+                                         gboolean   *include_subdomains);
+gboolean soup_hsts_preload_must_enforce (const char *host);
+
+G_END_DECLS
@@ -53,6 +53,11 @@ typedef struct {
         SoupMessageIOHTTP1 *msg_io;
         gboolean is_reusable;
         gboolean ever_used;
+
+        /* Lent to each message in turn, so that keep-alive requests
+         * don't reallocate it.
+         */
+        GString *write_buf;
 } SoupClientMessageIOHTTP1;
 
 #define RESPONSE_BLOCK_SIZE 8192
@@ -61,6 +66,8 @@ typedef struct {
 static void
 soup_message_io_http1_free (SoupMessageIOHTTP1 *msg_io)
 {
+        /* The write buffer belongs to the connection */
+        msg_io->base.write_buf = NULL;
         soup_message_io_data_cleanup (&msg_io->base);
         soup_message_queue_item_unref (msg_io->item);
         g_free (msg_io);
@@ -73,6 +80,7 @@ soup_client_message_io_http1_destroy (SoupClientMessageIO *iface)
 
         g_clear_object (&io->iostream);
         g_clear_pointer (&io->msg_io, soup_message_io_http1_free);
+        g_string_free (io->write_buf, TRUE);
 
         g_slice_free (SoupClientMessageIOHTTP1, io);
 }
@@ -241,9 +249,10 @@ write_headers (SoupMessage  *msg,
                SoupEncoding *encoding)
 {
         GUri *uri = soup_message_get_uri (msg);
-        char *uri_string;
-        SoupMessageHeadersIter iter;
-        const char *name, *value;
+        char *uri_string = NULL;
+
+        g_string_append (header, soup_message_get_method (msg));
+        g_string_append_c (header, ' ');
 
         if (soup_message_get_method (msg) == SOUP_METHOD_CONNECT) {
                 char *uri_host = soup_uri_get_host_for_headers (uri);
@@ -257,32 +266,38 @@ write_headers (SoupMessage  *msg,
                 /* Proxy expects full URI to destination. Otherwise
                  * just the path.
                  */
-                if (proxy)
+                if (proxy) {
                         uri_string = g_uri_to_string (uri);
-                else if (soup_message_get_is_options_ping (msg))
-                        uri_string = g_strdup ("*");
-                else
-                        uri_string = soup_uri_get_path_and_query (uri);
+                        if (g_uri_get_fragment (uri)) {
+                                /* Strip fragment */
+                                char *fragment = strchr (uri_string, '#');
+                                if (fragment)
+                                        *fragment = '\0';
+                        }
+                } else if (soup_message_get_is_options_ping (msg)) {
+                        g_string_append_c (header, '*');
+                } else {
+                        const char *query = g_uri_get_query (uri);
 
-                if (proxy && g_uri_get_fragment (uri)) {
-                        /* Strip fragment */
-                        char *fragment = strchr (uri_string, '#');
-                        if (fragment)
-                                *fragment = '\0';
+                        g_string_append (header, g_uri_get_path (uri));
+                        if (query) {
+                                g_string_append_c (header, '?');
+                                g_string_append (header, query);
+                        }
                 }
         }
 
-        g_string_append_printf (header, "%s %s HTTP/1.%d\r\n",
-                                soup_message_get_method (msg), uri_string,
-                                (soup_message_get_http_version (msg) == SOUP_HTTP_1_0) ? 0 : 1);
-        g_free (uri_string);
+        if (uri_string) {
+                g_string_append (header, uri_string);
+                g_free (uri_string);
+        }
+
+        g_string_append (header, soup_message_get_http_version (msg) == SOUP_HTTP_1_0 ?
+                         " HTTP/1.0\r\n" : " HTTP/1.1\r\n");
 
         *encoding = soup_message_headers_get_encoding (soup_message_get_request_headers (msg));
 
-        soup_message_headers_iter_init (&iter, soup_message_get_request_headers (msg));
-        while (soup_message_headers_iter_next (&iter, &name, &value))
-                g_string_append_printf (header, "%s: %s\r\n", name, value);
-        g_string_append (header, "\r\n");
+        soup_message_headers_serialize (soup_message_get_request_headers (msg), header);
 }
 
 /* Attempts to push forward the writing side of @msg's I/O. Returns
@@ -326,6 +341,8 @@ io_write (SoupClientMessageIOHTTP1 *client_io,
                                                           cancellable, error);
                         if (nwrote == -1)
                                 return FALSE;
+                        if (io->written == 0)
+                                soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_REQUEST_FIRST_BYTE_SENT);
                         io->written += nwrote;
                         if (client_io->msg_io->metrics)
                                 client_io->msg_io->metrics->request_header_bytes_sent += nwrote;
@@ -1029,7 +1046,8 @@ soup_client_message_io_http1_send_item (SoupClientMessageIO       *iface,
         msg_io->base.completion_data = user_data;
 
         msg_io->base.read_header_buf = g_byte_array_new ();
-        msg_io->base.write_buf = g_string_new (NULL);
+        g_string_truncate (io->write_buf, 0);
+        msg_io->base.write_buf = io->write_buf;
 
         msg_io->base.read_state = SOUP_MESSAGE_IO_STATE_NOT_STARTED;
         msg_io->base.write_state = SOUP_MESSAGE_IO_STATE_HEADERS;
@@ -1170,6 +1188,7 @@ soup_client_message_io_http1_new (SoupConnection *conn)
         io->istream = g_io_stream_get_input_stream (io->iostream);
         io->ostream = g_io_stream_get_output_stream (io->iostream);
         io->is_reusable = TRUE;
+        io->write_buf = g_string_sized_new (1024);
 
         io->iface.funcs = &io_funcs;
 
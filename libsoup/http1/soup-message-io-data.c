@@ -35,7 +35,8 @@ soup_message_io_data_cleanup (SoupMessageIOData *io)
 
 	g_byte_array_free (io->read_header_buf, TRUE);
 
-	g_string_free (io->write_buf, TRUE);
+	if (io->write_buf)
+		g_string_free (io->write_buf, TRUE);
 
 	if (io->async_wait) {
 		g_cancellable_cancel (io->async_wait);
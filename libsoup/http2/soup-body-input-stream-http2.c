@@ -59,6 +59,7 @@ G_DEFINE_TYPE_WITH_CODE (SoupBodyInputStreamHttp2, soup_body_input_stream_http2,
 
 enum {
         NEED_MORE_DATA,
+        DATA_CONSUMED,
         LAST_SIGNAL
 };
 
@@ -174,6 +175,8 @@ soup_body_input_stream_http2_read_real (GInputStream  *stream,
         }
 
         priv->pos += count;
+        if (count > 0)
+                g_signal_emit (memory_stream, signals[DATA_CONSUMED], 0, (guint64)count);
 
         /* We need to block until the read is completed.
          * So emit a signal saying we need more data. */
@@ -253,6 +256,8 @@ soup_body_input_stream_http2_skip (GInputStream  *stream,
 
         count = MIN (count, priv->len - priv->pos);
         priv->pos += count;
+        if (count > 0)
+                g_signal_emit (memory_stream, signals[DATA_CONSUMED], 0, (guint64)count);
 
         /* Remove all skipped chunks */
         gsize offset = priv->start_offset;
@@ -430,4 +435,17 @@ soup_body_input_stream_http2_class_init (SoupBodyInputStreamHttp2Class *klass)
                               NULL,
                               G_TYPE_ERROR,
                               1, G_TYPE_CANCELLABLE);
+
+        /* Emitted when data has been read or skipped, so that the
+         * flow control window can be given back to the peer.
+         */
+        signals[DATA_CONSUMED] =
+                g_signal_new ("data-consumed",
+                              G_OBJECT_CLASS_TYPE (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              0,
+                              NULL, NULL,
+                              NULL,
+                              G_TYPE_NONE,
+                              1, G_TYPE_UINT64);
 }
@@ -25,6 +25,7 @@
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "libsoup-http2"
 
+#include <string.h>
 #include <glib.h>
 #include <glib/gi18n-lib.h>
 
@@ -47,6 +48,19 @@
 
 #define FRAME_HEADER_SIZE 9
 
+/* The receive windows start small and follow the bandwidth-delay
+ * product of the connection, estimated from the data received during
+ * the round trip of a PING, as gRPC does. Window credit is only given
+ * back as the body streams are read, so the stream window caps the
+ * data buffered for a slow reader and the connection window the data
+ * buffered per connection. Their bounds are in the header, for the
+ * tests.
+ */
+#define CONNECTION_WINDOW_FACTOR 4
+/* Samples well below the window before shrinking it */
+#define BDP_LOW_SAMPLES_TO_SHRINK 3
+#define BDP_PING_PAYLOAD "soup-bdp"
+
 typedef enum {
         STATE_NONE,
         STATE_WRITE_HEADERS,
@@ -86,6 +100,16 @@ typedef struct {
         GTask *close_task;
         gboolean session_terminated;
         gboolean goaway_sent;
+
+        /* Flow control auto-tuning */
+        int32_t stream_window_size;
+        int32_t connection_window_size;
+        gboolean bdp_ping_in_flight;
+        gint64 bdp_ping_sent_time;
+        gsize bdp_bytes;
+        double bdp_max_bandwidth;
+        guint bdp_low_samples;
+        guint window_updates_sent;
 } SoupClientMessageIOHTTP2;
 
 typedef struct {
@@ -116,6 +140,9 @@ typedef struct {
         gboolean paused;
         guint32 stream_id;
         gboolean can_be_restarted;
+
+        /* Received but not yet read from body_istream */
+        gsize unconsumed_bytes;
 } SoupHTTP2MessageData;
 
 static void soup_client_message_io_http2_finished (SoupClientMessageIO *iface, SoupMessage *msg);
@@ -429,6 +456,11 @@ io_read (SoupClientMessageIOHTTP2  *io,
 
         ret = nghttp2_session_mem_recv (io->session, buffer, read);
         NGCHECK (ret);
+
+        /* Send the WINDOW_UPDATE and PING frames the data triggered */
+        if (nghttp2_session_want_write (io->session))
+                io_try_write (io);
+
         return ret != 0;
 }
 
@@ -516,6 +548,70 @@ soup_client_message_io_http2_terminate_session (SoupClientMessageIOHTTP2 *io)
         io_try_write (io);
 }
 
+static void
+set_window_sizes (SoupClientMessageIOHTTP2 *io,
+                  int32_t                   stream_window_size)
+{
+        nghttp2_settings_entry setting = { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, stream_window_size };
+
+        io->stream_window_size = stream_window_size;
+        io->connection_window_size = CLAMP ((gint64)stream_window_size * CONNECTION_WINDOW_FACTOR,
+                                            MIN_CONNECTION_WINDOW_SIZE, MAX_CONNECTION_WINDOW_SIZE);
+
+        h2_debug (io, NULL, "[FLOW] stream window=%d, connection window=%d",
+                  io->stream_window_size, io->connection_window_size);
+
+        NGCHECK (nghttp2_session_set_local_window_size (io->session, NGHTTP2_FLAG_NONE, 0, io->connection_window_size));
+        NGCHECK (nghttp2_submit_settings (io->session, NGHTTP2_FLAG_NONE, &setting, 1));
+}
+
+static void
+bdp_probe_data_received (SoupClientMessageIOHTTP2 *io,
+                         gsize                     len)
+{
+        io->bdp_bytes += len;
+
+        if (io->bdp_ping_in_flight || io->session_terminated)
+                return;
+
+        /* Counting starts when the PING is actually sent */
+        io->bdp_ping_in_flight = TRUE;
+        NGCHECK (nghttp2_submit_ping (io->session, NGHTTP2_FLAG_NONE, (const uint8_t *)BDP_PING_PAYLOAD));
+}
+
+static void
+bdp_probe_complete (SoupClientMessageIOHTTP2 *io)
+{
+        gint64 rtt = MAX (g_get_monotonic_time () - io->bdp_ping_sent_time, 1);
+        gsize bdp = io->bdp_bytes;
+        double bandwidth = (double)bdp / rtt;
+        int32_t window_size = io->stream_window_size;
+
+        io->bdp_ping_in_flight = FALSE;
+
+        h2_debug (io, NULL, "[FLOW] BDP sample: %zu bytes in %" G_GINT64_FORMAT " us", bdp, rtt);
+
+        if (bdp >= (gsize)window_size * 2 / 3 && bandwidth > io->bdp_max_bandwidth) {
+                /* The window may be what limits the transfer */
+                io->bdp_max_bandwidth = bandwidth;
+                io->bdp_low_samples = 0;
+                window_size = MIN (bdp * 2, MAX_STREAM_WINDOW_SIZE);
+        } else if (bdp * 4 < (gsize)window_size && window_size > MIN_STREAM_WINDOW_SIZE) {
+                /* Give the buffering back once the link or the
+                 * load no longer needs it.
+                 */
+                if (++io->bdp_low_samples >= BDP_LOW_SAMPLES_TO_SHRINK) {
+                        io->bdp_max_bandwidth = bandwidth;
+                        io->bdp_low_samples = 0;
+                        window_size = MAX (window_size / 2, MIN_STREAM_WINDOW_SIZE);
+                }
+        } else
+                io->bdp_low_samples = 0;
+
+        if (window_size != io->stream_window_size)
+                set_window_sizes (io, window_size);
+}
+
 /* HTTP2 read callbacks */
 
 static int
@@ -563,6 +659,24 @@ memory_stream_need_more_data_callback (SoupBodyInputStreamHttp2 *stream,
         return error;
 }
 
+static void
+memory_stream_data_consumed_callback (SoupBodyInputStreamHttp2 *stream,
+                                      guint64                   count,
+                                      gpointer                  user_data)
+{
+        SoupHTTP2MessageData *data = (SoupHTTP2MessageData*)user_data;
+        SoupClientMessageIOHTTP2 *io = data->io;
+
+        count = MIN (count, data->unconsumed_bytes);
+        if (!count)
+                return;
+
+        data->unconsumed_bytes -= count;
+        NGCHECK (nghttp2_session_consume (io->session, data->stream_id, count));
+        if (nghttp2_session_want_write (io->session))
+                io_try_write (io);
+}
+
 static int
 on_begin_frame_callback (nghttp2_session        *session,
                          const nghttp2_frame_hd *hd,
@@ -588,6 +702,8 @@ on_begin_frame_callback (nghttp2_session        *session,
                         data->body_istream = soup_body_input_stream_http2_new ();
                         g_signal_connect (data->body_istream, "need-more-data",
                                           G_CALLBACK (memory_stream_need_more_data_callback), data);
+                        g_signal_connect (data->body_istream, "data-consumed",
+                                          G_CALLBACK (memory_stream_data_consumed_callback), data);
 
                         g_assert (!data->decoded_data_istream);
                         data->decoded_data_istream = soup_session_setup_message_body_input_stream (data->item->session,
@@ -649,6 +765,11 @@ on_frame_recv_callback (nghttp2_session     *session,
                         h2_debug (io, NULL, "[RECV] WINDOW_UPDATE: increment=%d, total=%d", frame->window_update.window_size_increment,
                                   nghttp2_session_get_remote_window_size (session));
                         break;
+                case NGHTTP2_PING:
+                        if (frame->hd.flags & NGHTTP2_FLAG_ACK &&
+                            memcmp (frame->ping.opaque_data, BDP_PING_PAYLOAD, sizeof (frame->ping.opaque_data)) == 0)
+                                bdp_probe_complete (io);
+                        break;
                 }
 
                 return 0;
@@ -730,7 +851,10 @@ on_data_chunk_recv_callback (nghttp2_session *session,
 
         h2_debug (io, msgdata, "[DATA] Recieved chunk, len=%zu, flags=%u, paused=%d", len, flags, msgdata->paused);
 
+        bdp_probe_data_received (io, len);
+
         g_assert (msgdata->body_istream != NULL);
+        msgdata->unconsumed_bytes += len;
         soup_body_input_stream_http2_add_data (SOUP_BODY_INPUT_STREAM_HTTP2 (msgdata->body_istream), data, len);
         if (msgdata->state == STATE_READ_DATA_START)
                 io_try_sniff_content (msgdata, FALSE, msgdata->item->cancellable);
@@ -781,6 +905,7 @@ on_frame_send_callback (nghttp2_session     *session,
                 h2_debug (io, data, "[SEND] [HEADERS] finished=%d",
                           (frame->hd.flags & NGHTTP2_FLAG_END_HEADERS) ? 1 : 0);
 
+                soup_message_set_metrics_timestamp (data->msg, SOUP_MESSAGE_METRICS_REQUEST_FIRST_BYTE_SENT);
                 if (data->metrics)
                         data->metrics->request_header_bytes_sent += frame->hd.length + FRAME_HEADER_SIZE;
 
@@ -822,6 +947,19 @@ on_frame_send_callback (nghttp2_session     *session,
                         g_clear_object (&io->close_task);
                 }
                 break;
+        case NGHTTP2_PING:
+                h2_debug (io, data, "[SEND] [%s]", frame_type_to_string (frame->hd.type));
+                if (!(frame->hd.flags & NGHTTP2_FLAG_ACK) &&
+                    memcmp (frame->ping.opaque_data, BDP_PING_PAYLOAD, sizeof (frame->ping.opaque_data)) == 0) {
+                        io->bdp_ping_sent_time = g_get_monotonic_time ();
+                        io->bdp_bytes = 0;
+                }
+                break;
+        case NGHTTP2_WINDOW_UPDATE:
+                h2_debug (io, data, "[SEND] [WINDOW_UPDATE] stream_id=%u, increment=%d",
+                          frame->hd.stream_id, frame->window_update.window_size_increment);
+                io->window_updates_sent++;
+                break;
         default:
                 h2_debug (io, data, "[SEND] [%s]", frame_type_to_string (frame->hd.type));
                 break;
@@ -1078,6 +1216,14 @@ soup_http2_message_data_close (SoupHTTP2MessageData *data)
          * to be removed from the messages hash table. Everything is reset but
          * stream_id and io.
          */
+        if (data->unconsumed_bytes && data->io->session) {
+                /* Nobody is going to read the rest of the body, but the
+                 * connection window must not shrink because of it.
+                 */
+                NGCHECK (nghttp2_session_consume (data->io->session, data->stream_id, data->unconsumed_bytes));
+                data->unconsumed_bytes = 0;
+        }
+
         if (data->body_istream) {
                 g_signal_handlers_disconnect_by_data (data->body_istream, data);
                 g_clear_object (&data->body_istream);
@@ -1661,8 +1807,14 @@ soup_client_message_io_http2_init (SoupClientMessageIOHTTP2 *io)
         nghttp2_session_callbacks_set_on_frame_send_callback (callbacks, on_frame_send_callback);
         nghttp2_session_callbacks_set_on_stream_close_callback (callbacks, on_stream_close_callback);
 
-        NGCHECK (nghttp2_session_client_new (&io->session, callbacks, io));
+        nghttp2_option *option;
+        NGCHECK (nghttp2_option_new (&option));
+        /* Window credit is given back as the body streams are read */
+        nghttp2_option_set_no_auto_window_update (option, 1);
+
+        NGCHECK (nghttp2_session_client_new2 (&io->session, callbacks, io, option));
         nghttp2_session_callbacks_del (callbacks);
+        nghttp2_option_del (option);
 
         io->messages = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)soup_http2_message_data_free);
         io->closed_messages = g_hash_table_new_full (g_direct_hash, g_direct_equal, (GDestroyNotify)soup_http2_message_data_free, NULL);
@@ -1670,7 +1822,6 @@ soup_client_message_io_http2_init (SoupClientMessageIOHTTP2 *io)
         io->iface.funcs = &io_funcs;
 }
 
-#define INITIAL_WINDOW_SIZE (32 * 1024 * 1024) /* 32MB matches other implementations */
 #define MAX_HEADER_TABLE_SIZE 65536 /* Match size used by Chromium/Firefox */
 
 SoupClientMessageIO *
@@ -1692,10 +1843,12 @@ soup_client_message_io_http2_new (SoupConnection *conn)
         g_source_set_callback (io->read_source, (GSourceFunc)io_read_ready, io, NULL);
         g_source_attach (io->read_source, g_main_context_get_thread_default ());
 
-        NGCHECK (nghttp2_session_set_local_window_size (io->session, NGHTTP2_FLAG_NONE, 0, INITIAL_WINDOW_SIZE));
+        io->stream_window_size = MIN_STREAM_WINDOW_SIZE;
+        io->connection_window_size = MIN_CONNECTION_WINDOW_SIZE;
+        NGCHECK (nghttp2_session_set_local_window_size (io->session, NGHTTP2_FLAG_NONE, 0, io->connection_window_size));
 
         const nghttp2_settings_entry settings[] = {
-                { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, INITIAL_WINDOW_SIZE },
+                { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, io->stream_window_size },
                 { NGHTTP2_SETTINGS_HEADER_TABLE_SIZE, MAX_HEADER_TABLE_SIZE },
                 { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
         };
@@ -1704,3 +1857,27 @@ soup_client_message_io_http2_new (SoupConnection *conn)
 
         return (SoupClientMessageIO *)io;
 }
+
+gint32
+soup_client_message_io_http2_get_stream_window_size (SoupClientMessageIO *iface)
+{
+        SoupClientMessageIOHTTP2 *io = (SoupClientMessageIOHTTP2 *)iface;
+
+        return io->stream_window_size;
+}
+
+gint32
+soup_client_message_io_http2_get_connection_window_size (SoupClientMessageIO *iface)
+{
+        SoupClientMessageIOHTTP2 *io = (SoupClientMessageIOHTTP2 *)iface;
+
+        return io->connection_window_size;
+}
+
+guint
+soup_client_message_io_http2_get_window_updates_sent (SoupClientMessageIO *iface)
+{
+        SoupClientMessageIOHTTP2 *io = (SoupClientMessageIOHTTP2 *)iface;
+
+        return io->window_updates_sent;
+}
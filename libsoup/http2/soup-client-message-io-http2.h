@@ -9,6 +9,17 @@
 
 G_BEGIN_DECLS
 
+/* Bounds of the receive windows */
+#define MIN_STREAM_WINDOW_SIZE (256 * 1024)
+#define MAX_STREAM_WINDOW_SIZE (16 * 1024 * 1024)
+#define MIN_CONNECTION_WINDOW_SIZE (1024 * 1024)
+#define MAX_CONNECTION_WINDOW_SIZE (32 * 1024 * 1024) /* 32MB matches other implementations */
+
 SoupClientMessageIO *soup_client_message_io_http2_new (SoupConnection *conn);
 
+/* These are only used for tests */
+gint32               soup_client_message_io_http2_get_stream_window_size     (SoupClientMessageIO *iface);
+gint32               soup_client_message_io_http2_get_connection_window_size (SoupClientMessageIO *iface);
+guint                soup_client_message_io_http2_get_window_updates_sent    (SoupClientMessageIO *iface);
+
 G_END_DECLS
@@ -13,24 +13,512 @@
 
 #include "soup-path-map.h"
 
-/* This could be replaced with something more clever, like a Patricia
- * trie, but it's probably not worth it since the total number of
- * mappings is likely to always be small. So we keep an array of
- * paths, sorted by decreasing length. (The first prefix match will
- * therefore be the longest.)
+/* The map is a compressed radix tree (a Patricia trie) keyed on the
+ * bytes of the path, so that a lookup is proportional to the length of
+ * the path rather than to the number of mappings. Every node on the way
+ * down that holds data is a prefix of the path; the deepest one is the
+ * longest match.
+ *
+ * Routes can additionally contain "{name}" parameters, which match one
+ * or more characters up to the next "/". Those live in separate
+ * parameter children of a node, which are only tried after the static
+ * child, so that "/users/me" takes precedence over "/users/{id}".
+ * Routes can also be registered for a single method, in which case they
+ * take precedence over data registered for any method at the same node.
  */
 
 typedef struct {
-	char     *path;
-	int       len;
-	gpointer  data;
-} SoupPathMapping;
+	const char *method;
+	gpointer    data;
+} SoupPathMapMethodData;
+
+typedef struct _SoupPathMapNode SoupPathMapNode;
+
+struct _SoupPathMapNode {
+	SoupPathMapNode *parent;
+
+	/* Static nodes match @label; parameter nodes have a NULL
+	 * @label and match a path segment named @param.
+	 */
+	char            *label;
+	guint            label_len;
+	const char      *param;
+
+	GPtrArray       *children;       /* sorted by the first byte of the label */
+	GPtrArray       *param_children;
+
+	gboolean         has_data;
+	gpointer         data;
+	GArray          *method_data;    /* SoupPathMapMethodData */
+};
 
 struct SoupPathMap {
-	GArray *mappings;
+	SoupPathMapNode *root;
 	GDestroyNotify free_func;
 };
 
+static SoupPathMapNode *
+node_new (SoupPathMapNode *parent,
+	  const char      *label,
+	  guint            label_len)
+{
+	SoupPathMapNode *node;
+
+	node = g_slice_new0 (SoupPathMapNode);
+	node->parent = parent;
+	node->label = g_strndup (label, label_len);
+	node->label_len = label_len;
+
+	return node;
+}
+
+static SoupPathMapNode *
+param_node_new (SoupPathMapNode *parent,
+		const char      *name,
+		guint            name_len)
+{
+	SoupPathMapNode *node;
+	char *param;
+
+	node = g_slice_new0 (SoupPathMapNode);
+	node->parent = parent;
+
+	/* Parameter names are interned so that the names returned by
+	 * soup_path_map_lookup_route() outlive the map.
+	 */
+	param = g_strndup (name, name_len);
+	node->param = g_intern_string (param);
+	g_free (param);
+
+	return node;
+}
+
+static void
+node_free (SoupPathMap     *map,
+	   SoupPathMapNode *node)
+{
+	guint i;
+
+	if (node->children) {
+		for (i = 0; i < node->children->len; i++)
+			node_free (map, node->children->pdata[i]);
+		g_ptr_array_free (node->children, TRUE);
+	}
+	if (node->param_children) {
+		for (i = 0; i < node->param_children->len; i++)
+			node_free (map, node->param_children->pdata[i]);
+		g_ptr_array_free (node->param_children, TRUE);
+	}
+
+	if (map->free_func) {
+		if (node->has_data)
+			map->free_func (node->data);
+		if (node->method_data) {
+			for (i = 0; i < node->method_data->len; i++)
+				map->free_func (g_array_index (node->method_data, SoupPathMapMethodData, i).data);
+		}
+	}
+	if (node->method_data)
+		g_array_free (node->method_data, TRUE);
+
+	g_free (node->label);
+	g_slice_free (SoupPathMapNode, node);
+}
+
+static gboolean
+node_is_empty (SoupPathMapNode *node)
+{
+	return !node->has_data &&
+		(!node->method_data || !node->method_data->len) &&
+		(!node->children || !node->children->len) &&
+		(!node->param_children || !node->param_children->len);
+}
+
+/* Returns the static child of @node whose label starts with @c, or
+ * %NULL, in which case *@index is set to where it would be inserted.
+ */
+static SoupPathMapNode *
+node_find_child (SoupPathMapNode *node,
+		 char             c,
+		 guint           *index)
+{
+	guint i;
+
+	if (!node->children) {
+		if (index)
+			*index = 0;
+		return NULL;
+	}
+
+	for (i = 0; i < node->children->len; i++) {
+		SoupPathMapNode *child = node->children->pdata[i];
+
+		if (child->label[0] == c) {
+			if (index)
+				*index = i;
+			return child;
+		}
+		if ((guchar)child->label[0] > (guchar)c)
+			break;
+	}
+
+	if (index)
+		*index = i;
+	return NULL;
+}
+
+static void
+node_take_contents (SoupPathMapNode *node,
+		    SoupPathMapNode *from)
+{
+	guint i;
+
+	node->children = from->children;
+	node->param_children = from->param_children;
+	node->has_data = from->has_data;
+	node->data = from->data;
+	node->method_data = from->method_data;
+
+	from->children = from->param_children = NULL;
+	from->has_data = FALSE;
+	from->data = NULL;
+	from->method_data = NULL;
+
+	if (node->children) {
+		for (i = 0; i < node->children->len; i++)
+			((SoupPathMapNode *)node->children->pdata[i])->parent = node;
+	}
+	if (node->param_children) {
+		for (i = 0; i < node->param_children->len; i++)
+			((SoupPathMapNode *)node->param_children->pdata[i])->parent = node;
+	}
+}
+
+/* Splits the label of @node at @at, moving everything @node holds to
+ * a new child labelled with the tail.
+ */
+static void
+node_split (SoupPathMapNode *node,
+	    guint            at)
+{
+	SoupPathMapNode *tail;
+
+	tail = node_new (node, node->label + at, node->label_len - at);
+	node_take_contents (tail, node);
+
+	node->label[at] = '\0';
+	node->label_len = at;
+	node->children = g_ptr_array_new ();
+	g_ptr_array_add (node->children, tail);
+}
+
+static SoupPathMapNode *
+node_walk_static (SoupPathMapNode *node,
+		  const char      *str,
+		  guint            len,
+		  gboolean         create)
+{
+	while (len > 0) {
+		SoupPathMapNode *child;
+		guint index, common;
+
+		child = node_find_child (node, str[0], &index);
+		if (!child) {
+			if (!create)
+				return NULL;
+
+			child = node_new (node, str, len);
+			if (!node->children)
+				node->children = g_ptr_array_new ();
+			g_ptr_array_insert (node->children, index, child);
+			return child;
+		}
+
+		common = 1;
+		while (common < child->label_len && common < len &&
+		       child->label[common] == str[common])
+			common++;
+
+		if (common < child->label_len) {
+			if (!create)
+				return NULL;
+			node_split (child, common);
+		}
+
+		node = child;
+		str += common;
+		len -= common;
+	}
+
+	return node;
+}
+
+static SoupPathMapNode *
+node_walk_param (SoupPathMapNode *node,
+		 const char      *name,
+		 guint            name_len,
+		 gboolean         create)
+{
+	SoupPathMapNode *child;
+	guint i;
+
+	if (node->param_children) {
+		for (i = 0; i < node->param_children->len; i++) {
+			child = node->param_children->pdata[i];
+			if (strlen (child->param) == name_len &&
+			    !strncmp (child->param, name, name_len))
+				return child;
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	child = param_node_new (node, name, name_len);
+	if (!node->param_children)
+		node->param_children = g_ptr_array_new ();
+	g_ptr_array_add (node->param_children, child);
+
+	return child;
+}
+
+/* Finds the next "{name}" in @pattern. Names cannot be empty or
+ * contain "/"; anything else with braces is taken literally.
+ */
+static const char *
+find_param (const char  *pattern,
+	    const char **end)
+{
+	const char *open, *close;
+
+	for (open = strchr (pattern, '{'); open; open = strchr (open + 1, '{')) {
+		close = open + 1 + strcspn (open + 1, "{}/");
+		if (*close == '}' && close > open + 1) {
+			*end = close;
+			return open;
+		}
+	}
+
+	return NULL;
+}
+
+static SoupPathMapNode *
+get_node (SoupPathMap *map,
+	  const char  *path,
+	  gboolean     parse_params,
+	  gboolean     create)
+{
+	SoupPathMapNode *node = map->root;
+	const char *open, *close;
+
+	while (node && parse_params && (open = find_param (path, &close))) {
+		node = node_walk_static (node, path, open - path, create);
+		if (node)
+			node = node_walk_param (node, open + 1, close - open - 1, create);
+		path = close + 1;
+	}
+
+	if (node)
+		node = node_walk_static (node, path, strlen (path), create);
+
+	return node;
+}
+
+static gboolean
+node_get_data (SoupPathMapNode *node,
+	       const char      *method,
+	       gpointer        *data)
+{
+	guint i;
+
+	if (method && node->method_data) {
+		for (i = 0; i < node->method_data->len; i++) {
+			SoupPathMapMethodData *md = &g_array_index (node->method_data, SoupPathMapMethodData, i);
+
+			if (!strcmp (md->method, method)) {
+				*data = md->data;
+				return TRUE;
+			}
+		}
+	}
+
+	if (node->has_data) {
+		*data = node->data;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+node_set_data (SoupPathMap     *map,
+	       SoupPathMapNode *node,
+	       const char      *method,
+	       gpointer         data)
+{
+	SoupPathMapMethodData md;
+	guint i;
+
+	if (!method) {
+		if (node->has_data && map->free_func)
+			map->free_func (node->data);
+		node->has_data = TRUE;
+		node->data = data;
+		return;
+	}
+
+	if (!node->method_data)
+		node->method_data = g_array_new (FALSE, FALSE, sizeof (SoupPathMapMethodData));
+
+	for (i = 0; i < node->method_data->len; i++) {
+		SoupPathMapMethodData *existing = &g_array_index (node->method_data, SoupPathMapMethodData, i);
+
+		if (!strcmp (existing->method, method)) {
+			if (map->free_func)
+				map->free_func (existing->data);
+			existing->data = data;
+			return;
+		}
+	}
+
+	md.method = g_intern_string (method);
+	md.data = data;
+	g_array_append_val (node->method_data, md);
+}
+
+static gboolean
+node_remove_data (SoupPathMap     *map,
+		  SoupPathMapNode *node,
+		  const char      *method)
+{
+	guint i;
+
+	if (!method) {
+		if (!node->has_data)
+			return FALSE;
+		if (map->free_func)
+			map->free_func (node->data);
+		node->has_data = FALSE;
+		node->data = NULL;
+		return TRUE;
+	}
+
+	if (!node->method_data)
+		return FALSE;
+
+	for (i = 0; i < node->method_data->len; i++) {
+		SoupPathMapMethodData *md = &g_array_index (node->method_data, SoupPathMapMethodData, i);
+
+		if (!strcmp (md->method, method)) {
+			if (map->free_func)
+				map->free_func (md->data);
+			g_array_remove_index (node->method_data, i);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Removes the empty nodes left behind by a removal, and merges a
+ * static node that no longer holds anything into its only child so
+ * that the tree stays compressed.
+ */
+static void
+node_prune (SoupPathMap     *map,
+	    SoupPathMapNode *node)
+{
+	SoupPathMapNode *parent, *child;
+
+	while (node != map->root && node_is_empty (node)) {
+		parent = node->parent;
+		if (node->param)
+			g_ptr_array_remove (parent->param_children, node);
+		else
+			g_ptr_array_remove (parent->children, node);
+		node_free (map, node);
+		node = parent;
+	}
+
+	if (node == map->root || node->param || node->has_data ||
+	    (node->method_data && node->method_data->len) ||
+	    (node->param_children && node->param_children->len) ||
+	    !node->children || node->children->len != 1)
+		return;
+
+	child = node->children->pdata[0];
+	if (child->param)
+		return;
+
+	g_ptr_array_free (node->children, TRUE);
+	if (node->param_children)
+		g_ptr_array_free (node->param_children, TRUE);
+	if (node->method_data)
+		g_array_free (node->method_data, TRUE);
+
+	node->label = g_realloc (node->label, node->label_len + child->label_len + 1);
+	memcpy (node->label + node->label_len, child->label, child->label_len + 1);
+	node->label_len += child->label_len;
+	node_take_contents (node, child);
+	node_free (map, child);
+}
+
+typedef struct {
+	const char        *path;
+	guint              path_len;
+	const char        *method;
+
+	SoupPathMapParams  params;
+
+	gpointer           best;
+	int                best_len;
+	SoupPathMapParams *best_params;
+} SoupPathMapLookup;
+
+static void
+node_lookup (SoupPathMapNode   *node,
+	     SoupPathMapLookup *lookup,
+	     guint              pos)
+{
+	SoupPathMapNode *child;
+	gpointer data;
+	guint i, end;
+
+	if ((int)pos > lookup->best_len && node_get_data (node, lookup->method, &data)) {
+		lookup->best = data;
+		lookup->best_len = pos;
+		if (lookup->best_params)
+			*lookup->best_params = lookup->params;
+	}
+
+	if (pos == lookup->path_len)
+		return;
+
+	child = node_find_child (node, lookup->path[pos], NULL);
+	if (child && child->label_len <= lookup->path_len - pos &&
+	    !memcmp (child->label, lookup->path + pos, child->label_len))
+		node_lookup (child, lookup, pos + child->label_len);
+
+	if (!node->param_children || !node->param_children->len ||
+	    lookup->params.n_params == SOUP_PATH_MAP_MAX_PARAMS)
+		return;
+
+	for (end = pos; end < lookup->path_len && lookup->path[end] != '/'; end++)
+		;
+	if (end == pos)
+		return;
+
+	lookup->params.params[lookup->params.n_params].offset = pos;
+	lookup->params.params[lookup->params.n_params].length = end - pos;
+	lookup->params.n_params++;
+	for (i = 0; i < node->param_children->len; i++) {
+		child = node->param_children->pdata[i];
+		lookup->params.params[lookup->params.n_params - 1].name = child->param;
+		node_lookup (child, lookup, end);
+	}
+	lookup->params.n_params--;
+}
+
 /**
  * soup_path_map_new:
  * @data_free_func: function to use to free data added with
@@ -46,7 +534,7 @@ soup_path_map_new (GDestroyNotify data_free_func)
 	SoupPathMap *map;
 
 	map = g_slice_new0 (SoupPathMap);
-	map->mappings = g_array_new (FALSE, FALSE, sizeof (SoupPathMapping));
+	map->root = node_new (NULL, "", 0);
 	map->free_func = data_free_func;
 
 	return map;
@@ -61,59 +549,10 @@ soup_path_map_new (GDestroyNotify data_free_func)
 void
 soup_path_map_free (SoupPathMap *map)
 {
-	SoupPathMapping *mappings = (SoupPathMapping *)map->mappings->data;
-	guint i;
-
-	for (i = 0; i < map->mappings->len; i++) {
-		g_free (mappings[i].path);
-		if (map->free_func)
-			map->free_func (mappings[i].data);
-	}
-	g_array_free (map->mappings, TRUE);
-	
+	node_free (map, map->root);
 	g_slice_free (SoupPathMap, map);
 }
 
-/* Scan @map looking for @path or one of its ancestors.
- * Sets *@match to the index of a match, or -1 if no match is found.
- * Sets *@insert to the index to insert @path at if a new mapping is
- * desired. Returns %TRUE if *@match is an exact match.
- */
-static gboolean
-mapping_lookup (SoupPathMap *map, const char *path, int *match, int *insert)
-{
-	SoupPathMapping *mappings = (SoupPathMapping *)map->mappings->data;
-	guint i;
-	int path_len;
-	gboolean exact = FALSE;
-
-	*match = -1;
-
-	path_len = strcspn (path, "?");
-	for (i = 0; i < map->mappings->len; i++) {
-		if (mappings[i].len > path_len)
-			continue;
-
-		if (insert && mappings[i].len < path_len) {
-			*insert = i;
-			/* Clear insert so we don't try to set it again */
-			insert = NULL;
-		}
-
-		if (!strncmp (mappings[i].path, path, mappings[i].len)) {
-			*match = i;
-			if (path_len == mappings[i].len)
-				exact = TRUE;
-			if (!insert)
-				return exact;
-		}
-	}
-
-	if (insert)
-		*insert = i;
-	return exact;
-}	
-
 /**
  * soup_path_map_add:
  * @map: a %SoupPathMap
@@ -126,21 +565,28 @@ mapping_lookup (SoupPathMap *map, const char *path, int *match, int *insert)
 void
 soup_path_map_add (SoupPathMap *map, const char *path, gpointer data)
 {
-	SoupPathMapping *mappings = (SoupPathMapping *)map->mappings->data;
-	int match, insert;
-
-	if (mapping_lookup (map, path, &match, &insert)) {
-		if (map->free_func)
-			map->free_func (mappings[match].data);
-		mappings[match].data = data;
-	} else {
-		SoupPathMapping mapping;
+	node_set_data (map, get_node (map, path, FALSE, TRUE), NULL, data);
+}
 
-		mapping.path = g_strdup (path);
-		mapping.len = strlen (path);
-		mapping.data = data;
-		g_array_insert_val (map->mappings, insert, mapping);
-	}
+/**
+ * soup_path_map_add_route:
+ * @map: a %SoupPathMap
+ * @method: (nullable): the method, or %NULL for any method
+ * @pattern: the path, possibly containing "{name}" parameters
+ * @data: the data
+ *
+ * Adds @data to @map at @pattern, for requests using @method. Each
+ * "{name}" segment of @pattern matches one or more characters up to
+ * the next "/". If there was already data at @pattern for @method it
+ * will be freed.
+ **/
+void
+soup_path_map_add_route (SoupPathMap *map,
+			 const char  *method,
+			 const char  *pattern,
+			 gpointer     data)
+{
+	node_set_data (map, get_node (map, pattern, TRUE, TRUE), method, data);
 }
 
 /**
@@ -154,16 +600,32 @@ soup_path_map_add (SoupPathMap *map, const char *path, gpointer data)
 void
 soup_path_map_remove (SoupPathMap *map, const char *path)
 {
-	SoupPathMapping *mappings = (SoupPathMapping *)map->mappings->data;
-	int match;
+	SoupPathMapNode *node;
 
-	if (!mapping_lookup (map, path, &match, NULL))
-		return;
+	node = get_node (map, path, FALSE, FALSE);
+	if (node && node_remove_data (map, node, NULL))
+		node_prune (map, node);
+}
+
+/**
+ * soup_path_map_remove_route:
+ * @map: a %SoupPathMap
+ * @method: (nullable): the method the route was added with
+ * @pattern: the pattern the route was added with
+ *
+ * Removes the data added with soup_path_map_add_route() for @method
+ * at @pattern.
+ **/
+void
+soup_path_map_remove_route (SoupPathMap *map,
+			    const char  *method,
+			    const char  *pattern)
+{
+	SoupPathMapNode *node;
 
-	if (map->free_func)
-		map->free_func (mappings[match].data);
-	g_free (mappings[match].path);
-	g_array_remove_index (map->mappings, match);
+	node = get_node (map, pattern, TRUE, FALSE);
+	if (node && node_remove_data (map, node, method))
+		node_prune (map, node);
 }
 
 /**
@@ -181,12 +643,45 @@ soup_path_map_remove (SoupPathMap *map, const char *path)
 gpointer
 soup_path_map_lookup (SoupPathMap *map, const char *path)
 {
-	SoupPathMapping *mappings = (SoupPathMapping *)map->mappings->data;
-	int match;
+	return soup_path_map_lookup_route (map, NULL, path, NULL);
+}
 
-	mapping_lookup (map, path, &match, NULL);
-	if (match == -1)
-		return NULL;
-	else
-		return mappings[match].data;
+/**
+ * soup_path_map_lookup_route:
+ * @map: a %SoupPathMap
+ * @method: (nullable): the method of the request
+ * @path: the path
+ * @params: (out caller-allocates) (optional): return location for the
+ *   parameters of the matching route
+ *
+ * Like soup_path_map_lookup(), but also considers data added for
+ * @method, which takes precedence over data added for any method at
+ * the same path. When the match is a route with parameters, their
+ * values are returned in @params as offsets into @path, so that no
+ * memory is allocated.
+ *
+ * Returns: (nullable): the data of the longest matching route, or
+ * %NULL if nothing matched.
+ **/
+gpointer
+soup_path_map_lookup_route (SoupPathMap       *map,
+			    const char        *method,
+			    const char        *path,
+			    SoupPathMapParams *params)
+{
+	SoupPathMapLookup lookup;
+
+	lookup.path = path;
+	lookup.path_len = strcspn (path, "?");
+	lookup.method = method;
+	lookup.params.n_params = 0;
+	lookup.best = NULL;
+	lookup.best_len = -1;
+	lookup.best_params = params;
+	if (params)
+		params->n_params = 0;
+
+	node_lookup (map->root, &lookup, 0);
+
+	return lookup.best;
 }
@@ -10,6 +10,19 @@
 
 typedef struct SoupPathMap SoupPathMap;
 
+#define SOUP_PATH_MAP_MAX_PARAMS 8
+
+typedef struct {
+	const char *name;
+	guint       offset;
+	guint       length;
+} SoupPathMapParam;
+
+typedef struct {
+	guint            n_params;
+	SoupPathMapParam params[SOUP_PATH_MAP_MAX_PARAMS];
+} SoupPathMapParams;
+
 SoupPathMap *soup_path_map_new    (GDestroyNotify  data_free_func);
 void         soup_path_map_free   (SoupPathMap    *map);
 
@@ -22,5 +35,17 @@ void         soup_path_map_remove (SoupPathMap    *map,
 gpointer     soup_path_map_lookup (SoupPathMap    *map,
 				   const char     *path);
 
+void         soup_path_map_add_route    (SoupPathMap       *map,
+					 const char        *method,
+					 const char        *pattern,
+					 gpointer           data);
+void         soup_path_map_remove_route (SoupPathMap       *map,
+					 const char        *method,
+					 const char        *pattern);
+gpointer     soup_path_map_lookup_route (SoupPathMap       *map,
+					 const char        *method,
+					 const char        *path,
+					 SoupPathMapParams *params);
+
 
 #endif /* __SOUP_PATH_MAP_H__ */
@@ -0,0 +1,198 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-server-input-stream.c
+ *
+ * Copyright (C) 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-server-input-stream.h"
+
+/* The stream a handler reads a request body from. It reads straight
+ * from the connection, so the client is only read from as fast as the
+ * handler consumes the body, and it lets the server I/O know when the
+ * body has been consumed, or abandoned by closing the stream early.
+ */
+
+struct _SoupServerInputStream {
+	SoupFilterInputStream parent_instance;
+};
+
+typedef struct {
+	gboolean eof;
+} SoupServerInputStreamPrivate;
+
+enum {
+	SIGNAL_EOF,
+	SIGNAL_CLOSED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+static GPollableInputStreamInterface *soup_server_input_stream_parent_pollable_interface;
+static void soup_server_input_stream_pollable_init (GPollableInputStreamInterface *pollable_interface, gpointer interface_data);
+
+G_DEFINE_TYPE_WITH_CODE (SoupServerInputStream, soup_server_input_stream, SOUP_TYPE_FILTER_INPUT_STREAM,
+                         G_ADD_PRIVATE (SoupServerInputStream)
+			 G_IMPLEMENT_INTERFACE (G_TYPE_POLLABLE_INPUT_STREAM,
+						soup_server_input_stream_pollable_init))
+
+static void
+soup_server_input_stream_init (SoupServerInputStream *stream)
+{
+}
+
+static void
+got_eof (SoupServerInputStream *sistream)
+{
+        SoupServerInputStreamPrivate *priv = soup_server_input_stream_get_instance_private (sistream);
+
+        if (priv->eof)
+                return;
+
+        priv->eof = TRUE;
+        g_signal_emit (sistream, signals[SIGNAL_EOF], 0);
+}
+
+static gssize
+soup_server_input_stream_read_fn (GInputStream  *stream,
+				  void          *buffer,
+				  gsize          count,
+				  GCancellable  *cancellable,
+				  GError       **error)
+{
+	gssize nread;
+
+	nread = G_INPUT_STREAM_CLASS (soup_server_input_stream_parent_class)->
+		read_fn (stream, buffer, count, cancellable, error);
+
+	if (nread == 0)
+		got_eof (SOUP_SERVER_INPUT_STREAM (stream));
+
+	return nread;
+}
+
+static gssize
+soup_server_input_stream_skip (GInputStream  *stream,
+                               gsize          count,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+        gssize nread;
+
+        nread = G_INPUT_STREAM_CLASS (soup_server_input_stream_parent_class)->
+                skip (stream, count, cancellable, error);
+
+        if (nread == 0)
+                got_eof (SOUP_SERVER_INPUT_STREAM (stream));
+
+        return nread;
+}
+
+static gssize
+soup_server_input_stream_read_nonblocking (GPollableInputStream  *stream,
+					   void                  *buffer,
+					   gsize                  count,
+					   GError               **error)
+{
+	gssize nread;
+
+	nread = soup_server_input_stream_parent_pollable_interface->
+		read_nonblocking (stream, buffer, count, error);
+
+	if (nread == 0)
+		got_eof (SOUP_SERVER_INPUT_STREAM (stream));
+
+	return nread;
+}
+
+static gboolean
+soup_server_input_stream_close_fn (GInputStream  *stream,
+				   GCancellable  *cancellable,
+				   GError       **error)
+{
+        /* The connection isn't ours to close: the server reads and
+         * discards whatever is left of the body.
+         */
+	g_signal_emit (stream, signals[SIGNAL_CLOSED], 0);
+	return TRUE;
+}
+
+static void
+soup_server_input_stream_close_async (GInputStream        *stream,
+				      gint                 priority,
+				      GCancellable        *cancellable,
+				      GAsyncReadyCallback  callback,
+				      gpointer             user_data)
+{
+	GTask *task;
+
+        /* Closing doesn't block, and must not happen in another thread */
+	task = g_task_new (stream, cancellable, callback, user_data);
+	g_task_set_priority (task, priority);
+	g_signal_emit (stream, signals[SIGNAL_CLOSED], 0);
+	g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
+}
+
+static gboolean
+soup_server_input_stream_close_finish (GInputStream  *stream,
+				       GAsyncResult  *result,
+				       GError       **error)
+{
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+soup_server_input_stream_class_init (SoupServerInputStreamClass *stream_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (stream_class);
+	GInputStreamClass *input_stream_class = G_INPUT_STREAM_CLASS (stream_class);
+
+	input_stream_class->read_fn = soup_server_input_stream_read_fn;
+	input_stream_class->skip = soup_server_input_stream_skip;
+	input_stream_class->close_fn = soup_server_input_stream_close_fn;
+	input_stream_class->close_async = soup_server_input_stream_close_async;
+	input_stream_class->close_finish = soup_server_input_stream_close_finish;
+
+	signals[SIGNAL_EOF] =
+		g_signal_new ("eof",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0,
+			      NULL, NULL,
+			      NULL,
+			      G_TYPE_NONE, 0);
+
+	signals[SIGNAL_CLOSED] =
+		g_signal_new ("closed",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0,
+			      NULL, NULL,
+			      NULL,
+			      G_TYPE_NONE, 0);
+}
+
+static void
+soup_server_input_stream_pollable_init (GPollableInputStreamInterface *pollable_interface,
+					gpointer interface_data)
+{
+	soup_server_input_stream_parent_pollable_interface =
+		g_type_interface_peek_parent (pollable_interface);
+
+	pollable_interface->read_nonblocking = soup_server_input_stream_read_nonblocking;
+}
+
+GInputStream *
+soup_server_input_stream_new (GInputStream *base_stream)
+{
+	return g_object_new (SOUP_TYPE_SERVER_INPUT_STREAM,
+			     "base-stream", base_stream,
+			     "close-base-stream", FALSE,
+			     NULL);
+}
@@ -0,0 +1,18 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "soup-types.h"
+#include "soup-filter-input-stream.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_SERVER_INPUT_STREAM            (soup_server_input_stream_get_type ())
+G_DECLARE_FINAL_TYPE (SoupServerInputStream, soup_server_input_stream, SOUP, SERVER_INPUT_STREAM, SoupFilterInputStream)
+
+GInputStream *soup_server_input_stream_new (GInputStream *base_stream);
+
+G_END_DECLS
@@ -9,12 +9,15 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include <glib/gi18n-lib.h>
 
 #include "soup.h"
 #include "soup-body-input-stream.h"
 #include "soup-body-output-stream.h"
 #include "soup-filter-input-stream.h"
+#include "soup-server-input-stream.h"
 #include "soup-server-message-private.h"
 #include "soup-message-headers-private.h"
 #include "soup-misc.h"
@@ -32,11 +35,34 @@ struct _SoupServerMessageIOData {
 
 	GSource *unpause_source;
 
+        /* Set while an earlier pipelined request on the same
+         * connection hasn't finished writing its response.
+         */
+        gboolean write_blocked;
+
+        /* Set once the response headers are in the write buffer, and
+         * @body_inlined once the whole (possibly empty) body is there
+         * too, so that several pipelined responses can be written at
+         * once.
+         */
+        gboolean response_formatted;
+        gboolean body_inlined;
+
+        /* Set while the application reads the request body itself,
+         * from @body_stream.
+         */
+        GInputStream *body_stream;
+        gboolean body_pulled;
+        gboolean body_eof;
+
+        GSource *run_source;
+
 	GMainContext *async_context;
 };
 
 #define RESPONSE_BLOCK_SIZE 8192
 #define HEADER_SIZE_LIMIT (64 * 1024)
+#define INLINE_BODY_SIZE_LIMIT (64 * 1024)
 
 void
 soup_server_message_io_data_free (SoupServerMessageIOData *io)
@@ -46,6 +72,8 @@ soup_server_message_io_data_free (SoupServerMessageIOData *io)
 
         g_clear_object (&io->iostream);
 
+        /* The write buffer belongs to the connection */
+        io->base.write_buf = NULL;
         soup_message_io_data_cleanup (&io->base);
 
 	if (io->unpause_source) {
@@ -53,6 +81,12 @@ soup_server_message_io_data_free (SoupServerMessageIOData *io)
                 g_source_unref (io->unpause_source);
 	        io->unpause_source = NULL;
 	}
+        if (io->run_source) {
+                g_source_destroy (io->run_source);
+                g_source_unref (io->run_source);
+                io->run_source = NULL;
+        }
+        g_clear_object (&io->body_stream);
 
 	g_clear_pointer (&io->async_context, g_main_context_unref);
 	g_clear_pointer (&io->write_chunk, g_bytes_unref);
@@ -276,14 +310,88 @@ handle_partial_get (SoupServerMessage *msg)
         soup_message_headers_free_ranges (request_headers, ranges);
 }
 
+/* Status lines for the status codes libsoup knows about, formatted
+ * once for HTTP/1.1 with their standard reason phrase.
+ */
+#define STATUS_LINE_MAX_CODE 600
+
+typedef struct {
+        const char *phrase;
+        char       *line;
+        gsize       len;
+} SoupStatusLine;
+
+static const SoupStatusLine *
+get_status_lines (void)
+{
+        static SoupStatusLine *status_lines = NULL;
+
+        if (g_once_init_enter (&status_lines)) {
+                SoupStatusLine *lines;
+                guint code;
+
+                lines = g_new0 (SoupStatusLine, STATUS_LINE_MAX_CODE);
+                for (code = 100; code < STATUS_LINE_MAX_CODE; code++) {
+                        const char *phrase = soup_status_get_phrase (code);
+
+                        if (!strcmp (phrase, "Unknown Error"))
+                                continue;
+
+                        lines[code].phrase = phrase;
+                        lines[code].line = g_strdup_printf ("HTTP/1.1 %u %s\r\n", code, phrase);
+                        lines[code].len = strlen (lines[code].line);
+                }
+
+                g_once_init_leave (&status_lines, lines);
+        }
+
+        return status_lines;
+}
+
+static void
+append_status_line (GString         *headers,
+                    SoupHTTPVersion  version,
+                    guint            status_code,
+                    const char      *reason_phrase)
+{
+        char digits[3];
+        gsize start = headers->len;
+
+        if (status_code < STATUS_LINE_MAX_CODE) {
+                const SoupStatusLine *status_line = &get_status_lines ()[status_code];
+
+                if (status_line->line && !strcmp (reason_phrase, status_line->phrase)) {
+                        g_string_append_len (headers, status_line->line, status_line->len);
+                        if (version == SOUP_HTTP_1_0)
+                                headers->str[start + 7] = '0';
+                        return;
+                }
+        }
+
+        if (status_code < 100 || status_code > 999) {
+                g_string_append_printf (headers, "HTTP/1.%c %u %s\r\n",
+                                        version == SOUP_HTTP_1_0 ? '0' : '1',
+                                        status_code, reason_phrase);
+                return;
+        }
+
+        digits[0] = '0' + status_code / 100;
+        digits[1] = '0' + (status_code / 10) % 10;
+        digits[2] = '0' + status_code % 10;
+
+        g_string_append (headers, version == SOUP_HTTP_1_0 ? "HTTP/1.0 " : "HTTP/1.1 ");
+        g_string_append_len (headers, digits, 3);
+        g_string_append_c (headers, ' ');
+        g_string_append (headers, reason_phrase);
+        g_string_append_len (headers, "\r\n", 2);
+}
+
 static void
 write_headers (SoupServerMessage  *msg,
                GString            *headers,
                SoupEncoding       *encoding)
 {
         SoupEncoding claimed_encoding;
-        SoupMessageHeadersIter iter;
-        const char *name, *value;
 	guint status_code;
 	const char *reason_phrase;
 	const char *method;
@@ -298,9 +406,8 @@ write_headers (SoupServerMessage  *msg,
 	status_code = soup_server_message_get_status (msg);
         reason_phrase = soup_server_message_get_reason_phrase (msg);
 
-        g_string_append_printf (headers, "HTTP/1.%c %d %s\r\n",
-				soup_server_message_get_http_version (msg) == SOUP_HTTP_1_0 ? '0' : '1',
-				status_code, reason_phrase);
+        append_status_line (headers, soup_server_message_get_http_version (msg),
+                            status_code, reason_phrase);
 
 	method = soup_server_message_get_method (msg);
 	response_headers = soup_server_message_get_response_headers (msg);
@@ -322,10 +429,66 @@ write_headers (SoupServerMessage  *msg,
                                                          response_body->length);
         }
 
-        soup_message_headers_iter_init (&iter, response_headers);
-        while (soup_message_headers_iter_next (&iter, &name, &value))
-                g_string_append_printf (headers, "%s: %s\r\n", name, value);
-        g_string_append (headers, "\r\n");
+        soup_message_headers_serialize (response_headers, headers);
+}
+
+/* Formats @msg's response headers into @buf, followed by its body if
+ * it is small and complete already. Returns %TRUE if the response is
+ * then complete in @buf.
+ */
+static gboolean
+format_response (SoupServerMessage *msg,
+                 GString           *buf)
+{
+        SoupServerMessageIOData *server_io = soup_server_message_get_io_data (msg);
+        SoupMessageIOData *io = &server_io->base;
+        SoupMessageBody *response_body;
+        goffset length, offset;
+        gsize headers_len;
+
+        write_headers (msg, buf, &io->write_encoding);
+        server_io->response_formatted = TRUE;
+
+        if (SOUP_STATUS_IS_INFORMATIONAL (soup_server_message_get_status (msg)))
+                return FALSE;
+        if (io->write_encoding != SOUP_ENCODING_NONE &&
+            io->write_encoding != SOUP_ENCODING_CONTENT_LENGTH)
+                return FALSE;
+
+        length = io->write_encoding == SOUP_ENCODING_NONE ? 0 :
+                soup_message_headers_get_content_length (soup_server_message_get_response_headers (msg));
+        if (length > INLINE_BODY_SIZE_LIMIT)
+                return FALSE;
+
+        response_body = soup_server_message_get_response_body (msg);
+        headers_len = buf->len;
+        for (offset = 0; offset < length; ) {
+                GBytes *chunk;
+                gsize size;
+
+                chunk = soup_message_body_get_chunk (response_body, offset);
+                if (!chunk)
+                        break;
+
+                size = g_bytes_get_size (chunk);
+                if (size)
+                        g_string_append_len (buf, g_bytes_get_data (chunk, NULL), size);
+                g_bytes_unref (chunk);
+                if (!size)
+                        break;
+                offset += size;
+        }
+
+        /* The body is still being produced, or doesn't match its
+         * Content-Length; leave it to the body states.
+         */
+        if (offset != length) {
+                g_string_truncate (buf, headers_len);
+                return FALSE;
+        }
+
+        server_io->body_inlined = TRUE;
+        return TRUE;
 }
 
 /* Attempts to push forward the writing side of @msg's I/O. Returns
@@ -365,8 +528,13 @@ io_write (SoupServerMessage *msg,
                         soup_server_message_set_status (msg, SOUP_STATUS_CONTINUE, NULL);
                 }
 
-                if (!io->write_buf->len)
-                        write_headers (msg, io->write_buf, &io->write_encoding);
+                /* Only taken now, since a pipelined request may be
+                 * read while the previous response is being written.
+                 */
+                if (!io->write_buf)
+                        io->write_buf = soup_socket_get_write_buffer (soup_server_message_get_soup_socket (msg));
+                if (!server_io->response_formatted)
+                        format_response (msg, io->write_buf);
 
                 while (io->written < io->write_buf->len) {
                         nwrote = g_pollable_stream_write (server_io->ostream,
@@ -384,6 +552,7 @@ io_write (SoupServerMessage *msg,
 
 		status_code = soup_server_message_get_status (msg);
                 if (SOUP_STATUS_IS_INFORMATIONAL (status_code)) {
+                        server_io->response_formatted = FALSE;
                         if (status_code == SOUP_STATUS_CONTINUE) {
                                 /* Stop and wait for the body now */
                                 io->write_state =
@@ -426,9 +595,11 @@ io_write (SoupServerMessage *msg,
                 break;
 
         case SOUP_MESSAGE_IO_STATE_BODY_START:
-                io->body_ostream = soup_body_output_stream_new (server_io->ostream,
-                                                                io->write_encoding,
-                                                                io->write_length);
+                if (!server_io->body_inlined) {
+                        io->body_ostream = soup_body_output_stream_new (server_io->ostream,
+                                                                        io->write_encoding,
+                                                                        io->write_length);
+                }
                 io->write_state = SOUP_MESSAGE_IO_STATE_BODY;
                 break;
 
@@ -453,13 +624,18 @@ io_write (SoupServerMessage *msg,
                         }
                 }
 
-                nwrote = g_pollable_stream_write (io->body_ostream,
-                                                  (guchar*)g_bytes_get_data (server_io->write_chunk, NULL) + io->written,
-                                                  g_bytes_get_size (server_io->write_chunk) - io->written,
-                                                  FALSE,
-                                                  NULL, error);
-                if (nwrote == -1)
-                        return FALSE;
+                if (server_io->body_inlined) {
+                        /* Already written along with the headers */
+                        nwrote = g_bytes_get_size (server_io->write_chunk) - io->written;
+                } else {
+                        nwrote = g_pollable_stream_write (io->body_ostream,
+                                                          (guchar*)g_bytes_get_data (server_io->write_chunk, NULL) + io->written,
+                                                          g_bytes_get_size (server_io->write_chunk) - io->written,
+                                                          FALSE,
+                                                          NULL, error);
+                        if (nwrote == -1)
+                                return FALSE;
+                }
 
                 chunk = g_bytes_new_from_bytes (server_io->write_chunk, io->written, nwrote);
                 io->written += nwrote;
@@ -729,6 +905,17 @@ io_read (SoupServerMessage *msg,
         case SOUP_MESSAGE_IO_STATE_BODY: {
                 guchar buf[RESPONSE_BLOCK_SIZE];
 
+                /* The application is reading the body; wait for it
+                 * to get to the end.
+                 */
+                if (server_io->body_pulled) {
+                        if (!server_io->body_eof)
+                                return FALSE;
+
+                        io->read_state = SOUP_MESSAGE_IO_STATE_BODY_DONE;
+                        break;
+                }
+
                 nread = g_pollable_stream_read (io->body_istream,
                                                 buf,
                                                 RESPONSE_BLOCK_SIZE,
@@ -793,7 +980,7 @@ io_run_until (SoupServerMessage *msg,
 
                 if (SOUP_MESSAGE_IO_STATE_ACTIVE (io->read_state))
                         progress = io_read (msg, &my_error);
-                else if (SOUP_MESSAGE_IO_STATE_ACTIVE (io->write_state))
+                else if (SOUP_MESSAGE_IO_STATE_ACTIVE (io->write_state) && !server_io->write_blocked)
                         progress = io_write (msg, &my_error);
                 else
                         progress = FALSE;
@@ -856,6 +1043,19 @@ io_run (SoupServerMessage *msg)
                 soup_server_message_io_finished (msg);
         } else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
                 g_clear_error (&error);
+
+                /* Nothing to wait for on the socket until the
+                 * previous response is written, or until the
+                 * application has read the request body; see
+                 * soup_server_message_io_unblock_write() and
+                 * soup_server_message_io_get_request_body_stream().
+                 */
+                if ((server_io->write_blocked && !SOUP_MESSAGE_IO_STATE_ACTIVE (io->read_state)) ||
+                    (server_io->body_pulled && io->read_state == SOUP_MESSAGE_IO_STATE_BODY)) {
+                        g_object_unref (msg);
+                        return;
+                }
+
                 io->io_source = soup_message_io_data_get_source (io, G_OBJECT (msg),
                                                                  server_io->istream,
                                                                  server_io->ostream,
@@ -873,6 +1073,7 @@ io_run (SoupServerMessage *msg)
 
 void
 soup_server_message_read_request (SoupServerMessage        *msg,
+                                  gboolean                  write_blocked,
 				  SoupMessageIOCompletionFn completion_cb,
 				  gpointer                  user_data)
 {
@@ -889,10 +1090,10 @@ soup_server_message_read_request (SoupServerMessage        *msg,
         io->ostream = g_io_stream_get_output_stream (io->iostream);
 
         io->base.read_header_buf = g_byte_array_new ();
-        io->base.write_buf = g_string_new (NULL);
 
         io->base.read_state = SOUP_MESSAGE_IO_STATE_HEADERS;
         io->base.write_state = SOUP_MESSAGE_IO_STATE_NOT_STARTED;
+        io->write_blocked = write_blocked;
 
 	io->async_context = g_main_context_ref_thread_default ();
 
@@ -946,6 +1147,199 @@ soup_server_message_io_unpause (SoupServerMessage *msg)
         }
 }
 
+static gboolean
+io_run_soon_internal (gpointer msg)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+        g_return_val_if_fail (io != NULL, FALSE);
+
+        g_clear_pointer (&io->run_source, g_source_unref);
+        if (io->base.io_source || io->base.paused)
+                return FALSE;
+
+        io_run (msg);
+        return FALSE;
+}
+
+/* Resumes the I/O of @msg from the main loop, when it was stopped
+ * waiting for something other than the socket.
+ */
+static void
+io_run_soon (SoupServerMessage *msg)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+        if (!io->run_source) {
+                io->run_source = soup_add_completion_reffed (io->async_context,
+                                                             io_run_soon_internal, msg, NULL);
+        }
+}
+
+/* Lets @msg write its response once the responses to the requests
+ * pipelined before it on the same connection have been written.
+ */
+void
+soup_server_message_io_unblock_write (SoupServerMessage *msg)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+        if (!io || !io->write_blocked)
+                return;
+
+        io->write_blocked = FALSE;
+        io_run_soon (msg);
+}
+
+static gboolean
+response_ready (SoupServerMessage *msg)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+        guint status_code;
+
+        if (!io || !io->write_blocked || io->base.paused)
+                return FALSE;
+        if (io->base.read_state != SOUP_MESSAGE_IO_STATE_DONE ||
+            io->base.write_state != SOUP_MESSAGE_IO_STATE_HEADERS)
+                return FALSE;
+
+        status_code = soup_server_message_get_status (msg);
+        return status_code != 0 && !SOUP_STATUS_IS_INFORMATIONAL (status_code);
+}
+
+/* Formats the responses at the start of @pipeline that are ready into
+ * their connection's write buffer, so that the first one writes them
+ * all at once when it is unblocked. Stops at the first response that
+ * isn't complete in the buffer, since the ones after it have to wait
+ * for its body.
+ */
+void
+soup_server_message_io_coalesce_responses (GList *pipeline)
+{
+        GString *buf = NULL;
+        GList *l;
+
+        for (l = pipeline; l; l = l->next) {
+                SoupServerMessage *msg = l->data;
+                SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+                if (io && io->response_formatted) {
+                        /* Formatted and written by an earlier one */
+                        if (!io->body_inlined)
+                                break;
+                        continue;
+                }
+
+                if (!response_ready (msg))
+                        break;
+
+                if (!buf)
+                        buf = soup_socket_get_write_buffer (soup_server_message_get_soup_socket (msg));
+                else if (buf->len >= INLINE_BODY_SIZE_LIMIT)
+                        break;
+
+                io->base.write_buf = buf;
+                if (!format_response (msg, buf) || !soup_server_message_is_keepalive (msg))
+                        break;
+        }
+}
+
+gboolean
+soup_server_message_io_request_is_read (SoupServerMessage *msg)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+        return io && io->base.read_state >= SOUP_MESSAGE_IO_STATE_FINISHING;
+}
+
+static void
+body_stream_eof (SoupServerMessage *msg,
+                 GInputStream      *stream)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+        if (!io || io->body_stream != stream)
+                return;
+
+        io->body_eof = TRUE;
+        if (io->body_pulled && io->base.read_state == SOUP_MESSAGE_IO_STATE_BODY)
+                io_run_soon (msg);
+}
+
+static void
+body_stream_closed (SoupServerMessage *msg,
+                    GInputStream      *stream)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+        if (!io || io->body_stream != stream || !io->body_pulled)
+                return;
+
+        /* Read and discard the rest of the body ourselves, so that
+         * the connection can be reused.
+         */
+        io->body_pulled = FALSE;
+        if (!io->body_eof) {
+                soup_message_body_set_accumulate (soup_server_message_get_request_body (msg), FALSE);
+                if (io->base.read_state == SOUP_MESSAGE_IO_STATE_BODY)
+                        io_run_soon (msg);
+        }
+}
+
+/* Hands the reading of the request body of @msg over to the
+ * application: from then on, the body is read from the socket only
+ * as the returned stream is read, and it is neither accumulated nor
+ * emitted as chunks. The message proceeds to #SoupServerMessage::got-body
+ * once the stream reaches the end of the body.
+ */
+GInputStream *
+soup_server_message_io_get_request_body_stream (SoupServerMessage *msg)
+{
+        SoupServerMessageIOData *server_io = soup_server_message_get_io_data (msg);
+        SoupMessageIOData *io;
+
+        if (!server_io)
+                return NULL;
+
+        io = &server_io->base;
+        if (server_io->body_stream)
+                return g_object_ref (server_io->body_stream);
+
+        /* Only between the headers and the start of the body */
+        if (io->read_state != SOUP_MESSAGE_IO_STATE_BODY_START &&
+            io->read_state != SOUP_MESSAGE_IO_STATE_BLOCKING)
+                return NULL;
+
+        if (!io->body_istream) {
+                io->body_istream = soup_body_input_stream_new (server_io->istream,
+                                                               io->read_encoding,
+                                                               io->read_length);
+        }
+
+        server_io->body_stream = soup_server_input_stream_new (io->body_istream);
+        server_io->body_pulled = TRUE;
+        g_signal_connect_object (server_io->body_stream, "eof",
+                                 G_CALLBACK (body_stream_eof),
+                                 msg, G_CONNECT_SWAPPED);
+        g_signal_connect_object (server_io->body_stream, "closed",
+                                 G_CALLBACK (body_stream_closed),
+                                 msg, G_CONNECT_SWAPPED);
+
+        return g_object_ref (server_io->body_stream);
+}
+
+/* Whether part of the next request has arrived, while its headers
+ * are still incomplete.
+ */
+gboolean
+soup_server_message_io_has_partial_request (SoupServerMessage *msg)
+{
+        SoupServerMessageIOData *io = soup_server_message_get_io_data (msg);
+
+        return io && io->base.read_state == SOUP_MESSAGE_IO_STATE_HEADERS &&
+                io->base.read_header_buf->len > 0;
+}
+
 gboolean
 soup_server_message_is_io_paused (SoupServerMessage *msg)
 {
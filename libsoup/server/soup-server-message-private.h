@@ -9,6 +9,7 @@
 #include "soup-auth-domain.h"
 #include "soup-message-io-data.h"
 #include "soup-socket.h"
+#include "soup-path-map.h"
 
 SoupServerMessage *soup_server_message_new                 (SoupSocket               *sock);
 void               soup_server_message_set_uri             (SoupServerMessage        *msg,
@@ -24,6 +25,7 @@ GIOStream         *soup_server_message_io_steal            (SoupServerMessage
 void               soup_server_message_io_pause            (SoupServerMessage        *msg);
 void               soup_server_message_io_unpause          (SoupServerMessage        *msg);
 gboolean           soup_server_message_is_io_paused        (SoupServerMessage        *msg);
+gboolean           soup_server_message_io_has_partial_request (SoupServerMessage     *msg);
 void               soup_server_message_io_finished         (SoupServerMessage        *msg);
 void               soup_server_message_cleanup_response    (SoupServerMessage        *msg);
 void               soup_server_message_wrote_informational (SoupServerMessage        *msg);
@@ -38,10 +40,28 @@ void               soup_server_message_got_chunk           (SoupServerMessage
 void               soup_server_message_got_body            (SoupServerMessage        *msg);
 void               soup_server_message_finished            (SoupServerMessage        *msg);
 void               soup_server_message_read_request        (SoupServerMessage        *msg,
+                                                            gboolean                  write_blocked,
                                                             SoupMessageIOCompletionFn completion_cb,
                                                             gpointer                  user_data);
+void               soup_server_message_io_unblock_write    (SoupServerMessage        *msg);
+void               soup_server_message_io_coalesce_responses (GList                *pipeline);
+gboolean           soup_server_message_io_request_is_read  (SoupServerMessage        *msg);
+GInputStream      *soup_server_message_io_get_request_body_stream (SoupServerMessage *msg);
 void               soup_server_message_set_options_ping    (SoupServerMessage        *msg,
                                                             gboolean                  is_options_ping);
+void               soup_server_message_set_path_params     (SoupServerMessage        *msg,
+                                                            const char               *path,
+                                                            const SoupPathMapParams  *params);
+
+/* What the SoupServer accounts for the message, for its admission
+ * control.
+ */
+typedef struct {
+        gboolean in_flight;
+        gsize    buffered_body_size;
+} SoupServerMessageAdmission;
+
+SoupServerMessageAdmission *soup_server_message_get_admission (SoupServerMessage *msg);
 
 typedef struct _SoupServerMessageIOData SoupServerMessageIOData;
 void                     soup_server_message_io_data_free  (SoupServerMessageIOData *io);
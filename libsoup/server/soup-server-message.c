@@ -71,7 +71,16 @@ struct _SoupServerMessage {
 
         SoupServerMessageIOData *io_data;
 
+        SoupServerMessageAdmission admission;
+
         gboolean                 options_ping;
+
+        /* Parameters of the route that matched, as offsets into
+         * @path_params_path; their values are copied on demand.
+         */
+        const char              *path_params_path;
+        SoupPathMapParams        path_params;
+        char                    *path_param_values[SOUP_PATH_MAP_MAX_PARAMS];
 };
 
 struct _SoupServerMessageClass {
@@ -111,6 +120,17 @@ soup_server_message_init (SoupServerMessage *msg)
         soup_message_headers_set_encoding (msg->response_headers, SOUP_ENCODING_CONTENT_LENGTH);
 }
 
+static void
+clear_path_params (SoupServerMessage *msg)
+{
+        guint i;
+
+        for (i = 0; i < msg->path_params.n_params; i++)
+                g_clear_pointer (&msg->path_param_values[i], g_free);
+        msg->path_params.n_params = 0;
+        msg->path_params_path = NULL;
+}
+
 static void
 soup_server_message_finalize (GObject *object)
 {
@@ -118,6 +138,8 @@ soup_server_message_finalize (GObject *object)
 
         soup_server_message_io_data_free (msg->io_data);
 
+        clear_path_params (msg);
+
         g_clear_object (&msg->auth_domain);
         g_clear_pointer (&msg->auth_user, g_free);
         g_clear_object (&msg->remote_addr);
@@ -386,6 +408,9 @@ void
 soup_server_message_set_uri (SoupServerMessage *msg,
                              GUri              *uri)
 {
+        /* The parameters point into the path of the old URI */
+        clear_path_params (msg);
+
         if (msg->uri)
                 g_uri_unref (msg->uri);
         msg->uri = soup_uri_copy_with_normalized_flags (uri);
@@ -462,6 +487,12 @@ soup_server_message_get_io_data (SoupServerMessage *msg)
         return msg->io_data;
 }
 
+SoupServerMessageAdmission *
+soup_server_message_get_admission (SoupServerMessage *msg)
+{
+        return &msg->admission;
+}
+
 void
 soup_server_message_cleanup_response (SoupServerMessage *msg)
 {
@@ -580,6 +611,39 @@ soup_server_message_get_request_body (SoupServerMessage *msg)
         return msg->request_body;
 }
 
+/**
+ * soup_server_message_get_request_body_stream:
+ * @msg: a #SoupServerMessage
+ *
+ * Gets a stream to read the request body of @msg from, instead of
+ * having it accumulated in the #SoupMessageBody returned by
+ * soup_server_message_get_request_body().
+ *
+ * This must be called from a #SoupServerMessage::got-headers handler
+ * or an early handler (see soup_server_add_early_handler()). From
+ * then on, the body is only read from the connection as the returned
+ * stream is read, so a large upload can be piped elsewhere with
+ * bounded memory, and neither #SoupServerMessage::got-chunk nor the
+ * request #SoupMessageBody see any of it. Once the stream has been read
+ * to the end, the message proceeds as usual with
+ * #SoupServerMessage::got-body and the normal handler.
+ *
+ * The request is stalled until the stream is read, so make sure to
+ * read it (asynchronously, from the server's #GMainContext) or close
+ * it; closing it before the end makes the server discard the rest of
+ * the body.
+ *
+ * Returns: (transfer full) (nullable): a #GInputStream, or %NULL if
+ *   it's too late to read the request body from a stream.
+ */
+GInputStream *
+soup_server_message_get_request_body_stream (SoupServerMessage *msg)
+{
+        g_return_val_if_fail (SOUP_IS_SERVER_MESSAGE (msg), NULL);
+
+        return soup_server_message_io_get_request_body_stream (msg);
+}
+
 /**
  * soup_server_message_get_response_body:
  * @msg: a #SoupServerMessage
@@ -642,6 +706,53 @@ soup_server_message_is_options_ping (SoupServerMessage *msg)
         return msg->options_ping;
 }
 
+void
+soup_server_message_set_path_params (SoupServerMessage       *msg,
+                                     const char              *path,
+                                     const SoupPathMapParams *params)
+{
+        clear_path_params (msg);
+        if (!params || !params->n_params)
+                return;
+
+        msg->path_params = *params;
+        msg->path_params_path = path;
+}
+
+/**
+ * soup_server_message_get_path_param:
+ * @msg: a #SoupServerMessage
+ * @name: the name of a parameter
+ *
+ * Gets the value of the "{@name}" parameter of the route that @msg
+ * was dispatched to. See soup_server_add_route().
+ *
+ * Returns: (nullable): the value of the parameter, or %NULL if the
+ *   route has no such parameter.
+ */
+const char *
+soup_server_message_get_path_param (SoupServerMessage *msg,
+                                    const char        *name)
+{
+        guint i;
+
+        g_return_val_if_fail (SOUP_IS_SERVER_MESSAGE (msg), NULL);
+        g_return_val_if_fail (name != NULL, NULL);
+
+        for (i = 0; i < msg->path_params.n_params; i++) {
+                SoupPathMapParam *param = &msg->path_params.params[i];
+
+                if (strcmp (param->name, name) != 0)
+                        continue;
+
+                if (!msg->path_param_values[i])
+                        msg->path_param_values[i] = g_strndup (msg->path_params_path + param->offset, param->length);
+                return msg->path_param_values[i];
+        }
+
+        return NULL;
+}
+
 /**
  * soup_server_message_get_http_version:
  * @msg: a #SoupServerMessage
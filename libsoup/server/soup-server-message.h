@@ -25,6 +25,9 @@ SoupMessageHeaders *soup_server_message_get_response_headers (SoupServerMessage
 SOUP_AVAILABLE_IN_ALL
 SoupMessageBody    *soup_server_message_get_request_body     (SoupServerMessage *msg);
 
+SOUP_AVAILABLE_IN_ALL
+GInputStream       *soup_server_message_get_request_body_stream (SoupServerMessage *msg);
+
 SOUP_AVAILABLE_IN_ALL
 SoupMessageBody    *soup_server_message_get_response_body    (SoupServerMessage *msg);
 
@@ -80,6 +83,10 @@ GIOStream          *soup_server_message_steal_connection      (SoupServerMessage
 SOUP_AVAILABLE_IN_ALL
 gboolean            soup_server_message_is_options_ping       (SoupServerMessage *msg);
 
+SOUP_AVAILABLE_IN_ALL
+const char         *soup_server_message_get_path_param        (SoupServerMessage *msg,
+                                                               const char        *name);
+
 G_END_DECLS
 
 #endif /* __SOUP_SERVER_MESSAGE_H__ */
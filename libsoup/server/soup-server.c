@@ -20,6 +20,7 @@
 #include "soup-misc.h"
 #include "soup-path-map.h"
 #include "soup-socket.h"
+#include "soup-timer-wheel.h"
 #include "soup-uri-utils-private.h"
 #include "websocket/soup-websocket.h"
 #include "websocket/soup-websocket-connection.h"
@@ -138,6 +139,7 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 typedef struct {
 	char               *path;
+	const char         *method;
 
 	SoupServerCallback  early_callback;
 	GDestroyNotify      early_destroy;
@@ -155,6 +157,23 @@ typedef struct {
 	gpointer                      websocket_user_data;
 } SoupServerHandler;
 
+typedef enum {
+	CLIENT_TIMEOUT_IDLE,
+	CLIENT_TIMEOUT_HEADERS,
+	CLIENT_TIMEOUT_BODY
+} ClientTimeoutPhase;
+
+/* A client connection. Its deadline is for the request being read on
+ * it, if any.
+ */
+typedef struct {
+	SoupTimerWheelEntry timeout;
+	SoupServer         *server;
+	SoupSocket         *sock;
+	SoupServerMessage  *msg;
+	ClientTimeoutPhase  phase;
+} SoupServerConnection;
+
 typedef struct {
 	GSList            *listeners;
 	GSList            *clients;
@@ -175,6 +194,32 @@ typedef struct {
 
 	GPtrArray         *websocket_extension_types;
 
+	guint              pipeline_depth;
+	GHashTable        *pipelines; /* SoupSocket -> GQueue of SoupServerMessage */
+	SoupSocket        *aborting_pipeline;
+
+	/* Admission control; a limit of 0 means unlimited */
+	guint              max_connections;
+	guint              max_in_flight;
+	guint64            max_buffered_body_size;
+	GHashTable        *connections; /* SoupSocket -> SoupServerConnection */
+	guint              n_in_flight;
+	guint64            buffered_body_size;
+	guint64            n_rejected;
+	gboolean           accept_paused;
+
+	/* Client connection deadlines, in seconds; 0 means none */
+	guint              idle_timeout;
+	guint              header_timeout;
+	guint              body_timeout;
+	SoupTimerWheel    *timeouts;
+
+	SoupSocketOptions *socket_options;
+
+	/* The Date header only changes once per second */
+	gint64             date_second;
+	char              *date_string;
+
 	gboolean           disposed;
 
 } SoupServerPrivate;
@@ -189,6 +234,14 @@ enum {
         PROP_TLS_AUTH_MODE,
 	PROP_RAW_PATHS,
 	PROP_SERVER_HEADER,
+	PROP_PIPELINE_DEPTH,
+	PROP_MAX_CONNECTIONS,
+	PROP_MAX_IN_FLIGHT,
+	PROP_MAX_BUFFERED_BODY_SIZE,
+	PROP_IDLE_TIMEOUT,
+	PROP_HEADER_TIMEOUT,
+	PROP_BODY_TIMEOUT,
+	PROP_SOCKET_OPTIONS,
 
 	LAST_PROPERTY
 };
@@ -198,7 +251,14 @@ static GParamSpec *properties[LAST_PROPERTY] = { NULL, };
 G_DEFINE_TYPE_WITH_PRIVATE (SoupServer, soup_server, G_TYPE_OBJECT)
 
 static void start_request (SoupServer        *server,
-			   SoupServerMessage *msg);
+			   SoupServerMessage *msg,
+			   gboolean           write_blocked);
+static void update_admission (SoupServer *server);
+static void server_connection_free (SoupServerConnection *conn);
+static void set_client_timeout (SoupServer         *server,
+				SoupServerMessage  *msg,
+				ClientTimeoutPhase  phase,
+				guint               timeout);
 static void
 free_handler (SoupServerHandler *handler)
 {
@@ -221,6 +281,8 @@ soup_server_init (SoupServer *server)
 	SoupServerPrivate *priv = soup_server_get_instance_private (server);
 
 	priv->handlers = soup_path_map_new ((GDestroyNotify)free_handler);
+	priv->connections = g_hash_table_new_full (NULL, NULL, NULL,
+						   (GDestroyNotify)server_connection_free);
 
 	priv->websocket_extension_types = g_ptr_array_new_with_free_func ((GDestroyNotify)g_type_class_unref);
 
@@ -250,6 +312,7 @@ soup_server_finalize (GObject *object)
         g_clear_object (&priv->tls_database);
 
 	g_free (priv->server_header);
+	g_free (priv->date_string);
 
 	soup_path_map_free (priv->handlers);
 
@@ -259,6 +322,11 @@ soup_server_finalize (GObject *object)
 
 	g_ptr_array_free (priv->websocket_extension_types, TRUE);
 
+	g_clear_pointer (&priv->pipelines, g_hash_table_destroy);
+	g_hash_table_destroy (priv->connections);
+	g_clear_pointer (&priv->timeouts, soup_timer_wheel_free);
+	g_clear_pointer (&priv->socket_options, soup_socket_options_free);
+
 	G_OBJECT_CLASS (soup_server_parent_class)->finalize (object);
 }
 
@@ -283,6 +351,34 @@ soup_server_set_property (GObject *object, guint prop_id,
 	case PROP_RAW_PATHS:
 		priv->raw_paths = g_value_get_boolean (value);
 		break;
+	case PROP_PIPELINE_DEPTH:
+		priv->pipeline_depth = g_value_get_uint (value);
+		break;
+	case PROP_MAX_CONNECTIONS:
+		priv->max_connections = g_value_get_uint (value);
+		update_admission (server);
+		break;
+	case PROP_MAX_IN_FLIGHT:
+		priv->max_in_flight = g_value_get_uint (value);
+		update_admission (server);
+		break;
+	case PROP_MAX_BUFFERED_BODY_SIZE:
+		priv->max_buffered_body_size = g_value_get_uint64 (value);
+		update_admission (server);
+		break;
+	case PROP_IDLE_TIMEOUT:
+		priv->idle_timeout = g_value_get_uint (value);
+		break;
+	case PROP_HEADER_TIMEOUT:
+		priv->header_timeout = g_value_get_uint (value);
+		break;
+	case PROP_BODY_TIMEOUT:
+		priv->body_timeout = g_value_get_uint (value);
+		break;
+	case PROP_SOCKET_OPTIONS:
+		g_clear_pointer (&priv->socket_options, soup_socket_options_free);
+		priv->socket_options = g_value_dup_boxed (value);
+		break;
 	case PROP_SERVER_HEADER:
 		g_free (priv->server_header);
 		header = g_value_get_string (value);
@@ -327,6 +423,30 @@ soup_server_get_property (GObject *object, guint prop_id,
 	case PROP_SERVER_HEADER:
 		g_value_set_string (value, priv->server_header);
 		break;
+	case PROP_PIPELINE_DEPTH:
+		g_value_set_uint (value, priv->pipeline_depth);
+		break;
+	case PROP_MAX_CONNECTIONS:
+		g_value_set_uint (value, priv->max_connections);
+		break;
+	case PROP_MAX_IN_FLIGHT:
+		g_value_set_uint (value, priv->max_in_flight);
+		break;
+	case PROP_MAX_BUFFERED_BODY_SIZE:
+		g_value_set_uint64 (value, priv->max_buffered_body_size);
+		break;
+	case PROP_IDLE_TIMEOUT:
+		g_value_set_uint (value, priv->idle_timeout);
+		break;
+	case PROP_HEADER_TIMEOUT:
+		g_value_set_uint (value, priv->header_timeout);
+		break;
+	case PROP_BODY_TIMEOUT:
+		g_value_set_uint (value, priv->body_timeout);
+		break;
+	case PROP_SOCKET_OPTIONS:
+		g_value_set_boxed (value, priv->socket_options);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -533,6 +653,173 @@ soup_server_class_init (SoupServerClass *server_class)
                                      G_PARAM_CONSTRUCT |
                                      G_PARAM_STATIC_STRINGS);
 
+	/**
+	 * SoupServer:pipeline-depth:
+	 *
+	 * The maximum number of requests pipelined on an HTTP/1.1
+	 * connection that the server reads and dispatches at once.
+	 *
+	 * With the default of 1, a request is only read once the
+	 * response to the previous one has been sent. With a larger
+	 * value, the requests the client has already sent are read and
+	 * their handlers run while earlier handlers are still working
+	 * on their responses, so the handlers of pipelined requests
+	 * can overlap. Responses are always sent in the order of the
+	 * requests, so a response that is ready waits, together with
+	 * its body, until the ones before it have been sent; the depth
+	 * bounds how many of them can be held at once.
+	 *
+	 * If a response closes the connection, the requests read after
+	 * it are aborted, even if their handlers already ran, and the
+	 * client has to send them again.
+	 */
+        properties[PROP_PIPELINE_DEPTH] =
+		g_param_spec_uint ("pipeline-depth",
+				   "Pipeline depth",
+				   "Maximum number of pipelined requests handled at once on a connection",
+				   1, 64, 1,
+				   G_PARAM_READWRITE |
+				   G_PARAM_CONSTRUCT |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupServer:max-connections:
+	 *
+	 * The maximum number of client connections the server keeps
+	 * open at once, or 0 for no limit.
+	 *
+	 * When the limit is reached the server stops accepting new
+	 * connections on its listeners, leaving them in the kernel's
+	 * backlog, until some of the existing ones are closed.
+	 * Connections added with soup_server_accept_iostream() beyond
+	 * the limit have their requests rejected with
+	 * %SOUP_STATUS_SERVICE_UNAVAILABLE.
+	 */
+        properties[PROP_MAX_CONNECTIONS] =
+		g_param_spec_uint ("max-connections",
+				   "Maximum connections",
+				   "Maximum number of open client connections",
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READWRITE |
+				   G_PARAM_CONSTRUCT |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupServer:max-in-flight:
+	 *
+	 * The maximum number of requests being processed at once, from
+	 * the moment their headers are read until their response has
+	 * been sent, or 0 for no limit.
+	 *
+	 * Requests arriving while the limit is reached are answered
+	 * with %SOUP_STATUS_SERVICE_UNAVAILABLE and the connection is
+	 * closed, without calling any handler, and no new connections
+	 * are accepted.
+	 */
+        properties[PROP_MAX_IN_FLIGHT] =
+		g_param_spec_uint ("max-in-flight",
+				   "Maximum in-flight messages",
+				   "Maximum number of requests processed at once",
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READWRITE |
+				   G_PARAM_CONSTRUCT |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupServer:max-buffered-body-size:
+	 *
+	 * The maximum number of bytes of request bodies the server
+	 * buffers in memory across all the requests being processed,
+	 * or 0 for no limit. Only bodies that are accumulated (see
+	 * soup_message_body_set_accumulate()) are accounted.
+	 *
+	 * While the limit is exceeded new requests are rejected as
+	 * with #SoupServer:max-in-flight.
+	 */
+        properties[PROP_MAX_BUFFERED_BODY_SIZE] =
+		g_param_spec_uint64 ("max-buffered-body-size",
+				     "Maximum buffered body size",
+				     "Maximum number of request body bytes buffered at once",
+				     0, G_MAXUINT64, 0,
+				     G_PARAM_READWRITE |
+				     G_PARAM_CONSTRUCT |
+				     G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupServer:idle-timeout:
+	 *
+	 * The number of seconds a client connection may stay open
+	 * without sending a request, either after it is accepted or
+	 * after the previous response on it has been sent, before the
+	 * server closes it. 0 means no limit.
+	 *
+	 * Deadlines are tracked for all the connections of the server
+	 * together, at a resolution of a fraction of a second.
+	 */
+        properties[PROP_IDLE_TIMEOUT] =
+		g_param_spec_uint ("idle-timeout",
+				   "Idle timeout",
+				   "Seconds a connection may stay idle between requests",
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READWRITE |
+				   G_PARAM_CONSTRUCT |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupServer:header-timeout:
+	 *
+	 * The number of seconds a client has to send the complete
+	 * headers of a request, or 0 for no limit. This protects the
+	 * server from clients that keep connections busy by sending
+	 * their requests very slowly.
+	 *
+	 * When #SoupServer:idle-timeout is also set, the time is
+	 * counted from when the idle timeout would have expired if the
+	 * request has started to arrive by then; otherwise it is
+	 * counted from when the server starts waiting for the request.
+	 */
+        properties[PROP_HEADER_TIMEOUT] =
+		g_param_spec_uint ("header-timeout",
+				   "Header timeout",
+				   "Seconds a client has to send the request headers",
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READWRITE |
+				   G_PARAM_CONSTRUCT |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupServer:body-timeout:
+	 *
+	 * The number of seconds a client has to send the body of a
+	 * request once its headers have been read, or 0 for no limit.
+	 */
+        properties[PROP_BODY_TIMEOUT] =
+		g_param_spec_uint ("body-timeout",
+				   "Body timeout",
+				   "Seconds a client has to send the request body",
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READWRITE |
+				   G_PARAM_CONSTRUCT |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupServer:socket-options:
+	 *
+	 * The #SoupSocketOptions applied to the listening sockets and
+	 * to the client connections they accept, or %NULL for the
+	 * defaults.
+	 *
+	 * Changing this property only affects listening sockets added
+	 * afterwards, with soup_server_listen() and friends.
+	 */
+        properties[PROP_SOCKET_OPTIONS] =
+		g_param_spec_boxed ("socket-options",
+				    "Socket options",
+				    "Options applied to listening and accepted sockets",
+				    SOUP_TYPE_SOCKET_OPTIONS,
+				    G_PARAM_READWRITE |
+				    G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
 
@@ -775,8 +1062,17 @@ get_handler (SoupServer        *server,
 	     SoupServerMessage *msg)
 {
 	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupServerHandler *handler;
+	SoupPathMapParams params;
+	const char *path;
+
+	path = get_msg_path (msg);
+	handler = soup_path_map_lookup_route (priv->handlers,
+					      soup_server_message_get_method (msg),
+					      path, &params);
+	soup_server_message_set_path_params (msg, path, &params);
 
-	return soup_path_map_lookup (priv->handlers, get_msg_path (msg));
+	return handler;
 }
 
 static void
@@ -816,6 +1112,257 @@ call_handler (SoupServer        *server,
 		g_hash_table_unref (form_data_set);
 }
 
+static const char *
+get_date_string (SoupServer *server)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+	if (now != priv->date_second || !priv->date_string) {
+		GDateTime *date;
+
+		g_free (priv->date_string);
+		date = g_date_time_new_from_unix_utc (now);
+		priv->date_string = soup_date_time_to_string (date, SOUP_DATE_HTTP);
+		g_date_time_unref (date);
+		priv->date_second = now;
+	}
+
+	return priv->date_string;
+}
+
+/* Whether any limit is reached. With @counting_connection, the
+ * connection being checked is already in priv->connections, so the
+ * connection limit is only exceeded past it.
+ */
+static gboolean
+is_overloaded (SoupServerPrivate *priv,
+	       gboolean           counting_connection)
+{
+	guint n_connections = g_hash_table_size (priv->connections);
+
+	if (counting_connection && n_connections > 0)
+		n_connections--;
+
+	return (priv->max_connections && n_connections >= priv->max_connections) ||
+		(priv->max_in_flight && priv->n_in_flight >= priv->max_in_flight) ||
+		(priv->max_buffered_body_size && priv->buffered_body_size >= priv->max_buffered_body_size);
+}
+
+/* Stops accepting connections while any limit is reached, and starts
+ * again once all of them are below their limit.
+ */
+static void
+update_admission (SoupServer *server)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	gboolean overloaded = is_overloaded (priv, FALSE);
+	GSList *iter;
+
+	if (overloaded == priv->accept_paused)
+		return;
+
+	priv->accept_paused = overloaded;
+	for (iter = priv->listeners; iter; iter = iter->next) {
+		if (overloaded)
+			soup_socket_pause_accept (iter->data);
+		else
+			soup_socket_unpause_accept (iter->data);
+	}
+}
+
+static void
+server_connection_free (SoupServerConnection *conn)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (conn->server);
+
+	if (soup_timer_wheel_is_scheduled (&conn->timeout))
+		soup_timer_wheel_cancel (priv->timeouts, &conn->timeout);
+	g_free (conn);
+}
+
+static void
+connection_disconnected (SoupServer *server,
+			 SoupSocket *sock)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+
+	if (g_hash_table_remove (priv->connections, sock))
+		update_admission (server);
+}
+
+static void
+track_connection (SoupServer *server,
+		  SoupSocket *sock)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupServerConnection *conn;
+
+	conn = g_new0 (SoupServerConnection, 1);
+	conn->server = server;
+	conn->sock = sock;
+	g_hash_table_insert (priv->connections, sock, conn);
+	g_signal_connect_object (sock, "disconnected",
+				 G_CALLBACK (connection_disconnected),
+				 server, G_CONNECT_SWAPPED);
+	update_admission (server);
+}
+
+/* Counts @msg as in flight, or answers it right away with a 503,
+ * without calling any handler, if the server is over its limits.
+ */
+static gboolean
+admit_message (SoupServer        *server,
+	       SoupServerMessage *msg)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupMessageHeaders *headers;
+
+	if (is_overloaded (priv, TRUE)) {
+		priv->n_rejected++;
+
+		soup_message_body_set_accumulate (soup_server_message_get_request_body (msg), FALSE);
+		soup_server_message_set_status (msg, SOUP_STATUS_SERVICE_UNAVAILABLE, NULL);
+		headers = soup_server_message_get_response_headers (msg);
+		soup_message_headers_append (headers, "Retry-After", "1");
+		soup_message_headers_replace_common (headers, SOUP_HEADER_CONNECTION, "close");
+		return FALSE;
+	}
+
+	priv->n_in_flight++;
+	soup_server_message_get_admission (msg)->in_flight = TRUE;
+	update_admission (server);
+	return TRUE;
+}
+
+static void
+count_body_chunk (SoupServer        *server,
+		  GBytes            *chunk,
+		  SoupServerMessage *msg)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	gsize size;
+
+	if (!soup_message_body_get_accumulate (soup_server_message_get_request_body (msg)))
+		return;
+
+	/* Counted even without a limit, which can be set at any time */
+	size = g_bytes_get_size (chunk);
+	soup_server_message_get_admission (msg)->buffered_body_size += size;
+	priv->buffered_body_size += size;
+	if (priv->max_buffered_body_size)
+		update_admission (server);
+}
+
+static void
+release_message (SoupServer        *server,
+		 SoupServerMessage *msg)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupServerMessageAdmission *admission = soup_server_message_get_admission (msg);
+
+	if (admission->in_flight)
+		priv->n_in_flight--;
+	priv->buffered_body_size -= admission->buffered_body_size;
+	admission->in_flight = FALSE;
+	admission->buffered_body_size = 0;
+	update_admission (server);
+
+	if (priv->timeouts)
+		set_client_timeout (server, msg, CLIENT_TIMEOUT_IDLE, 0);
+}
+
+static void
+client_timeout_expired (SoupTimerWheelEntry *entry,
+			gpointer             user_data)
+{
+	SoupServer *server = user_data;
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupServerConnection *conn = (SoupServerConnection *)entry;
+	SoupSocket *sock = conn->sock;
+	GQueue *pipeline;
+
+	/* A request read ahead is not idle while the responses to the
+	 * ones before it are still being worked on.
+	 */
+	pipeline = priv->pipelines ? g_hash_table_lookup (priv->pipelines, sock) : NULL;
+	if (conn->phase != CLIENT_TIMEOUT_BODY && pipeline &&
+	    g_queue_peek_head (pipeline) != conn->msg &&
+	    !soup_server_message_io_has_partial_request (conn->msg)) {
+		soup_timer_wheel_schedule (priv->timeouts, entry,
+					   conn->phase == CLIENT_TIMEOUT_HEADERS && priv->header_timeout ?
+					   priv->header_timeout : priv->idle_timeout);
+		return;
+	}
+
+	/* The client is sending a request: give it the time to finish
+	 * the headers rather than closing the connection under it,
+	 * another idle timeout if there is no header timeout.
+	 */
+	if (conn->phase == CLIENT_TIMEOUT_IDLE &&
+	    soup_server_message_io_has_partial_request (conn->msg)) {
+		conn->phase = CLIENT_TIMEOUT_HEADERS;
+		soup_timer_wheel_schedule (priv->timeouts, entry,
+					   priv->header_timeout ? priv->header_timeout : priv->idle_timeout);
+		return;
+	}
+
+	/* @conn goes away with the connection */
+	g_object_ref (sock);
+	soup_socket_disconnect (sock);
+	g_object_unref (sock);
+}
+
+/* Sets the deadline of the connection of @msg, which is the one
+ * reading from it, or clears it if @timeout is 0.
+ */
+static void
+set_client_timeout (SoupServer         *server,
+		    SoupServerMessage  *msg,
+		    ClientTimeoutPhase  phase,
+		    guint               timeout)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupServerConnection *conn;
+
+	conn = g_hash_table_lookup (priv->connections, soup_server_message_get_soup_socket (msg));
+	if (!conn)
+		return;
+
+	if (!timeout) {
+		if (conn->msg == msg) {
+			soup_timer_wheel_cancel (priv->timeouts, &conn->timeout);
+			conn->msg = NULL;
+		}
+		return;
+	}
+
+	if (!priv->timeouts) {
+		priv->timeouts = soup_timer_wheel_new (g_main_context_get_thread_default (),
+						       client_timeout_expired, server);
+	}
+
+	conn->msg = msg;
+	conn->phase = phase;
+	soup_timer_wheel_schedule (priv->timeouts, &conn->timeout, timeout);
+}
+
+static void
+client_timeout_got_headers (SoupServer        *server,
+			    SoupServerMessage *msg)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+
+	set_client_timeout (server, msg, CLIENT_TIMEOUT_BODY, priv->body_timeout);
+}
+
+static void
+client_timeout_got_body (SoupServer        *server,
+			 SoupServerMessage *msg)
+{
+	set_client_timeout (server, msg, CLIENT_TIMEOUT_BODY, 0);
+}
+
 static void
 got_headers (SoupServer        *server,
 	     SoupServerMessage *msg)
@@ -823,8 +1370,6 @@ got_headers (SoupServer        *server,
 	SoupServerPrivate *priv = soup_server_get_instance_private (server);
 	SoupServerHandler *handler;
 	GUri *uri;
-	GDateTime *date;
-	char *date_string;
 	SoupAuthDomain *domain;
 	GSList *iter;
 	gboolean rejected = FALSE;
@@ -835,15 +1380,14 @@ got_headers (SoupServer        *server,
 	/* Add required response headers */
 	headers = soup_server_message_get_response_headers (msg);
 
-	date = g_date_time_new_now_utc ();
-	date_string = soup_date_time_to_string (date, SOUP_DATE_HTTP);
-	soup_message_headers_replace_common (headers, SOUP_HEADER_DATE, date_string);
-	g_free (date_string);
-	g_date_time_unref (date);
+	soup_message_headers_replace_common (headers, SOUP_HEADER_DATE, get_date_string (server));
 
 	if (soup_server_message_get_status (msg) != 0)
 		return;
 
+	if (!admit_message (server, msg))
+		return;
+
 	sock = soup_server_message_get_soup_socket (msg);
 	uri = soup_server_message_get_uri (msg);
 	if ((soup_socket_is_ssl (sock) && !soup_uri_is_https (uri)) ||
@@ -994,19 +1538,118 @@ client_disconnected (SoupServer        *server,
 		soup_server_message_io_finished (msg);
 }
 
+static GQueue *
+get_pipeline (SoupServer *server,
+	      SoupSocket *sock)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+
+	return priv->pipelines ? g_hash_table_lookup (priv->pipelines, sock) : NULL;
+}
+
+/* Drops the requests that were read ahead on @sock, since the
+ * connection is going away before their responses can be sent, even
+ * for those whose handler already ran. The caller deals with the
+ * connection itself.
+ */
+static void
+abort_pipeline (SoupServer *server,
+		SoupSocket *sock)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupServerMessage *msg;
+	GQueue *pipeline;
+
+	if (!priv->pipelines ||
+	    !g_hash_table_steal_extended (priv->pipelines, sock, NULL, (gpointer *)&pipeline))
+		return;
+
+	/* See request_finished() */
+	priv->aborting_pipeline = sock;
+	while ((msg = g_queue_pop_head (pipeline)))
+		soup_server_message_io_finished (msg);
+	priv->aborting_pipeline = NULL;
+	g_queue_free (pipeline);
+}
+
+/* Keep-alive is only final once the response headers are written,
+ * since the handler may close the connection after the next requests
+ * were read ahead.
+ */
+static void
+pipeline_wrote_headers (SoupServer        *server,
+			SoupServerMessage *msg)
+{
+	SoupSocket *sock = soup_server_message_get_soup_socket (msg);
+	GQueue *pipeline;
+
+	if (soup_server_message_is_keepalive (msg))
+		return;
+
+	pipeline = get_pipeline (server, sock);
+	if (!pipeline)
+		return;
+
+	/* @msg is the one writing, so the head of the pipeline */
+	g_queue_remove (pipeline, msg);
+	abort_pipeline (server, sock);
+}
+
 static void
 soup_server_accept_socket (SoupServer *server,
 			   SoupSocket *sock)
 {
 	SoupServerPrivate *priv = soup_server_get_instance_private (server);
 	SoupServerMessage *msg;
+	GQueue *pipeline = NULL;
 
 	msg = soup_server_message_new (sock);
 	g_signal_connect_object (msg, "disconnected",
 				 G_CALLBACK (client_disconnected),
 				 server, G_CONNECT_SWAPPED);
 	priv->clients = g_slist_prepend (priv->clients, msg);
-	start_request (server, msg);
+
+	if (priv->pipeline_depth > 1) {
+		if (!priv->pipelines)
+			priv->pipelines = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_queue_free);
+
+		pipeline = g_hash_table_lookup (priv->pipelines, sock);
+		if (!pipeline) {
+			pipeline = g_queue_new ();
+			g_hash_table_insert (priv->pipelines, sock, pipeline);
+		}
+		g_queue_push_tail (pipeline, msg);
+	}
+
+	start_request (server, msg, pipeline && pipeline->length > 1);
+}
+
+/* Called once @msg's request has been read completely: if the client
+ * pipelined more requests, start reading the next one right away
+ * rather than after @msg's response has been sent.
+ */
+static void
+read_ahead (SoupServer        *server,
+	    SoupServerMessage *msg)
+{
+	SoupServerPrivate *priv = soup_server_get_instance_private (server);
+	SoupSocket *sock = soup_server_message_get_soup_socket (msg);
+	GQueue *pipeline;
+
+	pipeline = get_pipeline (server, sock);
+	if (!pipeline || g_queue_peek_tail (pipeline) != msg ||
+	    pipeline->length >= priv->pipeline_depth)
+		return;
+
+	/* The connection won't carry another request after this one */
+	if (!soup_socket_is_connected (sock) || !priv->listeners ||
+	    !soup_server_message_is_keepalive (msg) ||
+	    soup_server_message_get_method (msg) == SOUP_METHOD_CONNECT ||
+	    soup_server_message_get_status (msg) == SOUP_STATUS_SWITCHING_PROTOCOLS ||
+	    soup_message_headers_get_one_common (soup_server_message_get_request_headers (msg), SOUP_HEADER_UPGRADE))
+		return;
+
+	soup_server_accept_socket (server, sock);
 }
 
 static void
@@ -1016,9 +1659,19 @@ request_finished (SoupServerMessage      *msg,
 {
 	SoupServerPrivate *priv = soup_server_get_instance_private (server);
 	SoupSocket *sock = soup_server_message_get_soup_socket (msg);
+	GQueue *pipeline;
 	gboolean failed;
 
+	pipeline = get_pipeline (server, sock);
+	if (pipeline)
+		g_queue_remove (pipeline, msg);
+
+	release_message (server, msg);
+
 	if (completion == SOUP_MESSAGE_IO_STOLEN) {
+		/* The connection is no longer the server's */
+		connection_disconnected (server, sock);
+		abort_pipeline (server, sock);
 		g_object_unref (msg);
 		return;
 	}
@@ -1034,6 +1687,13 @@ request_finished (SoupServerMessage      *msg,
 			       0, msg);
 	}
 
+	/* Read ahead and dropped with the rest of the pipeline */
+	if (sock == priv->aborting_pipeline) {
+		priv->clients = g_slist_remove (priv->clients, msg);
+		g_object_unref (msg);
+		return;
+	}
+
 	if (completion == SOUP_MESSAGE_IO_COMPLETE &&
 	    soup_socket_is_connected (sock) &&
 	    soup_server_message_is_keepalive (msg) &&
@@ -1042,18 +1702,37 @@ request_finished (SoupServerMessage      *msg,
 		priv->clients = g_slist_remove (priv->clients, msg);
 		g_object_unref (msg);
 
-		soup_server_accept_socket (server, sock);
+		/* The next request may already have been read ahead, and
+		 * the responses after it too; write the ones that are
+		 * ready at once.
+		 */
+		pipeline = get_pipeline (server, sock);
+		if (pipeline && !g_queue_is_empty (pipeline)) {
+			SoupServerMessage *tail = g_queue_peek_tail (pipeline);
+
+			soup_server_message_io_coalesce_responses (pipeline->head);
+			soup_server_message_io_unblock_write (g_queue_peek_head (pipeline));
+
+			/* If the pipeline was full, reading ahead stopped
+			 * at its tail; there is room again now.
+			 */
+			if (soup_server_message_io_request_is_read (tail))
+				read_ahead (server, tail);
+		} else
+			soup_server_accept_socket (server, sock);
 		g_object_unref (sock);
 		return;
 	}
 
+	abort_pipeline (server, sock);
 	soup_socket_disconnect (sock);
 	g_object_unref (msg);
 }
 
 static void
 start_request (SoupServer        *server,
-	       SoupServerMessage *msg)
+	       SoupServerMessage *msg,
+	       gboolean           write_blocked)
 {
 	SoupServerPrivate *priv = soup_server_get_instance_private (server);
 
@@ -1071,10 +1750,33 @@ start_request (SoupServer        *server,
 	g_signal_connect_object (msg, "got-body",
 				 G_CALLBACK (got_body),
 				 server, G_CONNECT_SWAPPED);
+	if (priv->idle_timeout || priv->header_timeout || priv->body_timeout) {
+		g_signal_connect_object (msg, "got-headers",
+					 G_CALLBACK (client_timeout_got_headers),
+					 server, G_CONNECT_SWAPPED);
+		g_signal_connect_object (msg, "got-body",
+					 G_CALLBACK (client_timeout_got_body),
+					 server, G_CONNECT_SWAPPED);
+		if (priv->idle_timeout)
+			set_client_timeout (server, msg, CLIENT_TIMEOUT_IDLE, priv->idle_timeout);
+		else
+			set_client_timeout (server, msg, CLIENT_TIMEOUT_HEADERS, priv->header_timeout);
+	}
+	g_signal_connect_object (msg, "got-chunk",
+				 G_CALLBACK (count_body_chunk),
+				 server, G_CONNECT_SWAPPED);
+	if (priv->pipeline_depth > 1) {
+		g_signal_connect_object (msg, "got-body",
+					 G_CALLBACK (read_ahead),
+					 server, G_CONNECT_SWAPPED);
+		g_signal_connect_object (msg, "wrote-headers",
+					 G_CALLBACK (pipeline_wrote_headers),
+					 server, G_CONNECT_SWAPPED);
+	}
 
 	g_signal_emit (server, signals[REQUEST_STARTED], 0, msg);
 
-	soup_server_message_read_request (msg,
+	soup_server_message_read_request (msg, write_blocked,
 					  (SoupMessageIOCompletionFn)request_finished,
 					  server);
 }
@@ -1112,17 +1814,100 @@ soup_server_accept_iostream (SoupServer     *server,
 	if (!sock)
 		return FALSE;
 
+	track_connection (server, sock);
 	soup_server_accept_socket (server, sock);
 	g_object_unref (sock);
 
 	return TRUE;
 }
 
+/**
+ * soup_server_get_n_connections:
+ * @server: a #SoupServer
+ *
+ * Gets the number of client connections @server currently has open.
+ *
+ * Returns: the number of open connections
+ */
+guint
+soup_server_get_n_connections (SoupServer *server)
+{
+	SoupServerPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SERVER (server), 0);
+	priv = soup_server_get_instance_private (server);
+
+	return g_hash_table_size (priv->connections);
+}
+
+/**
+ * soup_server_get_n_in_flight:
+ * @server: a #SoupServer
+ *
+ * Gets the number of requests @server is currently processing, as
+ * limited by #SoupServer:max-in-flight.
+ *
+ * Returns: the number of requests in flight
+ */
+guint
+soup_server_get_n_in_flight (SoupServer *server)
+{
+	SoupServerPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SERVER (server), 0);
+	priv = soup_server_get_instance_private (server);
+
+	return priv->n_in_flight;
+}
+
+/**
+ * soup_server_get_buffered_body_size:
+ * @server: a #SoupServer
+ *
+ * Gets the number of request body bytes @server currently holds in
+ * memory. This is only accounted while #SoupServer:max-buffered-body-size
+ * is set.
+ *
+ * Returns: the size of the buffered request bodies
+ */
+guint64
+soup_server_get_buffered_body_size (SoupServer *server)
+{
+	SoupServerPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SERVER (server), 0);
+	priv = soup_server_get_instance_private (server);
+
+	return priv->buffered_body_size;
+}
+
+/**
+ * soup_server_get_n_rejected:
+ * @server: a #SoupServer
+ *
+ * Gets the number of requests @server has answered with
+ * %SOUP_STATUS_SERVICE_UNAVAILABLE because it was over one of its
+ * limits.
+ *
+ * Returns: the number of rejected requests
+ */
+guint64
+soup_server_get_n_rejected (SoupServer *server)
+{
+	SoupServerPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SERVER (server), 0);
+	priv = soup_server_get_instance_private (server);
+
+	return priv->n_rejected;
+}
+
 static void
 new_connection (SoupSocket *listener, SoupSocket *sock, gpointer user_data)
 {
 	SoupServer *server = user_data;
 
+	track_connection (server, sock);
 	soup_server_accept_socket (server, sock);
 }
 
@@ -1230,6 +2015,8 @@ soup_server_listen_internal (SoupServer *server, SoupSocket *listener,
 
 	g_signal_connect (listener, "new_connection",
 			  G_CALLBACK (new_connection), server);
+	if (priv->accept_paused)
+		soup_socket_pause_accept (listener);
 
 	/* Note: soup_server_listen_ipv4_ipv6() below relies on the
 	 * fact that this does g_slist_prepend().
@@ -1288,6 +2075,7 @@ soup_server_listen (SoupServer *server, GSocketAddress *address,
         ipv6_only = g_socket_address_get_family (address) == G_SOCKET_FAMILY_IPV6;
 	listener = soup_socket_new ("local-address", address,
 				    "ipv6-only", ipv6_only,
+				    "socket-options", priv->socket_options,
 				    NULL);
 
 	success = soup_server_listen_internal (server, listener, options, error);
@@ -1512,6 +2300,7 @@ soup_server_listen_socket (SoupServer *server, GSocket *socket,
 	listener = g_initable_new (SOUP_TYPE_SOCKET, NULL, error,
 				   "gsocket", socket,
 				   "ipv6-only", TRUE,
+				   "socket-options", priv->socket_options,
 				   NULL);
 	if (!listener)
 		return FALSE;
@@ -1610,20 +2399,28 @@ soup_server_get_uris (SoupServer *server)
  **/
 
 static SoupServerHandler *
-get_or_create_handler (SoupServer *server, const char *exact_path)
+get_or_create_handler (SoupServer *server,
+		       const char *method,
+		       const char *exact_path,
+		       gboolean    is_route)
 {
 	SoupServerPrivate *priv = soup_server_get_instance_private (server);
 	SoupServerHandler *handler;
 
 	exact_path = NORMALIZED_PATH (exact_path);
 
-	handler = soup_path_map_lookup (priv->handlers, exact_path);
-	if (handler && !strcmp (handler->path, exact_path))
+	handler = soup_path_map_lookup_route (priv->handlers, method, exact_path, NULL);
+	if (handler && !g_strcmp0 (handler->method, method) &&
+	    !strcmp (handler->path, exact_path))
 		return handler;
 
 	handler = g_slice_new0 (SoupServerHandler);
 	handler->path = g_strdup (exact_path);
-	soup_path_map_add (priv->handlers, exact_path, handler);
+	handler->method = method ? g_intern_string (method) : NULL;
+	if (is_route)
+		soup_path_map_add_route (priv->handlers, method, exact_path, handler);
+	else
+		soup_path_map_add (priv->handlers, exact_path, handler);
 
 	return handler;
 }
@@ -1684,7 +2481,7 @@ soup_server_add_handler (SoupServer            *server,
 	g_return_if_fail (SOUP_IS_SERVER (server));
 	g_return_if_fail (callback != NULL);
 
-	handler = get_or_create_handler (server, path);
+	handler = get_or_create_handler (server, NULL, path, FALSE);
 	if (handler->destroy)
 		handler->destroy (handler->user_data);
 
@@ -1742,7 +2539,7 @@ soup_server_add_early_handler (SoupServer            *server,
 	g_return_if_fail (SOUP_IS_SERVER (server));
 	g_return_if_fail (callback != NULL);
 
-	handler = get_or_create_handler (server, path);
+	handler = get_or_create_handler (server, NULL, path, FALSE);
 	if (handler->early_destroy)
 		handler->early_destroy (handler->early_user_data);
 
@@ -1811,7 +2608,7 @@ soup_server_add_websocket_handler (SoupServer                   *server,
 	g_return_if_fail (SOUP_IS_SERVER (server));
 	g_return_if_fail (callback != NULL);
 
-	handler = get_or_create_handler (server, path);
+	handler = get_or_create_handler (server, NULL, path, FALSE);
 	if (handler->websocket_destroy)
 		handler->websocket_destroy (handler->websocket_user_data);
 	if (handler->websocket_origin)
@@ -1846,6 +2643,78 @@ soup_server_remove_handler (SoupServer *server, const char *path)
 	soup_path_map_remove (priv->handlers, NORMALIZED_PATH (path));
 }
 
+/**
+ * soup_server_add_route:
+ * @server: a #SoupServer
+ * @method: (allow-none): the method to handle, or %NULL for any method
+ * @pattern: (allow-none): the toplevel path for the handler
+ * @callback: callback to invoke for requests matching @pattern
+ * @user_data: data for @callback
+ * @destroy: destroy notifier to free @user_data
+ *
+ * Like soup_server_add_handler(), but @pattern can contain parameters
+ * and the handler can be restricted to a single @method.
+ *
+ * A "{name}" segment in @pattern matches one or more characters up to
+ * the next "/", and its value can be retrieved from the handler with
+ * soup_server_message_get_path_param(). For example a route for
+ * "/users/{id}/posts" handles "/users/42/posts", and also, as with
+ * any other handler, the paths under it. When both match, fixed
+ * segments take precedence over parameters, so a handler for
+ * "/users/me" is preferred over "/users/{id}".
+ *
+ * Handlers added for @method take precedence over handlers added for
+ * any method at the same @pattern; requests with other methods fall
+ * back to the closest handler that accepts them.
+ *
+ * Routes are matched with a radix tree, so dispatching a request
+ * costs time proportional to the length of its path rather than to
+ * the number of handlers.
+ **/
+void
+soup_server_add_route (SoupServer            *server,
+		       const char            *method,
+		       const char            *pattern,
+		       SoupServerCallback     callback,
+		       gpointer               user_data,
+		       GDestroyNotify         destroy)
+{
+	SoupServerHandler *handler;
+
+	g_return_if_fail (SOUP_IS_SERVER (server));
+	g_return_if_fail (callback != NULL);
+
+	handler = get_or_create_handler (server, method, pattern, TRUE);
+	if (handler->destroy)
+		handler->destroy (handler->user_data);
+
+	handler->callback   = callback;
+	handler->destroy    = destroy;
+	handler->user_data  = user_data;
+}
+
+/**
+ * soup_server_remove_route:
+ * @server: a #SoupServer
+ * @method: (allow-none): the method the route was added for
+ * @pattern: the pattern the route was added with
+ *
+ * Removes the handler added with soup_server_add_route() for @method
+ * at @pattern.
+ **/
+void
+soup_server_remove_route (SoupServer *server,
+			  const char *method,
+			  const char *pattern)
+{
+	SoupServerPrivate *priv;
+
+	g_return_if_fail (SOUP_IS_SERVER (server));
+	priv = soup_server_get_instance_private (server);
+
+	soup_path_map_remove_route (priv->handlers, method, NORMALIZED_PATH (pattern));
+}
+
 /**
  * soup_server_add_auth_domain:
  * @server: a #SoupServer
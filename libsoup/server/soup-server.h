@@ -97,6 +97,15 @@ gboolean        soup_server_accept_iostream    (SoupServer               *server
 						GSocketAddress           *remote_addr,
 						GError                  **error);
 
+SOUP_AVAILABLE_IN_ALL
+guint           soup_server_get_n_connections      (SoupServer           *server);
+SOUP_AVAILABLE_IN_ALL
+guint           soup_server_get_n_in_flight        (SoupServer           *server);
+SOUP_AVAILABLE_IN_ALL
+guint64         soup_server_get_buffered_body_size (SoupServer           *server);
+SOUP_AVAILABLE_IN_ALL
+guint64         soup_server_get_n_rejected         (SoupServer           *server);
+
 /* Handlers and auth */
 
 typedef void  (*SoupServerCallback)            (SoupServer         *server,
@@ -142,6 +151,18 @@ SOUP_AVAILABLE_IN_ALL
 void            soup_server_remove_handler     (SoupServer         *server,
 					        const char         *path);
 
+SOUP_AVAILABLE_IN_ALL
+void            soup_server_add_route          (SoupServer         *server,
+						const char         *method,
+						const char         *pattern,
+						SoupServerCallback  callback,
+						gpointer            user_data,
+						GDestroyNotify      destroy);
+SOUP_AVAILABLE_IN_ALL
+void            soup_server_remove_route       (SoupServer         *server,
+						const char         *method,
+						const char         *pattern);
+
 SOUP_AVAILABLE_IN_ALL
 void            soup_server_add_auth_domain    (SoupServer         *server,
 					        SoupAuthDomain     *auth_domain);
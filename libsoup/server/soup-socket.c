@@ -17,6 +17,7 @@
 #include "soup-socket.h"
 #include "soup.h"
 #include "soup-io-stream.h"
+#include "soup-socket-options-private.h"
 
 /*<private>
  * SECTION:soup-socket
@@ -49,6 +50,7 @@ enum {
 	PROP_TLS_CERTIFICATE,
         PROP_TLS_DATABASE,
         PROP_TLS_AUTH_MODE,
+        PROP_SOCKET_OPTIONS,
 
 	LAST_PROPERTY
 };
@@ -69,12 +71,16 @@ typedef struct {
 
 	guint ipv6_only:1;
 	guint ssl:1;
+	guint accept_paused:1;
 	GTlsCertificate *tls_certificate;
         GTlsDatabase *tls_database;
         GTlsAuthenticationMode tls_auth_mode;
+        SoupSocketOptions *socket_options;
 
 	GMainContext   *async_context;
 	GSource        *watch_src;
+
+	GString        *write_buf;
 } SoupSocketPrivate;
 
 static void soup_socket_initable_interface_init (GInitableIface *initable_interface);
@@ -123,8 +129,10 @@ soup_socket_initable_init (GInitable     *initable,
 		}
 
 		finish_socket_setup (sock);
-		if (listening)
+		if (listening) {
+			soup_socket_options_apply_listener (priv->socket_options, priv->gsock);
 			finish_listener_setup (sock);
+		}
 		else if (!g_socket_is_connected (priv->gsock)) {
 			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
 					     _("Can’t import unconnected socket"));
@@ -168,6 +176,7 @@ soup_socket_finalize (GObject *object)
 
 	g_clear_object (&priv->tls_certificate);
         g_clear_object (&priv->tls_database);
+        g_clear_pointer (&priv->socket_options, soup_socket_options_free);
 
 	if (priv->watch_src) {
 		g_source_destroy (priv->watch_src);
@@ -175,6 +184,9 @@ soup_socket_finalize (GObject *object)
 	}
 	g_clear_pointer (&priv->async_context, g_main_context_unref);
 
+	if (priv->write_buf)
+		g_string_free (priv->write_buf, TRUE);
+
 	G_OBJECT_CLASS (soup_socket_parent_class)->finalize (object);
 }
 
@@ -187,7 +199,7 @@ finish_socket_setup (SoupSocket *sock)
 		if (!priv->conn)
 			priv->conn = (GIOStream *)g_socket_connection_factory_create_connection (priv->gsock);
 
-		g_socket_set_option (priv->gsock, IPPROTO_TCP, TCP_NODELAY, TRUE, NULL);
+		soup_socket_options_apply_server (priv->socket_options, priv->gsock);
 	}
 
 	if (!priv->conn)
@@ -236,6 +248,10 @@ soup_socket_set_property (GObject *object, guint prop_id,
         case PROP_TLS_AUTH_MODE:
                 priv->tls_auth_mode = g_value_get_enum (value);
                 break;
+        case PROP_SOCKET_OPTIONS:
+                g_clear_pointer (&priv->socket_options, soup_socket_options_free);
+                priv->socket_options = g_value_dup_boxed (value);
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -271,6 +287,9 @@ soup_socket_get_property (GObject *object, guint prop_id,
         case PROP_TLS_AUTH_MODE:
                 g_value_set_enum (value, priv->tls_auth_mode);
                 break;
+        case PROP_SOCKET_OPTIONS:
+                g_value_set_boxed (value, priv->socket_options);
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -410,6 +429,14 @@ soup_socket_class_init (SoupSocketClass *socket_class)
                                      G_PARAM_READWRITE |
                                      G_PARAM_STATIC_STRINGS);
 
+        properties[PROP_SOCKET_OPTIONS] =
+                g_param_spec_boxed ("socket-options",
+                                    "Socket options",
+                                    "Options applied to the socket and the accepted ones",
+                                    SOUP_TYPE_SOCKET_OPTIONS,
+                                    G_PARAM_READWRITE |
+                                    G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
 
@@ -556,6 +583,8 @@ listen_watch (GObject *pollable, gpointer data)
         if (priv->tls_database)
                 new_priv->tls_database = g_object_ref (priv->tls_database);
         new_priv->tls_auth_mode = priv->tls_auth_mode;
+        if (priv->socket_options)
+                new_priv->socket_options = soup_socket_options_copy (priv->socket_options);
 	finish_socket_setup (new);
 
 	if (new_priv->tls_certificate) {
@@ -576,11 +605,46 @@ finish_listener_setup (SoupSocket *sock)
 {
 	SoupSocketPrivate *priv = soup_socket_get_instance_private (sock);
 
+	if (priv->accept_paused)
+		return;
+
 	priv->watch_src = g_pollable_input_stream_create_source (G_POLLABLE_INPUT_STREAM (priv->istream), NULL);
 	g_source_set_callback (priv->watch_src, (GSourceFunc)listen_watch, sock, NULL);
 	g_source_attach (priv->watch_src, priv->async_context);
 }
 
+/* Stops (or restarts) accepting connections on the listening socket
+ * @sock. Connections that arrive meanwhile wait in the kernel's
+ * backlog.
+ */
+void
+soup_socket_pause_accept (SoupSocket *sock)
+{
+	SoupSocketPrivate *priv = soup_socket_get_instance_private (sock);
+
+	if (priv->accept_paused)
+		return;
+
+	priv->accept_paused = TRUE;
+	if (priv->watch_src) {
+		g_source_destroy (priv->watch_src);
+		g_clear_pointer (&priv->watch_src, g_source_unref);
+	}
+}
+
+void
+soup_socket_unpause_accept (SoupSocket *sock)
+{
+	SoupSocketPrivate *priv = soup_socket_get_instance_private (sock);
+
+	if (!priv->accept_paused)
+		return;
+
+	priv->accept_paused = FALSE;
+	if (priv->conn && !priv->watch_src)
+		finish_listener_setup (sock);
+}
+
 /**
  * soup_socket_listen:
  * @sock: a server #SoupSocket (which must not already be connected or listening)
@@ -634,6 +698,8 @@ soup_socket_listen (SoupSocket *sock,
 	/* Force local_addr to be re-resolved now */
         g_clear_object (&priv->local_addr);
 
+	soup_socket_options_apply_listener (priv->socket_options, priv->gsock);
+
 	/* Listen */
 	if (!g_socket_listen (priv->gsock, error))
 		goto cant_listen;
@@ -804,3 +870,21 @@ soup_socket_get_connection (SoupSocket *sock)
 
 	return priv->conn;
 }
+
+/* Returns a buffer for the messages on @sock to format their headers
+ * into, so that it is allocated once per connection rather than once
+ * per request. Only one message writes to a connection at a time, and
+ * it must only get the buffer when it starts writing.
+ */
+GString *
+soup_socket_get_write_buffer (SoupSocket *sock)
+{
+	SoupSocketPrivate *priv = soup_socket_get_instance_private (sock);
+
+	if (!priv->write_buf)
+		priv->write_buf = g_string_sized_new (1024);
+	else
+		g_string_truncate (priv->write_buf, 0);
+
+	return priv->write_buf;
+}
@@ -17,6 +17,8 @@ SoupSocket    *soup_socket_new                (const char         *optname1,
 
 gboolean       soup_socket_listen             (SoupSocket         *sock,
 					       GError            **error);
+void           soup_socket_pause_accept       (SoupSocket         *sock);
+void           soup_socket_unpause_accept     (SoupSocket         *sock);
 
 gboolean       soup_socket_is_ssl             (SoupSocket         *sock);
 
@@ -30,4 +32,6 @@ GIOStream     *soup_socket_get_iostream       (SoupSocket         *sock);
 GInetSocketAddress   *soup_socket_get_local_address  (SoupSocket         *sock);
 GInetSocketAddress   *soup_socket_get_remote_address (SoupSocket         *sock);
 
+GString              *soup_socket_get_write_buffer   (SoupSocket         *sock);
+
 G_END_DECLS
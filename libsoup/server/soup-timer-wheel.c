@@ -0,0 +1,225 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-timer-wheel.c: coarse deadlines for many objects
+ *
+ * Copyright (C) 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-timer-wheel.h"
+
+/* A hashed timer wheel: deadlines are rounded up to a tick and each
+ * entry is kept in the slot for its tick modulo the number of slots,
+ * in an intrusive circular list, so that scheduling, rescheduling
+ * and cancelling are O(1) no matter how many entries there are. A
+ * single GSource walks the slots as time passes and is only attached
+ * while there is something scheduled. Entries further in the future
+ * than one turn of the wheel are simply skipped until their turn
+ * comes.
+ */
+
+#define TICK_USEC (250 * G_TIME_SPAN_MILLISECOND)
+#define N_SLOTS   256
+
+struct SoupTimerWheel {
+	SoupTimerWheelEntry slots[N_SLOTS];
+	guint64             current;
+	guint               n_entries;
+
+	GMainContext       *context;
+	GSource            *source;
+
+	SoupTimerWheelFunc  func;
+	gpointer            user_data;
+};
+
+static inline guint64
+get_tick (void)
+{
+	return g_get_monotonic_time () / TICK_USEC;
+}
+
+static inline void
+list_init (SoupTimerWheelEntry *head)
+{
+	head->prev = head->next = head;
+}
+
+static inline void
+list_append (SoupTimerWheelEntry *head,
+	     SoupTimerWheelEntry *entry)
+{
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+static inline void
+list_unlink (SoupTimerWheelEntry *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static gboolean advance (gpointer user_data);
+
+static void
+update_source (SoupTimerWheel *wheel)
+{
+	if (wheel->n_entries && !wheel->source) {
+		/* The wheel may have been idle for a while */
+		wheel->current = get_tick ();
+
+		wheel->source = g_timeout_source_new (TICK_USEC / G_TIME_SPAN_MILLISECOND);
+		g_source_set_name (wheel->source, "Soup server timer wheel");
+		g_source_set_callback (wheel->source, advance, wheel, NULL);
+		g_source_attach (wheel->source, wheel->context);
+	} else if (!wheel->n_entries && wheel->source) {
+		g_source_destroy (wheel->source);
+		g_clear_pointer (&wheel->source, g_source_unref);
+	}
+}
+
+static void
+expire_slot (SoupTimerWheel *wheel,
+	     guint64         tick)
+{
+	SoupTimerWheelEntry *slot = &wheel->slots[tick % N_SLOTS];
+	SoupTimerWheelEntry pending, *entry;
+
+	if (slot->next == slot)
+		return;
+
+	/* Move the slot aside, so that entries rescheduled or cancelled
+	 * from the callback don't disturb the walk.
+	 */
+	pending.next = slot->next;
+	pending.prev = slot->prev;
+	pending.next->prev = &pending;
+	pending.prev->next = &pending;
+	list_init (slot);
+
+	while (pending.next != &pending) {
+		entry = pending.next;
+		list_unlink (entry);
+
+		if (entry->expires > tick) {
+			list_append (slot, entry);
+			continue;
+		}
+
+		wheel->n_entries--;
+		wheel->func (entry, wheel->user_data);
+	}
+}
+
+static gboolean
+advance (gpointer user_data)
+{
+	SoupTimerWheel *wheel = user_data;
+	guint64 now = get_tick ();
+
+	if (now - wheel->current >= N_SLOTS) {
+		/* We fell behind by more than a turn, e.g. after a
+		 * suspend; every slot is due.
+		 */
+		guint i;
+
+		for (i = 0; i < N_SLOTS && wheel->n_entries; i++)
+			expire_slot (wheel, now - i);
+	} else {
+		while (wheel->current < now && wheel->n_entries) {
+			wheel->current++;
+			expire_slot (wheel, wheel->current);
+		}
+	}
+	wheel->current = now;
+
+	if (!wheel->n_entries) {
+		g_clear_pointer (&wheel->source, g_source_unref);
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+SoupTimerWheel *
+soup_timer_wheel_new (GMainContext       *context,
+		      SoupTimerWheelFunc  func,
+		      gpointer            user_data)
+{
+	SoupTimerWheel *wheel;
+	guint i;
+
+	wheel = g_new0 (SoupTimerWheel, 1);
+	for (i = 0; i < N_SLOTS; i++)
+		list_init (&wheel->slots[i]);
+	wheel->context = context ? g_main_context_ref (context) : NULL;
+	wheel->func = func;
+	wheel->user_data = user_data;
+
+	return wheel;
+}
+
+void
+soup_timer_wheel_free (SoupTimerWheel *wheel)
+{
+	guint i;
+
+	for (i = 0; i < N_SLOTS; i++) {
+		while (wheel->slots[i].next != &wheel->slots[i])
+			list_unlink (wheel->slots[i].next);
+	}
+	wheel->n_entries = 0;
+	update_source (wheel);
+
+	g_clear_pointer (&wheel->context, g_main_context_unref);
+	g_free (wheel);
+}
+
+/* (Re)schedules @entry to expire in @timeout seconds, give or take a
+ * tick.
+ */
+void
+soup_timer_wheel_schedule (SoupTimerWheel      *wheel,
+			   SoupTimerWheelEntry *entry,
+			   guint                timeout)
+{
+	guint64 expires;
+
+	if (entry->next)
+		list_unlink (entry);
+	else
+		wheel->n_entries++;
+
+	update_source (wheel);
+
+	/* Round up, so that an entry never expires early */
+	expires = MAX (get_tick (), wheel->current) + 1 +
+		(timeout * G_TIME_SPAN_SECOND + TICK_USEC - 1) / TICK_USEC;
+	entry->expires = expires;
+	list_append (&wheel->slots[expires % N_SLOTS], entry);
+}
+
+void
+soup_timer_wheel_cancel (SoupTimerWheel      *wheel,
+			 SoupTimerWheelEntry *entry)
+{
+	if (!entry->next)
+		return;
+
+	list_unlink (entry);
+	wheel->n_entries--;
+	update_source (wheel);
+}
+
+gboolean
+soup_timer_wheel_is_scheduled (SoupTimerWheelEntry *entry)
+{
+	return entry->next != NULL;
+}
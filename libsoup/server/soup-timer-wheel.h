@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2021 Igalia S.L.
+ */
+
+#ifndef __SOUP_TIMER_WHEEL_H__
+#define __SOUP_TIMER_WHEEL_H__ 1
+
+#include "soup-types.h"
+
+typedef struct SoupTimerWheel SoupTimerWheel;
+typedef struct SoupTimerWheelEntry SoupTimerWheelEntry;
+
+typedef void (*SoupTimerWheelFunc) (SoupTimerWheelEntry *entry,
+				    gpointer             user_data);
+
+/* Embed this in the object whose deadline is tracked; it must be
+ * zero-initialized before its first use.
+ */
+struct SoupTimerWheelEntry {
+	SoupTimerWheelEntry *prev, *next;
+	guint64              expires;
+};
+
+SoupTimerWheel *soup_timer_wheel_new          (GMainContext        *context,
+					       SoupTimerWheelFunc   func,
+					       gpointer             user_data);
+void            soup_timer_wheel_free         (SoupTimerWheel      *wheel);
+
+void            soup_timer_wheel_schedule     (SoupTimerWheel      *wheel,
+					       SoupTimerWheelEntry *entry,
+					       guint                timeout);
+void            soup_timer_wheel_cancel       (SoupTimerWheel      *wheel,
+					       SoupTimerWheelEntry *entry);
+gboolean        soup_timer_wheel_is_scheduled (SoupTimerWheelEntry *entry);
+
+#endif /* __SOUP_TIMER_WHEEL_H__ */
@@ -0,0 +1,115 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-adaptive-limit.c: per-host connection limit from observed load
+ *
+ * Copyright 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "soup-adaptive-limit.h"
+
+/* Every WINDOW_SAMPLES finished messages the limit is reconsidered:
+ *
+ * - if more than 1 in FAILURE_RATIO messages failed (transport errors
+ *   or the server telling us to back off), it shrinks by a quarter;
+ * - if the average latency went over LATENCY_FACTOR times the best
+ *   one seen, the host is likely saturated and it shrinks by one;
+ * - if at least 1 in WAIT_RATIO messages had to wait for a free slot,
+ *   for a noticeable time compared to the latency, it grows by one.
+ *
+ * Growing additively and shrinking faster keeps the host from being
+ * flooded while letting busy hosts reach their throughput over a few
+ * windows.
+ */
+
+#define WINDOW_SAMPLES 8
+#define FAILURE_RATIO  10
+#define LATENCY_FACTOR 2
+#define WAIT_RATIO     4
+
+void
+soup_adaptive_limit_init (SoupAdaptiveLimit *limit,
+			  guint              initial)
+{
+	memset (limit, 0, sizeof (SoupAdaptiveLimit));
+	limit->limit = initial;
+}
+
+guint
+soup_adaptive_limit_get (SoupAdaptiveLimit *limit,
+			 guint              min,
+			 guint              max)
+{
+	return CLAMP (limit->limit, min, MAX (min, max));
+}
+
+static void
+reset_window (SoupAdaptiveLimit *limit)
+{
+	limit->n_samples = limit->n_waited = limit->n_failed = 0;
+	limit->wait_sum = limit->latency_sum = 0;
+}
+
+/* Records a finished message: whether and how long it waited for a
+ * connection slot, and the time from getting the connection to the
+ * end of the response, in microseconds. Returns %TRUE if the limit
+ * changed.
+ */
+gboolean
+soup_adaptive_limit_record (SoupAdaptiveLimit *limit,
+			    guint              min,
+			    guint              max,
+			    gboolean           waited,
+			    gint64             wait,
+			    gint64             latency,
+			    gboolean           failed)
+{
+	guint old_limit, new_limit;
+	gint64 avg_latency;
+
+	limit->n_samples++;
+	if (waited) {
+		limit->n_waited++;
+		limit->wait_sum += MAX (wait, 0);
+	}
+	if (failed)
+		limit->n_failed++;
+	else
+		limit->latency_sum += MAX (latency, 0);
+
+	if (limit->n_samples < WINDOW_SAMPLES)
+		return FALSE;
+
+	old_limit = new_limit = soup_adaptive_limit_get (limit, min, max);
+
+	avg_latency = limit->n_samples > limit->n_failed ?
+		limit->latency_sum / (limit->n_samples - limit->n_failed) : 0;
+
+	if (limit->n_failed * FAILURE_RATIO > limit->n_samples) {
+		new_limit = old_limit - MAX (old_limit / 4, 1);
+	} else if (limit->base_latency &&
+		   avg_latency > LATENCY_FACTOR * limit->base_latency) {
+		new_limit = old_limit - 1;
+	} else if (limit->n_waited * WAIT_RATIO >= limit->n_samples &&
+		   limit->wait_sum / limit->n_waited * WAIT_RATIO >= avg_latency) {
+		new_limit = old_limit + 1;
+	}
+
+	if (avg_latency) {
+		if (!limit->base_latency || avg_latency < limit->base_latency)
+			limit->base_latency = avg_latency;
+		else
+			limit->base_latency += (avg_latency - limit->base_latency) / 8;
+	}
+
+	reset_window (limit);
+
+	limit->limit = CLAMP (new_limit, min, MAX (min, max));
+
+	return limit->limit != old_limit;
+}
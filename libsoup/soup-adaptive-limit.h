@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Per-host connection limit that follows the observed load */
+typedef struct {
+	guint  limit;
+
+	/* Current window */
+	guint  n_samples;
+	guint  n_waited;
+	guint  n_failed;
+	gint64 wait_sum;
+	gint64 latency_sum;
+
+	/* Lowest average latency seen, slowly following drifts */
+	gint64 base_latency;
+} SoupAdaptiveLimit;
+
+void     soup_adaptive_limit_init   (SoupAdaptiveLimit *limit,
+				     guint              initial);
+guint    soup_adaptive_limit_get    (SoupAdaptiveLimit *limit,
+				     guint              min,
+				     guint              max);
+gboolean soup_adaptive_limit_record (SoupAdaptiveLimit *limit,
+				     guint              min,
+				     guint              max,
+				     gboolean           waited,
+				     gint64             wait,
+				     gint64             latency,
+				     gboolean           failed);
+
+G_END_DECLS
@@ -11,14 +11,16 @@
 
 #include "soup-connection.h"
 #include "soup.h"
+#include "soup-dns-cache.h"
 #include "soup-io-stream.h"
 #include "soup-message-queue-item.h"
 #include "soup-client-message-io-http1.h"
 #include "soup-client-message-io-http2.h"
 #include "soup-socket-properties.h"
+#include "soup-socket-options-private.h"
 #include "soup-private-enum-types.h"
 #include "soup-tls-interaction.h"
-#include <gio/gnetworking.h>
+#include "soup-tls-session-cache.h"
 
 struct _SoupConnection {
         GObject parent_instance;
@@ -45,6 +47,8 @@ typedef struct {
         SoupHTTPVersion http_version;
 
         GTlsCertificate *tls_client_cert;
+        char *tls_session_origin;
+        gboolean tls_session_stored;
 
 	GCancellable *cancellable;
 } SoupConnectionPrivate;
@@ -122,6 +126,7 @@ soup_connection_finalize (GObject *object)
 
 	g_clear_object (&priv->iostream);
         g_clear_object (&priv->tls_client_cert);
+        g_free (priv->tls_session_origin);
 
 	G_OBJECT_CLASS (soup_connection_parent_class)->finalize (object);
 }
@@ -493,10 +498,20 @@ re_emit_socket_event (GSocketClient       *client,
 		      GIOStream           *connection,
 		      SoupConnection      *conn)
 {
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
 	/* We handle COMPLETE ourselves */
 	if (event == G_SOCKET_CLIENT_COMPLETE)
 		return;
 
+        /* Some options, like the receive buffer size or TCP Fast
+         * Open, only work if set before connecting.
+         */
+        if (event == G_SOCKET_CLIENT_CONNECTING) {
+                soup_socket_options_apply_client (priv->socket_props->socket_options,
+                                                  g_socket_connection_get_socket (G_SOCKET_CONNECTION (connection)));
+        }
+
 	soup_connection_event (conn, event, connection);
 }
 
@@ -565,6 +580,7 @@ new_tls_connection (SoupConnection    *conn,
         SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
         GTlsClientConnection *tls_connection;
         GTlsInteraction *tls_interaction;
+        GSocketConnectable *server_identity;
         GPtrArray *advertised_protocols = g_ptr_array_sized_new (4);
 
         // https://www.iana.org/assignments/tls-extensiontype-values/tls-extensiontype-values.xhtml
@@ -575,11 +591,16 @@ new_tls_connection (SoupConnection    *conn,
         g_ptr_array_add (advertised_protocols, "http/1.0");
         g_ptr_array_add (advertised_protocols, NULL);
 
+        if (SOUP_IS_CACHED_ADDRESS (priv->remote_connectable))
+                server_identity = soup_cached_address_get_identity (SOUP_CACHED_ADDRESS (priv->remote_connectable));
+        else
+                server_identity = priv->remote_connectable;
+
         tls_interaction = priv->socket_props->tls_interaction ? g_object_ref (priv->socket_props->tls_interaction) : soup_tls_interaction_new (conn);
         tls_connection = g_initable_new (g_tls_backend_get_client_connection_type (g_tls_backend_get_default ()),
                                          priv->cancellable, error,
                                          "base-io-stream", connection,
-                                         "server-identity", priv->remote_connectable,
+                                         "server-identity", server_identity,
                                          "require-close-notify", FALSE,
                                          "interaction", tls_interaction,
                                          "advertised-protocols", advertised_protocols->pdata,
@@ -593,6 +614,14 @@ new_tls_connection (SoupConnection    *conn,
 	if (!priv->socket_props->tlsdb_use_default)
 		g_tls_connection_set_database (G_TLS_CONNECTION (tls_connection), priv->socket_props->tlsdb);
 
+        if (priv->socket_props->tls_session_cache) {
+                g_free (priv->tls_session_origin);
+                priv->tls_session_origin = g_socket_connectable_to_string (server_identity);
+                soup_tls_session_cache_resume (priv->socket_props->tls_session_cache,
+                                               priv->tls_session_origin,
+                                               tls_connection);
+        }
+
 	g_signal_connect_object (tls_connection, "accept-certificate",
 				 G_CALLBACK (tls_connection_accept_certificate),
 				 conn, G_CONNECT_SWAPPED);
@@ -619,7 +648,6 @@ soup_connection_connected (SoupConnection    *conn,
 
         socket = g_socket_connection_get_socket (connection);
         g_socket_set_timeout (socket, priv->socket_props->io_timeout);
-        g_socket_set_option (socket, IPPROTO_TCP, TCP_NODELAY, TRUE, NULL);
 
         g_clear_object (&priv->remote_address);
         priv->remote_address = g_socket_get_remote_address (socket, NULL);
@@ -1110,6 +1138,32 @@ soup_connection_get_state (SoupConnection *conn)
 	return priv->state;
 }
 
+/* Session tickets may only arrive after the handshake (always with TLS
+ * 1.3), so the session is saved once the first message is done.
+ */
+static void
+store_tls_session (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        if (!priv->tls_session_origin || priv->tls_session_stored)
+                return;
+
+        if (!G_IS_TLS_CLIENT_CONNECTION (priv->connection))
+                return;
+
+        /* Resuming would skip the verification, so never save a
+         * session whose certificate was only accepted by the user.
+         */
+        if (g_tls_connection_get_peer_certificate_errors (G_TLS_CONNECTION (priv->connection)) != 0)
+                return;
+
+        soup_tls_session_cache_store (priv->socket_props->tls_session_cache,
+                                      priv->tls_session_origin,
+                                      G_TLS_CLIENT_CONNECTION (priv->connection));
+        priv->tls_session_stored = TRUE;
+}
+
 void
 soup_connection_set_in_use (SoupConnection *conn,
                             gboolean        in_use)
@@ -1131,9 +1185,10 @@ soup_connection_set_in_use (SoupConnection *conn,
 
         clear_proxy_msg (conn);
 
-        if (soup_connection_is_reusable (conn))
+        if (soup_connection_is_reusable (conn)) {
+                store_tls_session (conn);
                 soup_connection_set_state (conn, SOUP_CONNECTION_IDLE);
-        else
+        } else
                 soup_connection_disconnect (conn);
 }
 
@@ -1198,6 +1253,22 @@ soup_connection_get_tls_protocol_version (SoupConnection *conn)
         return g_tls_connection_get_protocol_version (G_TLS_CONNECTION (priv->connection));
 }
 
+gboolean
+soup_connection_get_tls_session_resumed (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+        gboolean resumed = FALSE;
+
+        if (!G_IS_TLS_CONNECTION (priv->connection))
+                return FALSE;
+
+        /* Not in the GIO API, but glib-networking exposes it */
+        if (g_object_class_find_property (G_OBJECT_GET_CLASS (priv->connection), "session-resumed"))
+                g_object_get (priv->connection, "session-resumed", &resumed, NULL);
+
+        return resumed;
+}
+
 char *
 soup_connection_get_tls_ciphersuite_name (SoupConnection *conn)
 {
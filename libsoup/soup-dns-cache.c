@@ -0,0 +1,690 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-dns-cache.c: session-wide cache of host name resolutions
+ *
+ * Copyright 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-dns-cache.h"
+
+/* GResolver does not report the TTL of the records it returns, so
+ * every successful resolution is trusted for the same amount of time,
+ * and failures for a much shorter one. Names that are looked up again
+ * shortly before they expire are refreshed in the background, so that
+ * busy hosts never wait on DNS once they are known.
+ */
+#define DNS_CACHE_TTL              (60 * G_TIME_SPAN_SECOND)
+#define DNS_CACHE_NEGATIVE_TTL     (5 * G_TIME_SPAN_SECOND)
+#define DNS_CACHE_REFRESH_WINDOW   (10 * G_TIME_SPAN_SECOND)
+#define DNS_CACHE_REFRESH_MIN_HITS 2
+#define DNS_CACHE_MAX_ENTRIES      256
+
+struct _SoupDNSCache {
+	GMutex mutex;
+	GHashTable *entries; /* lowercase hostname -> DNSCacheEntry */
+	guint64 n_lookups;
+};
+
+typedef struct {
+	GList *addresses;   /* GInetAddress */
+	GError *error;
+	gint64 expires;
+	guint hits;
+
+	gboolean resolving;
+	GSList *waiters;    /* GTask */
+} DNSCacheEntry;
+
+typedef struct {
+	SoupDNSCache *cache;
+	char *key;
+	GTask *task;
+} DNSCacheWaiter;
+
+static void
+dns_cache_entry_free (DNSCacheEntry *entry)
+{
+	g_resolver_free_addresses (entry->addresses);
+	g_clear_error (&entry->error);
+	g_assert (!entry->waiters);
+	g_free (entry);
+}
+
+static gboolean
+dns_cache_entry_is_fresh (DNSCacheEntry *entry,
+			  gint64         now)
+{
+	return (entry->addresses || entry->error) && entry->expires > now;
+}
+
+SoupDNSCache *
+soup_dns_cache_new (void)
+{
+	SoupDNSCache *cache;
+
+	cache = g_atomic_rc_box_new0 (SoupDNSCache);
+	g_mutex_init (&cache->mutex);
+	cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+						(GDestroyNotify)dns_cache_entry_free);
+
+	return cache;
+}
+
+SoupDNSCache *
+soup_dns_cache_ref (SoupDNSCache *cache)
+{
+	return g_atomic_rc_box_acquire (cache);
+}
+
+static void
+soup_dns_cache_destroy (SoupDNSCache *cache)
+{
+	g_hash_table_destroy (cache->entries);
+	g_mutex_clear (&cache->mutex);
+}
+
+void
+soup_dns_cache_unref (SoupDNSCache *cache)
+{
+	g_atomic_rc_box_release_full (cache, (GDestroyNotify)soup_dns_cache_destroy);
+}
+
+/* Called with the cache locked */
+static DNSCacheEntry *
+get_entry (SoupDNSCache *cache,
+	   const char   *key,
+	   gint64        now)
+{
+	DNSCacheEntry *entry;
+	GHashTableIter iter;
+
+	entry = g_hash_table_lookup (cache->entries, key);
+	if (entry)
+		return entry;
+
+	if (g_hash_table_size (cache->entries) >= DNS_CACHE_MAX_ENTRIES) {
+		/* Drop the stale entries first, anything but a
+		 * pending lookup if that is not enough.
+		 */
+		g_hash_table_iter_init (&iter, cache->entries);
+		while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry)) {
+			if (!entry->resolving && entry->expires <= now)
+				g_hash_table_iter_remove (&iter);
+		}
+
+		g_hash_table_iter_init (&iter, cache->entries);
+		while (g_hash_table_size (cache->entries) >= DNS_CACHE_MAX_ENTRIES &&
+		       g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry)) {
+			if (!entry->resolving)
+				g_hash_table_iter_remove (&iter);
+		}
+	}
+
+	entry = g_new0 (DNSCacheEntry, 1);
+	g_hash_table_insert (cache->entries, g_strdup (key), entry);
+
+	return entry;
+}
+
+static void
+return_result (GTask  *task,
+	       GList  *addresses,
+	       GError *error)
+{
+	if (error)
+		g_task_return_error (task, g_error_copy (error));
+	else
+		g_task_return_pointer (task,
+				       g_list_copy_deep (addresses, (GCopyFunc)g_object_ref, NULL),
+				       (GDestroyNotify)g_resolver_free_addresses);
+}
+
+static void
+dns_cache_waiter_free (DNSCacheWaiter *waiter)
+{
+	soup_dns_cache_unref (waiter->cache);
+	g_free (waiter->key);
+	g_object_unref (waiter->task);
+	g_free (waiter);
+}
+
+static gboolean
+waiter_cancelled_cb (GCancellable   *cancellable,
+		     DNSCacheWaiter *waiter)
+{
+	DNSCacheEntry *entry;
+	GSList *link = NULL;
+
+	g_mutex_lock (&waiter->cache->mutex);
+	entry = g_hash_table_lookup (waiter->cache->entries, waiter->key);
+	if (entry) {
+		link = g_slist_find (entry->waiters, waiter->task);
+		if (link)
+			entry->waiters = g_slist_delete_link (entry->waiters, link);
+	}
+	g_mutex_unlock (&waiter->cache->mutex);
+
+	/* Otherwise the result is already on its way */
+	if (link) {
+		g_task_return_error_if_cancelled (waiter->task);
+		g_object_unref (waiter->task);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Called with the cache locked. The shared lookup goes on, but a
+ * waiter is completed as soon as its own cancellable is cancelled.
+ */
+static void
+watch_waiter_cancellable (SoupDNSCache *cache,
+			  const char   *key,
+			  GTask        *task)
+{
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	DNSCacheWaiter *waiter;
+	GSource *source;
+
+	if (!cancellable)
+		return;
+
+	waiter = g_new (DNSCacheWaiter, 1);
+	waiter->cache = soup_dns_cache_ref (cache);
+	waiter->key = g_strdup (key);
+	waiter->task = g_object_ref (task);
+
+	source = g_cancellable_source_new (cancellable);
+	g_source_set_name (source, "SoupDNSCache waiter cancelled");
+	g_source_set_callback (source, (GSourceFunc)waiter_cancelled_cb,
+			       waiter, (GDestroyNotify)dns_cache_waiter_free);
+	g_source_attach (source, g_task_get_context (task));
+	g_task_set_task_data (task, source, (GDestroyNotify)g_source_unref);
+}
+
+/* Takes ownership of @addresses and @error */
+static void
+store_result (SoupDNSCache *cache,
+	      const char   *key,
+	      GList        *addresses,
+	      GError       *error)
+{
+	DNSCacheEntry *entry;
+	GSList *waiters, *w;
+	GList *result_addresses = NULL;
+	GError *result_error = NULL;
+	gint64 now = g_get_monotonic_time ();
+
+	g_mutex_lock (&cache->mutex);
+	entry = get_entry (cache, key, now);
+
+	g_resolver_free_addresses (entry->addresses);
+	g_clear_error (&entry->error);
+	entry->addresses = addresses;
+	entry->error = error;
+	entry->expires = now + (error ? DNS_CACHE_NEGATIVE_TTL : DNS_CACHE_TTL);
+	entry->hits = 0;
+	entry->resolving = FALSE;
+	waiters = g_steal_pointer (&entry->waiters);
+	if (waiters) {
+		/* The entry may change as soon as the cache is unlocked */
+		result_addresses = g_list_copy_deep (addresses, (GCopyFunc)g_object_ref, NULL);
+		result_error = error ? g_error_copy (error) : NULL;
+	}
+	g_mutex_unlock (&cache->mutex);
+
+	for (w = waiters; w; w = w->next) {
+		GSource *cancel_source = g_task_get_task_data (w->data);
+
+		if (cancel_source)
+			g_source_destroy (cancel_source);
+		return_result (w->data, result_addresses, result_error);
+	}
+
+	g_slist_free_full (waiters, g_object_unref);
+	g_resolver_free_addresses (result_addresses);
+	g_clear_error (&result_error);
+}
+
+typedef struct {
+	SoupDNSCache *cache;
+	char *key;
+} ResolveData;
+
+static void
+resolve_ready_cb (GResolver    *resolver,
+		  GAsyncResult *result,
+		  ResolveData  *data)
+{
+	GList *addresses;
+	GError *error = NULL;
+
+	addresses = g_resolver_lookup_by_name_finish (resolver, result, &error);
+	store_result (data->cache, data->key, addresses, error);
+
+	soup_dns_cache_unref (data->cache);
+	g_free (data->key);
+	g_free (data);
+}
+
+static void
+start_resolve (SoupDNSCache *cache,
+	       const char   *key)
+{
+	GResolver *resolver = g_resolver_get_default ();
+	ResolveData *data;
+
+	data = g_new (ResolveData, 1);
+	data->cache = soup_dns_cache_ref (cache);
+	data->key = g_strdup (key);
+
+	/* The lookup is shared by all the waiters, so it is never
+	 * cancelled; see watch_waiter_cancellable().
+	 */
+	g_resolver_lookup_by_name_async (resolver, key, NULL,
+					 (GAsyncReadyCallback)resolve_ready_cb,
+					 data);
+	g_object_unref (resolver);
+}
+
+static void
+lookup_internal (SoupDNSCache *cache,
+		 const char   *hostname,
+		 GTask        *task)
+{
+	DNSCacheEntry *entry;
+	char *key = g_ascii_strdown (hostname, -1);
+	gint64 now = g_get_monotonic_time ();
+	gboolean resolve = FALSE;
+	gboolean cached = FALSE;
+	GList *addresses = NULL;
+	GError *error = NULL;
+
+	g_mutex_lock (&cache->mutex);
+	entry = get_entry (cache, key, now);
+
+	if (dns_cache_entry_is_fresh (entry, now)) {
+		entry->hits++;
+		if (task) {
+			cached = TRUE;
+			addresses = g_list_copy_deep (entry->addresses, (GCopyFunc)g_object_ref, NULL);
+			error = entry->error ? g_error_copy (entry->error) : NULL;
+		}
+
+		/* Keep popular names warm */
+		if (entry->addresses && !entry->resolving &&
+		    entry->hits >= DNS_CACHE_REFRESH_MIN_HITS &&
+		    now >= entry->expires - DNS_CACHE_REFRESH_WINDOW) {
+			entry->resolving = TRUE;
+			resolve = TRUE;
+		}
+	} else {
+		if (task) {
+			entry->waiters = g_slist_append (entry->waiters, g_object_ref (task));
+			watch_waiter_cancellable (cache, key, task);
+		}
+		if (!entry->resolving) {
+			entry->resolving = TRUE;
+			resolve = TRUE;
+		}
+	}
+
+	if (resolve)
+		cache->n_lookups++;
+	g_mutex_unlock (&cache->mutex);
+
+	if (cached) {
+		return_result (task, addresses, error);
+		g_resolver_free_addresses (addresses);
+		g_clear_error (&error);
+	}
+
+	if (resolve)
+		start_resolve (cache, key);
+	g_free (key);
+}
+
+GList *
+soup_dns_cache_lookup (SoupDNSCache *cache,
+		       const char   *hostname,
+		       GCancellable *cancellable,
+		       GError      **error)
+{
+	DNSCacheEntry *entry;
+	GResolver *resolver;
+	GList *addresses;
+	GError *lookup_error = NULL;
+	char *key = g_ascii_strdown (hostname, -1);
+	gint64 now = g_get_monotonic_time ();
+
+	g_mutex_lock (&cache->mutex);
+	entry = get_entry (cache, key, now);
+	if (dns_cache_entry_is_fresh (entry, now)) {
+		entry->hits++;
+		if (entry->error)
+			g_propagate_error (error, g_error_copy (entry->error));
+		addresses = g_list_copy_deep (entry->addresses, (GCopyFunc)g_object_ref, NULL);
+		g_mutex_unlock (&cache->mutex);
+		g_free (key);
+
+		return addresses;
+	}
+	cache->n_lookups++;
+	g_mutex_unlock (&cache->mutex);
+
+	/* A pending asynchronous lookup can't be waited for here, as
+	 * it completes in another main context.
+	 */
+	resolver = g_resolver_get_default ();
+	addresses = g_resolver_lookup_by_name (resolver, key, cancellable, &lookup_error);
+	g_object_unref (resolver);
+
+	if (g_error_matches (lookup_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_propagate_error (error, lookup_error);
+		g_free (key);
+		return NULL;
+	}
+
+	store_result (cache, key,
+		      g_list_copy_deep (addresses, (GCopyFunc)g_object_ref, NULL),
+		      lookup_error ? g_error_copy (lookup_error) : NULL);
+	if (lookup_error)
+		g_propagate_error (error, lookup_error);
+	g_free (key);
+
+	return addresses;
+}
+
+void
+soup_dns_cache_lookup_async (SoupDNSCache        *cache,
+			     const char          *hostname,
+			     GCancellable        *cancellable,
+			     GAsyncReadyCallback  callback,
+			     gpointer             user_data)
+{
+	GTask *task;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, soup_dns_cache_lookup_async);
+	lookup_internal (cache, hostname, task);
+	g_object_unref (task);
+}
+
+GList *
+soup_dns_cache_lookup_finish (SoupDNSCache *cache,
+			      GAsyncResult *result,
+			      GError      **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* Starts resolving @hostname unless it is already known */
+void
+soup_dns_cache_prefetch (SoupDNSCache *cache,
+			 const char   *hostname)
+{
+	lookup_internal (cache, hostname, NULL);
+}
+
+/* Number of lookups that actually went to the resolver */
+guint64
+soup_dns_cache_get_n_lookups (SoupDNSCache *cache)
+{
+	guint64 n_lookups;
+
+	g_mutex_lock (&cache->mutex);
+	n_lookups = cache->n_lookups;
+	g_mutex_unlock (&cache->mutex);
+
+	return n_lookups;
+}
+
+struct _SoupCachedAddress {
+	GObject parent;
+
+	SoupDNSCache *cache;
+	char *hostname;
+	guint16 port;
+	char *scheme;
+	GSocketConnectable *identity;
+};
+
+static void soup_cached_address_connectable_iface_init (GSocketConnectableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (SoupCachedAddress, soup_cached_address, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_SOCKET_CONNECTABLE,
+						soup_cached_address_connectable_iface_init))
+
+typedef struct {
+	GSocketAddressEnumerator parent;
+
+	SoupCachedAddress *address;
+	GList *addresses;
+	GList *next;
+	gboolean resolved;
+} SoupCachedAddressEnumerator;
+
+typedef GSocketAddressEnumeratorClass SoupCachedAddressEnumeratorClass;
+
+G_DEFINE_TYPE (SoupCachedAddressEnumerator, soup_cached_address_enumerator, G_TYPE_SOCKET_ADDRESS_ENUMERATOR)
+
+static void
+soup_cached_address_init (SoupCachedAddress *address)
+{
+}
+
+static void
+soup_cached_address_finalize (GObject *object)
+{
+	SoupCachedAddress *address = SOUP_CACHED_ADDRESS (object);
+
+	soup_dns_cache_unref (address->cache);
+	g_free (address->hostname);
+	g_free (address->scheme);
+	g_object_unref (address->identity);
+
+	G_OBJECT_CLASS (soup_cached_address_parent_class)->finalize (object);
+}
+
+static void
+soup_cached_address_class_init (SoupCachedAddressClass *address_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (address_class);
+
+	object_class->finalize = soup_cached_address_finalize;
+}
+
+static GSocketAddressEnumerator *
+soup_cached_address_enumerate (GSocketConnectable *connectable)
+{
+	SoupCachedAddressEnumerator *enumerator;
+
+	enumerator = g_object_new (soup_cached_address_enumerator_get_type (), NULL);
+	enumerator->address = g_object_ref (SOUP_CACHED_ADDRESS (connectable));
+
+	return (GSocketAddressEnumerator *)enumerator;
+}
+
+static GSocketAddressEnumerator *
+soup_cached_address_proxy_enumerate (GSocketConnectable *connectable)
+{
+	SoupCachedAddress *address = SOUP_CACHED_ADDRESS (connectable);
+	GSocketAddressEnumerator *enumerator;
+	char *uri;
+
+	/* Like GNetworkAddress does; direct connections come back
+	 * to soup_cached_address_enumerate().
+	 */
+	uri = g_uri_join (G_URI_FLAGS_NONE, address->scheme ? address->scheme : "none",
+			  NULL, address->hostname, address->port, "", NULL, NULL);
+	enumerator = g_object_new (G_TYPE_PROXY_ADDRESS_ENUMERATOR,
+				   "connectable", connectable,
+				   "uri", uri,
+				   NULL);
+	g_free (uri);
+
+	return enumerator;
+}
+
+static gchar *
+soup_cached_address_to_string (GSocketConnectable *connectable)
+{
+	return g_socket_connectable_to_string (SOUP_CACHED_ADDRESS (connectable)->identity);
+}
+
+static void
+soup_cached_address_connectable_iface_init (GSocketConnectableIface *iface)
+{
+	iface->enumerate = soup_cached_address_enumerate;
+	iface->proxy_enumerate = soup_cached_address_proxy_enumerate;
+	iface->to_string = soup_cached_address_to_string;
+}
+
+GSocketConnectable *
+soup_cached_address_new (SoupDNSCache *cache,
+			 const char   *hostname,
+			 guint16       port,
+			 const char   *scheme)
+{
+	SoupCachedAddress *address;
+
+	address = g_object_new (SOUP_TYPE_CACHED_ADDRESS, NULL);
+	address->cache = soup_dns_cache_ref (cache);
+	address->hostname = g_strdup (hostname);
+	address->port = port;
+	address->scheme = g_strdup (scheme);
+	address->identity = g_network_address_new (hostname, port);
+
+	return G_SOCKET_CONNECTABLE (address);
+}
+
+/* The TLS backends need a GNetworkAddress as server identity, to know
+ * the name to send with SNI and to check the certificate against.
+ */
+GSocketConnectable *
+soup_cached_address_get_identity (SoupCachedAddress *address)
+{
+	return address->identity;
+}
+
+static void
+soup_cached_address_enumerator_init (SoupCachedAddressEnumerator *enumerator)
+{
+}
+
+static void
+soup_cached_address_enumerator_finalize (GObject *object)
+{
+	SoupCachedAddressEnumerator *enumerator = (SoupCachedAddressEnumerator *)object;
+
+	g_object_unref (enumerator->address);
+	g_resolver_free_addresses (enumerator->addresses);
+
+	G_OBJECT_CLASS (soup_cached_address_enumerator_parent_class)->finalize (object);
+}
+
+static GSocketAddress *
+next_address (SoupCachedAddressEnumerator *enumerator)
+{
+	GInetAddress *inet_address;
+
+	if (!enumerator->next)
+		return NULL;
+
+	inet_address = enumerator->next->data;
+	enumerator->next = enumerator->next->next;
+
+	return g_inet_socket_address_new (inet_address, enumerator->address->port);
+}
+
+static GSocketAddress *
+soup_cached_address_enumerator_next (GSocketAddressEnumerator *address_enumerator,
+				     GCancellable             *cancellable,
+				     GError                  **error)
+{
+	SoupCachedAddressEnumerator *enumerator = (SoupCachedAddressEnumerator *)address_enumerator;
+
+	if (!enumerator->resolved) {
+		enumerator->addresses = soup_dns_cache_lookup (enumerator->address->cache,
+							       enumerator->address->hostname,
+							       cancellable, error);
+		if (!enumerator->addresses)
+			return NULL;
+
+		enumerator->resolved = TRUE;
+		enumerator->next = enumerator->addresses;
+	}
+
+	return next_address (enumerator);
+}
+
+static void
+lookup_ready_cb (GObject      *source,
+		 GAsyncResult *result,
+		 GTask        *task)
+{
+	SoupCachedAddressEnumerator *enumerator = g_task_get_source_object (task);
+	GError *error = NULL;
+
+	enumerator->addresses = soup_dns_cache_lookup_finish (enumerator->address->cache, result, &error);
+	if (!enumerator->addresses) {
+		g_task_return_error (task, error);
+	} else {
+		enumerator->resolved = TRUE;
+		enumerator->next = enumerator->addresses;
+		g_task_return_pointer (task, next_address (enumerator), g_object_unref);
+	}
+	g_object_unref (task);
+}
+
+static void
+soup_cached_address_enumerator_next_async (GSocketAddressEnumerator *address_enumerator,
+					   GCancellable             *cancellable,
+					   GAsyncReadyCallback       callback,
+					   gpointer                  user_data)
+{
+	SoupCachedAddressEnumerator *enumerator = (SoupCachedAddressEnumerator *)address_enumerator;
+	GTask *task;
+
+	task = g_task_new (enumerator, cancellable, callback, user_data);
+	g_task_set_source_tag (task, soup_cached_address_enumerator_next_async);
+
+	if (enumerator->resolved) {
+		g_task_return_pointer (task, next_address (enumerator), g_object_unref);
+		g_object_unref (task);
+		return;
+	}
+
+	soup_dns_cache_lookup_async (enumerator->address->cache,
+				     enumerator->address->hostname,
+				     cancellable,
+				     (GAsyncReadyCallback)lookup_ready_cb,
+				     task);
+}
+
+static GSocketAddress *
+soup_cached_address_enumerator_next_finish (GSocketAddressEnumerator *address_enumerator,
+					    GAsyncResult             *result,
+					    GError                  **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, address_enumerator), NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+soup_cached_address_enumerator_class_init (SoupCachedAddressEnumeratorClass *enumerator_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (enumerator_class);
+
+	object_class->finalize = soup_cached_address_enumerator_finalize;
+
+	enumerator_class->next = soup_cached_address_enumerator_next;
+	enumerator_class->next_async = soup_cached_address_enumerator_next_async;
+	enumerator_class->next_finish = soup_cached_address_enumerator_next_finish;
+}
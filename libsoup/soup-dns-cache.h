@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _SoupDNSCache SoupDNSCache;
+
+SoupDNSCache *soup_dns_cache_new             (void);
+SoupDNSCache *soup_dns_cache_ref             (SoupDNSCache        *cache);
+void          soup_dns_cache_unref           (SoupDNSCache        *cache);
+
+GList        *soup_dns_cache_lookup          (SoupDNSCache        *cache,
+					      const char          *hostname,
+					      GCancellable        *cancellable,
+					      GError             **error);
+void          soup_dns_cache_lookup_async    (SoupDNSCache        *cache,
+					      const char          *hostname,
+					      GCancellable        *cancellable,
+					      GAsyncReadyCallback  callback,
+					      gpointer             user_data);
+GList        *soup_dns_cache_lookup_finish   (SoupDNSCache        *cache,
+					      GAsyncResult        *result,
+					      GError             **error);
+void          soup_dns_cache_prefetch        (SoupDNSCache        *cache,
+					      const char          *hostname);
+guint64       soup_dns_cache_get_n_lookups   (SoupDNSCache        *cache);
+
+/* A GSocketConnectable for a host name, resolved through a SoupDNSCache */
+#define SOUP_TYPE_CACHED_ADDRESS (soup_cached_address_get_type ())
+G_DECLARE_FINAL_TYPE (SoupCachedAddress, soup_cached_address, SOUP, CACHED_ADDRESS, GObject)
+
+GSocketConnectable *soup_cached_address_new          (SoupDNSCache      *cache,
+						      const char        *hostname,
+						      guint16            port,
+						      const char        *scheme);
+GSocketConnectable *soup_cached_address_get_identity (SoupCachedAddress *address);
+
+G_END_DECLS
@@ -0,0 +1,210 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-io-thread-input-stream.c: a stream read from the I/O thread
+ *
+ * Copyright 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-io-thread-input-stream.h"
+
+/* The response body streams of a thread-safe session can only be
+ * used from the I/O thread that owns their connection. This stream
+ * is handed to the other threads instead: each read is forwarded to
+ * the I/O thread and the calling thread waits for it, so the body
+ * is never buffered beyond what the caller asked for. The default
+ * GInputStream async implementations run the sync ones in a worker
+ * thread, so asynchronous reads don't block the caller either.
+ */
+
+struct _SoupIOThreadInputStream {
+	GInputStream parent_instance;
+
+	GInputStream *base_stream;
+	GMainContext *context;
+	GObject *owner;
+};
+
+G_DEFINE_TYPE (SoupIOThreadInputStream, soup_io_thread_input_stream, G_TYPE_INPUT_STREAM)
+
+typedef struct {
+	SoupIOThreadInputStream *stream;
+	void *buffer;
+	gsize count;
+	GCancellable *cancellable;
+
+	gssize nread;
+	gboolean closed;
+	GError *error;
+	gboolean done;
+	GMutex mutex;
+	GCond cond;
+} SoupIOThreadOperation;
+
+static void
+operation_done (SoupIOThreadOperation *op)
+{
+	g_mutex_lock (&op->mutex);
+	op->done = TRUE;
+	g_cond_signal (&op->cond);
+	g_mutex_unlock (&op->mutex);
+}
+
+static void
+read_ready (GInputStream          *base_stream,
+	    GAsyncResult          *result,
+	    SoupIOThreadOperation *op)
+{
+	op->nread = g_input_stream_read_finish (base_stream, result, &op->error);
+	operation_done (op);
+}
+
+static gboolean
+read_start (SoupIOThreadOperation *op)
+{
+	g_input_stream_read_async (op->stream->base_stream,
+				   op->buffer, op->count,
+				   G_PRIORITY_DEFAULT, op->cancellable,
+				   (GAsyncReadyCallback)read_ready, op);
+	return G_SOURCE_REMOVE;
+}
+
+static void
+close_ready (GInputStream          *base_stream,
+	     GAsyncResult          *result,
+	     SoupIOThreadOperation *op)
+{
+	op->closed = g_input_stream_close_finish (base_stream, result, &op->error);
+	operation_done (op);
+}
+
+static gboolean
+close_start (SoupIOThreadOperation *op)
+{
+	g_input_stream_close_async (op->stream->base_stream,
+				    G_PRIORITY_DEFAULT, op->cancellable,
+				    (GAsyncReadyCallback)close_ready, op);
+	return G_SOURCE_REMOVE;
+}
+
+/* Runs @func in the I/O thread and waits until it completes @op */
+static void
+run_operation (SoupIOThreadOperation *op,
+	       GSourceFunc            func)
+{
+	g_mutex_init (&op->mutex);
+	g_cond_init (&op->cond);
+	g_main_context_invoke (op->stream->context, func, op);
+
+	g_mutex_lock (&op->mutex);
+	while (!op->done)
+		g_cond_wait (&op->cond, &op->mutex);
+	g_mutex_unlock (&op->mutex);
+
+	g_mutex_clear (&op->mutex);
+	g_cond_clear (&op->cond);
+}
+
+static gssize
+soup_io_thread_input_stream_read_fn (GInputStream  *stream,
+				     void          *buffer,
+				     gsize          count,
+				     GCancellable  *cancellable,
+				     GError       **error)
+{
+	SoupIOThreadInputStream *istream = SOUP_IO_THREAD_INPUT_STREAM (stream);
+	SoupIOThreadOperation op = { istream, buffer, count, cancellable };
+
+	if (g_main_context_is_owner (istream->context))
+		return g_input_stream_read (istream->base_stream, buffer, count, cancellable, error);
+
+	run_operation (&op, (GSourceFunc)read_start);
+	if (op.error)
+		g_propagate_error (error, op.error);
+
+	return op.nread;
+}
+
+static gboolean
+soup_io_thread_input_stream_close_fn (GInputStream  *stream,
+				      GCancellable  *cancellable,
+				      GError       **error)
+{
+	SoupIOThreadInputStream *istream = SOUP_IO_THREAD_INPUT_STREAM (stream);
+	SoupIOThreadOperation op = { istream, NULL, 0, cancellable };
+
+	if (g_main_context_is_owner (istream->context))
+		return g_input_stream_close (istream->base_stream, cancellable, error);
+
+	run_operation (&op, (GSourceFunc)close_start);
+	if (op.error)
+		g_propagate_error (error, op.error);
+
+	return op.closed;
+}
+
+static gboolean
+release_base_stream (gpointer user_data)
+{
+	return G_SOURCE_REMOVE;
+}
+
+static void
+soup_io_thread_input_stream_finalize (GObject *object)
+{
+	SoupIOThreadInputStream *istream = SOUP_IO_THREAD_INPUT_STREAM (object);
+
+	/* The base stream is dropped in the I/O thread too, before
+	 * the owner can stop it.
+	 */
+	g_main_context_invoke_full (istream->context, G_PRIORITY_DEFAULT,
+				    release_base_stream, istream->base_stream,
+				    g_object_unref);
+	g_main_context_unref (istream->context);
+	g_object_unref (istream->owner);
+
+	G_OBJECT_CLASS (soup_io_thread_input_stream_parent_class)->finalize (object);
+}
+
+static void
+soup_io_thread_input_stream_init (SoupIOThreadInputStream *istream)
+{
+}
+
+static void
+soup_io_thread_input_stream_class_init (SoupIOThreadInputStreamClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GInputStreamClass *input_stream_class = G_INPUT_STREAM_CLASS (klass);
+
+	object_class->finalize = soup_io_thread_input_stream_finalize;
+
+	input_stream_class->read_fn = soup_io_thread_input_stream_read_fn;
+	input_stream_class->close_fn = soup_io_thread_input_stream_close_fn;
+}
+
+/**
+ * soup_io_thread_input_stream_new:
+ * @base_stream: a stream that can only be used from the thread owning @context
+ * @context: the main context of the I/O thread
+ * @owner: an object keeping the I/O thread running, like its session
+ *
+ * Returns: (transfer full): a stream reading @base_stream from any thread
+ */
+GInputStream *
+soup_io_thread_input_stream_new (GInputStream *base_stream,
+				 GMainContext *context,
+				 GObject      *owner)
+{
+	SoupIOThreadInputStream *istream;
+
+	istream = g_object_new (SOUP_TYPE_IO_THREAD_INPUT_STREAM, NULL);
+	istream->base_stream = g_object_ref (base_stream);
+	istream->context = g_main_context_ref (context);
+	istream->owner = g_object_ref (owner);
+
+	return G_INPUT_STREAM (istream);
+}
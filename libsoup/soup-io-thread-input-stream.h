@@ -0,0 +1,19 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_IO_THREAD_INPUT_STREAM            (soup_io_thread_input_stream_get_type ())
+G_DECLARE_FINAL_TYPE (SoupIOThreadInputStream, soup_io_thread_input_stream, SOUP, IO_THREAD_INPUT_STREAM, GInputStream)
+
+GInputStream *soup_io_thread_input_stream_new (GInputStream *base_stream,
+					       GMainContext *context,
+					       GObject      *owner);
+
+G_END_DECLS
@@ -85,6 +85,18 @@
  * due to, for example, a cancellation before receiving the last byte
  * of the response body, the response will still be logged on the
  * event of the #SoupMessage::finished signal.
+ *
+ * When #SoupLogger:output-format is %SOUP_LOGGER_OUTPUT_JSON, the
+ * logger does not format anything while the message is being
+ * processed. Instead, the request and response metadata (and the
+ * headers, at %SOUP_LOGGER_LOG_HEADERS level or above) are copied into
+ * a fixed-size ring buffer owned by the current thread, and a
+ * background thread turns them into one JSON object per line, which is
+ * passed to the printer. Bodies are never logged in this mode. Use
+ * #SoupLogger:sample-interval and #SoupLogger:max-records-per-second
+ * to bound the logging overhead; records that do not fit in the ring
+ * buffer or exceed the rate limit are dropped and counted (see
+ * soup_logger_get_dropped_records()).
  **/
 
 /**
@@ -97,8 +109,51 @@ struct _SoupLogger {
 	GObject parent;
 };
 
+/* Number of records per thread ring buffer, must be a power of two */
+#define RECORD_RING_SIZE 256
+#define RECORD_DATA_SIZE 1024
+/* How often the consumer thread wakes up to drain the rings */
+#define RECORD_FLUSH_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+
+/* A LogRecord holds a copy of the loggable state of a request or
+ * response. All the strings are stored NUL-separated in @data: the
+ * method, path (or host for CONNECT) and query for requests, or the
+ * reason phrase for responses, followed by @n_headers name/value pairs.
+ */
+typedef struct {
+        gint64              timestamp;
+        SoupLoggerLogLevel  level;
+        char                direction;
+        gboolean            restarted;
+        gboolean            truncated;
+        guint               session_id;
+        guint               msg_id;
+        guint               socket_id;
+        SoupHTTPVersion     http_version;
+        guint               status;
+        guint               port;
+        guint               n_headers;
+        gsize               data_len;
+        char                data[RECORD_DATA_SIZE];
+} LogRecord;
+
+/* Single-producer, single-consumer ring. The producer is the thread
+ * that owns the ring, the consumer is whoever holds
+ * priv->structured_mutex.
+ */
+typedef struct {
+        int        ref_count;
+        guint      head;
+        guint      tail;
+        LogRecord *records;
+} LogRing;
+
+static GPrivate thread_rings = G_PRIVATE_INIT ((GDestroyNotify)g_hash_table_destroy);
+static guint logger_serial;
+
 typedef struct {
 	GQuark              tag;
+	GMutex              lock; /* for ids and the body tables */
 	GHashTable         *ids;
 	GHashTable         *request_bodies;
 	GHashTable         *request_messages;
@@ -119,6 +174,20 @@ typedef struct {
 	SoupLoggerPrinter   printer;
 	gpointer            printer_data;
 	GDestroyNotify      printer_dnotify;
+
+        SoupLoggerOutputFormat output_format; /* atomic */
+        guint               serial;
+        guint               sample_interval;
+        guint               max_records_per_second;
+        guint               rate_window;
+        guint               rate_count;
+        guint               dropped_records;
+
+        GMutex              structured_mutex;
+        GCond               consumer_cond;
+        GThread            *consumer;
+        gboolean            consumer_stop;
+        GSList             *rings;
 } SoupLoggerPrivate;
 
 enum {
@@ -126,6 +195,9 @@ enum {
 
 	PROP_LEVEL,
 	PROP_MAX_BODY_SIZE,
+	PROP_OUTPUT_FORMAT,
+	PROP_SAMPLE_INTERVAL,
+	PROP_MAX_RECORDS_PER_SECOND,
 
 	LAST_PROPERTY
 };
@@ -156,6 +228,8 @@ write_body (SoupLogger *logger, const char *buffer, gsize nread,
         if (!nread)
                 return;
 
+        g_mutex_lock (&priv->lock);
+
         body = g_hash_table_lookup (bodies, key);
 
         if (!body) {
@@ -165,17 +239,34 @@ write_body (SoupLogger *logger, const char *buffer, gsize nread,
 
         if (priv->max_body_size > 0) {
                 /* longer than max => we've written the extra [...] */
-                if (body->len > priv->max_body_size)
-                        return;
-                int cap = priv->max_body_size - body->len;
-                if (cap)
-                        g_string_append_len (body, buffer,
-                                             (nread < cap) ? nread : cap);
-                if (nread > cap)
-                        g_string_append (body, "\n[...]");
+                if (body->len <= priv->max_body_size) {
+                        int cap = priv->max_body_size - body->len;
+                        if (cap)
+                                g_string_append_len (body, buffer,
+                                                     (nread < cap) ? nread : cap);
+                        if (nread > cap)
+                                g_string_append (body, "\n[...]");
+                }
         } else {
                 g_string_append_len (body, buffer, nread);
         }
+
+        g_mutex_unlock (&priv->lock);
+}
+
+static GString *
+steal_body (SoupLogger *logger,
+            GHashTable *bodies,
+            gpointer    key)
+{
+        SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+        GString *body = NULL;
+
+        g_mutex_lock (&priv->lock);
+        g_hash_table_steal_extended (bodies, key, NULL, (gpointer *)&body);
+        g_mutex_unlock (&priv->lock);
+
+        return body;
 }
 
 void
@@ -183,6 +274,9 @@ soup_logger_log_request_data (SoupLogger *logger, SoupMessage *msg, const char *
 {
         SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
 
+        if (soup_logger_get_output_format (logger) != SOUP_LOGGER_OUTPUT_TEXT)
+                return;
+
         write_body (logger, buffer, len, msg, priv->request_bodies);
 }
 
@@ -213,7 +307,8 @@ soup_logger_content_processor_wrap_input (SoupContentProcessor *processor,
         else
                 log_level = priv->level;
 
-        if (log_level < SOUP_LOGGER_LOG_BODY)
+        if (log_level < SOUP_LOGGER_LOG_BODY ||
+            soup_logger_get_output_format (logger) != SOUP_LOGGER_OUTPUT_TEXT)
                 return NULL;
 
         stream = g_object_new (SOUP_TYPE_LOGGER_INPUT_STREAM,
@@ -253,10 +348,15 @@ soup_logger_init (SoupLogger *logger)
 	id = g_strdup_printf ("SoupLogger-%p", logger);
 	priv->tag = g_quark_from_string (id);
 	g_free (id);
+	g_mutex_init (&priv->lock);
 	priv->ids = g_hash_table_new (NULL, NULL);
 	priv->request_bodies = g_hash_table_new_full (NULL, NULL, NULL, body_free);
 	priv->response_bodies = g_hash_table_new_full (NULL, NULL, NULL, body_free);
 	priv->request_messages = g_hash_table_new (NULL, NULL);
+        priv->serial = (guint)g_atomic_int_add (&logger_serial, 1);
+        priv->sample_interval = 1;
+        g_mutex_init (&priv->structured_mutex);
+        g_cond_init (&priv->consumer_cond);
 }
 
 static void
@@ -265,11 +365,79 @@ body_ostream_drop_ref (gpointer key, gpointer value, gpointer data)
         g_object_weak_unref (key, body_ostream_done, data);
 }
 
+static void
+log_ring_unref (LogRing *ring)
+{
+        if (!g_atomic_int_dec_and_test (&ring->ref_count))
+                return;
+
+        g_free (ring->records);
+        g_free (ring);
+}
+
+static void
+log_ring_close (LogRing *ring)
+{
+        LogRecord *records = ring->records;
+
+        /* Producers only write while the logger is alive, so the
+         * records can go away now; the other threads that have a ring
+         * drop it from thread_rings the next time they create one.
+         */
+        g_atomic_pointer_set (&ring->records, NULL);
+        g_free (records);
+        log_ring_unref (ring);
+}
+
+static gboolean
+log_ring_is_closed (gpointer key,
+                    gpointer value,
+                    gpointer user_data)
+{
+        LogRing *ring = value;
+
+        return g_atomic_pointer_get (&ring->records) == NULL;
+}
+
+static void drain_rings (SoupLogger *logger);
+
+static void
+stop_consumer (SoupLogger *logger)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+
+        if (!priv->consumer)
+                return;
+
+        g_mutex_lock (&priv->structured_mutex);
+        priv->consumer_stop = TRUE;
+        g_cond_signal (&priv->consumer_cond);
+        g_mutex_unlock (&priv->structured_mutex);
+        g_thread_join (priv->consumer);
+
+        priv->consumer = NULL;
+        priv->consumer_stop = FALSE;
+}
+
 static void
 soup_logger_finalize (GObject *object)
 {
 	SoupLogger *logger = SOUP_LOGGER (object);
 	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+        GHashTable *thread_ring_table;
+
+        stop_consumer (logger);
+
+        thread_ring_table = g_private_get (&thread_rings);
+        if (thread_ring_table)
+                g_hash_table_remove (thread_ring_table, GUINT_TO_POINTER (priv->serial));
+
+        g_mutex_lock (&priv->structured_mutex);
+        drain_rings (logger);
+        g_slist_free_full (priv->rings, (GDestroyNotify)log_ring_close);
+        g_mutex_unlock (&priv->structured_mutex);
+        g_mutex_clear (&priv->structured_mutex);
+        g_cond_clear (&priv->consumer_cond);
 
 	g_hash_table_foreach (priv->request_messages,
 	                      body_ostream_drop_ref, priv);
@@ -278,6 +446,7 @@ soup_logger_finalize (GObject *object)
 	g_hash_table_destroy (priv->request_bodies);
 	g_hash_table_destroy (priv->response_bodies);
 	g_hash_table_destroy (priv->request_messages);
+	g_mutex_clear (&priv->lock);
 
 	if (priv->request_filter_dnotify)
 		priv->request_filter_dnotify (priv->request_filter_data);
@@ -303,6 +472,15 @@ soup_logger_set_property (GObject *object, guint prop_id,
 	case PROP_MAX_BODY_SIZE:
 		priv->max_body_size = g_value_get_int (value);
 		break;
+	case PROP_OUTPUT_FORMAT:
+		soup_logger_set_output_format (logger, g_value_get_enum (value));
+		break;
+	case PROP_SAMPLE_INTERVAL:
+		g_atomic_int_set (&priv->sample_interval, g_value_get_uint (value));
+		break;
+	case PROP_MAX_RECORDS_PER_SECOND:
+		g_atomic_int_set (&priv->max_records_per_second, g_value_get_uint (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -323,6 +501,15 @@ soup_logger_get_property (GObject *object, guint prop_id,
 	case PROP_MAX_BODY_SIZE:
 		g_value_set_int (value, priv->max_body_size);
 		break;
+	case PROP_OUTPUT_FORMAT:
+		g_value_set_enum (value, soup_logger_get_output_format (logger));
+		break;
+	case PROP_SAMPLE_INTERVAL:
+		g_value_set_uint (value, priv->sample_interval);
+		break;
+	case PROP_MAX_RECORDS_PER_SECOND:
+		g_value_set_uint (value, priv->max_records_per_second);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -370,6 +557,55 @@ soup_logger_class_init (SoupLoggerClass *logger_class)
 				    -1,
 				    G_PARAM_READWRITE |
 				    G_PARAM_STATIC_STRINGS);
+	/**
+	 * SoupLogger:output-format:
+	 *
+	 * The format of the logging output. With
+	 * %SOUP_LOGGER_OUTPUT_JSON, records are captured without
+	 * formatting and printed as JSON lines from a background thread.
+	 *
+	 */
+        properties[PROP_OUTPUT_FORMAT] =
+		g_param_spec_enum ("output-format",
+				    "Output format",
+				    "The format of the logging output",
+				    SOUP_TYPE_LOGGER_OUTPUT_FORMAT,
+				    SOUP_LOGGER_OUTPUT_TEXT,
+				    G_PARAM_READWRITE |
+				    G_PARAM_STATIC_STRINGS);
+	/**
+	 * SoupLogger:sample-interval:
+	 *
+	 * If #SoupLogger:output-format is %SOUP_LOGGER_OUTPUT_JSON, only
+	 * one out of every sample-interval messages is logged.
+	 *
+	 */
+        properties[PROP_SAMPLE_INTERVAL] =
+		g_param_spec_uint ("sample-interval",
+				    "Sample interval",
+				    "Log one out of every N messages",
+				    1,
+				    G_MAXUINT,
+				    1,
+				    G_PARAM_READWRITE |
+				    G_PARAM_STATIC_STRINGS);
+	/**
+	 * SoupLogger:max-records-per-second:
+	 *
+	 * If #SoupLogger:output-format is %SOUP_LOGGER_OUTPUT_JSON, the
+	 * approximate maximum number of records captured per second.
+	 * Records over the limit are dropped. (0 means "no limit".)
+	 *
+	 */
+        properties[PROP_MAX_RECORDS_PER_SECOND] =
+		g_param_spec_uint ("max-records-per-second",
+				    "Max records per second",
+				    "The maximum number of records logged per second",
+				    0,
+				    G_MAXUINT,
+				    0,
+				    G_PARAM_READWRITE |
+				    G_PARAM_STATIC_STRINGS);
 
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
@@ -385,6 +621,17 @@ soup_logger_class_init (SoupLoggerClass *logger_class)
  * Describes the level of logging output to provide.
  **/
 
+/**
+ * SoupLoggerOutputFormat:
+ * @SOUP_LOGGER_OUTPUT_TEXT: Log messages as annotated HTTP text, formatted
+ * as they are sent and received
+ * @SOUP_LOGGER_OUTPUT_JSON: Capture message metadata into per-thread
+ * ring buffers and print it as one JSON object per line from a background
+ * thread
+ *
+ * Describes the format of the logging output.
+ **/
+
 /**
  * soup_logger_new:
  * @level: the debug level
@@ -503,6 +750,11 @@ soup_logger_set_response_filter (SoupLogger       *logger,
  *
  * Sets up an alternate log printing routine, if you don't want
  * the log to go to <literal>stdout</literal>.
+ *
+ * If #SoupLogger:output-format is %SOUP_LOGGER_OUTPUT_JSON, @printer
+ * is called from the logger's background thread (or from the thread
+ * calling soup_logger_flush()), once per record, with a complete JSON
+ * object as @data.
  **/
 void
 soup_logger_set_printer (SoupLogger        *logger,
@@ -548,6 +800,82 @@ soup_logger_get_max_body_size (SoupLogger *logger)
         return priv->max_body_size;
 }
 
+static gpointer structured_consumer_thread (gpointer user_data);
+
+/**
+ * soup_logger_set_output_format:
+ * @logger: a #SoupLogger
+ * @format: the #SoupLoggerOutputFormat
+ *
+ * Sets the format of the logging output of @logger. See
+ * #SoupLogger:output-format.
+ **/
+void
+soup_logger_set_output_format (SoupLogger             *logger,
+                               SoupLoggerOutputFormat  format)
+{
+        SoupLoggerPrivate *priv;
+
+        g_return_if_fail (SOUP_IS_LOGGER (logger));
+
+        priv = soup_logger_get_instance_private (logger);
+        if (soup_logger_get_output_format (logger) == format)
+                return;
+
+        g_atomic_int_set (&priv->output_format, format);
+        if (format == SOUP_LOGGER_OUTPUT_JSON) {
+                if (!priv->consumer)
+                        priv->consumer = g_thread_new ("soup-logger", structured_consumer_thread, logger);
+        } else {
+                /* Print what was captured before the change */
+                stop_consumer (logger);
+                soup_logger_flush (logger);
+        }
+
+        g_object_notify_by_pspec (G_OBJECT (logger), properties[PROP_OUTPUT_FORMAT]);
+}
+
+/**
+ * soup_logger_get_output_format:
+ * @logger: a #SoupLogger
+ *
+ * Gets the format of the logging output of @logger.
+ *
+ * Returns: the #SoupLoggerOutputFormat
+ **/
+SoupLoggerOutputFormat
+soup_logger_get_output_format (SoupLogger *logger)
+{
+        SoupLoggerPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_LOGGER (logger), SOUP_LOGGER_OUTPUT_TEXT);
+
+        priv = soup_logger_get_instance_private (logger);
+        return g_atomic_int_get (&priv->output_format);
+}
+
+/**
+ * soup_logger_get_dropped_records:
+ * @logger: a #SoupLogger
+ *
+ * Gets the number of records that were not logged because the ring
+ * buffer of the producing thread was full, or because of
+ * #SoupLogger:max-records-per-second. Messages skipped because of
+ * #SoupLogger:sample-interval are not counted.
+ *
+ * Returns: the number of dropped records
+ **/
+guint
+soup_logger_get_dropped_records (SoupLogger *logger)
+{
+        SoupLoggerPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_LOGGER (logger), 0);
+
+        priv = soup_logger_get_instance_private (logger);
+        return (guint)g_atomic_int_get (&priv->dropped_records);
+}
+
 static guint
 soup_logger_get_id (SoupLogger *logger, gpointer object)
 {
@@ -556,6 +884,9 @@ soup_logger_get_id (SoupLogger *logger, gpointer object)
 	return GPOINTER_TO_UINT (g_object_get_qdata (object, priv->tag));
 }
 
+/* Objects like the session or the sockets are seen by all the I/O
+ * threads of the session, so only the first one gives them an id.
+ */
 static guint
 soup_logger_set_id (SoupLogger *logger, gpointer object)
 {
@@ -563,11 +894,17 @@ soup_logger_set_id (SoupLogger *logger, gpointer object)
 	gpointer klass = G_OBJECT_GET_CLASS (object);
 	gpointer id;
 
-	id = g_hash_table_lookup (priv->ids, klass);
-	id = (char *)id + 1;
-	g_hash_table_insert (priv->ids, klass, id);
+	g_mutex_lock (&priv->lock);
+	id = g_object_get_qdata (object, priv->tag);
+	if (!id) {
+		id = g_hash_table_lookup (priv->ids, klass);
+		id = (char *)id + 1;
+		g_hash_table_insert (priv->ids, klass, id);
+
+		g_object_set_qdata (object, priv->tag, id);
+	}
+	g_mutex_unlock (&priv->lock);
 
-	g_object_set_qdata (object, priv->tag, id);
 	return GPOINTER_TO_UINT (id);
 }
 
@@ -603,17 +940,16 @@ soup_logger_print (SoupLogger *logger, SoupLoggerLogLevel level,
 	g_free (data);
 }
 
-static void
-soup_logger_print_basic_auth (SoupLogger *logger, const char *value)
+static char *
+mask_basic_auth (const char *value, gsize *len)
 {
 	char *decoded, *decoded_utf8, *p;
-	gsize len;
 
-	decoded = (char *)g_base64_decode (value + 6, &len);
+	decoded = (char *)g_base64_decode (value + 6, len);
 	if (decoded && !g_utf8_validate (decoded, -1, NULL)) {
 		decoded_utf8 = g_convert_with_fallback (decoded, -1,
 							"UTF-8", "ISO-8859-1",
-							NULL, NULL, &len,
+							NULL, NULL, len,
 							NULL);
 		if (decoded_utf8) {
 			g_free (decoded);
@@ -625,9 +961,20 @@ soup_logger_print_basic_auth (SoupLogger *logger, const char *value)
 		decoded = g_strdup (value);
 	p = strchr (decoded, ':');
 	if (p) {
-		while (++p < decoded + len)
+		while (++p < decoded + *len)
 			*p = '*';
 	}
+
+	return decoded;
+}
+
+static void
+soup_logger_print_basic_auth (SoupLogger *logger, const char *value)
+{
+	char *decoded;
+	gsize len;
+
+	decoded = mask_basic_auth (value, &len);
 	soup_logger_print (logger, SOUP_LOGGER_LOG_HEADERS, '>',
 			   "Authorization: Basic [%.*s]", (int)len, decoded);
 	g_free (decoded);
@@ -711,7 +1058,8 @@ print_request (SoupLogger *logger, SoupMessage *msg,
 	if (soup_message_headers_get_expectations (soup_message_get_request_headers (msg)) == SOUP_EXPECTATION_CONTINUE)
 		return;
 
-	if (!g_hash_table_steal_extended (priv->request_bodies, msg, NULL, (gpointer *)&body))
+	body = steal_body (logger, priv->request_bodies, msg);
+	if (!body)
 		return;
 
 	soup_logger_print (logger, SOUP_LOGGER_LOG_BODY, '>', "\n%s", body->str);
@@ -761,13 +1109,427 @@ print_response (SoupLogger *logger, SoupMessage *msg)
 	if (log_level == SOUP_LOGGER_LOG_HEADERS)
 		return;
 
-	if (!g_hash_table_steal_extended (priv->response_bodies, msg, NULL, (gpointer *)&body))
+	body = steal_body (logger, priv->response_bodies, msg);
+	if (!body)
 		return;
 
 	soup_logger_print (logger, SOUP_LOGGER_LOG_BODY, '<', "\n%s", body->str);
 	g_string_free (body, TRUE);
 }
 
+static LogRing *
+get_thread_ring (SoupLogger *logger)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+        GHashTable *rings;
+        LogRing *ring;
+
+        rings = g_private_get (&thread_rings);
+        if (!rings) {
+                rings = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)log_ring_unref);
+                g_private_set (&thread_rings, rings);
+        }
+
+        ring = g_hash_table_lookup (rings, GUINT_TO_POINTER (priv->serial));
+        if (ring)
+                return ring;
+
+        /* Drop the rings of the loggers that were finalized since */
+        g_hash_table_foreach_remove (rings, log_ring_is_closed, NULL);
+
+        ring = g_new0 (LogRing, 1);
+        ring->ref_count = 2;
+        ring->records = g_new (LogRecord, RECORD_RING_SIZE);
+        g_hash_table_insert (rings, GUINT_TO_POINTER (priv->serial), ring);
+
+        g_mutex_lock (&priv->structured_mutex);
+        priv->rings = g_slist_prepend (priv->rings, ring);
+        g_mutex_unlock (&priv->structured_mutex);
+
+        return ring;
+}
+
+static gboolean
+rate_limit_exceeded (SoupLoggerPrivate *priv)
+{
+        guint limit, window;
+
+        limit = (guint)g_atomic_int_get (&priv->max_records_per_second);
+        if (!limit)
+                return FALSE;
+
+        /* Approximate: concurrent producers may race on the window
+         * reset, which only lets a few extra records through.
+         */
+        window = (guint)(g_get_monotonic_time () / G_USEC_PER_SEC);
+        if ((guint)g_atomic_int_get (&priv->rate_window) != window) {
+                g_atomic_int_set (&priv->rate_window, window);
+                g_atomic_int_set (&priv->rate_count, 0);
+        }
+
+        return (guint)g_atomic_int_add (&priv->rate_count, 1) >= limit;
+}
+
+static LogRecord *
+log_record_begin (SoupLogger        *logger,
+                  LogRing          **ring_out,
+                  SoupLoggerLogLevel level,
+                  char               direction,
+                  SoupMessage       *msg)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+        LogRing *ring;
+        LogRecord *record;
+        guint head;
+
+        if (rate_limit_exceeded (priv)) {
+                g_atomic_int_inc (&priv->dropped_records);
+                return NULL;
+        }
+
+        ring = get_thread_ring (logger);
+        head = ring->head;
+        if (head - (guint)g_atomic_int_get (&ring->tail) >= RECORD_RING_SIZE) {
+                g_atomic_int_inc (&priv->dropped_records);
+                return NULL;
+        }
+
+        record = &ring->records[head & (RECORD_RING_SIZE - 1)];
+        record->timestamp = g_get_real_time ();
+        record->level = MIN (level, SOUP_LOGGER_LOG_HEADERS);
+        record->direction = direction;
+        record->restarted = FALSE;
+        record->truncated = FALSE;
+        record->session_id = 0;
+        record->msg_id = soup_logger_get_id (logger, msg);
+        record->socket_id = 0;
+        record->http_version = soup_message_get_http_version (msg);
+        record->status = 0;
+        record->port = 0;
+        record->n_headers = 0;
+        record->data_len = 0;
+
+        *ring_out = ring;
+        return record;
+}
+
+static gboolean
+log_record_append (LogRecord  *record,
+                   const char *str)
+{
+        gsize len = strlen (str) + 1;
+
+        if (record->data_len + len > RECORD_DATA_SIZE) {
+                record->truncated = TRUE;
+                return FALSE;
+        }
+
+        memcpy (record->data + record->data_len, str, len);
+        record->data_len += len;
+        return TRUE;
+}
+
+static void
+log_record_append_headers (LogRecord          *record,
+                           SoupMessageHeaders *headers)
+{
+        SoupMessageHeadersIter iter;
+        const char *name, *value;
+
+        if (record->level < SOUP_LOGGER_LOG_HEADERS)
+                return;
+
+        soup_message_headers_iter_init (&iter, headers);
+        while (soup_message_headers_iter_next (&iter, &name, &value)) {
+                gsize data_len = record->data_len;
+
+                if (!log_record_append (record, name) ||
+                    !log_record_append (record, value)) {
+                        record->data_len = data_len;
+                        break;
+                }
+                record->n_headers++;
+        }
+}
+
+static void
+log_record_commit (LogRing *ring)
+{
+        g_atomic_int_set (&ring->head, ring->head + 1);
+}
+
+static gboolean
+message_is_sampled (SoupLogger  *logger,
+                    SoupMessage *msg)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+        guint interval = (guint)g_atomic_int_get (&priv->sample_interval);
+
+        return interval <= 1 || (soup_logger_get_id (logger, msg) - 1) % interval == 0;
+}
+
+static void
+record_request (SoupLogger *logger, SoupMessage *msg,
+                GSocket *socket, gboolean restarted)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+	SoupLoggerLogLevel log_level;
+        LogRing *ring;
+        LogRecord *record;
+        GUri *uri;
+
+	if (priv->request_filter) {
+		log_level = priv->request_filter (logger, msg,
+						  priv->request_filter_data);
+	} else
+		log_level = priv->level;
+
+	if (log_level == SOUP_LOGGER_LOG_NONE || !message_is_sampled (logger, msg))
+		return;
+
+        record = log_record_begin (logger, &ring, log_level, '>', msg);
+        if (!record)
+                return;
+
+        record->restarted = restarted;
+        record->session_id = soup_logger_get_id (logger, priv->session);
+        record->socket_id = socket ? soup_logger_get_id (logger, socket) : 0;
+
+        uri = soup_message_get_uri (msg);
+        log_record_append (record, soup_message_get_method (msg));
+	if (soup_message_get_method (msg) == SOUP_METHOD_CONNECT) {
+                log_record_append (record, g_uri_get_host (uri));
+                record->port = g_uri_get_port (uri);
+                log_record_append (record, "");
+        } else {
+                log_record_append (record, g_uri_get_path (uri));
+                log_record_append (record, g_uri_get_query (uri) ? g_uri_get_query (uri) : "");
+        }
+
+        log_record_append_headers (record, soup_message_get_request_headers (msg));
+        log_record_commit (ring);
+}
+
+static void
+record_response (SoupLogger *logger, SoupMessage *msg)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+	SoupLoggerLogLevel log_level;
+        LogRing *ring;
+        LogRecord *record;
+
+	if (priv->response_filter) {
+		log_level = priv->response_filter (logger, msg,
+						   priv->response_filter_data);
+	} else
+		log_level = priv->level;
+
+	if (log_level == SOUP_LOGGER_LOG_NONE || !message_is_sampled (logger, msg))
+		return;
+
+        record = log_record_begin (logger, &ring, log_level, '<', msg);
+        if (!record)
+                return;
+
+        record->status = soup_message_get_status (msg);
+        log_record_append (record, soup_message_get_reason_phrase (msg) ? soup_message_get_reason_phrase (msg) : "");
+        log_record_append_headers (record, soup_message_get_response_headers (msg));
+        log_record_commit (ring);
+}
+
+static void
+json_append_string (GString    *json,
+                    const char *str,
+                    gssize      len)
+{
+        const char *end = str + (len < 0 ? strlen (str) : (gsize)len);
+
+        g_string_append_c (json, '"');
+        for (; str < end; str++) {
+                switch (*str) {
+                case '"':
+                        g_string_append (json, "\\\"");
+                        break;
+                case '\\':
+                        g_string_append (json, "\\\\");
+                        break;
+                case '\n':
+                        g_string_append (json, "\\n");
+                        break;
+                case '\r':
+                        g_string_append (json, "\\r");
+                        break;
+                case '\t':
+                        g_string_append (json, "\\t");
+                        break;
+                default:
+                        if ((guchar)*str < 0x20)
+                                g_string_append_printf (json, "\\u%04x", (guchar)*str);
+                        else
+                                g_string_append_c (json, *str);
+                        break;
+                }
+        }
+        g_string_append_c (json, '"');
+}
+
+static void
+print_record (SoupLogger *logger,
+              LogRecord  *record,
+              GString    *json)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+        const char *p = record->data;
+        guint i;
+
+#define NEXT_STRING(p) ((p) + strlen (p) + 1)
+
+        g_string_truncate (json, 0);
+        g_string_append_printf (json, "{\"timestamp\":%" G_GINT64_FORMAT ",\"direction\":\"%s\",\"message\":%u,\"http_version\":\"%s\"",
+                                record->timestamp,
+                                record->direction == '>' ? "request" : "response",
+                                record->msg_id,
+                                soup_http_version_to_string (record->http_version));
+
+        if (record->direction == '>') {
+                g_string_append_printf (json, ",\"session\":%u", record->session_id);
+                if (record->socket_id)
+                        g_string_append_printf (json, ",\"socket\":%u", record->socket_id);
+                else
+                        g_string_append (json, ",\"socket\":\"cached\"");
+                if (record->restarted)
+                        g_string_append (json, ",\"restarted\":true");
+
+                g_string_append (json, ",\"method\":");
+                json_append_string (json, p, -1);
+                p = NEXT_STRING (p);
+                if (record->port) {
+                        g_string_append (json, ",\"host\":");
+                        json_append_string (json, p, -1);
+                        g_string_append_printf (json, ",\"port\":%u", record->port);
+                        p = NEXT_STRING (p);
+                } else {
+                        g_string_append (json, ",\"path\":");
+                        json_append_string (json, p, -1);
+                        p = NEXT_STRING (p);
+                        if (*p) {
+                                g_string_append (json, ",\"query\":");
+                                json_append_string (json, p, -1);
+                        }
+                }
+                p = NEXT_STRING (p);
+        } else {
+                g_string_append_printf (json, ",\"status\":%u,\"reason\":", record->status);
+                json_append_string (json, p, -1);
+                p = NEXT_STRING (p);
+        }
+
+        if (record->level >= SOUP_LOGGER_LOG_HEADERS) {
+                g_string_append (json, ",\"headers\":[");
+                for (i = 0; i < record->n_headers; i++) {
+                        const char *name = p;
+                        const char *value = NEXT_STRING (name);
+
+                        g_string_append (json, i ? ",[" : "[");
+                        json_append_string (json, name, -1);
+                        g_string_append_c (json, ',');
+                        if (record->direction == '>' &&
+                            !g_ascii_strcasecmp (name, "Authorization") &&
+                            !g_ascii_strncasecmp (value, "Basic ", 6)) {
+                                char *decoded, *masked;
+                                gsize len;
+
+                                decoded = mask_basic_auth (value, &len);
+                                masked = g_strdup_printf ("Basic [%.*s]", (int)len, decoded);
+                                json_append_string (json, masked, -1);
+                                g_free (masked);
+                                g_free (decoded);
+                        } else
+                                json_append_string (json, value, -1);
+                        g_string_append_c (json, ']');
+                        p = NEXT_STRING (value);
+                }
+                g_string_append_c (json, ']');
+        }
+
+        if (record->truncated)
+                g_string_append (json, ",\"truncated\":true");
+        g_string_append_c (json, '}');
+
+#undef NEXT_STRING
+
+        if (priv->printer) {
+                priv->printer (logger, record->level, record->direction,
+                               json->str, priv->printer_data);
+        } else
+                printf ("%s\n", json->str);
+}
+
+/* Must be called with priv->structured_mutex held */
+static void
+drain_rings (SoupLogger *logger)
+{
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+        GString *json = NULL;
+        GSList *l;
+
+        for (l = priv->rings; l; l = l->next) {
+                LogRing *ring = l->data;
+                guint head = (guint)g_atomic_int_get (&ring->head);
+
+                while (ring->tail != head) {
+                        if (!json)
+                                json = g_string_sized_new (RECORD_DATA_SIZE);
+                        print_record (logger, &ring->records[ring->tail & (RECORD_RING_SIZE - 1)], json);
+                        g_atomic_int_set (&ring->tail, ring->tail + 1);
+                }
+        }
+
+        if (json)
+                g_string_free (json, TRUE);
+}
+
+static gpointer
+structured_consumer_thread (gpointer user_data)
+{
+        SoupLogger *logger = user_data;
+	SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
+
+        /* The logger is not referenced here; it stops and joins
+         * this thread before it goes away.
+         */
+        g_mutex_lock (&priv->structured_mutex);
+        while (!priv->consumer_stop) {
+                drain_rings (logger);
+                g_cond_wait_until (&priv->consumer_cond, &priv->structured_mutex,
+                                   g_get_monotonic_time () + RECORD_FLUSH_INTERVAL);
+        }
+        g_mutex_unlock (&priv->structured_mutex);
+
+        return NULL;
+}
+
+/**
+ * soup_logger_flush:
+ * @logger: a #SoupLogger
+ *
+ * Synchronously prints all the records that have been captured but
+ * not yet printed by @logger's background thread. This only has an
+ * effect if #SoupLogger:output-format is %SOUP_LOGGER_OUTPUT_JSON.
+ **/
+void
+soup_logger_flush (SoupLogger *logger)
+{
+        SoupLoggerPrivate *priv;
+
+        g_return_if_fail (SOUP_IS_LOGGER (logger));
+
+        priv = soup_logger_get_instance_private (logger);
+        g_mutex_lock (&priv->structured_mutex);
+        drain_rings (logger);
+        g_mutex_unlock (&priv->structured_mutex);
+}
+
 static void
 finished (SoupMessage *msg, gpointer user_data)
 {
@@ -779,6 +1541,11 @@ finished (SoupMessage *msg, gpointer user_data)
         if (!soup_logger_get_id (logger, msg))
                 return;
 
+        if (soup_logger_get_output_format (logger) != SOUP_LOGGER_OUTPUT_TEXT) {
+                record_response (logger, msg);
+                return;
+        }
+
 	print_response (logger, msg);
 	soup_logger_print (logger, SOUP_LOGGER_LOG_MINIMAL, ' ', "\n");
 }
@@ -798,10 +1565,17 @@ got_informational (SoupMessage *msg, gpointer user_data)
                 log_level = priv->level;
 
         g_signal_handlers_disconnect_by_func (msg, finished, logger);
+
+        if (soup_logger_get_output_format (logger) != SOUP_LOGGER_OUTPUT_TEXT) {
+                record_response (logger, msg);
+                return;
+        }
+
         print_response (logger, msg);
         soup_logger_print (logger, SOUP_LOGGER_LOG_MINIMAL, ' ', "\n");
 
-        if (!g_hash_table_steal_extended (priv->response_bodies, msg, NULL, (gpointer *)&body))
+        body = steal_body (logger, priv->response_bodies, msg);
+        if (!body)
                 return;
 
         if (soup_message_get_status (msg) == SOUP_STATUS_CONTINUE) {
@@ -826,6 +1600,11 @@ got_body (SoupMessage *msg, gpointer user_data)
 
 	g_signal_handlers_disconnect_by_func (msg, finished, logger);
 
+        if (soup_logger_get_output_format (logger) != SOUP_LOGGER_OUTPUT_TEXT) {
+                record_response (logger, msg);
+                return;
+        }
+
 	print_response (logger, msg);
 	soup_logger_print (logger, SOUP_LOGGER_LOG_MINIMAL, ' ', "\n");
 }
@@ -844,7 +1623,9 @@ body_stream_wrote_data_cb (GOutputStream *stream,
                 return;
 
         priv = soup_logger_get_instance_private (logger);
+        g_mutex_lock (&priv->lock);
         msg = g_hash_table_lookup (priv->request_messages, stream);
+        g_mutex_unlock (&priv->lock);
         write_body (logger, buffer, count, msg, priv->request_bodies);
 }
 
@@ -853,7 +1634,9 @@ body_ostream_done (gpointer data, GObject *bostream)
 {
         SoupLoggerPrivate *priv = data;
 
+        g_mutex_lock (&priv->lock);
         g_hash_table_remove (priv->request_messages, bostream);
+        g_mutex_unlock (&priv->lock);
 }
 
 void
@@ -863,7 +1646,12 @@ soup_logger_request_body_setup (SoupLogger           *logger,
 {
         SoupLoggerPrivate *priv = soup_logger_get_instance_private (logger);
 
+        if (soup_logger_get_output_format (logger) != SOUP_LOGGER_OUTPUT_TEXT)
+                return;
+
+        g_mutex_lock (&priv->lock);
         g_hash_table_insert (priv->request_messages, stream, msg);
+        g_mutex_unlock (&priv->lock);
         g_signal_connect_object (stream, "wrote-data",
                                  G_CALLBACK (body_stream_wrote_data_cb),
                                  logger, 0);
@@ -896,6 +1684,11 @@ wrote_body (SoupMessage *msg, gpointer user_data)
 	if (socket && !soup_logger_get_id (logger, socket))
 		soup_logger_set_id (logger, socket);
 
+        if (soup_logger_get_output_format (logger) != SOUP_LOGGER_OUTPUT_TEXT) {
+                record_request (logger, msg, socket, restarted);
+                return;
+        }
+
 	print_request (logger, msg, socket, restarted);
 	soup_logger_print (logger, SOUP_LOGGER_LOG_MINIMAL, ' ', "\n");
 }
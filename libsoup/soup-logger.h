@@ -20,6 +20,11 @@ typedef enum {
 	SOUP_LOGGER_LOG_BODY
 } SoupLoggerLogLevel;
 
+typedef enum {
+	SOUP_LOGGER_OUTPUT_TEXT,
+	SOUP_LOGGER_OUTPUT_JSON
+} SoupLoggerOutputFormat;
+
 typedef SoupLoggerLogLevel (*SoupLoggerFilter)  (SoupLogger         *logger,
 						 SoupMessage        *msg,
 						 gpointer            user_data);
@@ -58,4 +63,17 @@ void        soup_logger_set_max_body_size  (SoupLogger        *logger,
 SOUP_AVAILABLE_IN_ALL
 int         soup_logger_get_max_body_size  (SoupLogger        *logger);
 
+SOUP_AVAILABLE_IN_ALL
+void        soup_logger_set_output_format  (SoupLogger             *logger,
+					     SoupLoggerOutputFormat  format);
+
+SOUP_AVAILABLE_IN_ALL
+SoupLoggerOutputFormat soup_logger_get_output_format (SoupLogger *logger);
+
+SOUP_AVAILABLE_IN_ALL
+void        soup_logger_flush              (SoupLogger        *logger);
+
+SOUP_AVAILABLE_IN_ALL
+guint       soup_logger_get_dropped_records (SoupLogger       *logger);
+
 G_END_DECLS
@@ -29,4 +29,7 @@ gboolean    soup_message_headers_header_equals_common   (SoupMessageHeaders *hdr
                                                          SoupHeaderName      name,
                                                          const char         *value);
 
+void        soup_message_headers_serialize              (SoupMessageHeaders *hdrs,
+                                                         GString            *buffer);
+
 G_END_DECLS
@@ -832,6 +832,60 @@ soup_message_headers_iter_next (SoupMessageHeadersIter *iter,
         return FALSE;
 }
 
+static inline void
+append_header (GString    *buffer,
+               const char *name,
+               const char *value)
+{
+        gsize name_len = strlen (name);
+        gsize value_len = strlen (value);
+        gsize pos = buffer->len;
+        char *p;
+
+        g_string_set_size (buffer, pos + name_len + value_len + 4);
+        p = buffer->str + pos;
+        memcpy (p, name, name_len);
+        p += name_len;
+        *p++ = ':';
+        *p++ = ' ';
+        memcpy (p, value, value_len);
+        p += value_len;
+        *p++ = '\r';
+        *p = '\n';
+}
+
+/*
+ * soup_message_headers_serialize:
+ * @hdrs: a #SoupMessageHeaders
+ * @buffer: a #GString to append to
+ *
+ * Appends @hdrs to @buffer in HTTP/1 wire format, in the same order
+ * soup_message_headers_iter_next() returns them, followed by the
+ * empty line that ends the header block.
+ */
+void
+soup_message_headers_serialize (SoupMessageHeaders *hdrs,
+                                GString            *buffer)
+{
+        guint i;
+
+        if (hdrs->common_headers) {
+                SoupCommonHeader *hdr_array = (SoupCommonHeader *)hdrs->common_headers->data;
+
+                for (i = 0; i < hdrs->common_headers->len; i++)
+                        append_header (buffer, soup_header_name_to_string (hdr_array[i].name), hdr_array[i].value);
+        }
+
+        if (hdrs->uncommon_headers) {
+                SoupUncommonHeader *hdr_array = (SoupUncommonHeader *)hdrs->uncommon_headers->data;
+
+                for (i = 0; i < hdrs->uncommon_headers->len; i++)
+                        append_header (buffer, hdr_array[i].name, hdr_array[i].value);
+        }
+
+        g_string_append_len (buffer, "\r\n", 2);
+}
+
 /**
  * SoupMessageHeadersForeachFunc:
  * @name: the header name
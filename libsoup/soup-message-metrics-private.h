@@ -11,12 +11,15 @@ G_BEGIN_DECLS
 
 struct _SoupMessageMetrics {
         guint64 fetch_start;
+        guint64 queue_start;
+        guint64 connection_acquired;
         guint64 dns_start;
         guint64 dns_end;
         guint64 connect_start;
         guint64 connect_end;
         guint64 tls_start;
         guint64 request_start;
+        guint64 request_first_byte_sent;
         guint64 response_start;
         guint64 response_end;
 
@@ -26,6 +29,9 @@ struct _SoupMessageMetrics {
         guint64 response_header_bytes_received;
         guint64 response_body_size;
         guint64 response_body_bytes_received;
+
+        guint64 socket_send_buffer_size;
+        guint64 socket_receive_buffer_size;
 };
 
 SoupMessageMetrics *soup_message_metrics_new   (void);
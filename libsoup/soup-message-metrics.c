@@ -99,6 +99,46 @@ soup_message_metrics_get_fetch_start (SoupMessageMetrics *metrics)
         return metrics->fetch_start;
 }
 
+/**
+ * soup_message_metrics_get_queue_start:
+ * @metrics: a #SoupMessageMetrics
+ *
+ * Get the time immediately after the #SoupMessage was added to the
+ * #SoupSession queue. Unlike the fetch start time, this is not reset when
+ * the message is restarted, because of a redirection or authentication
+ * for example.
+ *
+ * Returns: the queue start time
+ */
+guint64
+soup_message_metrics_get_queue_start (SoupMessageMetrics *metrics)
+{
+        g_return_val_if_fail (metrics != NULL, 0);
+
+        return metrics->queue_start;
+}
+
+/**
+ * soup_message_metrics_get_connection_acquired:
+ * @metrics: a #SoupMessageMetrics
+ *
+ * Get the time immediately after the #SoupSession assigned a connection
+ * to the #SoupMessage, either a persistent one or a new one that still
+ * needs to be established. The difference with the fetch start time is
+ * the time spent waiting in the queue, for instance because the
+ * connection limits of the session were reached. It will be 0 if the
+ * resource was loaded from the local disk cache.
+ *
+ * Returns: the connection acquired time
+ */
+guint64
+soup_message_metrics_get_connection_acquired (SoupMessageMetrics *metrics)
+{
+        g_return_val_if_fail (metrics != NULL, 0);
+
+        return metrics->connection_acquired;
+}
+
 /**
  * soup_message_metrics_get_dns_start:
  * @metrics: a #SoupMessageMetrics
@@ -212,6 +252,24 @@ soup_message_metrics_get_request_start (SoupMessageMetrics *metrics)
         return metrics->request_start;
 }
 
+/**
+ * soup_message_metrics_get_request_first_byte_sent:
+ * @metrics: a #SoupMessageMetrics
+ *
+ * Get the time immediately after the first bytes of the request
+ * were written to the network. It will be 0 if the resource was loaded
+ * from the local disk cache.
+ *
+ * Returns: the request first byte sent time
+ */
+guint64
+soup_message_metrics_get_request_first_byte_sent (SoupMessageMetrics *metrics)
+{
+        g_return_val_if_fail (metrics != NULL, 0);
+
+        return metrics->request_first_byte_sent;
+}
+
 /**
  * soup_message_metrics_get_response_start:
  * @metrics: a #SoupMessageMetrics
@@ -362,3 +420,39 @@ soup_message_metrics_get_response_body_bytes_received (SoupMessageMetrics *metri
 
         return metrics->response_body_bytes_received;
 }
+
+/**
+ * soup_message_metrics_get_socket_send_buffer_size:
+ * @metrics: a #SoupMessageMetrics
+ *
+ * Get the size of the kernel send buffer of the socket, as reported by
+ * the system once it was connected. This is only set when the #SoupMessage
+ * caused a new connection to be created, see #SoupSession:socket-options.
+ *
+ * Returns: the send buffer size, or 0
+ */
+guint64
+soup_message_metrics_get_socket_send_buffer_size (SoupMessageMetrics *metrics)
+{
+        g_return_val_if_fail (metrics != NULL, 0);
+
+        return metrics->socket_send_buffer_size;
+}
+
+/**
+ * soup_message_metrics_get_socket_receive_buffer_size:
+ * @metrics: a #SoupMessageMetrics
+ *
+ * Get the size of the kernel receive buffer of the socket, as reported by
+ * the system once it was connected. This is only set when the #SoupMessage
+ * caused a new connection to be created, see #SoupSession:socket-options.
+ *
+ * Returns: the receive buffer size, or 0
+ */
+guint64
+soup_message_metrics_get_socket_receive_buffer_size (SoupMessageMetrics *metrics)
+{
+        g_return_val_if_fail (metrics != NULL, 0);
+
+        return metrics->socket_receive_buffer_size;
+}
@@ -24,6 +24,12 @@ void                soup_message_metrics_free               (SoupMessageMetrics
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_fetch_start    (SoupMessageMetrics *metrics);
 
+SOUP_AVAILABLE_IN_ALL
+guint64             soup_message_metrics_get_queue_start    (SoupMessageMetrics *metrics);
+
+SOUP_AVAILABLE_IN_ALL
+guint64             soup_message_metrics_get_connection_acquired (SoupMessageMetrics *metrics);
+
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_dns_start      (SoupMessageMetrics *metrics);
 
@@ -42,6 +48,9 @@ guint64             soup_message_metrics_get_tls_start      (SoupMessageMetrics
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_request_start  (SoupMessageMetrics *metrics);
 
+SOUP_AVAILABLE_IN_ALL
+guint64             soup_message_metrics_get_request_first_byte_sent (SoupMessageMetrics *metrics);
+
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_response_start (SoupMessageMetrics *metrics);
 
@@ -66,6 +75,12 @@ guint64             soup_message_metrics_get_response_body_size             (Sou
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_response_body_bytes_received   (SoupMessageMetrics *metrics);
 
+SOUP_AVAILABLE_IN_ALL
+guint64             soup_message_metrics_get_socket_send_buffer_size        (SoupMessageMetrics *metrics);
+
+SOUP_AVAILABLE_IN_ALL
+guint64             soup_message_metrics_get_socket_receive_buffer_size     (SoupMessageMetrics *metrics);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(SoupMessageMetrics, soup_message_metrics_free)
 
 G_END_DECLS
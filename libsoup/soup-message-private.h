@@ -127,12 +127,15 @@ void                soup_message_set_http_version        (SoupMessage       *msg
 
 typedef enum {
         SOUP_MESSAGE_METRICS_FETCH_START,
+        SOUP_MESSAGE_METRICS_QUEUE_START,
+        SOUP_MESSAGE_METRICS_CONNECTION_ACQUIRED,
         SOUP_MESSAGE_METRICS_DNS_START,
         SOUP_MESSAGE_METRICS_DNS_END,
         SOUP_MESSAGE_METRICS_CONNECT_START,
         SOUP_MESSAGE_METRICS_CONNECT_END,
         SOUP_MESSAGE_METRICS_TLS_START,
         SOUP_MESSAGE_METRICS_REQUEST_START,
+        SOUP_MESSAGE_METRICS_REQUEST_FIRST_BYTE_SENT,
         SOUP_MESSAGE_METRICS_RESPONSE_START,
         SOUP_MESSAGE_METRICS_RESPONSE_END
 } SoupMessageMetricsType;
@@ -140,6 +143,8 @@ typedef enum {
 void soup_message_set_metrics_timestamp (SoupMessage           *msg,
                                          SoupMessageMetricsType type);
 
+void soup_message_enable_metrics        (SoupMessage           *msg);
+
 void soup_message_set_request_host_from_uri     (SoupMessage *msg,
                                                  GUri        *uri);
 
@@ -49,6 +49,7 @@ soup_message_queue_item_destroy (SoupMessageQueueItem *item)
         g_object_unref (item->cancellable);
         g_clear_error (&item->error);
         g_clear_object (&item->task);
+        g_slist_free_full (item->features, g_object_unref);
 }
 
 void
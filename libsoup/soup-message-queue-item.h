@@ -40,10 +40,24 @@ struct _SoupMessageQueueItem {
         guint async        : 1;
         guint connect_only : 1;
         guint resend_count : 5;
+        guint waited_for_slot : 1;
         int io_priority;
 
         SoupMessageQueueItemState state;
         SoupMessageQueueItem *related;
+
+        /* The features request_queued() was called on */
+        GSList *features;
+
+        /* The SoupSessionReactor whose queue it is in */
+        gpointer reactor;
+
+        /* Only used for sysprof marks */
+        gint64 queue_begin_time_nsec;
+
+        /* Only used for the adaptive per-host limits */
+        gint64 conn_wait_begin_time;
+        gint64 conn_acquired_time;
 };
 
 SoupMessageQueueItem *soup_message_queue_item_new    (SoupSession          *session,
@@ -11,6 +11,8 @@
 
 #include <string.h>
 
+#include <gio/gnetworking.h>
+
 #include "soup-message.h"
 #include "soup.h"
 #include "soup-connection.h"
@@ -1515,12 +1517,33 @@ soup_message_set_metrics_timestamp_for_network_event (SoupMessage       *msg,
         }
 }
 
+/* The kernel may round or clamp the sizes that were asked for */
+static void
+soup_message_set_metrics_socket_buffer_sizes (SoupMessage *msg,
+                                              GIOStream   *connection)
+{
+        SoupMessageMetrics *metrics = soup_message_get_metrics (msg);
+        GSocket *socket;
+        int size;
+
+        if (!metrics || !G_IS_SOCKET_CONNECTION (connection))
+                return;
+
+        socket = g_socket_connection_get_socket (G_SOCKET_CONNECTION (connection));
+        if (g_socket_get_option (socket, SOL_SOCKET, SO_SNDBUF, &size, NULL))
+                metrics->socket_send_buffer_size = size;
+        if (g_socket_get_option (socket, SOL_SOCKET, SO_RCVBUF, &size, NULL))
+                metrics->socket_receive_buffer_size = size;
+}
+
 static void
 re_emit_connection_event (SoupMessage       *msg,
                           GSocketClientEvent event,
                           GIOStream         *connection)
 {
         soup_message_set_metrics_timestamp_for_network_event (msg, event);
+        if (event == G_SOCKET_CLIENT_CONNECTED)
+                soup_message_set_metrics_socket_buffer_sizes (msg, connection);
 
 	g_signal_emit (msg, signals[NETWORK_EVENT], 0,
 		       event, connection);
@@ -3030,7 +3053,8 @@ soup_message_get_remote_address (SoupMessage *msg)
  * @msg: The #SoupMessage
  *
  * Get the #SoupMessageMetrics of @msg. If the flag %SOUP_MESSAGE_COLLECT_METRICS is not
- * enabled for @msg this will return %NULL.
+ * enabled for @msg, and @msg has not been sent by a #SoupSession with a
+ * #SoupMetricsRegistry, this will return %NULL.
  *
  * Returns: (transfer none) (nullable): a #SoupMessageMetrics, or %NULL
  */
@@ -3051,6 +3075,15 @@ soup_message_get_metrics (SoupMessage *msg)
         return priv->metrics;
 }
 
+void
+soup_message_enable_metrics (SoupMessage *msg)
+{
+        SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
+
+        if (!priv->metrics)
+                priv->metrics = soup_message_metrics_new ();
+}
+
 void
 soup_message_set_metrics_timestamp (SoupMessage           *msg,
                                     SoupMessageMetricsType type)
@@ -3063,9 +3096,22 @@ soup_message_set_metrics_timestamp (SoupMessage           *msg,
 
         timestamp = g_get_monotonic_time ();
         switch (type) {
-        case SOUP_MESSAGE_METRICS_FETCH_START:
+        case SOUP_MESSAGE_METRICS_FETCH_START: {
+                /* The queue start is kept across restarts, so that the
+                 * whole life of the message in the session can be measured.
+                 */
+                guint64 queue_start = metrics->queue_start;
+
                 memset (metrics, 0, sizeof (SoupMessageMetrics));
                 metrics->fetch_start = timestamp;
+                metrics->queue_start = queue_start;
+                break;
+        }
+        case SOUP_MESSAGE_METRICS_QUEUE_START:
+                metrics->queue_start = timestamp;
+                break;
+        case SOUP_MESSAGE_METRICS_CONNECTION_ACQUIRED:
+                metrics->connection_acquired = timestamp;
                 break;
         case SOUP_MESSAGE_METRICS_DNS_START:
                 metrics->dns_start = timestamp;
@@ -3085,6 +3131,10 @@ soup_message_set_metrics_timestamp (SoupMessage           *msg,
         case SOUP_MESSAGE_METRICS_REQUEST_START:
                 metrics->request_start = timestamp;
                 break;
+        case SOUP_MESSAGE_METRICS_REQUEST_FIRST_BYTE_SENT:
+                if (metrics->request_first_byte_sent == 0)
+                        metrics->request_first_byte_sent = timestamp;
+                break;
         case SOUP_MESSAGE_METRICS_RESPONSE_START:
                 /* In case of multiple requests due to a informational response
                  * the response start is the first one.
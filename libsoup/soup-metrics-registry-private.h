@@ -0,0 +1,27 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "soup-metrics-registry.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+        SOUP_METRICS_COUNTER_QUEUE_KICKS,
+        SOUP_METRICS_COUNTER_REQUEUES,
+        SOUP_METRICS_COUNTER_CLEANUP_PASSES,
+
+        SOUP_METRICS_N_COUNTERS
+} SoupMetricsCounter;
+
+void soup_metrics_registry_increment_counter (SoupMetricsRegistry *registry,
+                                              SoupMetricsCounter   counter);
+
+void soup_metrics_registry_record_queue_run  (SoupMetricsRegistry *registry,
+                                              guint64              duration,
+                                              guint                items_scanned);
+
+G_END_DECLS
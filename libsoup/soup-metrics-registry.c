@@ -0,0 +1,836 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-metrics-registry.c
+ *
+ * Copyright (C) 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "soup-metrics-registry-private.h"
+#include "soup-connection.h"
+#include "soup-message-metrics-private.h"
+#include "soup-message-private.h"
+#include "soup-session-feature-private.h"
+#include "soup.h"
+
+/**
+ * SECTION:soup-metrics-registry
+ * @short_description: Session-wide metrics
+ * @see_also: #SoupMessageMetrics
+ *
+ * #SoupMetricsRegistry aggregates the #SoupMessageMetrics of every
+ * message sent by a #SoupSession into per-host statistics: latency
+ * histograms for each phase of a request (queue wait, DNS, TCP connect,
+ * TLS handshake, time to first byte, response download and total),
+ * connection reuse, HTTP/2 stream concurrency and bytes transferred.
+ * It also keeps counters of the work done by the session scheduler, to
+ * tell whether latency comes from the connection limits of the session
+ * or from the network.
+ *
+ * #SoupMetricsRegistry implements #SoupSessionFeature, so you can add
+ * it to a session with soup_session_add_feature() or
+ * soup_session_add_feature_by_type(). While it is attached, metrics are
+ * collected for every message of the session, whether or not
+ * %SOUP_MESSAGE_COLLECT_METRICS is set.
+ *
+ * The aggregated values can be read at any time, from any thread, with
+ * soup_metrics_registry_snapshot() or exported in the Prometheus text
+ * exposition format with soup_metrics_registry_to_prometheus().
+ */
+
+/**
+ * SoupMetricsRegistry:
+ *
+ * Class that aggregates #SoupMessageMetrics per host.
+ */
+
+/* Latency histograms use a log-linear layout, similar to HdrHistogram:
+ * values are recorded in microseconds, the first 2 * HISTOGRAM_SUB_BUCKETS
+ * values are exact and every following power of two is split into
+ * HISTOGRAM_SUB_BUCKETS linear buckets, which bounds the relative error
+ * of any percentile to 1 / HISTOGRAM_SUB_BUCKETS.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS     (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_SHIFT       36 /* Up to 2^41 µs, about 25 days */
+#define HISTOGRAM_N_BUCKETS       ((HISTOGRAM_MAX_SHIFT + 2) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+        guint64 count;
+        guint64 sum;
+        guint64 max;
+        guint64 buckets[HISTOGRAM_N_BUCKETS];
+} Histogram;
+
+typedef enum {
+        PHASE_QUEUE,
+        PHASE_DNS,
+        PHASE_CONNECT,
+        PHASE_TLS,
+        PHASE_WAIT,
+        PHASE_RECEIVE,
+        PHASE_TOTAL,
+
+        N_PHASES
+} Phase;
+
+static const char *phase_names[N_PHASES] = {
+        "queue",
+        "dns",
+        "connect",
+        "tls",
+        "wait",
+        "receive",
+        "total"
+};
+
+static const double percentiles[] = { 0.5, 0.9, 0.99 };
+
+typedef struct {
+        Histogram phases[N_PHASES];
+
+        guint64 requests;
+        guint64 connections_opened;
+        guint64 connections_reused;
+        guint64 tls_handshakes;
+        guint64 tls_resumptions;
+        guint64 bytes_sent;
+        guint64 bytes_received;
+
+        guint http2_streams_active;
+        guint http2_streams_max;
+} HostMetrics;
+
+typedef struct {
+        char *host;
+        guint64 http2_connection_id;
+} MessageState;
+
+struct _SoupMetricsRegistry {
+        GObject parent_instance;
+};
+
+typedef struct {
+        guint64 counters[SOUP_METRICS_N_COUNTERS];
+        guint64 items_scanned;
+        Histogram queue_runs;
+} SchedulerMetrics;
+
+typedef struct {
+        GMutex mutex;
+
+        SchedulerMetrics scheduler;
+
+        /* host key -> HostMetrics */
+        GHashTable *hosts;
+        /* SoupMessage -> MessageState */
+        GHashTable *messages;
+        /* HTTP/2 connection id -> number of active streams */
+        GHashTable *http2_streams;
+} SoupMetricsRegistryPrivate;
+
+static void soup_metrics_registry_session_feature_init (SoupSessionFeatureInterface *feature_interface, gpointer interface_data);
+
+G_DEFINE_TYPE_WITH_CODE (SoupMetricsRegistry, soup_metrics_registry, G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (SoupMetricsRegistry)
+                         G_IMPLEMENT_INTERFACE (SOUP_TYPE_SESSION_FEATURE,
+                                                soup_metrics_registry_session_feature_init))
+
+static guint
+histogram_bucket_index (guint64 value)
+{
+        guint shift;
+
+        if (value < 2 * HISTOGRAM_SUB_BUCKETS)
+                return value;
+
+        shift = g_bit_storage (value) - (HISTOGRAM_SUB_BUCKET_BITS + 1);
+        if (shift > HISTOGRAM_MAX_SHIFT)
+                return HISTOGRAM_N_BUCKETS - 1;
+
+        return (shift * HISTOGRAM_SUB_BUCKETS) + (value >> shift);
+}
+
+static guint64
+histogram_bucket_upper_bound (guint index)
+{
+        guint shift;
+        guint64 mantissa;
+
+        if (index < 2 * HISTOGRAM_SUB_BUCKETS)
+                return index;
+
+        shift = (index / HISTOGRAM_SUB_BUCKETS) - 1;
+        mantissa = (index % HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKETS;
+
+        return ((mantissa + 1) << shift) - 1;
+}
+
+static void
+histogram_record (Histogram *histogram,
+                  guint64    value)
+{
+        histogram->buckets[histogram_bucket_index (value)]++;
+        histogram->count++;
+        histogram->sum += value;
+        histogram->max = MAX (histogram->max, value);
+}
+
+static guint64
+histogram_get_percentile (Histogram *histogram,
+                          double     percentile)
+{
+        guint64 rank, seen = 0;
+        guint i;
+
+        if (!histogram->count)
+                return 0;
+
+        rank = MAX ((guint64)(percentile * histogram->count + 0.5), 1);
+        for (i = 0; i < HISTOGRAM_N_BUCKETS; i++) {
+                seen += histogram->buckets[i];
+                if (seen >= rank)
+                        return MIN (histogram_bucket_upper_bound (i), histogram->max);
+        }
+
+        return histogram->max;
+}
+
+static void
+message_state_free (MessageState *state)
+{
+        g_free (state->host);
+        g_free (state);
+}
+
+static char *
+host_key_for_message (SoupMessage *msg)
+{
+        GUri *uri = soup_message_get_uri (msg);
+
+        if (g_uri_get_port (uri) == -1)
+                return g_strdup_printf ("%s://%s", g_uri_get_scheme (uri), g_uri_get_host (uri));
+
+        return g_strdup_printf ("%s://%s:%d", g_uri_get_scheme (uri), g_uri_get_host (uri), g_uri_get_port (uri));
+}
+
+static HostMetrics *
+get_host_metrics (SoupMetricsRegistryPrivate *priv,
+                  const char                 *host)
+{
+        HostMetrics *metrics;
+
+        metrics = g_hash_table_lookup (priv->hosts, host);
+        if (!metrics) {
+                metrics = g_new0 (HostMetrics, 1);
+                g_hash_table_insert (priv->hosts, g_strdup (host), metrics);
+        }
+
+        return metrics;
+}
+
+/* Must be called with the registry mutex held */
+static void
+release_http2_stream (SoupMetricsRegistryPrivate *priv,
+                      MessageState               *state)
+{
+        HostMetrics *metrics;
+        guint active;
+
+        if (!state->http2_connection_id)
+                return;
+
+        active = GPOINTER_TO_UINT (g_hash_table_lookup (priv->http2_streams, &state->http2_connection_id));
+        if (active > 1)
+                g_hash_table_insert (priv->http2_streams, g_memdup2 (&state->http2_connection_id, sizeof (guint64)), GUINT_TO_POINTER (active - 1));
+        else
+                g_hash_table_remove (priv->http2_streams, &state->http2_connection_id);
+
+        metrics = get_host_metrics (priv, state->host);
+        if (metrics->http2_streams_active)
+                metrics->http2_streams_active--;
+
+        state->http2_connection_id = 0;
+}
+
+static void
+record_interval (HostMetrics *metrics,
+                 Phase        phase,
+                 guint64      start,
+                 guint64      end)
+{
+        if (!start || !end || end < start)
+                return;
+
+        histogram_record (&metrics->phases[phase], end - start);
+}
+
+static void
+soup_metrics_registry_init (SoupMetricsRegistry *registry)
+{
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (registry);
+
+        g_mutex_init (&priv->mutex);
+        priv->hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        priv->messages = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)message_state_free);
+        priv->http2_streams = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+}
+
+static void
+soup_metrics_registry_finalize (GObject *object)
+{
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (SOUP_METRICS_REGISTRY (object));
+
+        g_hash_table_destroy (priv->hosts);
+        g_hash_table_destroy (priv->messages);
+        g_hash_table_destroy (priv->http2_streams);
+        g_mutex_clear (&priv->mutex);
+
+        G_OBJECT_CLASS (soup_metrics_registry_parent_class)->finalize (object);
+}
+
+static void
+soup_metrics_registry_class_init (SoupMetricsRegistryClass *registry_class)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (registry_class);
+
+        object_class->finalize = soup_metrics_registry_finalize;
+}
+
+static void
+message_starting (SoupMessage         *msg,
+                  SoupMetricsRegistry *registry)
+{
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (registry);
+        SoupMessageMetrics *metrics = soup_message_get_metrics (msg);
+        SoupConnection *conn = soup_message_get_connection (msg);
+        MessageState *state;
+        HostMetrics *host_metrics;
+
+        g_mutex_lock (&priv->mutex);
+
+        state = g_hash_table_lookup (priv->messages, msg);
+        if (!state) {
+                g_mutex_unlock (&priv->mutex);
+                return;
+        }
+
+        /* A restarted message gives its stream back before taking a new one */
+        release_http2_stream (priv, state);
+
+        host_metrics = get_host_metrics (priv, state->host);
+        if (metrics && metrics->connect_start)
+                host_metrics->connections_opened++;
+        else
+                host_metrics->connections_reused++;
+
+        if (metrics && metrics->tls_start && conn) {
+                host_metrics->tls_handshakes++;
+                if (soup_connection_get_tls_session_resumed (conn))
+                        host_metrics->tls_resumptions++;
+        }
+
+        if (conn && soup_connection_get_negotiated_protocol (conn) == SOUP_HTTP_2_0) {
+                guint64 id = soup_connection_get_id (conn);
+                guint active;
+
+                active = GPOINTER_TO_UINT (g_hash_table_lookup (priv->http2_streams, &id)) + 1;
+                g_hash_table_insert (priv->http2_streams, g_memdup2 (&id, sizeof (guint64)), GUINT_TO_POINTER (active));
+                state->http2_connection_id = id;
+
+                host_metrics->http2_streams_active++;
+                host_metrics->http2_streams_max = MAX (host_metrics->http2_streams_max, active);
+        }
+
+        g_mutex_unlock (&priv->mutex);
+}
+
+static void
+message_finished (SoupMessage         *msg,
+                  SoupMetricsRegistry *registry)
+{
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (registry);
+        SoupMessageMetrics *metrics = soup_message_get_metrics (msg);
+        MessageState *state;
+        HostMetrics *host_metrics;
+
+        g_mutex_lock (&priv->mutex);
+
+        state = g_hash_table_lookup (priv->messages, msg);
+        if (!state) {
+                g_mutex_unlock (&priv->mutex);
+                return;
+        }
+
+        release_http2_stream (priv, state);
+
+        host_metrics = get_host_metrics (priv, state->host);
+        host_metrics->requests++;
+
+        if (metrics) {
+                record_interval (host_metrics, PHASE_QUEUE, metrics->fetch_start, metrics->connection_acquired);
+                record_interval (host_metrics, PHASE_DNS, metrics->dns_start, metrics->dns_end);
+                record_interval (host_metrics, PHASE_CONNECT, metrics->connect_start,
+                                 metrics->tls_start ? metrics->tls_start : metrics->connect_end);
+                record_interval (host_metrics, PHASE_TLS, metrics->tls_start, metrics->connect_end);
+                record_interval (host_metrics, PHASE_WAIT, metrics->request_start, metrics->response_start);
+                record_interval (host_metrics, PHASE_RECEIVE, metrics->response_start, metrics->response_end);
+                record_interval (host_metrics, PHASE_TOTAL, metrics->fetch_start, metrics->response_end);
+
+                host_metrics->bytes_sent += metrics->request_header_bytes_sent + metrics->request_body_bytes_sent;
+                host_metrics->bytes_received += metrics->response_header_bytes_received + metrics->response_body_bytes_received;
+        }
+
+        g_mutex_unlock (&priv->mutex);
+}
+
+static void
+soup_metrics_registry_request_queued (SoupSessionFeature *feature,
+                                      SoupMessage        *msg)
+{
+        SoupMetricsRegistry *registry = SOUP_METRICS_REGISTRY (feature);
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (registry);
+        MessageState *state;
+
+        state = g_new0 (MessageState, 1);
+        state->host = host_key_for_message (msg);
+
+        g_mutex_lock (&priv->mutex);
+        g_hash_table_insert (priv->messages, msg, state);
+        g_mutex_unlock (&priv->mutex);
+
+        g_signal_connect (msg, "starting",
+                          G_CALLBACK (message_starting), registry);
+        g_signal_connect (msg, "finished",
+                          G_CALLBACK (message_finished), registry);
+}
+
+static void
+soup_metrics_registry_request_unqueued (SoupSessionFeature *feature,
+                                        SoupMessage        *msg)
+{
+        SoupMetricsRegistry *registry = SOUP_METRICS_REGISTRY (feature);
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (registry);
+        MessageState *state;
+
+        g_signal_handlers_disconnect_by_data (msg, registry);
+
+        g_mutex_lock (&priv->mutex);
+        state = g_hash_table_lookup (priv->messages, msg);
+        if (state) {
+                release_http2_stream (priv, state);
+                g_hash_table_remove (priv->messages, msg);
+        }
+        g_mutex_unlock (&priv->mutex);
+}
+
+static void
+soup_metrics_registry_session_feature_init (SoupSessionFeatureInterface *feature_interface,
+                                            gpointer                     interface_data)
+{
+        feature_interface->request_queued = soup_metrics_registry_request_queued;
+        feature_interface->request_unqueued = soup_metrics_registry_request_unqueued;
+}
+
+/**
+ * soup_metrics_registry_new:
+ *
+ * Creates a new #SoupMetricsRegistry.
+ *
+ * Returns: a new #SoupMetricsRegistry
+ */
+SoupMetricsRegistry *
+soup_metrics_registry_new (void)
+{
+        return g_object_new (SOUP_TYPE_METRICS_REGISTRY, NULL);
+}
+
+void
+soup_metrics_registry_increment_counter (SoupMetricsRegistry *registry,
+                                         SoupMetricsCounter   counter)
+{
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (registry);
+
+        g_mutex_lock (&priv->mutex);
+        priv->scheduler.counters[counter]++;
+        g_mutex_unlock (&priv->mutex);
+}
+
+void
+soup_metrics_registry_record_queue_run (SoupMetricsRegistry *registry,
+                                        guint64              duration,
+                                        guint                items_scanned)
+{
+        SoupMetricsRegistryPrivate *priv = soup_metrics_registry_get_instance_private (registry);
+
+        g_mutex_lock (&priv->mutex);
+        histogram_record (&priv->scheduler.queue_runs, duration);
+        priv->scheduler.items_scanned += items_scanned;
+        g_mutex_unlock (&priv->mutex);
+}
+
+static GVariant *
+histogram_to_variant (Histogram *histogram)
+{
+        return g_variant_new ("(tttttt)",
+                              histogram->count,
+                              histogram->sum,
+                              histogram_get_percentile (histogram, 0.5),
+                              histogram_get_percentile (histogram, 0.9),
+                              histogram_get_percentile (histogram, 0.99),
+                              histogram->max);
+}
+
+/**
+ * soup_metrics_registry_snapshot:
+ * @registry: a #SoupMetricsRegistry
+ *
+ * Returns a consistent copy of the metrics collected so far, as a
+ * #GVariant of type `a{sv}` with two entries.
+ *
+ * `hosts` (`a{sa{sv}}`) maps each host, in the form `scheme://host:port`,
+ * to a dictionary with the following entries:
+ *
+ * - `requests` (`t`): number of finished messages
+ * - `connections-opened` (`t`): messages sent on a new connection
+ * - `connections-reused` (`t`): messages sent on an already open connection
+ * - `tls-handshakes` (`t`): TLS handshakes done for new connections
+ * - `tls-resumptions` (`t`): TLS handshakes that resumed a previous
+ *   session, when the TLS backend can tell
+ * - `bytes-sent` (`t`): request header and body bytes written
+ * - `bytes-received` (`t`): response header and body bytes read
+ * - `http2-streams-active` (`u`): HTTP/2 streams currently in flight
+ * - `http2-streams-max` (`u`): largest number of concurrent streams seen
+ *   on a single HTTP/2 connection
+ * - `queue`, `dns`, `connect`, `tls`, `wait`, `receive`, `total`
+ *   (`(tttttt)`): for each request phase, the number of samples, the sum,
+ *   the 50th, 90th and 99th percentiles and the maximum, all in
+ *   microseconds. The `queue` phase goes from the fetch start until the
+ *   message gets a connection.
+ *
+ * `scheduler` (`a{sv}`) describes the work done by the session queue:
+ *
+ * - `queue-runs` (`(tttttt)`): duration of each pass over the queue,
+ *   with the same layout as the request phases
+ * - `queue-kicks` (`t`): number of times a queue run was scheduled
+ * - `items-scanned` (`t`): queue items visited by all the queue runs
+ * - `requeues` (`t`): number of messages requeued for a restart
+ * - `cleanup-passes` (`t`): number of scans for connections to close
+ *
+ * Returns: (transfer none): a new floating #GVariant
+ */
+GVariant *
+soup_metrics_registry_snapshot (SoupMetricsRegistry *registry)
+{
+        SoupMetricsRegistryPrivate *priv;
+        GVariantBuilder builder, hosts_builder, scheduler_builder;
+        GHashTableIter iter;
+        gpointer key, value;
+
+        g_return_val_if_fail (SOUP_IS_METRICS_REGISTRY (registry), NULL);
+
+        priv = soup_metrics_registry_get_instance_private (registry);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_init (&hosts_builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+        g_variant_builder_init (&scheduler_builder, G_VARIANT_TYPE ("a{sv}"));
+
+        g_mutex_lock (&priv->mutex);
+        g_hash_table_iter_init (&iter, priv->hosts);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                HostMetrics *metrics = value;
+                GVariantBuilder host_builder;
+                guint i;
+
+                g_variant_builder_init (&host_builder, G_VARIANT_TYPE ("a{sv}"));
+                g_variant_builder_add (&host_builder, "{sv}", "requests", g_variant_new_uint64 (metrics->requests));
+                g_variant_builder_add (&host_builder, "{sv}", "connections-opened", g_variant_new_uint64 (metrics->connections_opened));
+                g_variant_builder_add (&host_builder, "{sv}", "connections-reused", g_variant_new_uint64 (metrics->connections_reused));
+                g_variant_builder_add (&host_builder, "{sv}", "tls-handshakes", g_variant_new_uint64 (metrics->tls_handshakes));
+                g_variant_builder_add (&host_builder, "{sv}", "tls-resumptions", g_variant_new_uint64 (metrics->tls_resumptions));
+                g_variant_builder_add (&host_builder, "{sv}", "bytes-sent", g_variant_new_uint64 (metrics->bytes_sent));
+                g_variant_builder_add (&host_builder, "{sv}", "bytes-received", g_variant_new_uint64 (metrics->bytes_received));
+                g_variant_builder_add (&host_builder, "{sv}", "http2-streams-active", g_variant_new_uint32 (metrics->http2_streams_active));
+                g_variant_builder_add (&host_builder, "{sv}", "http2-streams-max", g_variant_new_uint32 (metrics->http2_streams_max));
+
+                for (i = 0; i < N_PHASES; i++)
+                        g_variant_builder_add (&host_builder, "{sv}", phase_names[i], histogram_to_variant (&metrics->phases[i]));
+
+                g_variant_builder_add (&hosts_builder, "{sa{sv}}", key, &host_builder);
+        }
+
+        g_variant_builder_add (&scheduler_builder, "{sv}", "queue-runs", histogram_to_variant (&priv->scheduler.queue_runs));
+        g_variant_builder_add (&scheduler_builder, "{sv}", "queue-kicks", g_variant_new_uint64 (priv->scheduler.counters[SOUP_METRICS_COUNTER_QUEUE_KICKS]));
+        g_variant_builder_add (&scheduler_builder, "{sv}", "items-scanned", g_variant_new_uint64 (priv->scheduler.items_scanned));
+        g_variant_builder_add (&scheduler_builder, "{sv}", "requeues", g_variant_new_uint64 (priv->scheduler.counters[SOUP_METRICS_COUNTER_REQUEUES]));
+        g_variant_builder_add (&scheduler_builder, "{sv}", "cleanup-passes", g_variant_new_uint64 (priv->scheduler.counters[SOUP_METRICS_COUNTER_CLEANUP_PASSES]));
+        g_mutex_unlock (&priv->mutex);
+
+        g_variant_builder_add (&builder, "{sv}", "hosts", g_variant_builder_end (&hosts_builder));
+        g_variant_builder_add (&builder, "{sv}", "scheduler", g_variant_builder_end (&scheduler_builder));
+
+        return g_variant_builder_end (&builder);
+}
+
+static void
+append_label_value (GString    *string,
+                    const char *value)
+{
+        const char *p;
+
+        for (p = value; *p; p++) {
+                switch (*p) {
+                case '\\':
+                        g_string_append (string, "\\\\");
+                        break;
+                case '"':
+                        g_string_append (string, "\\\"");
+                        break;
+                case '\n':
+                        g_string_append (string, "\\n");
+                        break;
+                default:
+                        g_string_append_c (string, *p);
+                        break;
+                }
+        }
+}
+
+static void
+append_seconds (GString *string,
+                guint64  usecs)
+{
+        char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+        g_string_append (string, g_ascii_dtostr (buffer, sizeof (buffer), usecs / (double)G_USEC_PER_SEC));
+}
+
+static void
+append_host_sample (GString    *string,
+                    const char *name,
+                    const char *host,
+                    guint64     value)
+{
+        g_string_append_printf (string, "%s{host=\"", name);
+        append_label_value (string, host);
+        g_string_append_printf (string, "\"} %" G_GUINT64_FORMAT "\n", value);
+}
+
+typedef enum {
+        COUNTER_REQUESTS,
+        COUNTER_CONNECTIONS_OPENED,
+        COUNTER_CONNECTIONS_REUSED,
+        COUNTER_TLS_HANDSHAKES,
+        COUNTER_TLS_RESUMPTIONS,
+        COUNTER_BYTES_SENT,
+        COUNTER_BYTES_RECEIVED,
+        GAUGE_HTTP2_STREAMS_ACTIVE,
+        GAUGE_HTTP2_STREAMS_MAX,
+
+        N_SAMPLES
+} Sample;
+
+static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+} samples[N_SAMPLES] = {
+        { "soup_requests_total", "counter", "Number of finished messages" },
+        { "soup_connections_opened_total", "counter", "Messages sent on a new connection" },
+        { "soup_connections_reused_total", "counter", "Messages sent on an already open connection" },
+        { "soup_tls_handshakes_total", "counter", "TLS handshakes done for new connections" },
+        { "soup_tls_resumptions_total", "counter", "TLS handshakes that resumed a previous session" },
+        { "soup_bytes_sent_total", "counter", "Request header and body bytes written" },
+        { "soup_bytes_received_total", "counter", "Response header and body bytes read" },
+        { "soup_http2_streams_active", "gauge", "HTTP/2 streams currently in flight" },
+        { "soup_http2_streams_max", "gauge", "Largest number of concurrent streams on an HTTP/2 connection" }
+};
+
+/* SOUP_METRICS_N_COUNTERS stands for the number of items scanned */
+static const struct {
+        const char *name;
+        SoupMetricsCounter counter;
+        const char *help;
+} scheduler_samples[] = {
+        { "soup_session_queue_kicks_total", SOUP_METRICS_COUNTER_QUEUE_KICKS, "Number of times a queue run was scheduled" },
+        { "soup_session_queue_items_scanned_total", SOUP_METRICS_N_COUNTERS, "Queue items visited by all the queue runs" },
+        { "soup_session_requeues_total", SOUP_METRICS_COUNTER_REQUEUES, "Number of messages requeued for a restart" },
+        { "soup_session_cleanup_passes_total", SOUP_METRICS_COUNTER_CLEANUP_PASSES, "Number of scans for connections to close" }
+};
+
+static guint64
+host_metrics_get_sample (HostMetrics *metrics,
+                         Sample       sample)
+{
+        switch (sample) {
+        case COUNTER_REQUESTS:
+                return metrics->requests;
+        case COUNTER_CONNECTIONS_OPENED:
+                return metrics->connections_opened;
+        case COUNTER_CONNECTIONS_REUSED:
+                return metrics->connections_reused;
+        case COUNTER_TLS_HANDSHAKES:
+                return metrics->tls_handshakes;
+        case COUNTER_TLS_RESUMPTIONS:
+                return metrics->tls_resumptions;
+        case COUNTER_BYTES_SENT:
+                return metrics->bytes_sent;
+        case COUNTER_BYTES_RECEIVED:
+                return metrics->bytes_received;
+        case GAUGE_HTTP2_STREAMS_ACTIVE:
+                return metrics->http2_streams_active;
+        case GAUGE_HTTP2_STREAMS_MAX:
+                return metrics->http2_streams_max;
+        case N_SAMPLES:
+                break;
+        }
+
+        g_assert_not_reached ();
+        return 0;
+}
+
+/**
+ * soup_metrics_registry_to_prometheus:
+ * @registry: a #SoupMetricsRegistry
+ *
+ * Exports the metrics collected so far in the Prometheus text exposition
+ * format. Every sample is labelled with the host it belongs to; request
+ * phase durations are exported as the `soup_request_phase_seconds`
+ * summary with a `phase` label and the 0.5, 0.9 and 0.99 quantiles.
+ * The session scheduler metrics are exported without labels, with the
+ * `soup_session_` prefix.
+ *
+ * Returns: (transfer full): the metrics as text. Free with g_free().
+ */
+char *
+soup_metrics_registry_to_prometheus (SoupMetricsRegistry *registry)
+{
+        SoupMetricsRegistryPrivate *priv;
+        GString *string;
+        GHashTableIter iter;
+        gpointer key, value;
+        guint i, j;
+
+        g_return_val_if_fail (SOUP_IS_METRICS_REGISTRY (registry), NULL);
+
+        priv = soup_metrics_registry_get_instance_private (registry);
+        string = g_string_new (NULL);
+
+        g_mutex_lock (&priv->mutex);
+
+        for (i = 0; i < N_SAMPLES; i++) {
+                g_string_append_printf (string, "# HELP %s %s\n", samples[i].name, samples[i].help);
+                g_string_append_printf (string, "# TYPE %s %s\n", samples[i].name, samples[i].type);
+
+                g_hash_table_iter_init (&iter, priv->hosts);
+                while (g_hash_table_iter_next (&iter, &key, &value))
+                        append_host_sample (string, samples[i].name, key, host_metrics_get_sample (value, i));
+        }
+
+        g_string_append (string, "# HELP soup_request_phase_seconds Duration of each request phase\n");
+        g_string_append (string, "# TYPE soup_request_phase_seconds summary\n");
+        g_hash_table_iter_init (&iter, priv->hosts);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                HostMetrics *metrics = value;
+
+                for (i = 0; i < N_PHASES; i++) {
+                        Histogram *histogram = &metrics->phases[i];
+
+                        if (!histogram->count)
+                                continue;
+
+                        for (j = 0; j < G_N_ELEMENTS (percentiles); j++) {
+                                char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+                                g_string_append (string, "soup_request_phase_seconds{host=\"");
+                                append_label_value (string, key);
+                                g_string_append_printf (string, "\",phase=\"%s\",quantile=\"%s\"} ", phase_names[i],
+                                                        g_ascii_dtostr (buffer, sizeof (buffer), percentiles[j]));
+                                append_seconds (string, histogram_get_percentile (histogram, percentiles[j]));
+                                g_string_append_c (string, '\n');
+                        }
+
+                        g_string_append (string, "soup_request_phase_seconds_sum{host=\"");
+                        append_label_value (string, key);
+                        g_string_append_printf (string, "\",phase=\"%s\"} ", phase_names[i]);
+                        append_seconds (string, histogram->sum);
+                        g_string_append_c (string, '\n');
+
+                        g_string_append (string, "soup_request_phase_seconds_count{host=\"");
+                        append_label_value (string, key);
+                        g_string_append_printf (string, "\",phase=\"%s\"} %" G_GUINT64_FORMAT "\n", phase_names[i], histogram->count);
+                }
+        }
+
+        g_string_append (string, "# HELP soup_session_queue_run_seconds Duration of each pass over the session queue\n");
+        g_string_append (string, "# TYPE soup_session_queue_run_seconds summary\n");
+        for (j = 0; j < G_N_ELEMENTS (percentiles); j++) {
+                char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+                g_string_append_printf (string, "soup_session_queue_run_seconds{quantile=\"%s\"} ",
+                                        g_ascii_dtostr (buffer, sizeof (buffer), percentiles[j]));
+                append_seconds (string, histogram_get_percentile (&priv->scheduler.queue_runs, percentiles[j]));
+                g_string_append_c (string, '\n');
+        }
+        g_string_append (string, "soup_session_queue_run_seconds_sum ");
+        append_seconds (string, priv->scheduler.queue_runs.sum);
+        g_string_append_printf (string, "\nsoup_session_queue_run_seconds_count %" G_GUINT64_FORMAT "\n",
+                                priv->scheduler.queue_runs.count);
+
+        for (i = 0; i < G_N_ELEMENTS (scheduler_samples); i++) {
+                guint64 sample;
+
+                if (scheduler_samples[i].counter == SOUP_METRICS_N_COUNTERS)
+                        sample = priv->scheduler.items_scanned;
+                else
+                        sample = priv->scheduler.counters[scheduler_samples[i].counter];
+
+                g_string_append_printf (string, "# HELP %s %s\n", scheduler_samples[i].name, scheduler_samples[i].help);
+                g_string_append_printf (string, "# TYPE %s counter\n", scheduler_samples[i].name);
+                g_string_append_printf (string, "%s %" G_GUINT64_FORMAT "\n", scheduler_samples[i].name, sample);
+        }
+
+        g_mutex_unlock (&priv->mutex);
+
+        return g_string_free (string, FALSE);
+}
+
+/**
+ * soup_metrics_registry_reset:
+ * @registry: a #SoupMetricsRegistry
+ *
+ * Discards all the metrics collected so far. Messages that are still in
+ * flight are accounted for in the new period when they finish.
+ */
+void
+soup_metrics_registry_reset (SoupMetricsRegistry *registry)
+{
+        SoupMetricsRegistryPrivate *priv;
+        GHashTableIter iter;
+        gpointer value;
+
+        g_return_if_fail (SOUP_IS_METRICS_REGISTRY (registry));
+
+        priv = soup_metrics_registry_get_instance_private (registry);
+
+        g_mutex_lock (&priv->mutex);
+        g_hash_table_remove_all (priv->hosts);
+        memset (&priv->scheduler, 0, sizeof (SchedulerMetrics));
+
+        /* Keep the in-flight stream gauges consistent with the messages
+         * that will release them later.
+         */
+        g_hash_table_iter_init (&iter, priv->messages);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                MessageState *state = value;
+
+                if (state->http2_connection_id)
+                        get_host_metrics (priv, state->host)->http2_streams_active++;
+        }
+        g_mutex_unlock (&priv->mutex);
+}
@@ -0,0 +1,28 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_METRICS_REGISTRY (soup_metrics_registry_get_type ())
+SOUP_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (SoupMetricsRegistry, soup_metrics_registry, SOUP, METRICS_REGISTRY, GObject)
+
+SOUP_AVAILABLE_IN_ALL
+SoupMetricsRegistry *soup_metrics_registry_new           (void);
+
+SOUP_AVAILABLE_IN_ALL
+GVariant            *soup_metrics_registry_snapshot      (SoupMetricsRegistry *registry);
+
+SOUP_AVAILABLE_IN_ALL
+char                *soup_metrics_registry_to_prometheus (SoupMetricsRegistry *registry);
+
+SOUP_AVAILABLE_IN_ALL
+void                 soup_metrics_registry_reset         (SoupMetricsRegistry *registry);
+
+G_END_DECLS
@@ -8,6 +8,7 @@
 
 #include "soup-session.h"
 #include "soup-content-processor.h"
+#include "soup-dns-cache.h"
 
 G_BEGIN_DECLS
 
@@ -31,6 +32,8 @@ GInputStream *soup_session_setup_message_body_input_stream (SoupSession        *
 GSList       *soup_session_get_features                    (SoupSession        *session,
 							    GType               feature_type);
 
+SoupDNSCache *soup_session_get_dns_cache                   (SoupSession        *session);
+
 G_END_DECLS
 
 #endif /* __SOUP_SESSION_PRIVATE_H__ */
@@ -11,19 +11,28 @@
 
 #include <glib/gi18n-lib.h>
 
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
 #include "soup-session.h"
 #include "soup.h"
+#include "soup-adaptive-limit.h"
 #include "auth/soup-auth-manager.h"
 #include "auth/soup-auth-ntlm.h"
 #include "cache/soup-cache-private.h"
 #include "soup-connection.h"
+#include "soup-dns-cache.h"
+#include "soup-io-thread-input-stream.h"
 #include "soup-message-private.h"
 #include "soup-message-headers-private.h"
 #include "soup-misc.h"
 #include "soup-message-queue-item.h"
+#include "soup-metrics-registry-private.h"
 #include "soup-session-private.h"
 #include "soup-session-feature-private.h"
 #include "soup-socket-properties.h"
+#include "soup-tls-session-cache.h"
 #include "soup-uri-utils-private.h"
 #include "websocket/soup-websocket.h"
 #include "websocket/soup-websocket-connection.h"
@@ -72,6 +81,21 @@
  * Class managing options and state for #SoupMessage<!-- -->s.
  */
 
+/* The connection limits of a host, kept apart from the
+ * SoupSessionHost so that what was learned about a host is not lost
+ * when it goes idle for a while. They are shared by the reactors,
+ * since a redirected message keeps its new host in the reactor it
+ * started in, so the same host can be in several of them. Protected
+ * by host_limits_mutex.
+ */
+typedef struct {
+	GUri             *uri;
+	guint             n_hosts;
+	guint             num_conns; /* in all the reactors */
+	guint             max_conns_override;
+	SoupAdaptiveLimit adaptive_limit;
+} SoupSessionHostLimits;
+
 typedef struct {
 	GUri            *uri;
 	GNetworkAddress *addr;
@@ -81,15 +105,62 @@ typedef struct {
 
 	guint        num_messages;
 
+	GQueue       sync_waiters;     /* CONTAINS: SoupSessionSyncWaiter */
+
+	SoupSessionHostLimits *limits;
+
+	guint        demand;           /* recent requests, decaying */
+	gint64       demand_time;
+	guint        num_warming;      /* warm-up preconnects in flight */
+
 	GSource     *keep_alive_src;
 	SoupSession *session;
 } SoupSessionHost;
+
+/* A blocking soup_session_send() waiting for a connection slot */
+typedef struct {
+	SoupMessageQueueItem *item;
+	gboolean              woken;
+	guint                 serial;
+} SoupSessionSyncWaiter;
 static guint soup_host_uri_hash (gconstpointer key);
 static gboolean soup_host_uri_equal (gconstpointer v1, gconstpointer v2);
 
+/* The messages and connections handled by one I/O thread. A session
+ * that is not thread-safe has a single reactor, running in the
+ * context the session was created in; a thread-safe one has one per
+ * I/O thread, each of them owning the hosts that hash to it.
+ */
+typedef struct {
+	SoupSession *session;
+	GThread *thread;
+	GMainLoop *loop;
+
+	GQueue *queue;
+	GSource *queue_source;
+        guint16 in_async_run_queue;
+        gboolean needs_queue_sort;
+
+	GHashTable *http_hosts, *https_hosts; /* char* -> SoupSessionHost */
+	GHashTable *conns; /* SoupConnection -> SoupSessionHost */
+	guint num_warming;
+	gboolean needs_warm_up;
+	guint64 next_connection_id;
+
+	/* A copy of the session features, see get_reactor_features() */
+	GSList *features;
+	guint features_serial;
+	GHashTable *features_cache;
+} SoupSessionReactor;
+
 typedef struct {
 	gboolean disposed;
 
+	gboolean thread_safe;
+	guint io_threads;
+	SoupSessionReactor **reactors;
+	guint n_reactors;
+
 	GTlsDatabase *tlsdb;
 	GTlsInteraction *tls_interaction;
 	gboolean tlsdb_use_default;
@@ -100,30 +171,49 @@ typedef struct {
 	GProxyResolver *proxy_resolver;
 	gboolean proxy_use_default;
 
-	SoupSocketProperties *socket_props;
-
-	GQueue *queue;
-	GSource *queue_source;
-        guint16 in_async_run_queue;
-        gboolean needs_queue_sort;
+	SoupSocketOptions *socket_options;
+	GMutex socket_props_mutex;
+	SoupSocketProperties *socket_props; /* replaced by the setters */
 
 	char *user_agent;
 	char *accept_language;
 	gboolean accept_language_auto;
 
 	GSocketConnectable *remote_connectable;
+	SoupDNSCache *dns_cache;
+	SoupTlsSessionCache *tls_session_cache;
 
+	GRWLock features_lock;
 	GSList *features;
-	GHashTable *features_cache;
+	guint features_serial;
+	GMutex removed_features_mutex;
+	GSList *removed_features; /* CONTAINS: SoupSessionRemovedFeature */
 
-	GHashTable *http_hosts, *https_hosts; /* char* -> SoupSessionHost */
-	GHashTable *conns; /* SoupConnection -> SoupSessionHost */
-	guint num_conns;
+	int num_conns; /* shared by all the reactors */
 	guint max_conns, max_conns_per_host;
-        guint64 last_connection_id;
+	guint adaptive_max_conns_per_host;
+	guint warm_conns_per_host, max_warm_conns;
+
+	GMutex host_limits_mutex;
+	GHashTable *host_limits; /* GUri -> SoupSessionHostLimits */
+
+	GMutex sync_waiters_mutex;
+	GCond sync_waiters_cond;
+	guint num_sync_waiters;
+	guint sync_waiters_serial;
 } SoupSessionPrivate;
 
+/* A feature removed from the session, that is only detached once
+ * every reactor dropped its copy of the feature list.
+ */
+typedef struct {
+	SoupSessionFeature *feature;
+	guint serial;  /* features_serial after its removal */
+	guint pending; /* reactors that may still use it */
+} SoupSessionRemovedFeature;
+
 static void free_host (SoupSessionHost *host);
+static void host_limits_free (SoupSessionHostLimits *limits);
 static void connection_state_changed (GObject *object, GParamSpec *param,
 				      gpointer user_data);
 static void connection_disconnected (SoupConnection *conn, gpointer user_data);
@@ -136,6 +226,18 @@ static void async_send_request_running (SoupSession *session, SoupMessageQueueIt
 
 static void soup_session_kick_queue (SoupSession *session);
 
+static SoupSessionHost *get_host_for_uri (SoupSession *session, GUri *uri);
+static guint get_host_free_slots (SoupSession *session, SoupSessionHost *host);
+static void wake_sync_waiters (SoupSession *session);
+static void schedule_warm_up (SoupSession *session);
+static void ensure_socket_props (SoupSession *session);
+
+static inline SoupMetricsRegistry *
+get_metrics_registry (SoupSession *session)
+{
+        return (SoupMetricsRegistry *)soup_session_get_feature (session, SOUP_TYPE_METRICS_REGISTRY);
+}
+
 static void
 soup_session_process_queue_item (SoupSession          *session,
 				 SoupMessageQueueItem *item,
@@ -147,6 +249,17 @@ soup_session_process_queue_item (SoupSession          *session,
 
 #define SOUP_SESSION_MAX_RESEND_COUNT 20
 
+#define SOUP_SESSION_TLS_SESSION_CACHE_MAX_ORIGINS 64
+
+#define SOUP_SESSION_MAX_IO_THREADS 64
+
+#define SOUP_SESSION_MAX_WARM_CONNS_DEFAULT 16
+/* A host is worth warming up while it gets at least this many
+ * requests per half-life of its demand.
+ */
+#define SOUP_SESSION_WARM_UP_MIN_DEMAND 4
+#define SOUP_SESSION_WARM_UP_DEMAND_HALF_LIFE (60 * G_USEC_PER_SEC)
+
 #define SOUP_SESSION_USER_AGENT_BASE "libsoup/" PACKAGE_VERSION
 
 G_DEFINE_TYPE_WITH_PRIVATE (SoupSession, soup_session, G_TYPE_OBJECT)
@@ -174,6 +287,12 @@ enum {
 	PROP_IDLE_TIMEOUT,
 	PROP_LOCAL_ADDRESS,
 	PROP_TLS_INTERACTION,
+	PROP_SOCKET_OPTIONS,
+	PROP_ADAPTIVE_MAX_CONNS_PER_HOST,
+	PROP_WARM_CONNS_PER_HOST,
+	PROP_MAX_WARM_CONNS,
+	PROP_THREAD_SAFE,
+	PROP_IO_THREADS,
 
 	LAST_PROPERTY
 };
@@ -231,34 +350,98 @@ static GSourceFuncs queue_source_funcs = {
 	NULL, NULL, NULL
 };
 
+static GSource *
+queue_source_new (SoupSession *session)
+{
+	GSource *source;
+
+	source = g_source_new (&queue_source_funcs, sizeof (SoupMessageQueueSource));
+	((SoupMessageQueueSource *)source)->session = session;
+	g_source_set_name (source, "SoupMessageQueue");
+	g_source_set_can_recurse (source, TRUE);
+
+	return source;
+}
+
+/* The reactor of the calling I/O thread */
+static GPrivate current_reactor;
+
+static SoupSessionReactor *
+soup_session_reactor_new (SoupSession  *session,
+			  guint         index,
+			  GMainContext *context)
+{
+	SoupSessionReactor *reactor;
+
+	reactor = g_new0 (SoupSessionReactor, 1);
+	reactor->session = session;
+	reactor->queue = g_queue_new ();
+	reactor->queue_source = queue_source_new (session);
+	g_source_attach (reactor->queue_source, context);
+
+	reactor->http_hosts = g_hash_table_new_full (soup_host_uri_hash,
+						     soup_host_uri_equal,
+						     NULL, (GDestroyNotify)free_host);
+	reactor->https_hosts = g_hash_table_new_full (soup_host_uri_hash,
+						      soup_host_uri_equal,
+						      NULL, (GDestroyNotify)free_host);
+	reactor->conns = g_hash_table_new (NULL, NULL);
+
+	/* Reactors hand out every n-th id, starting at their own */
+	reactor->next_connection_id = index + 1;
+
+	reactor->features_serial = G_MAXUINT;
+	reactor->features_cache = g_hash_table_new (NULL, NULL);
+
+	return reactor;
+}
+
+static void
+soup_session_reactor_free (SoupSessionReactor *reactor)
+{
+	g_warn_if_fail (g_queue_is_empty (reactor->queue));
+	g_queue_free (reactor->queue);
+	g_source_unref (reactor->queue_source);
+
+	g_hash_table_destroy (reactor->http_hosts);
+	g_hash_table_destroy (reactor->https_hosts);
+	g_hash_table_destroy (reactor->conns);
+
+	g_slist_free_full (reactor->features, g_object_unref);
+	g_hash_table_destroy (reactor->features_cache);
+
+	g_clear_pointer (&reactor->loop, g_main_loop_unref);
+	g_free (reactor);
+}
+
 static void
 soup_session_init (SoupSession *session)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
 	SoupAuthManager *auth_manager;
-	SoupMessageQueueSource *source;
-
-	priv->queue = g_queue_new ();
-	priv->queue_source = g_source_new (&queue_source_funcs, sizeof (SoupMessageQueueSource));
-	source = (SoupMessageQueueSource *)priv->queue_source;
-	source->session = session;
-	g_source_set_name (priv->queue_source, "SoupMessageQueue");
-	g_source_set_can_recurse (priv->queue_source, TRUE);
-	g_source_attach (priv->queue_source, g_main_context_get_thread_default ());
+
+	g_mutex_init (&priv->host_limits_mutex);
+	priv->host_limits = g_hash_table_new_full (soup_host_uri_hash, soup_host_uri_equal,
+						   NULL, (GDestroyNotify)host_limits_free);
+
+	priv->io_threads = 1;
+	priv->n_reactors = 1;
+	priv->reactors = g_new (SoupSessionReactor *, 1);
+	priv->reactors[0] = soup_session_reactor_new (session, 0, g_main_context_get_thread_default ());
         priv->io_timeout = priv->idle_timeout = 60;
 
-	priv->http_hosts = g_hash_table_new_full (soup_host_uri_hash,
-						  soup_host_uri_equal,
-						  NULL, (GDestroyNotify)free_host);
-	priv->https_hosts = g_hash_table_new_full (soup_host_uri_hash,
-						   soup_host_uri_equal,
-						   NULL, (GDestroyNotify)free_host);
-	priv->conns = g_hash_table_new (NULL, NULL);
+	priv->dns_cache = soup_dns_cache_new ();
+	priv->tls_session_cache = soup_tls_session_cache_new (SOUP_SESSION_TLS_SESSION_CACHE_MAX_ORIGINS);
+	g_mutex_init (&priv->sync_waiters_mutex);
+	g_cond_init (&priv->sync_waiters_cond);
 
 	priv->max_conns = SOUP_SESSION_MAX_CONNS_DEFAULT;
 	priv->max_conns_per_host = SOUP_SESSION_MAX_CONNS_PER_HOST_DEFAULT;
+	priv->max_warm_conns = SOUP_SESSION_MAX_WARM_CONNS_DEFAULT;
 
-	priv->features_cache = g_hash_table_new (NULL, NULL);
+	g_rw_lock_init (&priv->features_lock);
+	g_mutex_init (&priv->removed_features_mutex);
+	g_mutex_init (&priv->socket_props_mutex);
 
 	auth_manager = g_object_new (SOUP_TYPE_AUTH_MANAGER, NULL);
 	soup_session_feature_add_feature (SOUP_SESSION_FEATURE (auth_manager),
@@ -278,20 +461,349 @@ soup_session_init (SoupSession *session)
         priv->tlsdb_use_default = TRUE;
 }
 
+static gpointer
+reactor_thread_run (SoupSessionReactor *reactor)
+{
+	GMainLoop *loop = g_main_loop_ref (reactor->loop);
+	GMainContext *context = g_main_loop_get_context (loop);
+
+	g_private_set (&current_reactor, reactor);
+	g_main_context_push_thread_default (context);
+	g_main_loop_run (loop);
+	g_main_context_pop_thread_default (context);
+	g_private_set (&current_reactor, NULL);
+	g_main_loop_unref (loop);
+
+	return NULL;
+}
+
+static void
+soup_session_constructed (GObject *object)
+{
+	SoupSession *session = SOUP_SESSION (object);
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor **reactors;
+	guint i;
+
+	G_OBJECT_CLASS (soup_session_parent_class)->constructed (object);
+
+	if (priv->io_threads > 1)
+		priv->thread_safe = TRUE;
+	if (!priv->thread_safe)
+		return;
+
+	/* All the I/O of a thread-safe session, and so all the access
+	 * to its queues, hosts and connections, happens in threads of
+	 * its own; the public API just forwards there when called from
+	 * any other thread.
+	 */
+	reactors = g_new (SoupSessionReactor *, priv->io_threads);
+	for (i = 0; i < priv->io_threads; i++) {
+		GMainContext *context = g_main_context_new ();
+		SoupSessionReactor *reactor;
+
+		if (i == 0) {
+			reactor = priv->reactors[0];
+			g_source_destroy (reactor->queue_source);
+			g_source_unref (reactor->queue_source);
+			reactor->queue_source = queue_source_new (session);
+			g_source_attach (reactor->queue_source, context);
+		} else
+			reactor = soup_session_reactor_new (session, i, context);
+
+		reactor->loop = g_main_loop_new (context, FALSE);
+		g_main_context_unref (context);
+		reactors[i] = reactor;
+	}
+	g_free (priv->reactors);
+	priv->reactors = reactors;
+	priv->n_reactors = priv->io_threads;
+
+	/* Created lazily otherwise, but the I/O threads must never read the
+	 * fields the properties are made of
+	 */
+	ensure_socket_props (session);
+
+	for (i = 0; i < priv->n_reactors; i++) {
+		char *name = g_strdup_printf ("soup-io-%u", i);
+
+		priv->reactors[i]->thread = g_thread_new (name,
+							  (GThreadFunc)reactor_thread_run,
+							  priv->reactors[i]);
+		g_free (name);
+	}
+}
+
+static gboolean
+reactor_quit (GMainLoop *loop)
+{
+	g_main_loop_quit (loop);
+	return G_SOURCE_REMOVE;
+}
+
+static void
+stop_reactors (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	guint i;
+
+	for (i = 0; i < priv->n_reactors; i++) {
+		SoupSessionReactor *reactor = priv->reactors[i];
+		GThread *thread = reactor->thread;
+
+		if (!thread)
+			continue;
+
+		/* Not g_main_loop_quit(), the thread may not be
+		 * running it yet.
+		 */
+		reactor->thread = NULL;
+		g_main_context_invoke (g_main_loop_get_context (reactor->loop),
+				       (GSourceFunc)reactor_quit, reactor->loop);
+		if (thread != g_thread_self ())
+			g_thread_join (thread);
+		else
+			g_thread_unref (thread);
+	}
+}
+
+/* Whether the calling thread can use the session state: any thread
+ * if the session is not thread-safe, only its I/O threads otherwise.
+ */
+static inline gboolean
+in_io_thread (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor;
+
+	if (!priv->reactors[0]->thread)
+		return TRUE;
+
+	reactor = g_private_get (&current_reactor);
+	return reactor && reactor->session == session;
+}
+
+static inline gboolean
+in_reactor (SoupSessionReactor *reactor)
+{
+	return !reactor->thread || reactor->thread == g_thread_self ();
+}
+
+static SoupSessionReactor *
+get_reactor (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	if (priv->n_reactors > 1) {
+		SoupSessionReactor *reactor = g_private_get (&current_reactor);
+
+		if (reactor && reactor->session == session)
+			return reactor;
+	}
+
+	return priv->reactors[0];
+}
+
+static SoupSessionReactor *
+get_reactor_for_uri (SoupSession *session,
+		     GUri        *uri)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	if (priv->n_reactors == 1)
+		return priv->reactors[0];
+
+	return priv->reactors[soup_host_uri_hash (uri) % priv->n_reactors];
+}
+
+typedef gpointer (*SoupSessionIOFunc) (SoupSession *session, gpointer arg);
+
+typedef struct {
+	SoupSession *session;
+	SoupSessionIOFunc func;
+	gpointer arg;
+	gpointer result;
+	gboolean done;
+	GMutex mutex;
+	GCond cond;
+} SoupSessionIOCall;
+
+static gboolean
+io_call_dispatch (SoupSessionIOCall *call)
+{
+	gpointer result = call->func (call->session, call->arg);
+
+	g_mutex_lock (&call->mutex);
+	call->result = result;
+	call->done = TRUE;
+	g_cond_signal (&call->cond);
+	g_mutex_unlock (&call->mutex);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Runs @func in the I/O thread of @reactor, blocking until it
+ * returns. Not to be used from another I/O thread of the session.
+ */
+static gpointer
+run_in_reactor (SoupSessionReactor *reactor,
+		SoupSessionIOFunc   func,
+		gpointer            arg)
+{
+	SoupSessionIOCall call = { reactor->session, func, arg, NULL, FALSE };
+
+	g_mutex_init (&call.mutex);
+	g_cond_init (&call.cond);
+	g_main_context_invoke (g_main_loop_get_context (reactor->loop),
+			       (GSourceFunc)io_call_dispatch, &call);
+
+	g_mutex_lock (&call.mutex);
+	while (!call.done)
+		g_cond_wait (&call.cond, &call.mutex);
+	g_mutex_unlock (&call.mutex);
+
+	g_mutex_clear (&call.mutex);
+	g_cond_clear (&call.cond);
+
+	return call.result;
+}
+
+static gpointer
+run_in_io_thread (SoupSession      *session,
+		  SoupSessionIOFunc func,
+		  gpointer          arg)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	return run_in_reactor (priv->reactors[0], func, arg);
+}
+
+static void
+reactor_release (SoupSessionReactor *reactor)
+{
+	g_object_unref (reactor->session);
+}
+
+/* Queues @func to run in the I/O thread of @reactor without waiting
+ * for it, so that I/O threads never block on each other.
+ */
+static void
+invoke_in_reactor (SoupSessionReactor *reactor,
+		   GSourceFunc         func)
+{
+	g_object_ref (reactor->session);
+	g_main_context_invoke_full (g_main_loop_get_context (reactor->loop),
+				    G_PRIORITY_DEFAULT, func, reactor,
+				    (GDestroyNotify)reactor_release);
+}
+
+/* Called when a reactor moves its copy of the feature list from
+ * @old_serial to @new_serial: the features removed in between are no
+ * longer used by it, and are detached once no reactor uses them.
+ */
+static void
+release_removed_features (SoupSession *session,
+			  guint        old_serial,
+			  guint        new_serial)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionRemovedFeature *removed;
+	GSList *l, *next, *released = NULL;
+
+	g_mutex_lock (&priv->removed_features_mutex);
+	for (l = priv->removed_features; l; l = next) {
+		next = l->next;
+		removed = l->data;
+
+		/* A reactor that never made a copy has nothing to drop */
+		if (old_serial != G_MAXUINT && removed->serial <= old_serial)
+			continue;
+		if (removed->serial > new_serial)
+			continue;
+
+		if (--removed->pending == 0) {
+			priv->removed_features = g_slist_delete_link (priv->removed_features, l);
+			released = g_slist_prepend (released, removed);
+		}
+	}
+	g_mutex_unlock (&priv->removed_features_mutex);
+
+	for (l = released; l; l = l->next) {
+		removed = l->data;
+
+		soup_session_feature_detach (removed->feature, session);
+		g_object_unref (removed->feature);
+		g_free (removed);
+	}
+	g_slist_free (released);
+}
+
+/* Each reactor works on its own copy of the feature list, refreshed
+ * when the features of the session change, so that no lock is held
+ * while calling into them.
+ */
+static GSList *
+get_reactor_features (SoupSession        *session,
+		      SoupSessionReactor *reactor)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	guint old_serial;
+
+	if (reactor->features_serial == (guint)g_atomic_int_get (&priv->features_serial))
+		return reactor->features;
+
+	old_serial = reactor->features_serial;
+
+	g_rw_lock_reader_lock (&priv->features_lock);
+	g_slist_free_full (reactor->features, g_object_unref);
+	reactor->features = g_slist_copy_deep (priv->features, (GCopyFunc)g_object_ref, NULL);
+	reactor->features_serial = priv->features_serial;
+	g_rw_lock_reader_unlock (&priv->features_lock);
+
+	g_hash_table_remove_all (reactor->features_cache);
+	release_removed_features (session, old_serial, reactor->features_serial);
+
+	return reactor->features;
+}
+
+static gboolean
+reactor_refresh_features (SoupSessionReactor *reactor)
+{
+	get_reactor_features (reactor->session, reactor);
+	return G_SOURCE_REMOVE;
+}
+
 static void
 soup_session_dispose (GObject *object)
 {
 	SoupSession *session = SOUP_SESSION (object);
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	guint i;
 
 	priv->disposed = TRUE;
+
+	/* Nothing is running anymore, since every operation keeps a
+	 * reference on the session, so the I/O threads can go before
+	 * closing the connections left.
+	 */
+	stop_reactors (session);
+
 	soup_session_abort (session);
-	g_warn_if_fail (g_hash_table_size (priv->conns) == 0);
+	for (i = 0; i < priv->n_reactors; i++)
+		g_warn_if_fail (g_hash_table_size (priv->reactors[i]->conns) == 0);
 
 	while (priv->features)
 		soup_session_remove_feature (session, priv->features->data);
 
-	g_source_destroy (priv->queue_source);
+	for (i = 0; i < priv->n_reactors; i++) {
+		SoupSessionReactor *reactor = priv->reactors[i];
+
+		g_source_destroy (reactor->queue_source);
+		/* Detaches what was removed before, if not done yet */
+		get_reactor_features (session, reactor);
+		g_slist_free_full (g_steal_pointer (&reactor->features), g_object_unref);
+		g_hash_table_remove_all (reactor->features_cache);
+	}
 
 	G_OBJECT_CLASS (soup_session_parent_class)->dispose (object);
 }
@@ -301,16 +813,19 @@ soup_session_finalize (GObject *object)
 {
 	SoupSession *session = SOUP_SESSION (object);
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	guint i;
 
-	g_warn_if_fail (g_queue_is_empty (priv->queue));
-	g_queue_free (priv->queue);
-	g_source_unref (priv->queue_source);
+	for (i = 0; i < priv->n_reactors; i++)
+		soup_session_reactor_free (priv->reactors[i]);
+	g_free (priv->reactors);
+	g_hash_table_destroy (priv->host_limits);
+	g_mutex_clear (&priv->host_limits_mutex);
 
 	g_clear_object (&priv->remote_connectable);
-
-	g_hash_table_destroy (priv->http_hosts);
-	g_hash_table_destroy (priv->https_hosts);
-	g_hash_table_destroy (priv->conns);
+	soup_dns_cache_unref (priv->dns_cache);
+	soup_tls_session_cache_unref (priv->tls_session_cache);
+	g_mutex_clear (&priv->sync_waiters_mutex);
+	g_cond_clear (&priv->sync_waiters_cond);
 
 	g_free (priv->user_agent);
 	g_free (priv->accept_language);
@@ -320,44 +835,92 @@ soup_session_finalize (GObject *object)
 
 	g_clear_object (&priv->local_addr);
 
-	g_hash_table_destroy (priv->features_cache);
+	g_rw_lock_clear (&priv->features_lock);
+	g_mutex_clear (&priv->removed_features_mutex);
+	g_mutex_clear (&priv->socket_props_mutex);
 
 	g_clear_object (&priv->proxy_resolver);
 
+	g_clear_pointer (&priv->socket_options, soup_socket_options_free);
 	g_clear_pointer (&priv->socket_props, soup_socket_properties_unref);
 
 	G_OBJECT_CLASS (soup_session_parent_class)->finalize (object);
 }
 
+static SoupSocketProperties *
+create_socket_props (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSocketProperties *props;
+
+	props = soup_socket_properties_new (priv->local_addr,
+					    priv->tls_interaction,
+					    priv->io_timeout,
+					    priv->idle_timeout);
+	if (!priv->proxy_use_default)
+		soup_socket_properties_set_proxy_resolver (props, priv->proxy_resolver);
+	if (!priv->tlsdb_use_default)
+		soup_socket_properties_set_tls_database (props, priv->tlsdb);
+	if (priv->socket_options)
+		soup_socket_properties_set_socket_options (props, priv->socket_options);
+	soup_socket_properties_set_tls_session_cache (props, priv->tls_session_cache);
+
+	return props;
+}
+
 static void
 ensure_socket_props (SoupSession *session)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
 
-	if (priv->socket_props)
-		return;
+	g_mutex_lock (&priv->socket_props_mutex);
+	if (!priv->socket_props)
+		priv->socket_props = create_socket_props (session);
+	g_mutex_unlock (&priv->socket_props_mutex);
+}
 
-	priv->socket_props = soup_socket_properties_new (priv->local_addr,
-							 priv->tls_interaction,
-							 priv->io_timeout,
-							 priv->idle_timeout);
-	if (!priv->proxy_use_default)
-		soup_socket_properties_set_proxy_resolver (priv->socket_props, priv->proxy_resolver);
-	if (!priv->tlsdb_use_default)
-		soup_socket_properties_set_tls_database (priv->socket_props, priv->tlsdb);
+/* The setters may replace the properties from any thread, so the I/O
+ * threads use them through a reference of their own.
+ */
+static SoupSocketProperties *
+get_socket_props (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSocketProperties *props;
+
+	g_mutex_lock (&priv->socket_props_mutex);
+	if (!priv->socket_props)
+		priv->socket_props = create_socket_props (session);
+	props = soup_socket_properties_ref (priv->socket_props);
+	g_mutex_unlock (&priv->socket_props_mutex);
+
+	return props;
 }
 
+/* Called by the setters, in the thread that changed the fields the
+ * properties are made of.
+ */
 static void
 socket_props_changed (SoupSession *session)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSocketProperties *props, *old_props;
+	gboolean created;
 
-	if (!priv->socket_props)
+	g_mutex_lock (&priv->socket_props_mutex);
+	created = priv->socket_props != NULL;
+	g_mutex_unlock (&priv->socket_props_mutex);
+	if (!created)
 		return;
 
-	soup_socket_properties_unref (priv->socket_props);
-	priv->socket_props = NULL;
-	ensure_socket_props (session);
+	props = create_socket_props (session);
+
+	g_mutex_lock (&priv->socket_props_mutex);
+	old_props = priv->socket_props;
+	priv->socket_props = props;
+	g_mutex_unlock (&priv->socket_props_mutex);
+
+	soup_socket_properties_unref (old_props);
 }
 
 static void
@@ -381,6 +944,21 @@ soup_session_set_property (GObject *object, guint prop_id,
 	case PROP_MAX_CONNS_PER_HOST:
 		priv->max_conns_per_host = g_value_get_int (value);
 		break;
+	case PROP_ADAPTIVE_MAX_CONNS_PER_HOST:
+		priv->adaptive_max_conns_per_host = g_value_get_int (value);
+		break;
+	case PROP_WARM_CONNS_PER_HOST:
+		priv->warm_conns_per_host = g_value_get_int (value);
+		break;
+	case PROP_MAX_WARM_CONNS:
+		priv->max_warm_conns = g_value_get_int (value);
+		break;
+	case PROP_THREAD_SAFE:
+		priv->thread_safe = g_value_get_boolean (value);
+		break;
+	case PROP_IO_THREADS:
+		priv->io_threads = g_value_get_uint (value);
+		break;
 	case PROP_TLS_DATABASE:
 		soup_session_set_tls_database (session, g_value_get_object (value));
 		break;
@@ -405,6 +983,9 @@ soup_session_set_property (GObject *object, guint prop_id,
 	case PROP_IDLE_TIMEOUT:
 		soup_session_set_idle_timeout (session, g_value_get_uint (value));
 		break;
+	case PROP_SOCKET_OPTIONS:
+		soup_session_set_socket_options (session, g_value_get_boxed (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -430,6 +1011,21 @@ soup_session_get_property (GObject *object, guint prop_id,
 	case PROP_MAX_CONNS_PER_HOST:
 		g_value_set_int (value, soup_session_get_max_conns_per_host (session));
 		break;
+	case PROP_ADAPTIVE_MAX_CONNS_PER_HOST:
+		g_value_set_int (value, soup_session_get_adaptive_max_conns_per_host (session));
+		break;
+	case PROP_WARM_CONNS_PER_HOST:
+		g_value_set_int (value, soup_session_get_warm_conns_per_host (session));
+		break;
+	case PROP_MAX_WARM_CONNS:
+		g_value_set_int (value, soup_session_get_max_warm_conns (session));
+		break;
+	case PROP_THREAD_SAFE:
+		g_value_set_boolean (value, soup_session_get_thread_safe (session));
+		break;
+	case PROP_IO_THREADS:
+		g_value_set_uint (value, soup_session_get_io_threads (session));
+		break;
 	case PROP_TLS_DATABASE:
 		g_value_set_object (value, soup_session_get_tls_database (session));
 		break;
@@ -454,6 +1050,9 @@ soup_session_get_property (GObject *object, guint prop_id,
 	case PROP_IDLE_TIMEOUT:
 		g_value_set_uint (value, soup_session_get_idle_timeout (session));
 		break;
+	case PROP_SOCKET_OPTIONS:
+		g_value_set_boxed (value, soup_session_get_socket_options (session));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -557,26 +1156,274 @@ soup_session_get_max_conns_per_host (SoupSession *session)
 }
 
 /**
- * soup_session_set_proxy_resolver:
+ * soup_session_get_adaptive_max_conns_per_host:
  * @session: a #SoupSession
- * @proxy_resolver: (nullable): a #GProxyResolver or %NULL
  *
- * Set a #GProxyResolver to be used by @session on new connections. If @proxy_resolver
- * is %NULL then no proxies will be used. See #SoupSession:proxy-resolver for more information.
+ * Get the upper bound of the per-host connection limits when
+ * #SoupSession:adaptive-max-conns-per-host is in use.
+ *
+ * Returns: the adaptive limit, or 0 if it's disabled
  */
-void
-soup_session_set_proxy_resolver (SoupSession    *session,
-				 GProxyResolver *proxy_resolver)
+guint
+soup_session_get_adaptive_max_conns_per_host (SoupSession *session)
 {
 	SoupSessionPrivate *priv;
 
-	g_return_if_fail (SOUP_IS_SESSION (session));
-	g_return_if_fail (proxy_resolver == NULL || G_IS_PROXY_RESOLVER (proxy_resolver));
+	g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
 
 	priv = soup_session_get_instance_private (session);
-	priv->proxy_use_default = FALSE;
-	if (priv->proxy_resolver == proxy_resolver)
-		return;
+	return priv->adaptive_max_conns_per_host;
+}
+
+/**
+ * soup_session_get_warm_conns_per_host:
+ * @session: a #SoupSession
+ *
+ * Get the number of idle connections that @session tries to keep open
+ * to each frequently used host. See #SoupSession:warm-conns-per-host.
+ *
+ * Returns: the number of warm connections per host, or 0 if disabled
+ */
+guint
+soup_session_get_warm_conns_per_host (SoupSession *session)
+{
+	SoupSessionPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+
+	priv = soup_session_get_instance_private (session);
+	return priv->warm_conns_per_host;
+}
+
+/**
+ * soup_session_get_max_warm_conns:
+ * @session: a #SoupSession
+ *
+ * Get the maximum number of idle connections that @session keeps open
+ * in total for #SoupSession:warm-conns-per-host.
+ *
+ * Returns: the maximum number of warm connections
+ */
+guint
+soup_session_get_max_warm_conns (SoupSession *session)
+{
+	SoupSessionPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+
+	priv = soup_session_get_instance_private (session);
+	return priv->max_warm_conns;
+}
+
+/* Hosts that are not in use keep their learned limits up to this */
+#define MAX_IDLE_HOST_LIMITS 256
+
+static void
+host_limits_free (SoupSessionHostLimits *limits)
+{
+	g_uri_unref (limits->uri);
+	g_free (limits);
+}
+
+/* Called with host_limits_mutex held */
+static SoupSessionHostLimits *
+lookup_host_limits (SoupSession *session,
+		    GUri        *uri,
+		    gboolean     create)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionHostLimits *limits;
+
+	limits = g_hash_table_lookup (priv->host_limits, uri);
+	if (limits || !create)
+		return limits;
+
+	limits = g_new0 (SoupSessionHostLimits, 1);
+	limits->uri = g_uri_ref (uri);
+	soup_adaptive_limit_init (&limits->adaptive_limit, priv->max_conns_per_host);
+	g_hash_table_insert (priv->host_limits, limits->uri, limits);
+
+	return limits;
+}
+
+/* Called with host_limits_mutex held */
+static void
+maybe_drop_host_limits (SoupSession           *session,
+			SoupSessionHostLimits *limits)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	if (limits->n_hosts || limits->num_conns || limits->max_conns_override)
+		return;
+
+	if (limits->adaptive_limit.limit != priv->max_conns_per_host &&
+	    g_hash_table_size (priv->host_limits) <= MAX_IDLE_HOST_LIMITS)
+		return;
+
+	g_hash_table_remove (priv->host_limits, limits->uri);
+}
+
+/* Called with host_limits_mutex held; @limits may be %NULL */
+static guint
+get_limits_max_conns (SoupSession           *session,
+		      SoupSessionHostLimits *limits)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	if (limits && limits->max_conns_override)
+		return limits->max_conns_override;
+
+	if (limits && priv->adaptive_max_conns_per_host > priv->max_conns_per_host) {
+		return soup_adaptive_limit_get (&limits->adaptive_limit,
+						priv->max_conns_per_host,
+						priv->adaptive_max_conns_per_host);
+	}
+
+	return priv->max_conns_per_host;
+}
+
+static void
+kick_all_queues (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	guint i;
+
+	for (i = 0; i < priv->n_reactors; i++)
+		g_source_set_ready_time (priv->reactors[i]->queue_source, 0);
+}
+
+/**
+ * soup_session_set_max_conns_for_host:
+ * @session: a #SoupSession
+ * @uri: a #GUri for the host
+ * @max_conns: the maximum number of connections, or 0
+ *
+ * Sets the maximum number of connections that @session can open at
+ * once to the host of @uri, overriding both
+ * #SoupSession:max-conns-per-host and the adaptive limit. Passing 0
+ * removes the override.
+ *
+ * The #SoupSession:max-conns limit still applies.
+ */
+void
+soup_session_set_max_conns_for_host (SoupSession *session,
+				     GUri        *uri,
+				     guint        max_conns)
+{
+	SoupSessionPrivate *priv;
+	SoupSessionHostLimits *limits;
+
+	g_return_if_fail (SOUP_IS_SESSION (session));
+	g_return_if_fail (uri != NULL && g_uri_get_host (uri) != NULL);
+
+	priv = soup_session_get_instance_private (session);
+
+	g_mutex_lock (&priv->host_limits_mutex);
+	limits = lookup_host_limits (session, uri, max_conns > 0);
+	if (limits) {
+		limits->max_conns_override = max_conns;
+		maybe_drop_host_limits (session, limits);
+	}
+	g_mutex_unlock (&priv->host_limits_mutex);
+
+	if (in_io_thread (session))
+		wake_sync_waiters (session);
+	kick_all_queues (session);
+}
+
+/**
+ * soup_session_get_max_conns_for_host:
+ * @session: a #SoupSession
+ * @uri: a #GUri for the host
+ *
+ * Gets the maximum number of connections that @session can currently
+ * open at once to the host of @uri: the value given to
+ * soup_session_set_max_conns_for_host() if any, otherwise the
+ * adaptive limit, if #SoupSession:adaptive-max-conns-per-host is in
+ * use, or #SoupSession:max-conns-per-host.
+ *
+ * Returns: the maximum number of connections to the host
+ */
+guint
+soup_session_get_max_conns_for_host (SoupSession *session,
+				     GUri        *uri)
+{
+	SoupSessionPrivate *priv;
+	guint max_conns;
+
+	g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+	g_return_val_if_fail (uri != NULL && g_uri_get_host (uri) != NULL, 0);
+
+	priv = soup_session_get_instance_private (session);
+
+	g_mutex_lock (&priv->host_limits_mutex);
+	max_conns = get_limits_max_conns (session, lookup_host_limits (session, uri, FALSE));
+	g_mutex_unlock (&priv->host_limits_mutex);
+
+	return max_conns;
+}
+
+/**
+ * soup_session_get_thread_safe:
+ * @session: a #SoupSession
+ *
+ * Gets whether @session can be used from several threads. See
+ * #SoupSession:thread-safe.
+ *
+ * Returns: %TRUE if @session is thread-safe
+ */
+gboolean
+soup_session_get_thread_safe (SoupSession *session)
+{
+	SoupSessionPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SESSION (session), FALSE);
+
+	priv = soup_session_get_instance_private (session);
+	return priv->thread_safe;
+}
+
+/**
+ * soup_session_get_io_threads:
+ * @session: a #SoupSession
+ *
+ * Gets the number of threads doing the I/O of @session. See
+ * #SoupSession:io-threads.
+ *
+ * Returns: the number of I/O threads
+ */
+guint
+soup_session_get_io_threads (SoupSession *session)
+{
+	SoupSessionPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+
+	priv = soup_session_get_instance_private (session);
+	return priv->io_threads;
+}
+
+/**
+ * soup_session_set_proxy_resolver:
+ * @session: a #SoupSession
+ * @proxy_resolver: (nullable): a #GProxyResolver or %NULL
+ *
+ * Set a #GProxyResolver to be used by @session on new connections. If @proxy_resolver
+ * is %NULL then no proxies will be used. See #SoupSession:proxy-resolver for more information.
+ */
+void
+soup_session_set_proxy_resolver (SoupSession    *session,
+				 GProxyResolver *proxy_resolver)
+{
+	SoupSessionPrivate *priv;
+
+	g_return_if_fail (SOUP_IS_SESSION (session));
+	g_return_if_fail (proxy_resolver == NULL || G_IS_PROXY_RESOLVER (proxy_resolver));
+
+	priv = soup_session_get_instance_private (session);
+	priv->proxy_use_default = FALSE;
+	if (priv->proxy_resolver == proxy_resolver)
+		return;
 
 	g_clear_object (&priv->proxy_resolver);
 	priv->proxy_resolver = proxy_resolver ? g_object_ref (proxy_resolver) : NULL;
@@ -629,6 +1476,8 @@ soup_session_set_tls_database (SoupSession  *session,
 
 	g_clear_object (&priv->tlsdb);
 	priv->tlsdb = tls_database ? g_object_ref (tls_database) : NULL;
+	/* Resumed sessions are not verified again */
+	soup_tls_session_cache_clear (priv->tls_session_cache);
 	socket_props_changed (session);
 	g_object_notify_by_pspec (G_OBJECT (session), properties[PROP_TLS_DATABASE]);
 }
@@ -679,6 +1528,8 @@ soup_session_set_tls_interaction (SoupSession     *session,
 
 	g_clear_object (&priv->tls_interaction);
 	priv->tls_interaction = tls_interaction ? g_object_ref (tls_interaction) : NULL;
+	/* Nor is the client certificate asked for again */
+	soup_tls_session_cache_clear (priv->tls_session_cache);
 	socket_props_changed (session);
 	g_object_notify_by_pspec (G_OBJECT (session), properties[PROP_TLS_INTERACTION]);
 }
@@ -790,6 +1641,52 @@ soup_session_get_idle_timeout (SoupSession *session)
 	return priv->idle_timeout;
 }
 
+/**
+ * soup_session_set_socket_options:
+ * @session: a #SoupSession
+ * @options: (nullable): a #SoupSocketOptions, or %NULL
+ *
+ * Sets the options to apply to the sockets of new connections made by
+ * @session. See #SoupSession:socket-options for more information.
+ */
+void
+soup_session_set_socket_options (SoupSession       *session,
+				 SoupSocketOptions *options)
+{
+	SoupSessionPrivate *priv;
+
+	g_return_if_fail (SOUP_IS_SESSION (session));
+
+	priv = soup_session_get_instance_private (session);
+	if (priv->socket_options == options)
+		return;
+
+	g_clear_pointer (&priv->socket_options, soup_socket_options_free);
+	priv->socket_options = options ? soup_socket_options_copy (options) : NULL;
+	socket_props_changed (session);
+	g_object_notify_by_pspec (G_OBJECT (session), properties[PROP_SOCKET_OPTIONS]);
+}
+
+/**
+ * soup_session_get_socket_options:
+ * @session: a #SoupSession
+ *
+ * Get the options applied to the sockets of new connections made by
+ * @session.
+ *
+ * Returns: (transfer none) (nullable): a #SoupSocketOptions, or %NULL
+ */
+SoupSocketOptions *
+soup_session_get_socket_options (SoupSession *session)
+{
+	SoupSessionPrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_SESSION (session), NULL);
+
+	priv = soup_session_get_instance_private (session);
+	return priv->socket_options;
+}
+
 /**
  * soup_session_set_user_agent:
  * @session: a #SoupSession
@@ -961,6 +1858,14 @@ soup_session_get_accept_language_auto (SoupSession *session)
 	return priv->accept_language_auto;
 }
 
+SoupDNSCache *
+soup_session_get_dns_cache (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	return priv->dns_cache;
+}
+
 /**
  * soup_session_get_remote_connectable:
  * @session: a #SoupSession
@@ -1017,6 +1922,7 @@ soup_host_uri_equal (gconstpointer v1, gconstpointer v2)
 static SoupSessionHost *
 soup_session_host_new (SoupSession *session, GUri *uri)
 {
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
 	SoupSessionHost *host;
         const char *scheme = g_uri_get_scheme (uri);
 
@@ -1038,22 +1944,27 @@ soup_session_host_new (SoupSession *session, GUri *uri)
 	host->keep_alive_src = NULL;
 	host->session = session;
 
+	g_mutex_lock (&priv->host_limits_mutex);
+	host->limits = lookup_host_limits (session, host->uri, TRUE);
+	host->limits->n_hosts++;
+	g_mutex_unlock (&priv->host_limits_mutex);
+
 	return host;
 }
 
 static SoupSessionHost *
 get_host_for_uri (SoupSession *session, GUri *uri)
 {
-	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
 	SoupSessionHost *host;
 	gboolean https;
 	GUri *uri_tmp = NULL;
 
 	https = soup_uri_is_https (uri);
 	if (https)
-		host = g_hash_table_lookup (priv->https_hosts, uri);
+		host = g_hash_table_lookup (reactor->https_hosts, uri);
 	else
-		host = g_hash_table_lookup (priv->http_hosts, uri);
+		host = g_hash_table_lookup (reactor->http_hosts, uri);
 	if (host)
 		return host;
 
@@ -1067,9 +1978,9 @@ get_host_for_uri (SoupSession *session, GUri *uri)
 		g_uri_unref (uri_tmp);
 
 	if (https)
-		g_hash_table_insert (priv->https_hosts, host->uri, host);
+		g_hash_table_insert (reactor->https_hosts, host->uri, host);
 	else
-		g_hash_table_insert (priv->http_hosts, host->uri, host);
+		g_hash_table_insert (reactor->http_hosts, host->uri, host);
 
 	return host;
 }
@@ -1083,7 +1994,15 @@ get_host_for_message (SoupSession *session, SoupMessage *msg)
 static void
 free_host (SoupSessionHost *host)
 {
+	SoupSessionPrivate *priv = soup_session_get_instance_private (host->session);
+
 	g_warn_if_fail (host->connections == NULL);
+	g_warn_if_fail (g_queue_is_empty (&host->sync_waiters));
+
+	g_mutex_lock (&priv->host_limits_mutex);
+	host->limits->n_hosts--;
+	maybe_drop_host_limits (host->session, host->limits);
+	g_mutex_unlock (&priv->host_limits_mutex);
 
 	if (host->keep_alive_src) {
 		g_source_destroy (host->keep_alive_src);
@@ -1100,10 +2019,10 @@ soup_session_lookup_queue (SoupSession *session,
 			   gpointer     data,
 			   GCompareFunc compare_func)
 {
-	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
 	GList *link;
 
-	link = g_queue_find_custom (priv->queue, data, compare_func);
+	link = g_queue_find_custom (reactor->queue, data, compare_func);
 	return link ? (SoupMessageQueueItem *)link->data : NULL;
 }
 
@@ -1206,9 +2125,14 @@ soup_session_requeue_item (SoupSession          *session,
 		}
 		retval = FALSE;
 	} else {
+		SoupMetricsRegistry *registry = get_metrics_registry (session);
+
 		item->resend_count++;
 		item->state = SOUP_MESSAGE_REQUEUED;
 		retval = TRUE;
+
+		if (registry)
+			soup_metrics_registry_increment_counter (registry, SOUP_METRICS_COUNTER_REQUEUES);
 	}
 
 	return retval;
@@ -1327,226 +2251,712 @@ compare_queue_item (SoupMessageQueueItem *a,
         SoupMessagePriority a_priority = soup_message_get_priority (a->msg);
         SoupMessagePriority b_priority = soup_message_get_priority (b->msg);
 
-	/* For the same priority we want to append items in the queue */
-	return b_priority > a_priority ? 1 : -1;
+	/* For the same priority we want to append items in the queue */
+	return b_priority > a_priority ? 1 : -1;
+}
+
+static gboolean
+reactor_sort_queue (SoupSessionReactor *reactor)
+{
+        if (reactor->in_async_run_queue) {
+                reactor->needs_queue_sort = TRUE;
+                return G_SOURCE_REMOVE;
+        }
+
+        g_queue_sort (reactor->queue, (GCompareDataFunc)compare_queue_item, NULL);
+        reactor->needs_queue_sort = FALSE;
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+message_priority_changed (SoupMessage          *msg,
+                          GParamSpec           *pspec,
+                          SoupMessageQueueItem *item)
+{
+        SoupSessionReactor *reactor = item->reactor;
+
+        /* The priority can be changed from any thread */
+        if (!in_reactor (reactor)) {
+                invoke_in_reactor (reactor, (GSourceFunc)reactor_sort_queue);
+                return;
+        }
+
+        reactor_sort_queue (reactor);
+}
+
+static SoupMessageQueueItem *
+soup_session_append_queue_item (SoupSession        *session,
+				SoupMessage        *msg,
+				gboolean            async,
+				GCancellable       *cancellable)
+{
+	SoupSessionReactor *reactor = get_reactor (session);
+	SoupMessageQueueItem *item;
+	SoupSessionHost *host;
+	GSList *f;
+
+        if (get_metrics_registry (session))
+                soup_message_enable_metrics (msg);
+        soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_FETCH_START);
+        soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_QUEUE_START);
+	soup_message_cleanup_response (msg);
+        soup_message_set_is_preconnect (msg, FALSE);
+
+	item = soup_message_queue_item_new (session, msg, async, cancellable);
+	item->reactor = reactor;
+#ifdef HAVE_SYSPROF
+        item->queue_begin_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
+#endif
+	g_queue_insert_sorted (reactor->queue,
+			       soup_message_queue_item_ref (item),
+			       (GCompareDataFunc)compare_queue_item, NULL);
+
+	host = get_host_for_message (session, item->msg);
+	host->num_messages++;
+
+	if (!soup_message_query_flags (msg, SOUP_MESSAGE_NO_REDIRECT)) {
+		soup_message_add_header_handler (
+			msg, "got_body", "Location",
+			G_CALLBACK (redirect_handler), item);
+	}
+        soup_message_add_status_code_handler (msg, "got-body",
+                                              SOUP_STATUS_MISDIRECTED_REQUEST,
+                                              G_CALLBACK (misdirected_handler), item);
+	g_signal_connect (msg, "restarted",
+			  G_CALLBACK (message_restarted), item);
+        g_signal_connect (msg, "notify::priority",
+                          G_CALLBACK (message_priority_changed), item);
+
+	/* The item keeps the features it was queued with, for
+	 * request_unqueued(), whatever happens to the session ones.
+	 */
+	item->features = g_slist_copy_deep (get_reactor_features (session, reactor),
+					    (GCopyFunc)g_object_ref, NULL);
+	for (f = item->features; f; f = g_slist_next (f))
+		soup_session_feature_request_queued (f->data, msg);
+	g_signal_emit (session, signals[REQUEST_QUEUED], 0, msg);
+
+	return item;
+}
+
+static void
+soup_session_send_queue_item (SoupSession *session,
+			      SoupMessageQueueItem *item,
+			      SoupMessageIOCompletionFn completion_cb)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupMessageHeaders *request_headers;
+	const char *method;
+
+	request_headers = soup_message_get_request_headers (item->msg);
+	if (priv->user_agent)
+		soup_message_headers_replace_common (request_headers, SOUP_HEADER_USER_AGENT, priv->user_agent);
+
+	if (priv->accept_language && !soup_message_headers_get_list_common (request_headers, SOUP_HEADER_ACCEPT_LANGUAGE))
+		soup_message_headers_append_common (request_headers, SOUP_HEADER_ACCEPT_LANGUAGE, priv->accept_language);
+
+        soup_message_set_http_version (item->msg, soup_connection_get_negotiated_protocol (soup_message_get_connection (item->msg)));
+
+        soup_message_force_keep_alive_if_needed (item->msg);
+        soup_message_update_request_host_if_needed (item->msg);
+
+
+	/* A user agent SHOULD send a Content-Length in a request message when
+	 * no Transfer-Encoding is sent and the request method defines a meaning
+	 * for an enclosed payload body. For example, a Content-Length header
+	 * field is normally sent in a POST request even when the value is 0
+	 * (indicating an empty payload body).
+	 */
+	method = soup_message_get_method (item->msg);
+	if ((method == SOUP_METHOD_POST || method == SOUP_METHOD_PUT) &&
+	    soup_message_get_request_body_stream (item->msg) == NULL) {
+		soup_message_headers_set_content_length (request_headers, 0);
+	}
+
+	soup_message_starting (item->msg);
+	if (item->state == SOUP_MESSAGE_RUNNING)
+                soup_message_send_item (item->msg, item, completion_cb, item);
+}
+
+static gboolean
+soup_session_cleanup_connections (SoupSession *session,
+				  gboolean     cleanup_idle)
+{
+	SoupSessionReactor *reactor = get_reactor (session);
+	SoupMetricsRegistry *registry = get_metrics_registry (session);
+	GSList *conns = NULL, *c;
+	GHashTableIter iter;
+	gpointer conn, host;
+	SoupConnectionState state;
+
+	if (registry)
+		soup_metrics_registry_increment_counter (registry, SOUP_METRICS_COUNTER_CLEANUP_PASSES);
+
+	g_hash_table_iter_init (&iter, reactor->conns);
+	while (g_hash_table_iter_next (&iter, &conn, &host)) {
+		state = soup_connection_get_state (conn);
+                if (state == SOUP_CONNECTION_IDLE &&
+                    (cleanup_idle || !soup_connection_is_idle_open (conn))) {
+			conns = g_slist_prepend (conns, g_object_ref (conn));
+			g_hash_table_iter_remove (&iter);
+			drop_connection (session, host, conn);
+		}
+	}
+
+	if (!conns)
+		return FALSE;
+
+	for (c = conns; c; c = c->next) {
+		conn = c->data;
+		soup_connection_disconnect (conn);
+		g_object_unref (conn);
+	}
+	g_slist_free (conns);
+
+	return TRUE;
+}
+
+static gboolean
+free_unused_host (gpointer user_data)
+{
+	SoupSessionHost *host = (SoupSessionHost *) user_data;
+	SoupSessionReactor *reactor = get_reactor (host->session);
+	GUri *uri = host->uri;
+
+	if (host->connections || !g_queue_is_empty (&host->sync_waiters) ||
+	    host->num_warming)
+		return FALSE;
+
+	/* This will free the host in addition to removing it from the
+	 * hash table
+	 */
+	if (soup_uri_is_https (uri))
+		g_hash_table_remove (reactor->https_hosts, uri);
+	else
+		g_hash_table_remove (reactor->http_hosts, uri);
+
+	return FALSE;
+}
+
+static void
+drop_connection (SoupSession *session, SoupSessionHost *host, SoupConnection *conn)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	gboolean kick_all = FALSE;
+
+	if (host) {
+		host->connections = g_slist_remove (host->connections, conn);
+		host->num_conns--;
+
+		/* The host may have messages waiting in other reactors */
+		kick_all = release_host_slot (session, host);
+
+		/* Free the SoupHost (and its GNetworkAddress) if there
+		 * has not been any new connection to the host during
+		 * the last HOST_KEEP_ALIVE msecs.
+		 */
+		if (host->num_conns == 0) {
+			g_assert (host->keep_alive_src == NULL);
+			host->keep_alive_src = soup_add_timeout (g_main_context_get_thread_default (),
+								 HOST_KEEP_ALIVE,
+								 free_unused_host,
+								 host);
+		}
+	}
+
+	g_signal_handlers_disconnect_by_func (conn, connection_disconnected, session);
+	g_signal_handlers_disconnect_by_func (conn, connection_state_changed, session);
+
+	/* Messages waiting for the global limit may be in other reactors */
+	if ((guint)g_atomic_int_add (&priv->num_conns, -1) >= priv->max_conns)
+		kick_all = TRUE;
+	if (kick_all && priv->n_reactors > 1)
+		kick_all_queues (session);
+
+	g_object_unref (conn);
+
+	schedule_warm_up (session);
+}
+
+/* Lets the first blocked soup_session_send() of every host of
+ * @reactor try again; the others keep their place in the line.
+ */
+static void
+wake_reactor_sync_waiters (SoupSessionReactor *reactor)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (reactor->session);
+	GHashTable *tables[] = { reactor->http_hosts, reactor->https_hosts };
+	SoupSessionSyncWaiter *waiter;
+	SoupSessionHost *host;
+	GHashTableIter iter;
+	guint i;
+
+	g_mutex_lock (&priv->sync_waiters_mutex);
+	/* See sync_waiter_enqueue() */
+	priv->sync_waiters_serial++;
+	if (!priv->num_sync_waiters) {
+		g_mutex_unlock (&priv->sync_waiters_mutex);
+		return;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (tables); i++) {
+		g_hash_table_iter_init (&iter, tables[i]);
+		while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&host)) {
+			waiter = g_queue_peek_head (&host->sync_waiters);
+			if (waiter)
+				waiter->woken = TRUE;
+		}
+	}
+	g_cond_broadcast (&priv->sync_waiters_cond);
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+
+	g_main_context_wakeup (g_source_get_context (reactor->queue_source));
+}
+
+static gboolean
+reactor_wake_sync_waiters (SoupSessionReactor *reactor)
+{
+	wake_reactor_sync_waiters (reactor);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* The connection limits are shared by all the reactors, so a freed
+ * slot may be the one a host of any of them is waiting for. The host
+ * tables of the other reactors are only walked from their own thread,
+ * which runs its context while a soup_session_send() blocks it.
+ */
+static void
+wake_sync_waiters (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
+	gboolean waiting;
+	guint i;
+
+	wake_reactor_sync_waiters (reactor);
+	if (priv->n_reactors == 1)
+		return;
+
+	g_mutex_lock (&priv->sync_waiters_mutex);
+	waiting = priv->num_sync_waiters > 0;
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+	if (!waiting)
+		return;
+
+	for (i = 0; i < priv->n_reactors; i++) {
+		if (priv->reactors[i] != reactor)
+			invoke_in_reactor (priv->reactors[i], (GSourceFunc)reactor_wake_sync_waiters);
+	}
+}
+
+static int
+compare_sync_waiter (SoupSessionSyncWaiter *a,
+		     SoupSessionSyncWaiter *b)
+{
+	return compare_queue_item (a->item, b->item);
+}
+
+/* Called before looking for a connection, to catch the wake ups that
+ * happen before @waiter is enqueued.
+ */
+static void
+sync_waiter_prepare (SoupSession           *session,
+		     SoupSessionSyncWaiter *waiter)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	g_mutex_lock (&priv->sync_waiters_mutex);
+	waiter->serial = priv->sync_waiters_serial;
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+}
+
+static gboolean
+sync_waiters_pending (SoupSession     *session,
+		      SoupSessionHost *host)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	gboolean pending;
+
+	g_mutex_lock (&priv->sync_waiters_mutex);
+	pending = !g_queue_is_empty (&host->sync_waiters);
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+
+	return pending;
+}
+
+static void
+sync_waiter_enqueue (SoupSession           *session,
+		     SoupSessionHost       *host,
+		     SoupSessionSyncWaiter *waiter)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+
+	/* Same order as the async queue: by priority, then FIFO */
+	g_mutex_lock (&priv->sync_waiters_mutex);
+	g_queue_insert_sorted (&host->sync_waiters, waiter,
+			       (GCompareDataFunc)compare_sync_waiter, NULL);
+	priv->num_sync_waiters++;
+
+	/* A slot was freed since we last looked and nobody was in
+	 * line to be told: that wake up was ours.
+	 */
+	if (waiter->serial != priv->sync_waiters_serial &&
+	    g_queue_peek_head (&host->sync_waiters) == waiter)
+		waiter->woken = TRUE;
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+}
+
+static void
+sync_waiter_dequeue (SoupSession           *session,
+		     SoupSessionHost       *host,
+		     SoupSessionSyncWaiter *waiter)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionSyncWaiter *next;
+	gboolean was_head;
+
+	g_mutex_lock (&priv->sync_waiters_mutex);
+	was_head = g_queue_peek_head (&host->sync_waiters) == waiter;
+	g_queue_remove (&host->sync_waiters, waiter);
+	priv->num_sync_waiters--;
+
+	/* Whatever we got, the next one may be able to get too */
+	next = was_head ? g_queue_peek_head (&host->sync_waiters) : NULL;
+	if (next) {
+		next->woken = TRUE;
+		g_cond_broadcast (&priv->sync_waiters_cond);
+	}
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+
+	if (next)
+		g_main_context_wakeup (g_source_get_context (get_reactor (session)->queue_source));
+}
+
+static void
+sync_waiter_cancelled (GCancellable          *cancellable,
+		       SoupSessionSyncWaiter *waiter)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (waiter->item->session);
+
+	g_mutex_lock (&priv->sync_waiters_mutex);
+	g_cond_broadcast (&priv->sync_waiters_cond);
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+
+	g_main_context_wakeup (g_source_get_context (get_reactor (waiter->item->session)->queue_source));
+}
+
+/* Blocks until @waiter is woken up, or its message is cancelled, in
+ * which case it returns %FALSE. Connections only change state in the
+ * session context, so if we can, we run it while waiting; otherwise
+ * its owner will signal us.
+ */
+static gboolean
+sync_waiter_wait (SoupSession           *session,
+		  SoupSessionSyncWaiter *waiter)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	GMainContext *context = g_source_get_context (get_reactor (session)->queue_source);
+	GCancellable *cancellable = waiter->item->cancellable;
+	gulong cancelled_id;
+	gboolean cancelled;
+
+	cancelled_id = g_cancellable_connect (cancellable, G_CALLBACK (sync_waiter_cancelled),
+					      waiter, NULL);
+
+	if (g_main_context_acquire (context)) {
+		while (TRUE) {
+			g_mutex_lock (&priv->sync_waiters_mutex);
+			if (waiter->woken || g_cancellable_is_cancelled (cancellable))
+				break;
+			g_mutex_unlock (&priv->sync_waiters_mutex);
+
+			g_main_context_iteration (context, TRUE);
+		}
+		g_main_context_release (context);
+	} else {
+		g_mutex_lock (&priv->sync_waiters_mutex);
+		while (!waiter->woken && !g_cancellable_is_cancelled (cancellable))
+			g_cond_wait (&priv->sync_waiters_cond, &priv->sync_waiters_mutex);
+	}
+
+	waiter->woken = FALSE;
+	cancelled = g_cancellable_is_cancelled (cancellable);
+	g_mutex_unlock (&priv->sync_waiters_mutex);
+
+	g_cancellable_disconnect (cancellable, cancelled_id);
+
+	return !cancelled;
+}
+
+static void
+connection_disconnected (SoupConnection *conn, gpointer user_data)
+{
+	SoupSession *session = user_data;
+	SoupSessionReactor *reactor = get_reactor (session);
+	SoupSessionHost *host;
+
+	host = g_hash_table_lookup (reactor->conns, conn);
+	if (host)
+		g_hash_table_remove (reactor->conns, conn);
+	drop_connection (session, host, conn);
+
+	soup_session_kick_queue (session);
+	wake_sync_waiters (session);
 }
 
 static void
-message_priority_changed (SoupMessage          *msg,
-                          GParamSpec           *pspec,
-                          SoupMessageQueueItem *item)
+connection_state_changed (GObject *object, GParamSpec *param, gpointer user_data)
 {
-        SoupSessionPrivate *priv = soup_session_get_instance_private (item->session);
+	SoupSession *session = user_data;
+	SoupConnection *conn = SOUP_CONNECTION (object);
 
-        if (priv->in_async_run_queue) {
-                priv->needs_queue_sort = TRUE;
-                return;
-        }
+	if (soup_connection_get_state (conn) == SOUP_CONNECTION_IDLE && soup_connection_is_idle_open (conn))
+		soup_session_kick_queue (session);
+	else if (soup_connection_get_state (conn) == SOUP_CONNECTION_IN_USE)
+		schedule_warm_up (session);
 
-        g_queue_sort (priv->queue, (GCompareDataFunc)compare_queue_item, NULL);
-        priv->needs_queue_sort = FALSE;
+	/* A connection that finished connecting may be shareable (h2) */
+	wake_sync_waiters (session);
 }
 
-static SoupMessageQueueItem *
-soup_session_append_queue_item (SoupSession        *session,
-				SoupMessage        *msg,
-				gboolean            async,
-				GCancellable       *cancellable)
+/* The connections that can still be opened to @host, in any reactor */
+static guint
+get_host_free_slots (SoupSession     *session,
+		     SoupSessionHost *host)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
-	SoupMessageQueueItem *item;
-	SoupSessionHost *host;
-	GSList *f;
+	guint max_conns, free_slots;
 
-        soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_FETCH_START);
-	soup_message_cleanup_response (msg);
-        soup_message_set_is_preconnect (msg, FALSE);
+	g_mutex_lock (&priv->host_limits_mutex);
+	max_conns = get_limits_max_conns (session, host->limits);
+	free_slots = max_conns > host->limits->num_conns ? max_conns - host->limits->num_conns : 0;
+	g_mutex_unlock (&priv->host_limits_mutex);
 
-	item = soup_message_queue_item_new (session, msg, async, cancellable);
-	g_queue_insert_sorted (priv->queue,
-			       soup_message_queue_item_ref (item),
-			       (GCompareDataFunc)compare_queue_item, NULL);
+	return free_slots;
+}
 
-	host = get_host_for_message (session, item->msg);
-	host->num_messages++;
+static gboolean
+reserve_host_slot (SoupSession     *session,
+		   SoupSessionHost *host)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	gboolean reserved;
 
-	if (!soup_message_query_flags (msg, SOUP_MESSAGE_NO_REDIRECT)) {
-		soup_message_add_header_handler (
-			msg, "got_body", "Location",
-			G_CALLBACK (redirect_handler), item);
-	}
-        soup_message_add_status_code_handler (msg, "got-body",
-                                              SOUP_STATUS_MISDIRECTED_REQUEST,
-                                              G_CALLBACK (misdirected_handler), item);
-	g_signal_connect (msg, "restarted",
-			  G_CALLBACK (message_restarted), item);
-        g_signal_connect (msg, "notify::priority",
-                          G_CALLBACK (message_priority_changed), item);
+	g_mutex_lock (&priv->host_limits_mutex);
+	reserved = host->limits->num_conns < get_limits_max_conns (session, host->limits);
+	if (reserved)
+		host->limits->num_conns++;
+	g_mutex_unlock (&priv->host_limits_mutex);
 
-	for (f = priv->features; f; f = g_slist_next (f)) {
-		SoupSessionFeature *feature = SOUP_SESSION_FEATURE (f->data);
+	return reserved;
+}
 
-		g_object_ref (feature);
-		soup_session_feature_request_queued (feature, msg);
-	}
-	g_signal_emit (session, signals[REQUEST_QUEUED], 0, msg);
+/* Returns whether @host was at its limit */
+static gboolean
+release_host_slot (SoupSession     *session,
+		   SoupSessionHost *host)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	gboolean was_full;
 
-	return item;
+	g_mutex_lock (&priv->host_limits_mutex);
+	was_full = host->limits->num_conns >= get_limits_max_conns (session, host->limits);
+	host->limits->num_conns--;
+	g_mutex_unlock (&priv->host_limits_mutex);
+
+	return was_full;
 }
 
 static void
-soup_session_send_queue_item (SoupSession *session,
-			      SoupMessageQueueItem *item,
-			      SoupMessageIOCompletionFn completion_cb)
+update_adaptive_limit (SoupSession          *session,
+		       SoupSessionHost      *host,
+		       SoupMessageQueueItem *item)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
-	SoupMessageHeaders *request_headers;
-	const char *method;
+	guint status = soup_message_get_status (item->msg);
+	guint old_limit, new_limit;
+	gboolean failed, changed;
 
-	request_headers = soup_message_get_request_headers (item->msg);
-	if (priv->user_agent)
-		soup_message_headers_replace_common (request_headers, SOUP_HEADER_USER_AGENT, priv->user_agent);
+	if (priv->adaptive_max_conns_per_host <= priv->max_conns_per_host)
+		return;
 
-	if (priv->accept_language && !soup_message_headers_get_list_common (request_headers, SOUP_HEADER_ACCEPT_LANGUAGE))
-		soup_message_headers_append_common (request_headers, SOUP_HEADER_ACCEPT_LANGUAGE, priv->accept_language);
+	if (!item->conn_acquired_time || item->connect_only)
+		return;
 
-        soup_message_set_http_version (item->msg, soup_connection_get_negotiated_protocol (soup_message_get_connection (item->msg)));
+	if (g_error_matches (item->error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return;
 
-        soup_message_force_keep_alive_if_needed (item->msg);
-        soup_message_update_request_host_if_needed (item->msg);
+	/* Transport errors or the server asking us to back off */
+	failed = item->error != NULL ||
+		status == SOUP_STATUS_SERVICE_UNAVAILABLE ||
+		status == 429 /* Too Many Requests */;
+
+	g_mutex_lock (&priv->host_limits_mutex);
+	old_limit = get_limits_max_conns (session, host->limits);
+	changed = soup_adaptive_limit_record (&host->limits->adaptive_limit,
+					      priv->max_conns_per_host,
+					      priv->adaptive_max_conns_per_host,
+					      item->waited_for_slot,
+					      item->conn_acquired_time - item->conn_wait_begin_time,
+					      g_get_monotonic_time () - item->conn_acquired_time,
+					      failed);
+	new_limit = get_limits_max_conns (session, host->limits);
+	g_mutex_unlock (&priv->host_limits_mutex);
+
+	if (changed && new_limit > old_limit) {
+		wake_sync_waiters (session);
+		kick_all_queues (session);
+	}
+}
 
+static guint
+host_get_demand (SoupSessionHost *host,
+		 gint64           now)
+{
+	gint64 periods = (now - host->demand_time) / SOUP_SESSION_WARM_UP_DEMAND_HALF_LIFE;
 
-	/* A user agent SHOULD send a Content-Length in a request message when
-	 * no Transfer-Encoding is sent and the request method defines a meaning
-	 * for an enclosed payload body. For example, a Content-Length header
-	 * field is normally sent in a POST request even when the value is 0
-	 * (indicating an empty payload body).
-	 */
-	method = soup_message_get_method (item->msg);
-	if ((method == SOUP_METHOD_POST || method == SOUP_METHOD_PUT) &&
-	    soup_message_get_request_body_stream (item->msg) == NULL) {
-		soup_message_headers_set_content_length (request_headers, 0);
+	if (periods > 0) {
+		host->demand = periods < 32 ? host->demand >> periods : 0;
+		host->demand_time += periods * SOUP_SESSION_WARM_UP_DEMAND_HALF_LIFE;
 	}
 
-	soup_message_starting (item->msg);
-	if (item->state == SOUP_MESSAGE_RUNNING)
-                soup_message_send_item (item->msg, item, completion_cb, item);
+	return host->demand;
 }
 
-static gboolean
-soup_session_cleanup_connections (SoupSession *session,
-				  gboolean     cleanup_idle)
+static void
+update_host_demand (SoupSession          *session,
+		    SoupSessionHost      *host,
+		    SoupMessageQueueItem *item)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
-	GSList *conns = NULL, *c;
-	GHashTableIter iter;
-	gpointer conn, host;
-	SoupConnectionState state;
 
-	g_hash_table_iter_init (&iter, priv->conns);
-	while (g_hash_table_iter_next (&iter, &conn, &host)) {
-		state = soup_connection_get_state (conn);
-                if (state == SOUP_CONNECTION_IDLE &&
-                    (cleanup_idle || !soup_connection_is_idle_open (conn))) {
-			conns = g_slist_prepend (conns, g_object_ref (conn));
-			g_hash_table_iter_remove (&iter);
-			drop_connection (session, host, conn);
-		}
-	}
+	if (!priv->warm_conns_per_host || item->connect_only)
+		return;
 
-	if (!conns)
-		return FALSE;
+	if (host_get_demand (host, g_get_monotonic_time ()) < G_MAXUINT)
+		host->demand++;
 
-	for (c = conns; c; c = c->next) {
-		conn = c->data;
-		soup_connection_disconnect (conn);
-		g_object_unref (conn);
-	}
-	g_slist_free (conns);
+	if (host->demand == SOUP_SESSION_WARM_UP_MIN_DEMAND)
+		schedule_warm_up (session);
+}
 
-	return TRUE;
+static void
+schedule_warm_up (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
+
+	if (!priv->warm_conns_per_host || priv->disposed || reactor->needs_warm_up)
+		return;
+
+	reactor->needs_warm_up = TRUE;
+	soup_session_kick_queue (session);
 }
 
-static gboolean
-free_unused_host (gpointer user_data)
+static void
+warm_up_complete (SoupSession  *session,
+		  GAsyncResult *result,
+		  GUri         *uri)
 {
-	SoupSessionHost *host = (SoupSessionHost *) user_data;
-	SoupSessionPrivate *priv = soup_session_get_instance_private (host->session);
-	GUri *uri = host->uri;
+	SoupSessionReactor *reactor = get_reactor (session);
+	SoupSessionHost *host;
 
-	if (host->connections)
-		return FALSE;
+	soup_session_preconnect_finish (session, result, NULL);
 
-	/* This will free the host in addition to removing it from the
-	 * hash table
-	 */
-	if (soup_uri_is_https (uri))
-		g_hash_table_remove (priv->https_hosts, uri);
-	else
-		g_hash_table_remove (priv->http_hosts, uri);
+	/* The host can't go away while warming up */
+	host = g_hash_table_lookup (soup_uri_is_https (uri) ? reactor->https_hosts : reactor->http_hosts, uri);
+	host->num_warming--;
+	reactor->num_warming--;
 
-	return FALSE;
+	g_uri_unref (uri);
 }
 
-static void
-drop_connection (SoupSession *session, SoupSessionHost *host, SoupConnection *conn)
+static guint
+host_count_warm_conns (SoupSessionHost *host)
 {
-	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	GSList *c;
+	guint n_warm = host->num_warming;
 
-	if (host) {
-		host->connections = g_slist_remove (host->connections, conn);
-		host->num_conns--;
+	for (c = host->connections; c; c = c->next) {
+		SoupConnection *conn = c->data;
 
-		/* Free the SoupHost (and its GNetworkAddress) if there
-		 * has not been any new connection to the host during
-		 * the last HOST_KEEP_ALIVE msecs.
-		 */
-		if (host->num_conns == 0) {
-			g_assert (host->keep_alive_src == NULL);
-			host->keep_alive_src = soup_add_timeout (g_main_context_get_thread_default (),
-								 HOST_KEEP_ALIVE,
-								 free_unused_host,
-								 host);
-		}
-	}
+		/* One HTTP/2 connection is enough for everything */
+		if (soup_connection_get_negotiated_protocol (conn) == SOUP_HTTP_2_0 &&
+		    soup_connection_is_reusable (conn))
+			return G_MAXUINT;
 
-	g_signal_handlers_disconnect_by_func (conn, connection_disconnected, session);
-	g_signal_handlers_disconnect_by_func (conn, connection_state_changed, session);
-	priv->num_conns--;
+		if (soup_connection_get_state (conn) == SOUP_CONNECTION_IDLE)
+			n_warm++;
+	}
 
-	g_object_unref (conn);
+	return n_warm;
 }
 
+/* Opens connections to the hosts in demand that are short of idle
+ * ones, without going over the global budget of idle connections, and
+ * always leaving a free slot for the messages in the queue.
+ */
 static void
-connection_disconnected (SoupConnection *conn, gpointer user_data)
+warm_up_hosts (SoupSession *session)
 {
-	SoupSession *session = user_data;
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
+	GHashTable *tables[] = { reactor->http_hosts, reactor->https_hosts };
 	SoupSessionHost *host;
+	GHashTableIter iter;
+	gpointer conn;
+	gint64 now = g_get_monotonic_time ();
+	guint n_idle, i;
 
-	host = g_hash_table_lookup (priv->conns, conn);
-	if (host)
-		g_hash_table_remove (priv->conns, conn);
-	drop_connection (session, host, conn);
+	/* With several reactors, each one keeps to its own share of
+	 * the idle budget.
+	 */
+	n_idle = reactor->num_warming * priv->n_reactors;
+	g_hash_table_iter_init (&iter, reactor->conns);
+	while (g_hash_table_iter_next (&iter, &conn, NULL)) {
+		if (soup_connection_get_state (conn) == SOUP_CONNECTION_IDLE)
+			n_idle += priv->n_reactors;
+	}
 
-	soup_session_kick_queue (session);
-}
+	for (i = 0; i < G_N_ELEMENTS (tables); i++) {
+		g_hash_table_iter_init (&iter, tables[i]);
+		while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&host)) {
+			guint n_warm;
 
-static void
-connection_state_changed (GObject *object, GParamSpec *param, gpointer user_data)
-{
-	SoupSession *session = user_data;
-	SoupConnection *conn = SOUP_CONNECTION (object);
+			if (host_get_demand (host, now) < SOUP_SESSION_WARM_UP_MIN_DEMAND)
+				continue;
 
-	if (soup_connection_get_state (conn) == SOUP_CONNECTION_IDLE && soup_connection_is_idle_open (conn))
-		soup_session_kick_queue (session);
+			n_warm = host_count_warm_conns (host);
+			while (n_warm < priv->warm_conns_per_host &&
+			       n_idle < priv->max_warm_conns &&
+			       host->num_warming < get_host_free_slots (session, host) &&
+			       (guint)g_atomic_int_get (&priv->num_conns) + reactor->num_warming + 1 < priv->max_conns) {
+				SoupMessage *msg;
+
+				msg = soup_message_new_from_uri (SOUP_METHOD_HEAD, host->uri);
+				soup_message_add_flags (msg, SOUP_MESSAGE_NEW_CONNECTION);
+
+				host->num_warming++;
+				reactor->num_warming++;
+				n_warm++;
+				n_idle += priv->n_reactors;
+
+				soup_session_preconnect_async (session, msg, G_PRIORITY_LOW, NULL,
+							       (GAsyncReadyCallback)warm_up_complete,
+							       g_uri_ref (host->uri));
+				g_object_unref (msg);
+			}
+		}
+	}
 }
 
 static void
 soup_session_unqueue_item (SoupSession          *session,
 			   SoupMessageQueueItem *item)
 {
-	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
 	SoupSessionHost *host;
 	GSList *f;
 
@@ -1557,11 +2967,14 @@ soup_session_unqueue_item (SoupSession          *session,
 		return;
 	}
 
-	g_queue_remove (priv->queue, item);
+	g_queue_remove (reactor->queue, item);
 
 	host = get_host_for_message (session, item->msg);
 	host->num_messages--;
 
+	update_adaptive_limit (session, host, item);
+	update_host_demand (session, host, item);
+
 	/* g_signal_handlers_disconnect_by_func doesn't work if you
 	 * have a metamarshal, meaning it doesn't work with
 	 * soup_message_add_header_handler()
@@ -1569,12 +2982,9 @@ soup_session_unqueue_item (SoupSession          *session,
 	g_signal_handlers_disconnect_matched (item->msg, G_SIGNAL_MATCH_DATA,
 					      0, 0, NULL, NULL, item);
 
-	for (f = priv->features; f; f = g_slist_next (f)) {
-		SoupSessionFeature *feature = SOUP_SESSION_FEATURE (f->data);
-
-		soup_session_feature_request_unqueued (feature, item->msg);
-		g_object_unref (feature);
-	}
+	for (f = item->features; f; f = g_slist_next (f))
+		soup_session_feature_request_unqueued (f->data, item->msg);
+	g_slist_free_full (g_steal_pointer (&item->features), g_object_unref);
 	g_signal_emit (session, signals[REQUEST_UNQUEUED], 0, item->msg);
 	soup_message_queue_item_unref (item);
 }
@@ -1794,6 +3204,24 @@ steal_preconnection (SoupSession          *session,
         return TRUE;
 }
 
+/* The global connection limit is shared by all the reactors, so a
+ * slot is taken atomically; drop_connection() gives it back.
+ */
+static gboolean
+reserve_connection_slot (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	int num_conns;
+
+	do {
+		num_conns = g_atomic_int_get (&priv->num_conns);
+		if ((guint)num_conns >= priv->max_conns)
+			return FALSE;
+	} while (!g_atomic_int_compare_and_exchange (&priv->num_conns, num_conns, num_conns + 1));
+
+	return TRUE;
+}
+
 static SoupConnection *
 get_connection_for_host (SoupSession *session,
 			 SoupMessageQueueItem *item,
@@ -1802,7 +3230,9 @@ get_connection_for_host (SoupSession *session,
 			 gboolean *try_cleanup)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
 	GSocketConnectable *remote_connectable;
+	SoupSocketProperties *socket_props;
         gboolean force_http1;
 	SoupConnection *conn;
 	GSList *conns;
@@ -1853,18 +3283,27 @@ get_connection_for_host (SoupSession *session,
 		}
 	}
 
-	if (host->num_conns >= priv->max_conns_per_host) {
+	if (!reserve_host_slot (session, host)) {
+		item->waited_for_slot = TRUE;
 		if (need_new_connection)
 			*try_cleanup = TRUE;
 		return NULL;
 	}
 
-	if (priv->num_conns >= priv->max_conns) {
+	if (!reserve_connection_slot (session)) {
+		release_host_slot (session, host);
 		*try_cleanup = TRUE;
 		return NULL;
 	}
 
-	if (priv->remote_connectable == NULL) {
+	if (priv->remote_connectable == NULL &&
+	    !g_hostname_is_ip_address (g_uri_get_host (host->uri))) {
+		remote_connectable =
+			soup_cached_address_new (priv->dns_cache,
+						 g_uri_get_host (host->uri),
+						 g_uri_get_port (host->uri),
+						 g_uri_get_scheme (host->uri));
+	} else if (priv->remote_connectable == NULL) {
 		remote_connectable =
 			g_object_new (G_TYPE_NETWORK_ADDRESS,
 				      "hostname", g_uri_get_host (host->uri),
@@ -1875,15 +3314,17 @@ get_connection_for_host (SoupSession *session,
 		remote_connectable = g_object_ref (priv->remote_connectable);
 	}
 
-	ensure_socket_props (session);
+	socket_props = get_socket_props (session);
 	conn = g_object_new (SOUP_TYPE_CONNECTION,
-                             "id", ++priv->last_connection_id,
+                             "id", reactor->next_connection_id,
 			     "remote-connectable", remote_connectable,
 			     "ssl", soup_uri_is_https (host->uri),
-			     "socket-properties", priv->socket_props,
+			     "socket-properties", socket_props,
                              "force-http1", force_http1,
 			     NULL);
 	g_object_unref (remote_connectable);
+	soup_socket_properties_unref (socket_props);
+	reactor->next_connection_id += priv->n_reactors;
 
 	g_signal_connect (conn, "disconnected",
 			  G_CALLBACK (connection_disconnected),
@@ -1892,9 +3333,8 @@ get_connection_for_host (SoupSession *session,
 			  G_CALLBACK (connection_state_changed),
 			  session);
 
-	g_hash_table_insert (priv->conns, conn, host);
+	g_hash_table_insert (reactor->conns, conn, host);
 
-	priv->num_conns++;
 	host->num_conns++;
 	host->connections = g_slist_prepend (host->connections, conn);
 
@@ -1913,11 +3353,16 @@ get_connection (SoupMessageQueueItem *item, gboolean *should_cleanup)
 	SoupSession *session = item->session;
 	SoupSessionHost *host;
 	SoupConnection *conn = NULL;
+	SoupSessionSyncWaiter waiter = { item, FALSE, 0 };
+	gboolean waiting = FALSE, cancelled = FALSE;
 	gboolean my_should_cleanup = FALSE;
 	gboolean need_new_connection;
 
 	soup_session_cleanup_connections (session, FALSE);
 
+	if (!item->conn_wait_begin_time)
+		item->conn_wait_begin_time = g_get_monotonic_time ();
+
 	need_new_connection =
 		(soup_message_query_flags (item->msg, SOUP_MESSAGE_NEW_CONNECTION)) ||
                 (soup_message_is_misdirected_retry (item->msg)) ||
@@ -1925,7 +3370,16 @@ get_connection (SoupMessageQueueItem *item, gboolean *should_cleanup)
 		 !SOUP_METHOD_IS_IDEMPOTENT (soup_message_get_method (item->msg)));
 
 	host = get_host_for_message (session, item->msg);
-	while (TRUE) {
+	if (!item->async)
+		sync_waiter_prepare (session, &waiter);
+	if (!item->async && sync_waiters_pending (session, host)) {
+		/* Don't jump ahead of the ones already waiting */
+		sync_waiter_enqueue (session, host, &waiter);
+		waiting = TRUE;
+		cancelled = !sync_waiter_wait (session, &waiter);
+	}
+
+	while (!cancelled) {
 		conn = get_connection_for_host (session, item, host,
 						need_new_connection,
 						&my_should_cleanup);
@@ -1933,10 +3387,28 @@ get_connection (SoupMessageQueueItem *item, gboolean *should_cleanup)
 			break;
 
 		if (my_should_cleanup) {
-			soup_session_cleanup_connections (session, TRUE);
 			my_should_cleanup = FALSE;
-			continue;
+			if (soup_session_cleanup_connections (session, TRUE)) {
+				if (!waiting)
+					sync_waiter_prepare (session, &waiter);
+				continue;
+			}
 		}
+
+		if (!waiting) {
+			sync_waiter_enqueue (session, host, &waiter);
+			waiting = TRUE;
+		}
+		cancelled = !sync_waiter_wait (session, &waiter);
+	}
+
+	if (waiting)
+		sync_waiter_dequeue (session, host, &waiter);
+
+	if (cancelled) {
+		g_cancellable_set_error_if_cancelled (item->cancellable, &item->error);
+		item->state = SOUP_MESSAGE_READY;
+		return TRUE;
 	}
 
 	if (!conn) {
@@ -1946,6 +3418,21 @@ get_connection (SoupMessageQueueItem *item, gboolean *should_cleanup)
 	}
 
         soup_message_set_connection (item->msg, conn);
+        soup_message_set_metrics_timestamp (item->msg, SOUP_MESSAGE_METRICS_CONNECTION_ACQUIRED);
+	item->conn_acquired_time = g_get_monotonic_time ();
+
+#ifdef HAVE_SYSPROF
+        {
+                char *uri_str = g_uri_to_string_partial (soup_message_get_uri (item->msg), G_URI_HIDE_PASSWORD);
+
+                sysprof_collector_mark_printf (item->queue_begin_time_nsec,
+                                               SYSPROF_CAPTURE_CURRENT_TIME - item->queue_begin_time_nsec,
+                                               "libsoup", "queue-wait",
+                                               "Connection %" G_GUINT64_FORMAT " acquired for %s",
+                                               soup_connection_get_id (conn), uri_str);
+                g_free (uri_str);
+        }
+#endif
 
 	switch (soup_connection_get_state (conn)) {
 	case SOUP_CONNECTION_IN_USE:
@@ -2042,7 +3529,12 @@ soup_session_process_queue_item (SoupSession          *session,
 
 		case SOUP_MESSAGE_RESTARTING:
 			item->state = SOUP_MESSAGE_STARTING;
+			item->waited_for_slot = FALSE;
+			item->conn_wait_begin_time = item->conn_acquired_time = 0;
                         soup_message_set_metrics_timestamp (item->msg, SOUP_MESSAGE_METRICS_FETCH_START);
+#ifdef HAVE_SYSPROF
+                        item->queue_begin_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
+#endif
 			soup_message_restarted (item->msg);
 
 			break;
@@ -2077,18 +3569,53 @@ process_queue_item (SoupMessageQueueItem *item,
         soup_session_process_queue_item (item->session, item, should_cleanup, TRUE);
 }
 
+static gboolean
+reactor_cleanup_idle_connections (SoupSessionReactor *reactor)
+{
+	soup_session_cleanup_connections (reactor->session, TRUE);
+	return G_SOURCE_REMOVE;
+}
+
+/* The connections over the global limit may all be idle in other
+ * reactors; have them closed there, then we'll get kicked by
+ * drop_connection().
+ */
+static void
+cleanup_other_reactors (SoupSession *session)
+{
+	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
+	guint i;
+
+	for (i = 0; i < priv->n_reactors; i++) {
+		if (priv->reactors[i] != reactor)
+			invoke_in_reactor (priv->reactors[i], (GSourceFunc)reactor_cleanup_idle_connections);
+	}
+}
+
 static void
 async_run_queue (SoupSession *session)
 {
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupSessionReactor *reactor = get_reactor (session);
+	SoupMetricsRegistry *registry = get_metrics_registry (session);
 	gboolean try_cleanup = TRUE, should_cleanup = FALSE;
+        gint64 begin_time = 0;
+        guint items_scanned = 0;
+#ifdef HAVE_SYSPROF
+        gint64 begin_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
+#endif
+
+        if (registry)
+                begin_time = g_get_monotonic_time ();
 
 	g_object_ref (session);
-        priv->in_async_run_queue++;
+        reactor->in_async_run_queue++;
 	soup_session_cleanup_connections (session, FALSE);
 
  try_again:
-        g_queue_foreach (priv->queue, (GFunc)process_queue_item, &should_cleanup);
+        items_scanned += g_queue_get_length (reactor->queue);
+        g_queue_foreach (reactor->queue, (GFunc)process_queue_item, &should_cleanup);
 
 	if (try_cleanup && should_cleanup) {
 		/* There is at least one message in the queue that
@@ -2099,14 +3626,32 @@ async_run_queue (SoupSession *session)
 			try_cleanup = should_cleanup = FALSE;
 			goto try_again;
 		}
+
+		if (priv->n_reactors > 1)
+			cleanup_other_reactors (session);
+	}
+
+	if (reactor->needs_warm_up) {
+		reactor->needs_warm_up = FALSE;
+		warm_up_hosts (session);
 	}
 
-        priv->in_async_run_queue--;
-        if (!priv->in_async_run_queue && priv->needs_queue_sort) {
-                g_queue_sort (priv->queue, (GCompareDataFunc)compare_queue_item, NULL);
-                priv->needs_queue_sort = FALSE;
+        reactor->in_async_run_queue--;
+        if (!reactor->in_async_run_queue && reactor->needs_queue_sort) {
+                g_queue_sort (reactor->queue, (GCompareDataFunc)compare_queue_item, NULL);
+                reactor->needs_queue_sort = FALSE;
         }
 
+        if (registry)
+                soup_metrics_registry_record_queue_run (registry, g_get_monotonic_time () - begin_time, items_scanned);
+
+#ifdef HAVE_SYSPROF
+        sysprof_collector_mark_printf (begin_time_nsec,
+                                       SYSPROF_CAPTURE_CURRENT_TIME - begin_time_nsec,
+                                       "libsoup", "queue-run",
+                                       "Scanned %u queue items", items_scanned);
+#endif
+
 	g_object_unref (session);
 }
 
@@ -2156,9 +3701,12 @@ soup_session_pause_message (SoupSession *session,
 static void
 soup_session_kick_queue (SoupSession *session)
 {
-	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+	SoupMetricsRegistry *registry = get_metrics_registry (session);
+
+	if (registry)
+		soup_metrics_registry_increment_counter (registry, SOUP_METRICS_COUNTER_QUEUE_KICKS);
 
-	g_source_set_ready_time (priv->queue_source, 0);
+	g_source_set_ready_time (get_reactor (session)->queue_source, 0);
 }
 
 /**
@@ -2200,37 +3748,26 @@ soup_session_cancel_message (SoupSession *session,
 			     SoupMessage *msg)
 {
 	SoupMessageQueueItem *item = soup_session_lookup_queue_item (session, msg);
-
-        /* If the message is already ending, don't do anything */
-	if (item)
-		soup_message_queue_item_cancel (item);
-}
-
-/**
- * soup_session_abort:
- * @session: the session
- *
- * Cancels all pending requests in @session and closes all idle
- * persistent connections.
- *
- */
-void
-soup_session_abort (SoupSession *session)
+
+        /* If the message is already ending, don't do anything */
+	if (item)
+		soup_message_queue_item_cancel (item);
+}
+
+static void
+abort_reactor (SoupSession        *session,
+	       SoupSessionReactor *reactor)
 {
-	SoupSessionPrivate *priv;
 	GSList *conns, *c;
 	GHashTableIter iter;
 	gpointer conn, host;
 
-	g_return_if_fail (SOUP_IS_SESSION (session));
-	priv = soup_session_get_instance_private (session);
-
 	/* Cancel everything */
-	g_queue_foreach (priv->queue, (GFunc)soup_message_queue_item_cancel, NULL);
+	g_queue_foreach (reactor->queue, (GFunc)soup_message_queue_item_cancel, NULL);
 
 	/* Close all idle connections */
 	conns = NULL;
-	g_hash_table_iter_init (&iter, priv->conns);
+	g_hash_table_iter_init (&iter, reactor->conns);
 	while (g_hash_table_iter_next (&iter, &conn, &host)) {
 		SoupConnectionState state;
 
@@ -2248,6 +3785,66 @@ soup_session_abort (SoupSession *session)
 	}
 
 	g_slist_free (conns);
+
+	/* Don't warm up again what was just closed */
+	reactor->needs_warm_up = FALSE;
+	g_hash_table_iter_init (&iter, reactor->http_hosts);
+	while (g_hash_table_iter_next (&iter, NULL, &host))
+		((SoupSessionHost *)host)->demand = 0;
+	g_hash_table_iter_init (&iter, reactor->https_hosts);
+	while (g_hash_table_iter_next (&iter, NULL, &host))
+		((SoupSessionHost *)host)->demand = 0;
+}
+
+static gpointer
+abort_in_reactor (SoupSession *session,
+		  gpointer     reactor)
+{
+	abort_reactor (session, reactor);
+	return NULL;
+}
+
+static gboolean
+reactor_abort (SoupSessionReactor *reactor)
+{
+	abort_reactor (reactor->session, reactor);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * soup_session_abort:
+ * @session: the session
+ *
+ * Cancels all pending requests in @session and closes all idle
+ * persistent connections.
+ *
+ * This returns once all of it is done, except when called from one of
+ * the I/O threads of a session with several of them (see
+ * #SoupSession:io-threads), for instance from a callback: to never have
+ * an I/O thread block on another one, only the requests and
+ * connections of the calling thread are done with before returning,
+ * and the other threads do the same with theirs right after.
+ *
+ */
+void
+soup_session_abort (SoupSession *session)
+{
+	SoupSessionPrivate *priv;
+	guint i;
+
+	g_return_if_fail (SOUP_IS_SESSION (session));
+	priv = soup_session_get_instance_private (session);
+
+	for (i = 0; i < priv->n_reactors; i++) {
+		SoupSessionReactor *reactor = priv->reactors[i];
+
+		if (in_reactor (reactor))
+			abort_reactor (session, reactor);
+		else if (in_io_thread (session)) /* See above */
+			invoke_in_reactor (reactor, (GSourceFunc)reactor_abort);
+		else
+			run_in_reactor (reactor, abort_in_reactor, reactor);
+	}
 }
 
 static gboolean
@@ -2262,6 +3859,14 @@ feature_already_added (SoupSession *session, GType feature_type)
         return FALSE;
 }
 
+static gpointer
+add_feature_in_io_thread (SoupSession *session,
+			  gpointer     feature)
+{
+	soup_session_add_feature (session, feature);
+	return NULL;
+}
+
 /**
  * soup_session_add_feature:
  * @session: a #SoupSession
@@ -2282,14 +3887,31 @@ soup_session_add_feature (SoupSession *session, SoupSessionFeature *feature)
 	g_return_if_fail (SOUP_IS_SESSION (session));
 	g_return_if_fail (SOUP_IS_SESSION_FEATURE (feature));
 
+	if (!in_io_thread (session)) {
+		run_in_io_thread (session, add_feature_in_io_thread, feature);
+		return;
+	}
+
 	priv = soup_session_get_instance_private (session);
 
         if (feature_already_added (session, G_TYPE_FROM_INSTANCE (feature)))
                 return;
 
-	priv->features = g_slist_prepend (priv->features, g_object_ref (feature));
-	g_hash_table_remove_all (priv->features_cache);
+	/* Other reactors may start using it as soon as it is in the list */
 	soup_session_feature_attach (feature, session);
+
+	g_rw_lock_writer_lock (&priv->features_lock);
+	priv->features = g_slist_prepend (priv->features, g_object_ref (feature));
+	g_atomic_int_inc (&priv->features_serial);
+	g_rw_lock_writer_unlock (&priv->features_lock);
+}
+
+static gpointer
+add_feature_by_type_in_io_thread (SoupSession *session,
+				  gpointer     feature_type)
+{
+	soup_session_add_feature_by_type (session, GPOINTER_TO_SIZE (feature_type));
+	return NULL;
 }
 
 /**
@@ -2314,11 +3936,13 @@ soup_session_add_feature (SoupSession *session, SoupSessionFeature *feature)
 void
 soup_session_add_feature_by_type (SoupSession *session, GType feature_type)
 {
-	SoupSessionPrivate *priv;
-
 	g_return_if_fail (SOUP_IS_SESSION (session));
 
-	priv = soup_session_get_instance_private (session);
+	if (!in_io_thread (session)) {
+		run_in_io_thread (session, add_feature_by_type_in_io_thread,
+				  GSIZE_TO_POINTER (feature_type));
+		return;
+	}
 
 	if (g_type_is_a (feature_type, SOUP_TYPE_SESSION_FEATURE)) {
 		SoupSessionFeature *feature;
@@ -2332,7 +3956,7 @@ soup_session_add_feature_by_type (SoupSession *session, GType feature_type)
 	} else {
 		GSList *f;
 
-		for (f = priv->features; f; f = f->next) {
+		for (f = get_reactor_features (session, get_reactor (session)); f; f = f->next) {
 			if (soup_session_feature_add_feature (f->data, feature_type))
 				return;
 		}
@@ -2340,6 +3964,14 @@ soup_session_add_feature_by_type (SoupSession *session, GType feature_type)
 	}
 }
 
+static gpointer
+remove_feature_in_io_thread (SoupSession *session,
+			     gpointer     feature)
+{
+	soup_session_remove_feature (session, feature);
+	return NULL;
+}
+
 /**
  * soup_session_remove_feature:
  * @session: a #SoupSession
@@ -2352,18 +3984,62 @@ void
 soup_session_remove_feature (SoupSession *session, SoupSessionFeature *feature)
 {
 	SoupSessionPrivate *priv;
+	gboolean found;
+	guint i;
 
 	g_return_if_fail (SOUP_IS_SESSION (session));
 
+	if (!in_io_thread (session)) {
+		run_in_io_thread (session, remove_feature_in_io_thread, feature);
+		return;
+	}
+
 	priv = soup_session_get_instance_private (session);
-	if (g_slist_find (priv->features, feature)) {
+
+	g_rw_lock_writer_lock (&priv->features_lock);
+	found = g_slist_find (priv->features, feature) != NULL;
+	if (found) {
+		SoupSessionRemovedFeature *removed;
+
 		priv->features = g_slist_remove (priv->features, feature);
-		g_hash_table_remove_all (priv->features_cache);
-		soup_session_feature_detach (feature, session);
-		g_object_unref (feature);
+		g_atomic_int_inc (&priv->features_serial);
+
+		/* Takes over the reference of the list */
+		removed = g_new (SoupSessionRemovedFeature, 1);
+		removed->feature = feature;
+		removed->serial = priv->features_serial;
+		removed->pending = priv->n_reactors;
+		g_mutex_lock (&priv->removed_features_mutex);
+		priv->removed_features = g_slist_prepend (priv->removed_features, removed);
+		g_mutex_unlock (&priv->removed_features_mutex);
+	}
+	g_rw_lock_writer_unlock (&priv->features_lock);
+
+	if (!found)
+		return;
+
+	/* Every reactor drops its copy as soon as it can, the last one
+	 * detaches the feature. The messages already queued keep
+	 * theirs until they are unqueued.
+	 */
+	for (i = 0; i < priv->n_reactors; i++) {
+		SoupSessionReactor *reactor = priv->reactors[i];
+
+		if (in_reactor (reactor))
+			get_reactor_features (session, reactor);
+		else
+			invoke_in_reactor (reactor, (GSourceFunc)reactor_refresh_features);
 	}
 }
 
+static gpointer
+remove_feature_by_type_in_io_thread (SoupSession *session,
+				     gpointer     feature_type)
+{
+	soup_session_remove_feature_by_type (session, GPOINTER_TO_SIZE (feature_type));
+	return NULL;
+}
+
 /**
  * soup_session_remove_feature_by_type:
  * @session: a #SoupSession
@@ -2378,23 +4054,26 @@ soup_session_remove_feature (SoupSession *session, SoupSessionFeature *feature)
 void
 soup_session_remove_feature_by_type (SoupSession *session, GType feature_type)
 {
-	SoupSessionPrivate *priv;
 	GSList *f;
 
 	g_return_if_fail (SOUP_IS_SESSION (session));
 
-	priv = soup_session_get_instance_private (session);
+	if (!in_io_thread (session)) {
+		run_in_io_thread (session, remove_feature_by_type_in_io_thread,
+				  GSIZE_TO_POINTER (feature_type));
+		return;
+	}
 
 	if (g_type_is_a (feature_type, SOUP_TYPE_SESSION_FEATURE)) {
 	restart:
-		for (f = priv->features; f; f = f->next) {
+		for (f = get_reactor_features (session, get_reactor (session)); f; f = f->next) {
 			if (G_TYPE_CHECK_INSTANCE_TYPE (f->data, feature_type)) {
 				soup_session_remove_feature (session, f->data);
 				goto restart;
 			}
 		}
 	} else {
-		for (f = priv->features; f; f = f->next) {
+		for (f = get_reactor_features (session, get_reactor (session)); f; f = f->next) {
 			if (soup_session_feature_remove_feature (f->data, feature_type))
 				return;
 		}
@@ -2402,6 +4081,13 @@ soup_session_remove_feature_by_type (SoupSession *session, GType feature_type)
 	}
 }
 
+static gpointer
+has_feature_in_io_thread (SoupSession *session,
+			  gpointer     feature_type)
+{
+	return GINT_TO_POINTER (soup_session_has_feature (session, GPOINTER_TO_SIZE (feature_type)));
+}
+
 /**
  * soup_session_has_feature:
  * @session: a #SoupSession
@@ -2418,20 +4104,24 @@ gboolean
 soup_session_has_feature (SoupSession *session,
 			  GType        feature_type)
 {
-	SoupSessionPrivate *priv;
-	GSList *f;
+	GSList *features, *f;
 
 	g_return_val_if_fail (SOUP_IS_SESSION (session), FALSE);
 
-	priv = soup_session_get_instance_private (session);
+	if (!in_io_thread (session)) {
+		return GPOINTER_TO_INT (run_in_io_thread (session, has_feature_in_io_thread,
+							  GSIZE_TO_POINTER (feature_type)));
+	}
+
+	features = get_reactor_features (session, get_reactor (session));
 
 	if (g_type_is_a (feature_type, SOUP_TYPE_SESSION_FEATURE)) {
-		for (f = priv->features; f; f = f->next) {
+		for (f = features; f; f = f->next) {
 			if (G_TYPE_CHECK_INSTANCE_TYPE (f->data, feature_type))
 				return TRUE;
 		}
 	} else {
-		for (f = priv->features; f; f = f->next) {
+		for (f = features; f; f = f->next) {
 			if (soup_session_feature_has_feature (f->data, feature_type))
 				return TRUE;
 		}
@@ -2440,6 +4130,13 @@ soup_session_has_feature (SoupSession *session,
 	return FALSE;
 }
 
+static gpointer
+get_features_in_io_thread (SoupSession *session,
+			   gpointer     feature_type)
+{
+	return soup_session_get_features (session, GPOINTER_TO_SIZE (feature_type));
+}
+
 /**
  * soup_session_get_features:
  * @session: a #SoupSession
@@ -2456,19 +4153,29 @@ soup_session_has_feature (SoupSession *session,
 GSList *
 soup_session_get_features (SoupSession *session, GType feature_type)
 {
-	SoupSessionPrivate *priv;
 	GSList *f, *ret;
 
 	g_return_val_if_fail (SOUP_IS_SESSION (session), NULL);
 
-	priv = soup_session_get_instance_private (session);
-	for (f = priv->features, ret = NULL; f; f = f->next) {
+	if (!in_io_thread (session)) {
+		return run_in_io_thread (session, get_features_in_io_thread,
+					 GSIZE_TO_POINTER (feature_type));
+	}
+
+	for (f = get_reactor_features (session, get_reactor (session)), ret = NULL; f; f = f->next) {
 		if (G_TYPE_CHECK_INSTANCE_TYPE (f->data, feature_type))
 			ret = g_slist_prepend (ret, f->data);
 	}
 	return g_slist_reverse (ret);
 }
 
+static gpointer
+get_feature_in_io_thread (SoupSession *session,
+			  gpointer     feature_type)
+{
+	return soup_session_get_feature (session, GPOINTER_TO_SIZE (feature_type));
+}
+
 /**
  * soup_session_get_feature:
  * @session: a #SoupSession
@@ -2483,23 +4190,29 @@ soup_session_get_features (SoupSession *session, GType feature_type)
 SoupSessionFeature *
 soup_session_get_feature (SoupSession *session, GType feature_type)
 {
-	SoupSessionPrivate *priv;
+	SoupSessionReactor *reactor;
 	SoupSessionFeature *feature;
-	GSList *f;
+	GSList *features, *f;
 
 	g_return_val_if_fail (SOUP_IS_SESSION (session), NULL);
 
-	priv = soup_session_get_instance_private (session);
+	if (!in_io_thread (session)) {
+		return run_in_io_thread (session, get_feature_in_io_thread,
+					 GSIZE_TO_POINTER (feature_type));
+	}
 
-	feature = g_hash_table_lookup (priv->features_cache,
+	reactor = get_reactor (session);
+	features = get_reactor_features (session, reactor);
+
+	feature = g_hash_table_lookup (reactor->features_cache,
 				       GSIZE_TO_POINTER (feature_type));
 	if (feature)
 		return feature;
 
-	for (f = priv->features; f; f = f->next) {
+	for (f = features; f; f = f->next) {
 		feature = f->data;
 		if (G_TYPE_CHECK_INSTANCE_TYPE (feature, feature_type)) {
-			g_hash_table_insert (priv->features_cache,
+			g_hash_table_insert (reactor->features_cache,
 					     GSIZE_TO_POINTER (feature_type),
 					     feature);
 			return feature;
@@ -2588,6 +4301,7 @@ soup_session_class_init (SoupSessionClass *session_class)
 	GObjectClass *object_class = G_OBJECT_CLASS (session_class);
 
 	/* virtual method override */
+	object_class->constructed = soup_session_constructed;
 	object_class->dispose = soup_session_dispose;
 	object_class->finalize = soup_session_finalize;
 	object_class->set_property = soup_session_set_property;
@@ -2901,6 +4615,151 @@ soup_session_class_init (SoupSessionClass *session_class)
 				     G_PARAM_READWRITE |
 				     G_PARAM_STATIC_STRINGS);
 
+	/**
+	 * SoupSession:socket-options:
+	 *
+	 * The #SoupSocketOptions applied to the sockets of new
+	 * connections, or %NULL for the defaults.
+	 *
+	 * Like #SoupSession:timeout, changing this property only
+	 * affects newly-created connections.
+	 *
+	 **/
+        properties[PROP_SOCKET_OPTIONS] =
+		g_param_spec_boxed ("socket-options",
+				    "Socket options",
+				    "Options applied to new sockets",
+				    SOUP_TYPE_SOCKET_OPTIONS,
+				    G_PARAM_READWRITE |
+				    G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupSession:adaptive-max-conns-per-host:
+	 *
+	 * If greater than #SoupSession:max-conns-per-host, the limit
+	 * of connections to each host is adjusted as messages finish,
+	 * between those two values: it grows while messages have to
+	 * wait for a free connection to the host, and shrinks when the
+	 * host gets slower or answers with errors, or with 503 or 429
+	 * status codes. A value of 0 disables this.
+	 *
+	 * See also soup_session_set_max_conns_for_host().
+	 */
+        properties[PROP_ADAPTIVE_MAX_CONNS_PER_HOST] =
+		g_param_spec_int ("adaptive-max-conns-per-host",
+				  "Adaptive Max Per-Host Connection Count",
+				  "The maximum number of connections to a given host in adaptive mode",
+				  0,
+				  G_MAXINT,
+				  0,
+				  G_PARAM_READWRITE |
+				  G_PARAM_CONSTRUCT_ONLY |
+				  G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupSession:warm-conns-per-host:
+	 *
+	 * The number of idle connections that the session tries to keep
+	 * open to each host it sends requests to frequently, so that new
+	 * requests to them don't have to wait for a connection to be
+	 * established. Connections are opened again when idle ones are
+	 * taken or closed, as long as the host keeps being used, within
+	 * the limits of #SoupSession:max-warm-conns, the per-host
+	 * connection limit and #SoupSession:max-conns. A value of 0
+	 * disables this.
+	 */
+        properties[PROP_WARM_CONNS_PER_HOST] =
+		g_param_spec_int ("warm-conns-per-host",
+				  "Warm Per-Host Connection Count",
+				  "The number of idle connections to keep open to frequently used hosts",
+				  0,
+				  G_MAXINT,
+				  0,
+				  G_PARAM_READWRITE |
+				  G_PARAM_CONSTRUCT_ONLY |
+				  G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupSession:max-warm-conns:
+	 *
+	 * The maximum number of idle connections that the session keeps
+	 * open in total because of #SoupSession:warm-conns-per-host.
+	 */
+        properties[PROP_MAX_WARM_CONNS] =
+		g_param_spec_int ("max-warm-conns",
+				  "Max Warm Connection Count",
+				  "The maximum number of idle connections kept open in total",
+				  0,
+				  G_MAXINT,
+				  SOUP_SESSION_MAX_WARM_CONNS_DEFAULT,
+				  G_PARAM_READWRITE |
+				  G_PARAM_CONSTRUCT_ONLY |
+				  G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupSession:thread-safe:
+	 *
+	 * Whether the session can be used from several threads at the
+	 * same time.
+	 *
+	 * A thread-safe session does all its I/O in a thread of its
+	 * own, or several of them (see #SoupSession:io-threads),
+	 * sharing its connections, cookie jar, HSTS policies and cache
+	 * among all the threads using it. Messages can be sent
+	 * from any thread, both synchronously and asynchronously; the
+	 * callbacks of the asynchronous operations are invoked in the
+	 * thread-default main context of the caller, as usual. The
+	 * response body streams returned to other threads forward
+	 * their reads to the session thread. WebSocket connections
+	 * can't be started from other threads.
+	 *
+	 * Note that the signals of the messages and of the session
+	 * features are emitted in the session thread. The session
+	 * should be configured and its features added before it is
+	 * used from several threads.
+	 */
+        properties[PROP_THREAD_SAFE] =
+		g_param_spec_boolean ("thread-safe",
+				      "Thread safe",
+				      "Whether the session can be used from several threads",
+				      FALSE,
+				      G_PARAM_READWRITE |
+				      G_PARAM_CONSTRUCT_ONLY |
+				      G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupSession:io-threads:
+	 *
+	 * The number of threads doing the I/O of a thread-safe
+	 * session, up to 64. A value greater than 1 implies
+	 * #SoupSession:thread-safe.
+	 *
+	 * Hosts are spread over the I/O threads by hash, each thread
+	 * owning the connections and the queued messages of its
+	 * hosts, so that sessions sending lots of requests to many
+	 * hosts are not limited by a single thread. A message stays
+	 * in the thread of its original host when redirected.
+	 * #SoupSession:max-conns and the per-host limits are shared
+	 * by all the threads, while the idle connections of
+	 * #SoupSession:warm-conns-per-host apply to each thread.
+	 *
+	 * The session features are shared by all the threads, so they
+	 * must be thread-safe, like the ones provided by libsoup; the
+	 * #SoupLogger printer and filters are called from all the
+	 * threads. Blocking calls must not be made from the I/O
+	 * threads.
+	 */
+        properties[PROP_IO_THREADS] =
+		g_param_spec_uint ("io-threads",
+				   "I/O threads",
+				   "The number of threads doing the I/O of a thread-safe session",
+				   1,
+				   SOUP_SESSION_MAX_IO_THREADS,
+				   1,
+				   G_PARAM_READWRITE |
+				   G_PARAM_CONSTRUCT_ONLY |
+				   G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
 
@@ -3323,6 +5182,179 @@ soup_session_return_error_if_message_already_in_queue (SoupSession         *sess
         return TRUE;
 }
 
+/* The caller side of operations forwarded to the I/O thread of a
+ * thread-safe session gets the queue item for
+ * soup_session_get_async_result_message().
+ */
+static void
+io_thread_task_take_item (GTask        *task,
+			  GAsyncResult *result)
+{
+	SoupMessageQueueItem *item = g_task_get_task_data (G_TASK (result));
+
+	if (item)
+		g_task_set_task_data (task, soup_message_queue_item_ref (item), (GDestroyNotify)soup_message_queue_item_unref);
+	else
+		g_task_set_task_data (task, NULL, NULL);
+}
+
+static void
+io_thread_send_and_read_ready (SoupSession  *session,
+			       GAsyncResult *result,
+			       GTask        *task)
+{
+	GBytes *body;
+	GError *error = NULL;
+
+	io_thread_task_take_item (task, result);
+
+	body = soup_session_send_and_read_finish (session, result, &error);
+	if (body)
+		g_task_return_pointer (task, body, (GDestroyNotify)g_bytes_unref);
+	else
+		g_task_return_error (task, error);
+	g_object_unref (task);
+}
+
+static void
+io_thread_send_ready (SoupSession  *session,
+		      GAsyncResult *result,
+		      GTask        *task)
+{
+	GInputStream *stream;
+	GError *error = NULL;
+
+	io_thread_task_take_item (task, result);
+
+	stream = soup_session_send_finish (session, result, &error);
+	if (stream) {
+		g_task_return_pointer (task,
+				       soup_io_thread_input_stream_new (stream, g_main_context_get_thread_default (), G_OBJECT (session)),
+				       g_object_unref);
+		g_object_unref (stream);
+	} else
+		g_task_return_error (task, error);
+	g_object_unref (task);
+}
+
+static void
+io_thread_preconnect_ready (SoupSession  *session,
+			    GAsyncResult *result,
+			    GTask        *task)
+{
+	GError *error = NULL;
+
+	io_thread_task_take_item (task, result);
+
+	if (soup_session_preconnect_finish (session, result, &error))
+		g_task_return_boolean (task, TRUE);
+	else
+		g_task_return_error (task, error);
+	g_object_unref (task);
+}
+
+static gboolean
+io_thread_send_start (GTask *task)
+{
+	SoupSession *session = g_task_get_source_object (task);
+	SoupMessage *msg = g_task_get_task_data (task);
+
+	if (g_task_get_source_tag (task) == soup_session_preconnect_async) {
+		soup_session_preconnect_async (session, msg,
+					       g_task_get_priority (task),
+					       g_task_get_cancellable (task),
+					       (GAsyncReadyCallback)io_thread_preconnect_ready,
+					       task);
+	} else if (g_task_get_source_tag (task) == soup_session_send_async) {
+		soup_session_send_async (session, msg,
+					 g_task_get_priority (task),
+					 g_task_get_cancellable (task),
+					 (GAsyncReadyCallback)io_thread_send_ready,
+					 task);
+	} else {
+		soup_session_send_and_read_async (session, msg,
+						  g_task_get_priority (task),
+						  g_task_get_cancellable (task),
+						  (GAsyncReadyCallback)io_thread_send_and_read_ready,
+						  task);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Whether @msg can be sent from the calling thread: any thread if the
+ * session is not thread-safe, otherwise only the I/O thread owning the
+ * host of @msg.
+ */
+static inline gboolean
+in_reactor_for_message (SoupSession *session,
+			SoupMessage *msg)
+{
+	return in_reactor (get_reactor_for_uri (session, soup_message_get_uri (msg)));
+}
+
+/* Starts the operation identified by @source_tag in the I/O thread
+ * owning the host of @msg, completing it in the thread-default context
+ * of the caller. Response bodies are read in the I/O thread, since
+ * the streams can't be used from any other.
+ */
+static void
+send_in_io_thread (SoupSession        *session,
+		   SoupMessage        *msg,
+		   int                 io_priority,
+		   GCancellable       *cancellable,
+		   gpointer            source_tag,
+		   GAsyncReadyCallback callback,
+		   gpointer            user_data)
+{
+	SoupSessionReactor *reactor = get_reactor_for_uri (session, soup_message_get_uri (msg));
+	GTask *task;
+
+	task = g_task_new (session, cancellable, callback, user_data);
+	g_task_set_source_tag (task, source_tag);
+	g_task_set_priority (task, io_priority);
+	g_task_set_task_data (task, g_object_ref (msg), g_object_unref);
+
+	g_main_context_invoke (g_main_loop_get_context (reactor->loop),
+			       (GSourceFunc)io_thread_send_start, task);
+}
+
+static void
+send_in_io_thread_sync_ready (SoupSession   *session,
+			      GAsyncResult  *result,
+			      GAsyncResult **result_out)
+{
+	*result_out = g_object_ref (result);
+}
+
+static gpointer
+send_in_io_thread_sync (SoupSession  *session,
+			SoupMessage  *msg,
+			GCancellable *cancellable,
+			gpointer      source_tag,
+			GError      **error)
+{
+	GMainContext *context;
+	GAsyncResult *result = NULL;
+	gpointer retval;
+
+	context = g_main_context_new ();
+	g_main_context_push_thread_default (context);
+
+	send_in_io_thread (session, msg, G_PRIORITY_DEFAULT, cancellable, source_tag,
+			   (GAsyncReadyCallback)send_in_io_thread_sync_ready, &result);
+	while (!result)
+		g_main_context_iteration (context, TRUE);
+
+	g_main_context_pop_thread_default (context);
+	g_main_context_unref (context);
+
+	retval = g_task_propagate_pointer (G_TASK (result), error);
+	g_object_unref (result);
+
+	return retval;
+}
+
 /**
  * soup_session_send_async:
  * @session: a #SoupSession
@@ -3352,6 +5384,13 @@ soup_session_send_async (SoupSession         *session,
 	SoupMessageQueueItem *item;
 
 	g_return_if_fail (SOUP_IS_SESSION (session));
+	g_return_if_fail (SOUP_IS_MESSAGE (msg));
+
+	if (!in_reactor_for_message (session, msg)) {
+		send_in_io_thread (session, msg, io_priority, cancellable,
+				   soup_session_send_async, callback, user_data);
+		return;
+	}
 
         if (soup_session_return_error_if_message_already_in_queue (session, msg, cancellable, callback, user_data))
             return;
@@ -3397,6 +5436,11 @@ soup_session_send_finish (SoupSession   *session,
 	g_return_val_if_fail (g_task_is_valid (result, session), NULL);
 
 	task = G_TASK (result);
+
+	/* Sent from another thread; the I/O thread already finished it */
+	if (g_task_get_source_tag (task) == soup_session_send_async)
+		return g_task_propagate_pointer (task, error);
+
 	if (g_task_had_error (task)) {
 		SoupMessageQueueItem *item = g_task_get_task_data (task);
 
@@ -3458,6 +5502,10 @@ soup_session_send (SoupSession   *session,
 	GError *my_error = NULL;
 
 	g_return_val_if_fail (SOUP_IS_SESSION (session), NULL);
+	g_return_val_if_fail (SOUP_IS_MESSAGE (msg), NULL);
+
+	if (!in_reactor_for_message (session, msg))
+		return send_in_io_thread_sync (session, msg, cancellable, soup_session_send_async, error);
 
         if (soup_session_lookup_queue_item (session, msg)) {
                 g_set_error_literal (error,
@@ -3634,6 +5682,12 @@ soup_session_send_and_read_async (SoupSession        *session,
 	g_return_if_fail (SOUP_IS_SESSION (session));
 	g_return_if_fail (SOUP_IS_MESSAGE (msg));
 
+	if (!in_reactor_for_message (session, msg)) {
+		send_in_io_thread (session, msg, io_priority, cancellable,
+				   soup_session_send_and_read_async, callback, user_data);
+		return;
+	}
+
 	task = g_task_new (session, cancellable, callback, user_data);
 	g_task_set_priority (task, io_priority);
 
@@ -3692,6 +5746,12 @@ soup_session_send_and_read (SoupSession  *session,
 	GOutputStream *ostream;
 	GBytes *bytes = NULL;
 
+	g_return_val_if_fail (SOUP_IS_SESSION (session), NULL);
+	g_return_val_if_fail (SOUP_IS_MESSAGE (msg), NULL);
+
+	if (!in_reactor_for_message (session, msg))
+		return send_in_io_thread_sync (session, msg, cancellable, soup_session_send_and_read_async, error);
+
 	stream = soup_session_send (session, msg, cancellable, error);
 	if (!stream)
 		return NULL;
@@ -3739,14 +5799,15 @@ static GIOStream *
 steal_connection (SoupSession          *session,
                   SoupMessageQueueItem *item)
 {
-        SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+        SoupSessionReactor *reactor = get_reactor (session);
         SoupConnection *conn;
         SoupSessionHost *host;
         GIOStream *stream;
 
         conn = g_object_ref (soup_message_get_connection (item->msg));
-        host = get_host_for_message (session, item->msg);
-        g_hash_table_remove (priv->conns, conn);
+        /* Not necessarily the host of the message, after a redirection */
+        host = g_hash_table_lookup (reactor->conns, conn);
+        g_hash_table_remove (reactor->conns, conn);
         drop_connection (session, host, conn);
 
 	stream = soup_connection_steal_iostream (conn);
@@ -3915,6 +5976,14 @@ soup_session_websocket_connect_async (SoupSession          *session,
 	g_return_if_fail (SOUP_IS_SESSION (session));
 	g_return_if_fail (SOUP_IS_MESSAGE (msg));
 
+	if (!in_reactor_for_message (session, msg)) {
+		g_task_report_new_error (session, callback, user_data,
+					 soup_session_websocket_connect_async,
+					 G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+					 _("WebSocket connections can only be started from the session thread"));
+		return;
+	}
+
         if (soup_session_return_error_if_message_already_in_queue (session, msg, cancellable, callback, user_data))
                 return;
 
@@ -4030,15 +6099,31 @@ soup_session_preconnect_async (SoupSession        *session,
                                GAsyncReadyCallback callback,
                                gpointer            user_data)
 {
+        SoupSessionPrivate *priv;
         SoupMessageQueueItem *item;
+        const char *host;
         GTask *task;
 
         g_return_if_fail (SOUP_IS_SESSION (session));
         g_return_if_fail (SOUP_IS_MESSAGE (msg));
 
+        if (!in_reactor_for_message (session, msg)) {
+                send_in_io_thread (session, msg, io_priority, cancellable,
+                                   soup_session_preconnect_async, callback, user_data);
+                return;
+        }
+
         if (soup_session_return_error_if_message_already_in_queue (session, msg, cancellable, callback, user_data))
                 return;
 
+        /* Start resolving right away, the connection itself may have
+         * to wait for a free slot.
+         */
+        priv = soup_session_get_instance_private (session);
+        host = g_uri_get_host (soup_message_get_uri (msg));
+        if (!priv->remote_connectable && host && !g_hostname_is_ip_address (host))
+                soup_dns_cache_prefetch (priv->dns_cache, host);
+
         item = soup_session_append_queue_item (session, msg, TRUE, cancellable);
         item->connect_only = TRUE;
         item->io_priority = io_priority;
@@ -7,6 +7,7 @@
 
 #include "soup-types.h"
 #include "soup-message.h"
+#include "soup-socket-options.h"
 #include "soup-websocket-connection.h"
 
 G_BEGIN_DECLS
@@ -63,6 +64,30 @@ guint               soup_session_get_max_conns            (SoupSession     *sess
 SOUP_AVAILABLE_IN_ALL
 guint               soup_session_get_max_conns_per_host   (SoupSession     *session);
 
+SOUP_AVAILABLE_IN_ALL
+guint               soup_session_get_adaptive_max_conns_per_host (SoupSession *session);
+
+SOUP_AVAILABLE_IN_ALL
+guint               soup_session_get_warm_conns_per_host  (SoupSession     *session);
+
+SOUP_AVAILABLE_IN_ALL
+guint               soup_session_get_max_warm_conns       (SoupSession     *session);
+
+SOUP_AVAILABLE_IN_ALL
+void                soup_session_set_max_conns_for_host   (SoupSession     *session,
+							   GUri            *uri,
+							   guint            max_conns);
+
+SOUP_AVAILABLE_IN_ALL
+guint               soup_session_get_max_conns_for_host   (SoupSession     *session,
+							   GUri            *uri);
+
+SOUP_AVAILABLE_IN_ALL
+gboolean            soup_session_get_thread_safe          (SoupSession     *session);
+
+SOUP_AVAILABLE_IN_ALL
+guint               soup_session_get_io_threads           (SoupSession     *session);
+
 SOUP_AVAILABLE_IN_ALL
 void                soup_session_set_proxy_resolver       (SoupSession     *session,
 							   GProxyResolver  *proxy_resolver);
@@ -98,6 +123,13 @@ void                soup_session_set_idle_timeout         (SoupSession     *sess
 SOUP_AVAILABLE_IN_ALL
 guint               soup_session_get_idle_timeout         (SoupSession     *session);
 
+SOUP_AVAILABLE_IN_ALL
+void                soup_session_set_socket_options       (SoupSession       *session,
+							   SoupSocketOptions *options);
+
+SOUP_AVAILABLE_IN_ALL
+SoupSocketOptions  *soup_session_get_socket_options       (SoupSession     *session);
+
 SOUP_AVAILABLE_IN_ALL
 void                soup_session_set_user_agent           (SoupSession     *session,
 							   const char      *user_agent);
@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "soup-socket-options.h"
+
+G_BEGIN_DECLS
+
+struct _SoupSocketOptions {
+        gboolean tcp_nodelay;
+
+        guint send_buffer_size;
+        guint receive_buffer_size;
+
+        gboolean keepalive;
+        guint keepalive_idle;
+        guint keepalive_interval;
+        guint keepalive_count;
+
+        gboolean tcp_fastopen;
+        guint busy_poll;
+        int tos;
+};
+
+/* @options may be %NULL in all of these, for the defaults */
+void soup_socket_options_apply_client   (SoupSocketOptions *options,
+                                         GSocket           *socket);
+void soup_socket_options_apply_server   (SoupSocketOptions *options,
+                                         GSocket           *socket);
+void soup_socket_options_apply_listener (SoupSocketOptions *options,
+                                         GSocket           *socket);
+
+G_END_DECLS
@@ -0,0 +1,432 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-socket-options.c: socket tuning for sessions and servers
+ *
+ * Copyright 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gio/gnetworking.h>
+
+#include "soup-socket-options-private.h"
+
+/**
+ * SECTION:soup-socket-options
+ * @short_description: Low level socket tuning
+ * @see_also: #SoupSession, #SoupServer
+ *
+ * #SoupSocketOptions holds the settings that #SoupSession and
+ * #SoupServer apply to their TCP sockets, through their
+ * #SoupSession:socket-options and #SoupServer:socket-options
+ * properties.
+ *
+ * All the options are hints: the ones that the platform doesn't
+ * support, or that the kernel refuses, are silently ignored. The
+ * send and receive buffer sizes that were actually set on a client
+ * connection are reported in its #SoupMessageMetrics.
+ */
+
+/**
+ * SoupSocketOptions:
+ *
+ * An opaque set of socket options. By default only
+ * <literal>TCP_NODELAY</literal> is enabled, everything else is
+ * left to the system.
+ */
+
+G_DEFINE_BOXED_TYPE (SoupSocketOptions, soup_socket_options, soup_socket_options_copy, soup_socket_options_free)
+
+/**
+ * soup_socket_options_new:
+ *
+ * Creates a new #SoupSocketOptions with the default settings.
+ *
+ * Returns: (transfer full): a new #SoupSocketOptions
+ */
+SoupSocketOptions *
+soup_socket_options_new (void)
+{
+        SoupSocketOptions *options;
+
+        options = g_slice_new0 (SoupSocketOptions);
+        options->tcp_nodelay = TRUE;
+        options->tos = -1;
+
+        return options;
+}
+
+/**
+ * soup_socket_options_copy:
+ * @options: a #SoupSocketOptions
+ *
+ * Copies @options.
+ *
+ * Returns: (transfer full): a copy of @options
+ */
+SoupSocketOptions *
+soup_socket_options_copy (SoupSocketOptions *options)
+{
+        SoupSocketOptions *copy;
+
+        g_return_val_if_fail (options != NULL, NULL);
+
+        copy = g_slice_new (SoupSocketOptions);
+        *copy = *options;
+
+        return copy;
+}
+
+/**
+ * soup_socket_options_free:
+ * @options: a #SoupSocketOptions
+ *
+ * Frees @options.
+ */
+void
+soup_socket_options_free (SoupSocketOptions *options)
+{
+        g_return_if_fail (options != NULL);
+
+        g_slice_free (SoupSocketOptions, options);
+}
+
+/**
+ * soup_socket_options_set_tcp_nodelay:
+ * @options: a #SoupSocketOptions
+ * @nodelay: whether to disable Nagle's algorithm
+ *
+ * Sets whether small writes are sent right away
+ * (<literal>TCP_NODELAY</literal>). This is %TRUE by default.
+ */
+void
+soup_socket_options_set_tcp_nodelay (SoupSocketOptions *options,
+                                     gboolean           nodelay)
+{
+        g_return_if_fail (options != NULL);
+
+        options->tcp_nodelay = nodelay;
+}
+
+/**
+ * soup_socket_options_get_tcp_nodelay:
+ * @options: a #SoupSocketOptions
+ *
+ * Gets whether <literal>TCP_NODELAY</literal> is set.
+ *
+ * Returns: whether Nagle's algorithm is disabled
+ */
+gboolean
+soup_socket_options_get_tcp_nodelay (SoupSocketOptions *options)
+{
+        g_return_val_if_fail (options != NULL, TRUE);
+
+        return options->tcp_nodelay;
+}
+
+/**
+ * soup_socket_options_set_buffer_sizes:
+ * @options: a #SoupSocketOptions
+ * @send_size: the send buffer size, or 0 for the system default
+ * @receive_size: the receive buffer size, or 0 for the system default
+ *
+ * Sets the kernel socket buffer sizes (<literal>SO_SNDBUF</literal>
+ * and <literal>SO_RCVBUF</literal>), in bytes. Note that setting them
+ * disables the automatic tuning of the kernel on some systems.
+ */
+void
+soup_socket_options_set_buffer_sizes (SoupSocketOptions *options,
+                                      guint              send_size,
+                                      guint              receive_size)
+{
+        g_return_if_fail (options != NULL);
+
+        options->send_buffer_size = send_size;
+        options->receive_buffer_size = receive_size;
+}
+
+/**
+ * soup_socket_options_get_buffer_sizes:
+ * @options: a #SoupSocketOptions
+ * @send_size: (out) (optional): return location for the send buffer size
+ * @receive_size: (out) (optional): return location for the receive buffer size
+ *
+ * Gets the buffer sizes set with soup_socket_options_set_buffer_sizes().
+ */
+void
+soup_socket_options_get_buffer_sizes (SoupSocketOptions *options,
+                                      guint             *send_size,
+                                      guint             *receive_size)
+{
+        g_return_if_fail (options != NULL);
+
+        if (send_size)
+                *send_size = options->send_buffer_size;
+        if (receive_size)
+                *receive_size = options->receive_buffer_size;
+}
+
+/**
+ * soup_socket_options_set_keepalive:
+ * @options: a #SoupSocketOptions
+ * @enabled: whether to enable TCP keepalive
+ * @idle: seconds of inactivity before the first probe, or 0
+ * @interval: seconds between probes, or 0
+ * @count: number of unanswered probes before giving up, or 0
+ *
+ * Sets whether TCP keepalive probes are sent on idle connections,
+ * and how. A 0 timing keeps the system default.
+ */
+void
+soup_socket_options_set_keepalive (SoupSocketOptions *options,
+                                   gboolean           enabled,
+                                   guint              idle,
+                                   guint              interval,
+                                   guint              count)
+{
+        g_return_if_fail (options != NULL);
+
+        options->keepalive = enabled;
+        options->keepalive_idle = idle;
+        options->keepalive_interval = interval;
+        options->keepalive_count = count;
+}
+
+/**
+ * soup_socket_options_get_keepalive:
+ * @options: a #SoupSocketOptions
+ * @idle: (out) (optional): return location for the idle time
+ * @interval: (out) (optional): return location for the probe interval
+ * @count: (out) (optional): return location for the probe count
+ *
+ * Gets the keepalive settings of @options.
+ *
+ * Returns: whether TCP keepalive is enabled
+ */
+gboolean
+soup_socket_options_get_keepalive (SoupSocketOptions *options,
+                                   guint             *idle,
+                                   guint             *interval,
+                                   guint             *count)
+{
+        g_return_val_if_fail (options != NULL, FALSE);
+
+        if (idle)
+                *idle = options->keepalive_idle;
+        if (interval)
+                *interval = options->keepalive_interval;
+        if (count)
+                *count = options->keepalive_count;
+
+        return options->keepalive;
+}
+
+/**
+ * soup_socket_options_set_tcp_fastopen:
+ * @options: a #SoupSocketOptions
+ * @fastopen: whether to use TCP Fast Open
+ *
+ * Sets whether TCP Fast Open is used. On a #SoupServer, listening
+ * sockets accept data in the SYN of the connections; on a
+ * #SoupSession, the first write is sent along with the SYN when
+ * the server is known to support it.
+ *
+ * Note that a client connection then completes with the first
+ * write, so connection errors are reported at that point, and the
+ * other addresses of the host are not tried.
+ */
+void
+soup_socket_options_set_tcp_fastopen (SoupSocketOptions *options,
+                                      gboolean           fastopen)
+{
+        g_return_if_fail (options != NULL);
+
+        options->tcp_fastopen = fastopen;
+}
+
+/**
+ * soup_socket_options_get_tcp_fastopen:
+ * @options: a #SoupSocketOptions
+ *
+ * Gets whether TCP Fast Open is used.
+ *
+ * Returns: whether TCP Fast Open is enabled
+ */
+gboolean
+soup_socket_options_get_tcp_fastopen (SoupSocketOptions *options)
+{
+        g_return_val_if_fail (options != NULL, FALSE);
+
+        return options->tcp_fastopen;
+}
+
+/**
+ * soup_socket_options_set_busy_poll:
+ * @options: a #SoupSocketOptions
+ * @usec: the busy poll time in microseconds, or 0 to disable it
+ *
+ * Sets for how long blocking reads busy poll the device queue
+ * (<literal>SO_BUSY_POLL</literal>), trading CPU for latency. This
+ * is only supported on Linux.
+ */
+void
+soup_socket_options_set_busy_poll (SoupSocketOptions *options,
+                                   guint              usec)
+{
+        g_return_if_fail (options != NULL);
+
+        options->busy_poll = usec;
+}
+
+/**
+ * soup_socket_options_get_busy_poll:
+ * @options: a #SoupSocketOptions
+ *
+ * Gets the busy poll time of @options.
+ *
+ * Returns: the busy poll time in microseconds
+ */
+guint
+soup_socket_options_get_busy_poll (SoupSocketOptions *options)
+{
+        g_return_val_if_fail (options != NULL, 0);
+
+        return options->busy_poll;
+}
+
+/**
+ * soup_socket_options_set_tos:
+ * @options: a #SoupSocketOptions
+ * @tos: the type of service byte, or -1 for the system default
+ *
+ * Sets the IP type of service byte (<literal>IP_TOS</literal>, or
+ * <literal>IPV6_TCLASS</literal> for IPv6) of the outgoing packets.
+ * The DSCP value goes in the upper six bits.
+ */
+void
+soup_socket_options_set_tos (SoupSocketOptions *options,
+                             int                tos)
+{
+        g_return_if_fail (options != NULL);
+        g_return_if_fail (tos >= -1 && tos <= 255);
+
+        options->tos = tos;
+}
+
+/**
+ * soup_socket_options_get_tos:
+ * @options: a #SoupSocketOptions
+ *
+ * Gets the IP type of service byte of @options.
+ *
+ * Returns: the type of service byte, or -1 if unset
+ */
+int
+soup_socket_options_get_tos (SoupSocketOptions *options)
+{
+        g_return_val_if_fail (options != NULL, -1);
+
+        return options->tos;
+}
+
+static void
+set_option (GSocket    *socket,
+            int         level,
+            int         optname,
+            int         value,
+            const char *name)
+{
+        GError *error = NULL;
+
+        if (!g_socket_set_option (socket, level, optname, value, &error)) {
+                g_debug ("Failed to set %s on socket: %s", name, error->message);
+                g_error_free (error);
+        }
+}
+
+static void
+apply_common (SoupSocketOptions *options,
+              GSocket           *socket)
+{
+        if (!options) {
+                set_option (socket, IPPROTO_TCP, TCP_NODELAY, TRUE, "TCP_NODELAY");
+                return;
+        }
+
+        set_option (socket, IPPROTO_TCP, TCP_NODELAY, options->tcp_nodelay, "TCP_NODELAY");
+
+        if (options->send_buffer_size)
+                set_option (socket, SOL_SOCKET, SO_SNDBUF, options->send_buffer_size, "SO_SNDBUF");
+        if (options->receive_buffer_size)
+                set_option (socket, SOL_SOCKET, SO_RCVBUF, options->receive_buffer_size, "SO_RCVBUF");
+
+        if (options->keepalive) {
+                g_socket_set_keepalive (socket, TRUE);
+#ifdef TCP_KEEPIDLE
+                if (options->keepalive_idle)
+                        set_option (socket, IPPROTO_TCP, TCP_KEEPIDLE, options->keepalive_idle, "TCP_KEEPIDLE");
+#endif
+#ifdef TCP_KEEPINTVL
+                if (options->keepalive_interval)
+                        set_option (socket, IPPROTO_TCP, TCP_KEEPINTVL, options->keepalive_interval, "TCP_KEEPINTVL");
+#endif
+#ifdef TCP_KEEPCNT
+                if (options->keepalive_count)
+                        set_option (socket, IPPROTO_TCP, TCP_KEEPCNT, options->keepalive_count, "TCP_KEEPCNT");
+#endif
+        }
+
+#ifdef SO_BUSY_POLL
+        if (options->busy_poll)
+                set_option (socket, SOL_SOCKET, SO_BUSY_POLL, options->busy_poll, "SO_BUSY_POLL");
+#endif
+
+        if (options->tos >= 0) {
+                if (g_socket_get_family (socket) == G_SOCKET_FAMILY_IPV6) {
+#ifdef IPV6_TCLASS
+                        set_option (socket, IPPROTO_IPV6, IPV6_TCLASS, options->tos, "IPV6_TCLASS");
+#endif
+                } else
+                        set_option (socket, IPPROTO_IP, IP_TOS, options->tos, "IP_TOS");
+        }
+}
+
+/* Called on the socket of a client connection before it connects */
+void
+soup_socket_options_apply_client (SoupSocketOptions *options,
+                                  GSocket           *socket)
+{
+        apply_common (options, socket);
+
+#ifdef TCP_FASTOPEN_CONNECT
+        if (options && options->tcp_fastopen)
+                set_option (socket, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, TRUE, "TCP_FASTOPEN_CONNECT");
+#endif
+}
+
+/* Called on both listening and accepted server sockets. Setting the
+ * buffer sizes on the listening socket, before listen(), is what lets
+ * the window scaling of the accepted ones take them into account.
+ */
+void
+soup_socket_options_apply_server (SoupSocketOptions *options,
+                                  GSocket           *socket)
+{
+        apply_common (options, socket);
+}
+
+/* The listener-only options, in addition to the server ones */
+void
+soup_socket_options_apply_listener (SoupSocketOptions *options,
+                                    GSocket           *socket)
+{
+#ifdef TCP_FASTOPEN
+        /* The value is the length of the queue of pending Fast Open
+         * requests.
+         */
+        if (options && options->tcp_fastopen)
+                set_option (socket, IPPROTO_TCP, TCP_FASTOPEN, SOMAXCONN, "TCP_FASTOPEN");
+#endif
+}
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+typedef struct _SoupSocketOptions SoupSocketOptions;
+
+SOUP_AVAILABLE_IN_ALL
+GType soup_socket_options_get_type (void);
+#define SOUP_TYPE_SOCKET_OPTIONS (soup_socket_options_get_type())
+
+SOUP_AVAILABLE_IN_ALL
+SoupSocketOptions *soup_socket_options_new                     (void);
+
+SOUP_AVAILABLE_IN_ALL
+SoupSocketOptions *soup_socket_options_copy                    (SoupSocketOptions *options);
+
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_free                    (SoupSocketOptions *options);
+
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_set_tcp_nodelay         (SoupSocketOptions *options,
+                                                                gboolean           nodelay);
+SOUP_AVAILABLE_IN_ALL
+gboolean           soup_socket_options_get_tcp_nodelay         (SoupSocketOptions *options);
+
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_set_buffer_sizes        (SoupSocketOptions *options,
+                                                                guint              send_size,
+                                                                guint              receive_size);
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_get_buffer_sizes        (SoupSocketOptions *options,
+                                                                guint             *send_size,
+                                                                guint             *receive_size);
+
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_set_keepalive           (SoupSocketOptions *options,
+                                                                gboolean           enabled,
+                                                                guint              idle,
+                                                                guint              interval,
+                                                                guint              count);
+SOUP_AVAILABLE_IN_ALL
+gboolean           soup_socket_options_get_keepalive           (SoupSocketOptions *options,
+                                                                guint             *idle,
+                                                                guint             *interval,
+                                                                guint             *count);
+
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_set_tcp_fastopen        (SoupSocketOptions *options,
+                                                                gboolean           fastopen);
+SOUP_AVAILABLE_IN_ALL
+gboolean           soup_socket_options_get_tcp_fastopen        (SoupSocketOptions *options);
+
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_set_busy_poll           (SoupSocketOptions *options,
+                                                                guint              usec);
+SOUP_AVAILABLE_IN_ALL
+guint              soup_socket_options_get_busy_poll           (SoupSocketOptions *options);
+
+SOUP_AVAILABLE_IN_ALL
+void               soup_socket_options_set_tos                 (SoupSocketOptions *options,
+                                                                int                tos);
+SOUP_AVAILABLE_IN_ALL
+int                soup_socket_options_get_tos                 (SoupSocketOptions *options);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SoupSocketOptions, soup_socket_options_free)
+
+G_END_DECLS
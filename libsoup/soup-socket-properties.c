@@ -47,6 +47,8 @@ soup_socket_properties_destroy (SoupSocketProperties *props)
         g_clear_object (&props->local_addr);
 	g_clear_object (&props->tlsdb);
 	g_clear_object (&props->tls_interaction);
+	g_clear_pointer (&props->socket_options, soup_socket_options_free);
+	g_clear_pointer (&props->tls_session_cache, soup_tls_session_cache_unref);
 }
 
 void
@@ -81,4 +83,23 @@ soup_socket_properties_set_tls_database (SoupSocketProperties *props,
 	props->tlsdb = tlsdb ? g_object_ref (tlsdb) : NULL;
 }
 
+void
+soup_socket_properties_set_socket_options (SoupSocketProperties *props,
+					   SoupSocketOptions    *options)
+{
+	g_clear_pointer (&props->socket_options, soup_socket_options_free);
+	props->socket_options = options ? soup_socket_options_copy (options) : NULL;
+}
+
+void
+soup_socket_properties_set_tls_session_cache (SoupSocketProperties *props,
+					      SoupTlsSessionCache  *cache)
+{
+	if (props->tls_session_cache == cache)
+		return;
+
+	g_clear_pointer (&props->tls_session_cache, soup_tls_session_cache_unref);
+	props->tls_session_cache = cache ? soup_tls_session_cache_ref (cache) : NULL;
+}
+
 G_DEFINE_BOXED_TYPE (SoupSocketProperties, soup_socket_properties, soup_socket_properties_ref, soup_socket_properties_unref)
@@ -7,6 +7,8 @@
 #define __SOUP_SOCKET_PROPERTIES_H__ 1
 
 #include <gio/gio.h>
+#include "soup-socket-options.h"
+#include "soup-tls-session-cache.h"
 
 typedef struct {
 	GProxyResolver *proxy_resolver;
@@ -19,6 +21,9 @@ typedef struct {
 
 	guint io_timeout;
 	guint idle_timeout;
+
+	SoupSocketOptions *socket_options;
+	SoupTlsSessionCache *tls_session_cache;
 } SoupSocketProperties;
 
 GType soup_socket_properties_get_type (void);
@@ -36,5 +41,9 @@ void                  soup_socket_properties_set_proxy_resolver (SoupSocketPrope
 								 GProxyResolver       *proxy_resolver);
 void                  soup_socket_properties_set_tls_database   (SoupSocketProperties *props,
 								 GTlsDatabase         *tlsdb);
+void                  soup_socket_properties_set_socket_options (SoupSocketProperties *props,
+								 SoupSocketOptions    *options);
+void                  soup_socket_properties_set_tls_session_cache (SoupSocketProperties *props,
+								    SoupTlsSessionCache  *cache);
 
 #endif /* __SOUP_SOCKET_PROPERTIES_H__ */
@@ -30,6 +30,156 @@
 static const char *soup_tld_get_base_domain_internal (const char *hostname,
 						      GError    **error);
 
+/* The results of the lookups are kept in a bounded cache, split in
+ * shards with their own lock and LRU list so that threads looking up
+ * different hosts rarely contend.
+ */
+#define TLD_CACHE_N_SHARDS   16
+#define TLD_CACHE_SHARD_SIZE 128
+
+typedef enum {
+	PUBLIC_SUFFIX_UNKNOWN,
+	PUBLIC_SUFFIX_NO,
+	PUBLIC_SUFFIX_YES
+} PublicSuffixResult;
+
+typedef enum {
+	TLD_CACHE_BASE_DOMAIN,
+	TLD_CACHE_PUBLIC_SUFFIX
+} TLDCacheField;
+
+typedef struct {
+	GList link;
+	char *hostname;
+
+	gboolean base_domain_known;
+	/* Offset of the base domain in the hostname, or -1 and the error */
+	int base_domain_offset;
+	SoupTLDError base_domain_error;
+
+	PublicSuffixResult public_suffix;
+} TLDCacheEntry;
+
+typedef struct {
+	GMutex mutex;
+	GHashTable *entries;
+	GQueue lru;
+	guint64 hits;
+	guint64 misses;
+} TLDCacheShard;
+
+static TLDCacheShard tld_cache[TLD_CACHE_N_SHARDS];
+
+static void
+tld_cache_entry_free (TLDCacheEntry *entry)
+{
+	g_free (entry->hostname);
+	g_free (entry);
+}
+
+static TLDCacheShard *
+tld_cache_get_shard (const char *hostname)
+{
+	return &tld_cache[g_str_hash (hostname) % TLD_CACHE_N_SHARDS];
+}
+
+/* Copies the cached entry for @hostname to @result if @field is known */
+static gboolean
+tld_cache_lookup (TLDCacheShard *shard,
+		  const char    *hostname,
+		  TLDCacheField  field,
+		  TLDCacheEntry *result)
+{
+	TLDCacheEntry *entry = NULL;
+	gboolean hit = FALSE;
+
+	g_mutex_lock (&shard->mutex);
+	if (shard->entries)
+		entry = g_hash_table_lookup (shard->entries, hostname);
+	if (entry) {
+		g_queue_unlink (&shard->lru, &entry->link);
+		g_queue_push_head_link (&shard->lru, &entry->link);
+
+		if (field == TLD_CACHE_BASE_DOMAIN)
+			hit = entry->base_domain_known;
+		else
+			hit = entry->public_suffix != PUBLIC_SUFFIX_UNKNOWN;
+		*result = *entry;
+	}
+	if (hit)
+		shard->hits++;
+	else
+		shard->misses++;
+	g_mutex_unlock (&shard->mutex);
+
+	return hit;
+}
+
+/* Merges the known fields of @result into the entry for @hostname */
+static void
+tld_cache_store (TLDCacheShard       *shard,
+		 const char          *hostname,
+		 const TLDCacheEntry *result)
+{
+	TLDCacheEntry *entry;
+
+	g_mutex_lock (&shard->mutex);
+	if (!shard->entries)
+		shard->entries = g_hash_table_new (g_str_hash, g_str_equal);
+
+	entry = g_hash_table_lookup (shard->entries, hostname);
+	if (!entry) {
+		if (shard->lru.length >= TLD_CACHE_SHARD_SIZE) {
+			TLDCacheEntry *oldest = g_queue_pop_tail_link (&shard->lru)->data;
+
+			g_hash_table_remove (shard->entries, oldest->hostname);
+			tld_cache_entry_free (oldest);
+		}
+
+		entry = g_new0 (TLDCacheEntry, 1);
+		entry->hostname = g_strdup (hostname);
+		entry->link.data = entry;
+		g_hash_table_insert (shard->entries, entry->hostname, entry);
+		g_queue_push_head_link (&shard->lru, &entry->link);
+	}
+
+	if (result->base_domain_known) {
+		entry->base_domain_known = TRUE;
+		entry->base_domain_offset = result->base_domain_offset;
+		entry->base_domain_error = result->base_domain_error;
+	}
+	if (result->public_suffix != PUBLIC_SUFFIX_UNKNOWN)
+		entry->public_suffix = result->public_suffix;
+	g_mutex_unlock (&shard->mutex);
+}
+
+static void
+set_tld_error (GError       **error,
+	       SoupTLDError   code)
+{
+	const char *message = NULL;
+
+	switch (code) {
+	case SOUP_TLD_ERROR_INVALID_HOSTNAME:
+		message = _("Invalid hostname");
+		break;
+	case SOUP_TLD_ERROR_IS_IP_ADDRESS:
+		message = _("Hostname is an IP address");
+		break;
+	case SOUP_TLD_ERROR_NOT_ENOUGH_DOMAINS:
+		message = _("Not enough domains");
+		break;
+	case SOUP_TLD_ERROR_NO_BASE_DOMAIN:
+		message = _("Hostname has no base domain");
+		break;
+	case SOUP_TLD_ERROR_NO_PSL_DATA:
+		message = _("No public-suffix list available.");
+		break;
+	}
+
+	g_set_error_literal (error, SOUP_TLD_ERROR, code, message);
+}
+
 /**
  * soup_tld_get_base_domain:
  * @hostname: a hostname
@@ -57,18 +207,49 @@ static const char *soup_tld_get_base_domain_internal (const char *hostname,
 const char *
 soup_tld_get_base_domain (const char *hostname, GError **error)
 {
+	TLDCacheShard *shard;
+	TLDCacheEntry result;
+	GError *internal_error = NULL;
+	const char *base_domain;
+
 	g_return_val_if_fail (hostname, NULL);
 
-	return soup_tld_get_base_domain_internal (hostname, error);
+	shard = tld_cache_get_shard (hostname);
+	if (tld_cache_lookup (shard, hostname, TLD_CACHE_BASE_DOMAIN, &result)) {
+		if (result.base_domain_offset < 0) {
+			set_tld_error (error, result.base_domain_error);
+			return NULL;
+		}
+		return hostname + result.base_domain_offset;
+	}
+
+	base_domain = soup_tld_get_base_domain_internal (hostname, &internal_error);
+
+	/* Not having the list at all is not a property of @hostname */
+	if (!g_error_matches (internal_error, SOUP_TLD_ERROR, SOUP_TLD_ERROR_NO_PSL_DATA)) {
+		memset (&result, 0, sizeof (result));
+		result.base_domain_known = TRUE;
+		result.base_domain_offset = base_domain ? base_domain - hostname : -1;
+		result.base_domain_error = internal_error ? internal_error->code : 0;
+		tld_cache_store (shard, hostname, &result);
+	}
+
+	if (internal_error)
+		g_propagate_error (error, internal_error);
+
+	return base_domain;
 }
 
 static psl_ctx_t *
 soup_psl_context (void)
 {
+	static gsize psl_initialized = 0;
 	static psl_ctx_t *psl = NULL;
 
-	if (!psl)
+	if (g_once_init_enter (&psl_initialized)) {
 		psl = psl_latest (NULL);
+		g_once_init_leave (&psl_initialized, 1);
+	}
 
 	return psl;
 }
@@ -91,6 +272,8 @@ gboolean
 soup_tld_domain_is_public_suffix (const char *domain)
 {
 	const psl_ctx_t* psl = soup_psl_context ();
+	TLDCacheShard *shard;
+	TLDCacheEntry result;
 
 	g_return_val_if_fail (domain, FALSE);
 
@@ -99,7 +282,49 @@ soup_tld_domain_is_public_suffix (const char *domain)
 		return FALSE;
 	}
 
-	return psl_is_public_suffix2 (psl, domain, PSL_TYPE_ANY | PSL_TYPE_NO_STAR_RULE);
+	shard = tld_cache_get_shard (domain);
+	if (tld_cache_lookup (shard, domain, TLD_CACHE_PUBLIC_SUFFIX, &result))
+		return result.public_suffix == PUBLIC_SUFFIX_YES;
+
+	memset (&result, 0, sizeof (result));
+	result.public_suffix = psl_is_public_suffix2 (psl, domain, PSL_TYPE_ANY | PSL_TYPE_NO_STAR_RULE) ?
+		PUBLIC_SUFFIX_YES : PUBLIC_SUFFIX_NO;
+	tld_cache_store (shard, domain, &result);
+
+	return result.public_suffix == PUBLIC_SUFFIX_YES;
+}
+
+/**
+ * soup_tld_get_cache_stats:
+ * @hits: (out) (optional): return location for the number of lookups
+ *   answered from the cache
+ * @misses: (out) (optional): return location for the number of lookups
+ *   that had to consult the public suffix list
+ *
+ * The results of soup_tld_get_base_domain() and
+ * soup_tld_domain_is_public_suffix() are cached, process-wide, for a
+ * bounded number of recently used hostnames. This returns how
+ * effective that cache has been so far.
+ *
+ **/
+void
+soup_tld_get_cache_stats (guint64 *hits,
+			  guint64 *misses)
+{
+	guint64 total_hits = 0, total_misses = 0;
+	guint i;
+
+	for (i = 0; i < TLD_CACHE_N_SHARDS; i++) {
+		g_mutex_lock (&tld_cache[i].mutex);
+		total_hits += tld_cache[i].hits;
+		total_misses += tld_cache[i].misses;
+		g_mutex_unlock (&tld_cache[i].mutex);
+	}
+
+	if (hits)
+		*hits = total_hits;
+	if (misses)
+		*misses = total_misses;
 }
 
 /**
@@ -137,9 +362,7 @@ soup_tld_get_base_domain_internal (const char *hostname, GError **error)
 	const char *registrable_domain, *unregistrable_domain;
 
 	if (!psl) {
-		g_set_error_literal (error, SOUP_TLD_ERROR,
-				     SOUP_TLD_ERROR_NO_PSL_DATA,
-				     _("No public-suffix list available."));
+		set_tld_error (error, SOUP_TLD_ERROR_NO_PSL_DATA);
 		return NULL;
 	}
 
@@ -147,25 +370,19 @@ soup_tld_get_base_domain_internal (const char *hostname, GError **error)
 	 * dot together.
 	 */
 	if (*hostname == '.') {
-		g_set_error_literal (error, SOUP_TLD_ERROR,
-				     SOUP_TLD_ERROR_INVALID_HOSTNAME,
-				     _("Invalid hostname"));
+		set_tld_error (error, SOUP_TLD_ERROR_INVALID_HOSTNAME);
 		return NULL;
 	}
 
 	if (g_hostname_is_ip_address (hostname)) {
-		g_set_error_literal (error, SOUP_TLD_ERROR,
-				     SOUP_TLD_ERROR_IS_IP_ADDRESS,
-				     _("Hostname is an IP address"));
+		set_tld_error (error, SOUP_TLD_ERROR_IS_IP_ADDRESS);
 		return NULL;
 	}
 
 	if (g_hostname_is_ascii_encoded (hostname)) {
 		utf8_hostname = g_hostname_to_unicode (hostname);
 		if (!utf8_hostname) {
-			g_set_error_literal (error, SOUP_TLD_ERROR,
-					     SOUP_TLD_ERROR_INVALID_HOSTNAME,
-					     _("Invalid hostname"));
+			set_tld_error (error, SOUP_TLD_ERROR_INVALID_HOSTNAME);
 			return NULL;
 		}
 		g_free (utf8_hostname);
@@ -175,17 +392,13 @@ soup_tld_get_base_domain_internal (const char *hostname, GError **error)
 	 * it's a public domain. */
 	unregistrable_domain = psl_unregistrable_domain (psl, hostname);
 	if (!psl_is_public_suffix2 (psl, unregistrable_domain, PSL_TYPE_ANY | PSL_TYPE_NO_STAR_RULE)) {
-		g_set_error_literal (error, SOUP_TLD_ERROR,
-				     SOUP_TLD_ERROR_NO_BASE_DOMAIN,
-				     _("Hostname has no base domain"));
+		set_tld_error (error, SOUP_TLD_ERROR_NO_BASE_DOMAIN);
 		return NULL;
 	}
 
 	registrable_domain = psl_registrable_domain (psl, hostname);
 	if (!registrable_domain) {
-		g_set_error_literal (error, SOUP_TLD_ERROR,
-				     SOUP_TLD_ERROR_NOT_ENOUGH_DOMAINS,
-				     _("Not enough domains"));
+		set_tld_error (error, SOUP_TLD_ERROR_NOT_ENOUGH_DOMAINS);
 		return NULL;
 	}
 
@@ -16,6 +16,10 @@ const char *soup_tld_get_base_domain         (const char *hostname,
 SOUP_AVAILABLE_IN_ALL
 gboolean    soup_tld_domain_is_public_suffix (const char *domain);
 
+SOUP_AVAILABLE_IN_ALL
+void        soup_tld_get_cache_stats         (guint64    *hits,
+					      guint64    *misses);
+
 /* Errors */
 SOUP_AVAILABLE_IN_ALL
 GQuark soup_tld_error_quark (void);
@@ -0,0 +1,153 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-tls-session-cache.c: TLS session resumption data per origin
+ *
+ * Copyright 2021 Igalia S.L.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-tls-session-cache.h"
+
+/* GIO has no type for TLS session state: the only way to resume a
+ * session is g_tls_client_connection_copy_session_state() from a
+ * connection that completed a handshake. So for every origin we keep
+ * the last such connection around (closed or not, its session data
+ * stays) and copy its state into the new connections to the same
+ * origin, leaving the tickets or session IDs to the backend. Origins
+ * are evicted in LRU order.
+ */
+
+struct _SoupTlsSessionCache {
+	GMutex mutex;
+	GHashTable *entries; /* origin -> TlsSessionEntry */
+	GQueue lru;          /* most recently used first */
+	guint max_origins;
+};
+
+typedef struct {
+	char *origin;
+	GTlsClientConnection *conn;
+	GList link;
+} TlsSessionEntry;
+
+static void
+tls_session_entry_free (TlsSessionEntry *entry)
+{
+	g_free (entry->origin);
+	g_object_unref (entry->conn);
+	g_free (entry);
+}
+
+SoupTlsSessionCache *
+soup_tls_session_cache_new (guint max_origins)
+{
+	SoupTlsSessionCache *cache;
+
+	cache = g_atomic_rc_box_new0 (SoupTlsSessionCache);
+	g_mutex_init (&cache->mutex);
+	cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+	g_queue_init (&cache->lru);
+	cache->max_origins = max_origins;
+
+	return cache;
+}
+
+SoupTlsSessionCache *
+soup_tls_session_cache_ref (SoupTlsSessionCache *cache)
+{
+	return g_atomic_rc_box_acquire (cache);
+}
+
+static void
+soup_tls_session_cache_destroy (SoupTlsSessionCache *cache)
+{
+	soup_tls_session_cache_clear (cache);
+	g_hash_table_destroy (cache->entries);
+	g_mutex_clear (&cache->mutex);
+}
+
+void
+soup_tls_session_cache_unref (SoupTlsSessionCache *cache)
+{
+	g_atomic_rc_box_release_full (cache, (GDestroyNotify)soup_tls_session_cache_destroy);
+}
+
+/* Returns whether there was session data to offer to @conn; whether
+ * the server accepts it is only known after the handshake.
+ */
+gboolean
+soup_tls_session_cache_resume (SoupTlsSessionCache  *cache,
+			       const char           *origin,
+			       GTlsClientConnection *conn)
+{
+	TlsSessionEntry *entry;
+	GTlsClientConnection *source = NULL;
+
+	g_mutex_lock (&cache->mutex);
+	entry = g_hash_table_lookup (cache->entries, origin);
+	if (entry) {
+		g_queue_unlink (&cache->lru, &entry->link);
+		g_queue_push_head_link (&cache->lru, &entry->link);
+		source = g_object_ref (entry->conn);
+	}
+	g_mutex_unlock (&cache->mutex);
+
+	if (!source)
+		return FALSE;
+
+	g_tls_client_connection_copy_session_state (conn, source);
+	g_object_unref (source);
+
+	return TRUE;
+}
+
+void
+soup_tls_session_cache_store (SoupTlsSessionCache  *cache,
+			      const char           *origin,
+			      GTlsClientConnection *conn)
+{
+	TlsSessionEntry *entry;
+
+	g_mutex_lock (&cache->mutex);
+	entry = g_hash_table_lookup (cache->entries, origin);
+	if (entry) {
+		g_queue_unlink (&cache->lru, &entry->link);
+		g_set_object (&entry->conn, conn);
+	} else {
+		if (g_hash_table_size (cache->entries) >= cache->max_origins) {
+			TlsSessionEntry *oldest = g_queue_peek_tail (&cache->lru);
+
+			g_queue_unlink (&cache->lru, &oldest->link);
+			g_hash_table_remove (cache->entries, oldest->origin);
+			tls_session_entry_free (oldest);
+		}
+
+		entry = g_new0 (TlsSessionEntry, 1);
+		entry->origin = g_strdup (origin);
+		entry->conn = g_object_ref (conn);
+		entry->link.data = entry;
+		g_hash_table_insert (cache->entries, entry->origin, entry);
+	}
+	g_queue_push_head_link (&cache->lru, &entry->link);
+	g_mutex_unlock (&cache->mutex);
+}
+
+/* Forgets all the sessions, e.g. when the trust settings change,
+ * since a resumed session skips certificate verification.
+ */
+void
+soup_tls_session_cache_clear (SoupTlsSessionCache *cache)
+{
+	TlsSessionEntry *entry;
+
+	g_mutex_lock (&cache->mutex);
+	while ((entry = g_queue_peek_head (&cache->lru))) {
+		g_queue_unlink (&cache->lru, &entry->link);
+		tls_session_entry_free (entry);
+	}
+	g_hash_table_remove_all (cache->entries);
+	g_mutex_unlock (&cache->mutex);
+}
@@ -0,0 +1,26 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _SoupTlsSessionCache SoupTlsSessionCache;
+
+SoupTlsSessionCache *soup_tls_session_cache_new    (guint                 max_origins);
+SoupTlsSessionCache *soup_tls_session_cache_ref    (SoupTlsSessionCache  *cache);
+void                 soup_tls_session_cache_unref  (SoupTlsSessionCache  *cache);
+
+gboolean             soup_tls_session_cache_resume (SoupTlsSessionCache  *cache,
+                                                    const char           *origin,
+                                                    GTlsClientConnection *conn);
+void                 soup_tls_session_cache_store  (SoupTlsSessionCache  *cache,
+                                                    const char           *origin,
+                                                    GTlsClientConnection *conn);
+void                 soup_tls_session_cache_clear  (SoupTlsSessionCache  *cache);
+
+G_END_DECLS
@@ -28,6 +28,7 @@
 #include "soup-message.h"
 #include "soup-message-metrics.h"
 #include "soup-method.h"
+#include "soup-metrics-registry.h"
 #include "soup-multipart.h"
 #include "soup-multipart-input-stream.h"
 #include "server/soup-auth-domain.h"
@@ -37,6 +38,7 @@
 #include "server/soup-server-message.h"
 #include "soup-session.h"
 #include "soup-session-feature.h"
+#include "soup-socket-options.h"
 #include "soup-status.h"
 #include "soup-tld.h"
 #include "soup-uri-utils.h"
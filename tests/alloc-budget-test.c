@@ -0,0 +1,124 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#include "test-utils.h"
+#include "alloc-tracker.h"
+
+/* Budgets are allocations per message made in the client thread, from the
+ * moment the message is queued until it is unqueued. They are deliberately
+ * generous: the point is to catch regressions that add allocations per
+ * header or per read, not to pin the exact number.
+ */
+#define KEEPALIVE_GET_BUDGET 600
+#define POST_BUDGET          800
+
+#define N_REQUESTS 50
+
+static GUri *base_uri;
+
+static void
+server_callback (SoupServer        *server,
+                 SoupServerMessage *msg,
+                 const char        *path,
+                 GHashTable        *query,
+                 gpointer           data)
+{
+        soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+        soup_server_message_set_response (msg, "text/plain",
+                                          SOUP_MEMORY_STATIC,
+                                          "Hello world\r\n", 13);
+}
+
+static void
+send_message (SoupSession *session,
+              const char  *method)
+{
+        SoupMessage *msg;
+        GBytes *body;
+
+        msg = soup_message_new_from_uri (method, base_uri);
+        if (g_str_equal (method, SOUP_METHOD_POST)) {
+                GBytes *request_body;
+
+                request_body = g_bytes_new_static ("foo=bar&baz=qux", 15);
+                soup_message_set_request_body_from_bytes (msg, "application/x-www-form-urlencoded",
+                                                          request_body);
+                g_bytes_unref (request_body);
+        }
+        body = soup_test_session_async_send (session, msg, NULL, NULL);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_bytes_unref (body);
+        g_object_unref (msg);
+}
+
+static void
+do_budget_test (gconstpointer data)
+{
+        const char *method = data;
+        guint budget = g_str_equal (method, SOUP_METHOD_POST) ? POST_BUDGET : KEEPALIVE_GET_BUDGET;
+        SoupSession *session;
+        AllocTracker *tracker;
+        AllocCounters counters;
+        guint i;
+
+        if (!alloc_tracker_is_available ()) {
+                g_test_skip ("Allocation tracking is not available");
+                return;
+        }
+
+        session = soup_test_session_new (NULL);
+
+        /* The first request opens the connection and fills the
+         * one-time caches, so it is not accounted.
+         */
+        send_message (session, method);
+
+        tracker = alloc_tracker_new (session);
+        for (i = 0; i < N_REQUESTS; i++)
+                send_message (session, method);
+
+        g_assert_cmpuint (alloc_tracker_get_n_messages (tracker), ==, N_REQUESTS);
+        if (debug_level) {
+                char *report = alloc_tracker_to_string (tracker);
+
+                debug_printf (1, "%s\n", report);
+                g_free (report);
+        }
+
+        /* Every phase of a keep-alive request allocates something */
+        alloc_tracker_get_phase_counters (tracker, ALLOC_PHASE_REQUEST, &counters);
+        g_assert_cmpuint (counters.allocs, >, 0);
+        alloc_tracker_get_phase_counters (tracker, ALLOC_PHASE_RESPONSE_BODY, &counters);
+        g_assert_cmpuint (counters.bytes, >, 0);
+
+        soup_test_assert_alloc_budget (tracker, budget);
+
+        alloc_tracker_free (tracker);
+        soup_test_session_abort_unref (session);
+}
+
+int
+main (int argc, char **argv)
+{
+        SoupServer *server;
+        int ret;
+
+        test_init (argc, argv, NULL);
+
+        server = soup_test_server_new (SOUP_TEST_SERVER_IN_THREAD);
+        soup_server_add_handler (server, NULL, server_callback, NULL, NULL);
+        base_uri = soup_test_server_get_uri (server, "http", NULL);
+
+        g_test_add_data_func ("/alloc-budget/keepalive-get", SOUP_METHOD_GET, do_budget_test);
+        g_test_add_data_func ("/alloc-budget/post", SOUP_METHOD_POST, do_budget_test);
+
+        ret = g_test_run ();
+
+        g_uri_unref (base_uri);
+        soup_test_server_quit_unref (server);
+
+        test_cleanup ();
+        return ret;
+}
@@ -0,0 +1,320 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#include "alloc-tracker.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* When built with -Dalloc_tracking=true the C allocator is interposed,
+ * which is where g_malloc(), g_slice_alloc() (with G_SLICE=always-malloc)
+ * and GObject instances end up. Counters are per thread, so that a
+ * server running in its own thread isn't accounted to the client.
+ */
+#if defined(SOUP_TEST_ALLOC_TRACKING) && defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define ALLOC_TRACKING_ENABLED 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void *__libc_memalign (size_t alignment, size_t size);
+extern void __libc_free (void *ptr);
+
+static __thread AllocCounters thread_counters __attribute__((tls_model ("initial-exec")));
+
+static inline void
+count_alloc (size_t size)
+{
+        thread_counters.allocs++;
+        thread_counters.bytes += size;
+}
+
+void *
+malloc (size_t size)
+{
+        count_alloc (size);
+        return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb,
+        size_t size)
+{
+        count_alloc (nmemb * size);
+        return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void  *ptr,
+         size_t size)
+{
+        /* Resizing an existing block is neither a new allocation nor a
+         * free, but the bytes requested are still accounted.
+         */
+        if (!ptr)
+                thread_counters.allocs++;
+        else if (size == 0)
+                thread_counters.frees++;
+        thread_counters.bytes += size;
+        return __libc_realloc (ptr, size);
+}
+
+int
+posix_memalign (void  **memptr,
+                size_t  alignment,
+                size_t  size)
+{
+        void *ptr;
+
+        ptr = __libc_memalign (alignment, size);
+        if (!ptr)
+                return ENOMEM;
+
+        count_alloc (size);
+        *memptr = ptr;
+        return 0;
+}
+
+void *
+aligned_alloc (size_t alignment,
+               size_t size)
+{
+        count_alloc (size);
+        return __libc_memalign (alignment, size);
+}
+
+void
+free (void *ptr)
+{
+        if (ptr)
+                thread_counters.frees++;
+        __libc_free (ptr);
+}
+#endif
+
+gboolean
+alloc_tracker_is_available (void)
+{
+#ifdef ALLOC_TRACKING_ENABLED
+        return TRUE;
+#else
+        return FALSE;
+#endif
+}
+
+void
+alloc_tracker_get_thread_counters (AllocCounters *counters)
+{
+#ifdef ALLOC_TRACKING_ENABLED
+        *counters = thread_counters;
+#else
+        memset (counters, 0, sizeof (AllocCounters));
+#endif
+}
+
+/* The tracker follows the messages of a session and, at every phase
+ * transition, attributes whatever the current thread allocated since the
+ * previous transition to the phase that just ended. With several messages
+ * in flight at once the boundaries interleave, so per-phase figures are
+ * only exact for messages sent one after another; the totals are always
+ * exact for the thread.
+ */
+struct _AllocTracker {
+        SoupSession *session;
+        GHashTable *messages; /* SoupMessage -> AllocPhase */
+        AllocCounters last;
+        AllocCounters phases[ALLOC_N_PHASES];
+        guint n_messages;
+};
+
+static const char *phase_names[ALLOC_N_PHASES] = {
+        "queued",
+        "request",
+        "response-headers",
+        "response-body",
+        "finishing"
+};
+
+static void
+counters_add_delta (AllocCounters       *total,
+                    const AllocCounters *now,
+                    const AllocCounters *before)
+{
+        total->allocs += now->allocs - before->allocs;
+        total->frees += now->frees - before->frees;
+        total->bytes += now->bytes - before->bytes;
+}
+
+static void
+close_phase (AllocTracker *tracker,
+             SoupMessage  *msg)
+{
+        AllocCounters now;
+        gpointer phase;
+
+        alloc_tracker_get_thread_counters (&now);
+        if (g_hash_table_lookup_extended (tracker->messages, msg, NULL, &phase))
+                counters_add_delta (&tracker->phases[GPOINTER_TO_UINT (phase)], &now, &tracker->last);
+}
+
+static void
+enter_phase (AllocTracker *tracker,
+             SoupMessage  *msg,
+             AllocPhase    phase)
+{
+        close_phase (tracker, msg);
+        g_hash_table_insert (tracker->messages, msg, GUINT_TO_POINTER (phase));
+        alloc_tracker_get_thread_counters (&tracker->last);
+}
+
+static void
+message_starting (SoupMessage  *msg,
+                  AllocTracker *tracker)
+{
+        enter_phase (tracker, msg, ALLOC_PHASE_REQUEST);
+}
+
+static void
+message_wrote_body (SoupMessage  *msg,
+                    AllocTracker *tracker)
+{
+        enter_phase (tracker, msg, ALLOC_PHASE_RESPONSE_HEADERS);
+}
+
+static void
+message_got_headers (SoupMessage  *msg,
+                     AllocTracker *tracker)
+{
+        enter_phase (tracker, msg, ALLOC_PHASE_RESPONSE_BODY);
+}
+
+static void
+message_got_body (SoupMessage  *msg,
+                  AllocTracker *tracker)
+{
+        enter_phase (tracker, msg, ALLOC_PHASE_FINISHING);
+}
+
+static void
+request_queued (SoupSession  *session,
+                SoupMessage  *msg,
+                AllocTracker *tracker)
+{
+        g_signal_connect (msg, "starting",
+                          G_CALLBACK (message_starting), tracker);
+        g_signal_connect (msg, "wrote-body",
+                          G_CALLBACK (message_wrote_body), tracker);
+        g_signal_connect (msg, "got-headers",
+                          G_CALLBACK (message_got_headers), tracker);
+        g_signal_connect (msg, "got-body",
+                          G_CALLBACK (message_got_body), tracker);
+
+        g_hash_table_insert (tracker->messages, msg, GUINT_TO_POINTER (ALLOC_PHASE_QUEUED));
+        alloc_tracker_get_thread_counters (&tracker->last);
+}
+
+static void
+request_unqueued (SoupSession  *session,
+                  SoupMessage  *msg,
+                  AllocTracker *tracker)
+{
+        if (!g_hash_table_contains (tracker->messages, msg))
+                return;
+
+        close_phase (tracker, msg);
+        g_hash_table_remove (tracker->messages, msg);
+        g_signal_handlers_disconnect_by_data (msg, tracker);
+        tracker->n_messages++;
+        alloc_tracker_get_thread_counters (&tracker->last);
+}
+
+AllocTracker *
+alloc_tracker_new (SoupSession *session)
+{
+        AllocTracker *tracker;
+
+        tracker = g_new0 (AllocTracker, 1);
+        tracker->session = g_object_ref (session);
+        tracker->messages = g_hash_table_new (NULL, NULL);
+        g_signal_connect (session, "request-queued",
+                          G_CALLBACK (request_queued), tracker);
+        g_signal_connect (session, "request-unqueued",
+                          G_CALLBACK (request_unqueued), tracker);
+
+        return tracker;
+}
+
+void
+alloc_tracker_free (AllocTracker *tracker)
+{
+        GHashTableIter iter;
+        gpointer msg;
+
+        g_hash_table_iter_init (&iter, tracker->messages);
+        while (g_hash_table_iter_next (&iter, &msg, NULL))
+                g_signal_handlers_disconnect_by_data (msg, tracker);
+        g_hash_table_destroy (tracker->messages);
+
+        g_signal_handlers_disconnect_by_data (tracker->session, tracker);
+        g_object_unref (tracker->session);
+        g_free (tracker);
+}
+
+guint
+alloc_tracker_get_n_messages (AllocTracker *tracker)
+{
+        return tracker->n_messages;
+}
+
+void
+alloc_tracker_get_phase_counters (AllocTracker  *tracker,
+                                  AllocPhase     phase,
+                                  AllocCounters *counters)
+{
+        g_assert (phase < ALLOC_N_PHASES);
+
+        *counters = tracker->phases[phase];
+}
+
+guint64
+alloc_tracker_get_allocs (AllocTracker *tracker)
+{
+        guint64 allocs = 0;
+        guint i;
+
+        for (i = 0; i < ALLOC_N_PHASES; i++)
+                allocs += tracker->phases[i].allocs;
+
+        return allocs;
+}
+
+void
+alloc_tracker_reset (AllocTracker *tracker)
+{
+        memset (tracker->phases, 0, sizeof (tracker->phases));
+        tracker->n_messages = 0;
+        alloc_tracker_get_thread_counters (&tracker->last);
+}
+
+char *
+alloc_tracker_to_string (AllocTracker *tracker)
+{
+        GString *str;
+        guint n = MAX (tracker->n_messages, 1);
+        guint i;
+
+        str = g_string_new (NULL);
+        for (i = 0; i < ALLOC_N_PHASES; i++) {
+                g_string_append_printf (str, "%s%s: allocs/msg=%.1f frees/msg=%.1f bytes/msg=%.1f",
+                                        i ? "\n" : "",
+                                        phase_names[i],
+                                        tracker->phases[i].allocs / (double)n,
+                                        tracker->phases[i].frees / (double)n,
+                                        tracker->phases[i].bytes / (double)n);
+        }
+
+        return g_string_free (str, FALSE);
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * Copyright 2021 Igalia S.L.
+ */
+
+#pragma once
+
+#include "test-utils.h"
+
+G_BEGIN_DECLS
+
+typedef struct {
+        guint64 allocs;
+        guint64 frees;
+        guint64 bytes;
+} AllocCounters;
+
+/* Phases of a message, delimited by the SoupMessage signals */
+typedef enum {
+        ALLOC_PHASE_QUEUED,           /* request-queued -> starting */
+        ALLOC_PHASE_REQUEST,          /* starting -> wrote-body */
+        ALLOC_PHASE_RESPONSE_HEADERS, /* wrote-body -> got-headers */
+        ALLOC_PHASE_RESPONSE_BODY,    /* got-headers -> got-body */
+        ALLOC_PHASE_FINISHING,        /* got-body -> request-unqueued */
+
+        ALLOC_N_PHASES
+} AllocPhase;
+
+typedef struct _AllocTracker AllocTracker;
+
+gboolean      alloc_tracker_is_available         (void);
+void          alloc_tracker_get_thread_counters  (AllocCounters *counters);
+
+AllocTracker *alloc_tracker_new                  (SoupSession   *session);
+void          alloc_tracker_free                 (AllocTracker  *tracker);
+guint         alloc_tracker_get_n_messages       (AllocTracker  *tracker);
+void          alloc_tracker_get_phase_counters   (AllocTracker  *tracker,
+                                                  AllocPhase     phase,
+                                                  AllocCounters *counters);
+guint64       alloc_tracker_get_allocs           (AllocTracker  *tracker);
+void          alloc_tracker_reset                (AllocTracker  *tracker);
+char         *alloc_tracker_to_string            (AllocTracker  *tracker);
+
+#define soup_test_assert_alloc_budget(tracker, budget)                          \
+        G_STMT_START {                                                          \
+                guint _n = alloc_tracker_get_n_messages (tracker);              \
+                guint64 _allocs = alloc_tracker_get_allocs (tracker);           \
+                if (alloc_tracker_is_available () && _n > 0 &&                  \
+                    _allocs > (guint64)(budget) * _n) {                         \
+                        char *_report = alloc_tracker_to_string (tracker);      \
+                        soup_test_assert (FALSE,                                \
+                                          "%" G_GUINT64_FORMAT " allocations for %u messages, " \
+                                          "budget is %u per message\n%s",       \
+                                          _allocs, _n, (guint)(budget), _report); \
+                        g_free (_report);                                       \
+                }                                                               \
+        } G_STMT_END
+
+G_END_DECLS
@@ -791,6 +791,8 @@ do_metrics_test (gconstpointer data)
         g_assert_cmpuint (soup_message_metrics_get_connect_start (metrics), ==, 0);
         g_assert_cmpuint (soup_message_metrics_get_tls_start (metrics), ==, 0);
         g_assert_cmpuint (soup_message_metrics_get_connect_end (metrics), ==, 0);
+        g_assert_cmpuint (soup_message_metrics_get_connection_acquired (metrics), ==, 0);
+        g_assert_cmpuint (soup_message_metrics_get_request_first_byte_sent (metrics), ==, 0);
         g_assert_cmpuint (soup_message_metrics_get_request_start (metrics), >=, soup_message_metrics_get_fetch_start (metrics));
         g_input_stream_read_all (stream, buffer, sizeof (buffer), &nread, NULL, NULL);
         g_assert_cmpuint (soup_message_metrics_get_response_start (metrics), >=, soup_message_metrics_get_request_start (metrics));
@@ -6,6 +6,7 @@
 #include "test-utils.h"
 
 #include "soup-connection.h"
+#include "soup-session-private.h"
 #include "soup-socket.h"
 #include "soup-server-message-private.h"
 
@@ -533,6 +534,163 @@ do_max_conns_test (void)
 	soup_test_session_abort_unref (session);
 }
 
+static gboolean
+cancel_sync_wait (gpointer user_data)
+{
+	g_cancellable_cancel (user_data);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+unlock_server (gpointer user_data)
+{
+	g_mutex_unlock (&server_mutex);
+	return G_SOURCE_REMOVE;
+}
+
+static void
+set_flag (SoupMessage *msg,
+	  gboolean    *flag)
+{
+	*flag = TRUE;
+}
+
+static void
+do_max_conns_sync_test (void)
+{
+	SoupSession *session;
+	SoupMessage *async_msg, *msg;
+	GCancellable *cancellable;
+	gboolean async_done = FALSE;
+	GBytes *body;
+	GError *error = NULL;
+
+	session = soup_test_session_new ("max-conns", 1, NULL);
+
+	/* Keep the only connection busy */
+	g_mutex_lock (&server_mutex);
+	async_msg = soup_message_new_from_uri ("GET", base_uri);
+	g_signal_connect (async_msg, "finished",
+			  G_CALLBACK (set_flag), &async_done);
+	soup_session_send_async (session, async_msg, G_PRIORITY_DEFAULT, NULL, NULL, NULL);
+	while (!soup_message_get_connection (async_msg))
+		g_main_context_iteration (NULL, TRUE);
+
+	/* A blocked send can be cancelled */
+	cancellable = g_cancellable_new ();
+	g_timeout_add (100, cancel_sync_wait, cancellable);
+	msg = soup_message_new_from_uri ("GET", base_uri);
+	body = soup_session_send_and_read (session, msg, cancellable, &error);
+	g_assert_null (body);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_clear_error (&error);
+	g_object_unref (msg);
+	g_object_unref (cancellable);
+
+	/* And otherwise gets the connection once it's released */
+	g_timeout_add (100, unlock_server, NULL);
+	msg = soup_message_new_from_uri ("GET", base_uri);
+	body = soup_session_send_and_read (session, msg, NULL, &error);
+	g_assert_no_error (error);
+	soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+	g_assert_true (async_done);
+	soup_test_assert_message_status (async_msg, SOUP_STATUS_OK);
+	g_bytes_unref (body);
+	g_object_unref (msg);
+	g_object_unref (async_msg);
+
+	soup_test_session_abort_unref (session);
+}
+
+static void
+adaptive_message_finished (SoupMessage *msg,
+			   int         *pending)
+{
+	(*pending)--;
+}
+
+static void
+do_adaptive_max_conns_test (void)
+{
+	SoupSession *session;
+	SoupMessage *msgs[8];
+	int i, pending;
+
+	session = soup_test_session_new ("max-conns-per-host", 1,
+					 "adaptive-max-conns-per-host", 4,
+					 NULL);
+	g_assert_cmpuint (soup_session_get_max_conns_for_host (session, base_uri), ==, 1);
+
+	/* All the messages but the first wait for the only
+	 * connection, so the limit grows after this first window.
+	 */
+	pending = G_N_ELEMENTS (msgs);
+	for (i = 0; i < G_N_ELEMENTS (msgs); i++) {
+		msgs[i] = soup_message_new_from_uri ("GET", base_uri);
+		g_signal_connect (msgs[i], "finished",
+				  G_CALLBACK (adaptive_message_finished), &pending);
+		soup_session_send_async (session, msgs[i], G_PRIORITY_DEFAULT, NULL, NULL, NULL);
+	}
+	while (pending)
+		g_main_context_iteration (NULL, TRUE);
+
+	for (i = 0; i < G_N_ELEMENTS (msgs); i++) {
+		soup_test_assert_message_status (msgs[i], SOUP_STATUS_OK);
+		g_object_unref (msgs[i]);
+	}
+	g_assert_cmpuint (soup_session_get_max_conns_for_host (session, base_uri), ==, 2);
+
+	/* An explicit limit wins until it's removed */
+	soup_session_set_max_conns_for_host (session, base_uri, 6);
+	g_assert_cmpuint (soup_session_get_max_conns_for_host (session, base_uri), ==, 6);
+	soup_session_set_max_conns_for_host (session, base_uri, 0);
+	g_assert_cmpuint (soup_session_get_max_conns_for_host (session, base_uri), ==, 2);
+
+	soup_test_session_abort_unref (session);
+}
+
+static void
+warm_up_request_unqueued (SoupSession *session,
+			  SoupMessage *msg,
+			  int         *n_warm_ups)
+{
+	if (soup_message_get_method (msg) == SOUP_METHOD_HEAD)
+		(*n_warm_ups)++;
+}
+
+static void
+do_warm_conns_test (void)
+{
+	SoupSession *session;
+	int i, n_warm_ups = 0;
+
+	session = soup_test_session_new ("warm-conns-per-host", 2, NULL);
+	g_signal_connect (session, "request-unqueued",
+			  G_CALLBACK (warm_up_request_unqueued), &n_warm_ups);
+
+	/* Once the host is used often enough, a second idle
+	 * connection is opened next to the one the messages used.
+	 */
+	for (i = 0; i < 4; i++) {
+		SoupMessage *msg;
+		GBytes *body;
+
+		msg = soup_message_new_from_uri ("GET", base_uri);
+		body = soup_test_session_async_send (session, msg, NULL, NULL);
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	while (n_warm_ups < 1)
+		g_main_context_iteration (NULL, TRUE);
+	while (g_main_context_pending (NULL))
+		g_main_context_iteration (NULL, FALSE);
+	g_assert_cmpint (n_warm_ups, ==, 1);
+
+	soup_test_session_abort_unref (session);
+}
+
 static void
 np_message_started (SoupMessage *msg,
 		    GSocket    **save_socket)
@@ -902,8 +1060,11 @@ metrics_test_message_starting_cb (SoupMessage *msg)
 {
         SoupMessageMetrics *metrics = soup_message_get_metrics (msg);
 
+        g_assert_cmpuint (soup_message_metrics_get_queue_start (metrics), >, 0);
+        g_assert_cmpuint (soup_message_metrics_get_queue_start (metrics), <=, soup_message_metrics_get_fetch_start (metrics));
+        g_assert_cmpuint (soup_message_metrics_get_connection_acquired (metrics), >=, soup_message_metrics_get_fetch_start (metrics));
         g_assert_cmpuint (soup_message_metrics_get_request_start (metrics), >, 0);
-        g_assert_cmpuint (soup_message_metrics_get_request_start (metrics), >=, soup_message_metrics_get_fetch_start (metrics));
+        g_assert_cmpuint (soup_message_metrics_get_request_start (metrics), >=, soup_message_metrics_get_connection_acquired (metrics));
 }
 
 static void
@@ -912,8 +1073,9 @@ metrics_test_status_changed_cb (SoupMessage *msg)
         SoupMessageMetrics *metrics;
 
         metrics = soup_message_get_metrics (msg);
+        g_assert_cmpuint (soup_message_metrics_get_request_first_byte_sent (metrics), >=, soup_message_metrics_get_request_start (metrics));
         g_assert_cmpuint (soup_message_metrics_get_response_start (metrics), >, 0);
-        g_assert_cmpuint (soup_message_metrics_get_response_start (metrics), >=, soup_message_metrics_get_request_start (metrics));
+        g_assert_cmpuint (soup_message_metrics_get_response_start (metrics), >=, soup_message_metrics_get_request_first_byte_sent (metrics));
 }
 
 static void
@@ -1591,6 +1753,143 @@ do_connection_metrics_test (void)
         soup_test_session_abort_unref (session);
 }
 
+static void
+socket_options_network_event (SoupMessage        *msg,
+			      GSocketClientEvent  event,
+			      GIOStream          *connection,
+			      gboolean           *keepalive)
+{
+	if (event == G_SOCKET_CLIENT_CONNECTED)
+		*keepalive = g_socket_get_keepalive (g_socket_connection_get_socket (G_SOCKET_CONNECTION (connection)));
+}
+
+static void
+do_socket_options_test (void)
+{
+	SoupSession *session;
+	SoupSocketOptions *options;
+	SoupMessage *msg;
+	SoupMessageMetrics *metrics;
+	gboolean keepalive = FALSE;
+	GBytes *body;
+
+	options = soup_socket_options_new ();
+	soup_socket_options_set_buffer_sizes (options, 64 * 1024, 128 * 1024);
+	soup_socket_options_set_keepalive (options, TRUE, 30, 5, 3);
+	soup_socket_options_set_tos (options, 0x10);
+	session = soup_test_session_new ("socket-options", options, NULL);
+	soup_socket_options_free (options);
+
+	options = soup_session_get_socket_options (session);
+	g_assert_nonnull (options);
+	g_assert_true (soup_socket_options_get_keepalive (options, NULL, NULL, NULL));
+	g_assert_cmpint (soup_socket_options_get_tos (options), ==, 0x10);
+
+	msg = soup_message_new_from_uri ("GET", base_uri);
+	soup_message_add_flags (msg, SOUP_MESSAGE_COLLECT_METRICS);
+	g_signal_connect (msg, "network-event",
+			  G_CALLBACK (socket_options_network_event), &keepalive);
+	body = soup_test_session_async_send (session, msg, NULL, NULL);
+	soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+	g_assert_true (keepalive);
+
+	/* The kernel may round the sizes up, but not below what we asked */
+	metrics = soup_message_get_metrics (msg);
+	g_assert_cmpuint (soup_message_metrics_get_socket_send_buffer_size (metrics), >=, 64 * 1024);
+	g_assert_cmpuint (soup_message_metrics_get_socket_receive_buffer_size (metrics), >=, 128 * 1024);
+
+	g_bytes_unref (body);
+	g_object_unref (msg);
+	soup_test_session_abort_unref (session);
+}
+
+static void
+do_dns_cache_test (void)
+{
+        SoupSession *session;
+        SoupDNSCache *dns_cache;
+        GUri *uri;
+        int i;
+
+        session = soup_test_session_new (NULL);
+        dns_cache = soup_session_get_dns_cache (session);
+
+        /* The server only listens on 127.0.0.1, but it's the name
+         * that has to go through the cache.
+         */
+        uri = soup_uri_copy (base_uri, SOUP_URI_HOST, "localhost", SOUP_URI_NONE);
+
+        for (i = 0; i < 3; i++) {
+                SoupMessage *msg;
+                GBytes *body;
+
+                msg = soup_message_new_from_uri ("GET", uri);
+                soup_message_add_flags (msg, SOUP_MESSAGE_NEW_CONNECTION);
+                body = soup_test_session_async_send (session, msg, NULL, NULL);
+                soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+                g_bytes_unref (body);
+                g_object_unref (msg);
+        }
+
+        g_assert_cmpuint (soup_dns_cache_get_n_lookups (dns_cache), ==, 1);
+
+        /* Prefetching a name that is already known is a no-op */
+        soup_dns_cache_prefetch (dns_cache, "LOCALHOST");
+        g_assert_cmpuint (soup_dns_cache_get_n_lookups (dns_cache), ==, 1);
+
+        g_uri_unref (uri);
+        soup_test_session_abort_unref (session);
+}
+
+typedef struct {
+        GError *error;
+        gboolean resolved;
+        guint64 n_lookups;
+} DNSCacheWaiterData;
+
+static void
+dns_cache_waiter_cb (SoupDNSCache       *dns_cache,
+                     GAsyncResult       *result,
+                     DNSCacheWaiterData *data)
+{
+        GList *addresses;
+
+        addresses = soup_dns_cache_lookup_finish (dns_cache, result, &data->error);
+        data->resolved = TRUE;
+        /* Calling back into the cache from the callback must not deadlock */
+        data->n_lookups = soup_dns_cache_get_n_lookups (dns_cache);
+        g_resolver_free_addresses (addresses);
+}
+
+static void
+do_dns_cache_cancel_test (void)
+{
+        SoupDNSCache *dns_cache;
+        GCancellable *cancellable;
+        DNSCacheWaiterData cancelled = { NULL, }, waiting = { NULL, };
+
+        dns_cache = soup_dns_cache_new ();
+        cancellable = g_cancellable_new ();
+
+        /* Both wait for the same lookup */
+        soup_dns_cache_lookup_async (dns_cache, "localhost", cancellable,
+                                     (GAsyncReadyCallback)dns_cache_waiter_cb, &cancelled);
+        soup_dns_cache_lookup_async (dns_cache, "localhost", NULL,
+                                     (GAsyncReadyCallback)dns_cache_waiter_cb, &waiting);
+        g_cancellable_cancel (cancellable);
+
+        while (!cancelled.resolved || !waiting.resolved)
+                g_main_context_iteration (NULL, TRUE);
+
+        g_assert_error (cancelled.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+        g_assert_no_error (waiting.error);
+        g_assert_cmpuint (waiting.n_lookups, ==, 1);
+
+        g_clear_error (&cancelled.error);
+        g_object_unref (cancellable);
+        soup_dns_cache_unref (dns_cache);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1608,12 +1907,18 @@ main (int argc, char **argv)
 	g_test_add_func ("/connection/persistent-connection-timeout-with-cancellable",
 			 do_persistent_connection_timeout_test_with_cancellation);
 	g_test_add_func ("/connection/max-conns", do_max_conns_test);
+	g_test_add_func ("/connection/max-conns-sync", do_max_conns_sync_test);
+	g_test_add_func ("/connection/adaptive-max-conns", do_adaptive_max_conns_test);
+	g_test_add_func ("/connection/warm-conns", do_warm_conns_test);
 	g_test_add_func ("/connection/non-persistent", do_non_persistent_connection_test);
 	g_test_add_func ("/connection/non-idempotent", do_non_idempotent_connection_test);
 	g_test_add_func ("/connection/state", do_connection_state_test);
 	g_test_add_func ("/connection/event", do_connection_event_test);
 	g_test_add_func ("/connection/preconnect", do_connection_preconnect_test);
         g_test_add_func ("/connection/metrics", do_connection_metrics_test);
+        g_test_add_func ("/connection/dns-cache", do_dns_cache_test);
+        g_test_add_func ("/connection/dns-cache/cancel", do_dns_cache_cancel_test);
+        g_test_add_func ("/connection/socket-options", do_socket_options_test);
 
 	ret = g_test_run ();
 
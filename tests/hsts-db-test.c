@@ -186,6 +186,43 @@ do_hsts_db_large_max_age_test (void)
 	g_remove (DB_FILE);
 }
 
+static void
+do_hsts_db_batched_test (void)
+{
+	SoupHSTSEnforcer *enforcer = soup_hsts_enforcer_db_new (DB_FILE);
+	SoupHSTSPolicy *policy;
+	GList *domains;
+	guint i;
+
+	/* Every other policy is removed again before it is written. */
+	for (i = 0; i < 100; i++) {
+		char *domain = g_strdup_printf ("host%u.localhost", i);
+
+		policy = soup_hsts_policy_new (domain, 3600, FALSE);
+		soup_hsts_enforcer_set_policy (enforcer, policy);
+		soup_hsts_policy_free (policy);
+
+		if (i % 2) {
+			policy = soup_hsts_policy_new (domain, SOUP_HSTS_POLICY_MAX_AGE_PAST, FALSE);
+			soup_hsts_enforcer_set_policy (enforcer, policy);
+			soup_hsts_policy_free (policy);
+		}
+		g_free (domain);
+	}
+	g_object_unref (enforcer);
+
+	/* The policies are loaded in the background, but are in place
+	 * as soon as they are asked for.
+	 */
+	enforcer = soup_hsts_enforcer_db_new (DB_FILE);
+	domains = soup_hsts_enforcer_get_domains (enforcer, FALSE);
+	g_assert_cmpuint (g_list_length (domains), ==, 50);
+	g_list_free_full (domains, g_free);
+	g_object_unref (enforcer);
+
+	g_remove (DB_FILE);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -208,6 +245,7 @@ main (int argc, char **argv)
 	g_test_add_func ("/hsts-db/basic", do_hsts_db_persistency_test);
 	g_test_add_func ("/hsts-db/subdomains", do_hsts_db_subdomains_test);
 	g_test_add_func ("/hsts-db/large-max-age", do_hsts_db_large_max_age_test);
+	g_test_add_func ("/hsts-db/batched", do_hsts_db_batched_test);
 
 	ret = g_test_run ();
 
@@ -6,6 +6,7 @@
 
 #include "test-utils.h"
 #include "soup-uri-utils-private.h"
+#include "soup-session-feature-private.h"
 
 GUri *http_uri;
 GUri *https_uri;
@@ -575,6 +576,121 @@ do_hsts_get_policies_test (void)
 	g_object_unref(enforcer);
 }
 
+static void
+on_expire_many_enforcer_changed (SoupHSTSEnforcer *enforcer, SoupHSTSPolicy *old, SoupHSTSPolicy *new, gpointer data)
+{
+	guint *n_expired = data;
+
+	if (!new) {
+		g_assert_true (soup_hsts_policy_is_expired (old));
+		(*n_expired)++;
+	}
+}
+
+static void
+do_hsts_expire_many_test (void)
+{
+	SoupHSTSEnforcer *enforcer = soup_hsts_enforcer_new ();
+	SoupHSTSPolicy *policy;
+	SoupSession *session;
+	GList *domains;
+	guint n_expired = 0;
+	guint i;
+
+	/* Interleave short and long-lasting policies, so that the
+	   expired ones are not simply the oldest ones. */
+	for (i = 0; i < 100; i++) {
+		char *domain = g_strdup_printf ("host%u.localhost", i);
+
+		policy = soup_hsts_policy_new (domain, i % 2 ? 3600 : 1, FALSE);
+		soup_hsts_enforcer_set_policy (enforcer, policy);
+		soup_hsts_policy_free (policy);
+		g_free (domain);
+	}
+	policy = soup_hsts_policy_new ("localhost", 3600, TRUE);
+	soup_hsts_enforcer_set_policy (enforcer, policy);
+	soup_hsts_policy_free (policy);
+
+	g_signal_connect (enforcer, "changed", G_CALLBACK (on_expire_many_enforcer_changed), &n_expired);
+
+	/* Wait for the short-lasting policies to expire. */
+	g_usleep (2 * G_USEC_PER_SEC);
+
+	/* Replacing a policy prunes the expired ones. */
+	policy = soup_hsts_policy_new ("localhost", 7200, TRUE);
+	soup_hsts_enforcer_set_policy (enforcer, policy);
+	soup_hsts_policy_free (policy);
+
+	g_assert_cmpuint (n_expired, ==, 50);
+	domains = soup_hsts_enforcer_get_domains (enforcer, FALSE);
+	g_assert_cmpuint (g_list_length (domains), ==, 51);
+	g_list_free_full (domains, g_free);
+
+	/* The super domain policy still covers the subdomains whose
+	   own policies have gone. */
+	session = hsts_session_new (enforcer);
+	session_get_uri (session, "http://host0.localhost", SOUP_STATUS_NONE, TRUE);
+	soup_test_session_abort_unref (session);
+
+	g_object_unref (enforcer);
+}
+
+static void
+do_hsts_preload_test (void)
+{
+	SoupHSTSEnforcer *enforcer = soup_hsts_enforcer_new ();
+	GList *domains;
+
+	/* Preloaded hosts are valid without any policy being set,
+	   but are not listed among the known ones. */
+	g_assert_true (soup_hsts_enforcer_has_valid_policy (enforcer, "dev"));
+	g_assert_true (soup_hsts_enforcer_has_valid_policy (enforcer, "APP"));
+	g_assert_false (soup_hsts_enforcer_has_valid_policy (enforcer, "devel"));
+	g_assert_false (soup_hsts_enforcer_has_valid_policy (enforcer, "localhost"));
+
+	domains = soup_hsts_enforcer_get_domains (enforcer, TRUE);
+	g_assert_null (domains);
+
+	g_object_unref (enforcer);
+}
+
+static gboolean
+preload_enforces (SoupHSTSEnforcer *enforcer,
+		  const char       *uri)
+{
+	SoupMessage *msg;
+	gboolean enforced = FALSE;
+
+	msg = soup_message_new ("GET", uri);
+	g_signal_connect (msg, "hsts-enforced", G_CALLBACK (hsts_enforced_cb), &enforced);
+	soup_session_feature_request_queued (SOUP_SESSION_FEATURE (enforcer), msg);
+	soup_session_feature_request_unqueued (SOUP_SESSION_FEATURE (enforcer), msg);
+	g_assert_cmpstr (g_uri_get_scheme (soup_message_get_uri (msg)), ==, enforced ? "https" : "http");
+	g_object_unref (msg);
+
+	return enforced;
+}
+
+static void
+do_hsts_preload_subdomains_test (void)
+{
+	SoupHSTSEnforcer *enforcer = soup_hsts_enforcer_new ();
+
+	/* The preloaded top level domains include their subdomains */
+	g_assert_true (preload_enforces (enforcer, "http://dev/"));
+	g_assert_true (preload_enforces (enforcer, "http://example.dev/"));
+	g_assert_true (preload_enforces (enforcer, "http://www.example.APP/"));
+	g_assert_false (preload_enforces (enforcer, "http://example.devel/"));
+	g_assert_false (preload_enforces (enforcer, "http://dev.example.com/"));
+
+	/* Unless the list is turned off */
+	g_object_set (enforcer, "use-preload-list", FALSE, NULL);
+	g_assert_false (preload_enforces (enforcer, "http://example.dev/"));
+	g_assert_false (soup_hsts_enforcer_has_valid_policy (enforcer, "dev"));
+
+	g_object_unref (enforcer);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -600,6 +716,7 @@ main (int argc, char **argv)
 	g_test_add_func ("/hsts/case-insensitive-header", do_hsts_case_insensitive_header_test);
 	g_test_add_func ("/hsts/basic", do_hsts_basic_test);
 	g_test_add_func ("/hsts/expire", do_hsts_expire_test);
+	g_test_add_func ("/hsts/expire-many", do_hsts_expire_many_test);
 	g_test_add_func ("/hsts/delete", do_hsts_delete_test);
 	g_test_add_func ("/hsts/replace", do_hsts_replace_test);
 	g_test_add_func ("/hsts/update", do_hsts_update_test);
@@ -622,6 +739,8 @@ main (int argc, char **argv)
 	g_test_add_func ("/hsts/idna-addresses", do_hsts_idna_addresses_test);
 	g_test_add_func ("/hsts/get-domains", do_hsts_get_domains_test);
 	g_test_add_func ("/hsts/get-policies", do_hsts_get_policies_test);
+	g_test_add_func ("/hsts/preload", do_hsts_preload_test);
+	g_test_add_func ("/hsts/preload/subdomains", do_hsts_preload_subdomains_test);
 
 	ret = g_test_run ();
 
@@ -113,6 +113,44 @@ do_skip_async_test (void)
         g_main_loop_unref (loop);
 }
 
+static void
+on_data_consumed (GInputStream *stream,
+                  guint64       count,
+                  guint64      *consumed)
+{
+        *consumed += count;
+}
+
+static void
+do_data_consumed_test (void)
+{
+        GInputStream *stream = soup_body_input_stream_http2_new ();
+        SoupBodyInputStreamHttp2 *bistream = SOUP_BODY_INPUT_STREAM_HTTP2 (stream);
+        guint64 consumed = 0;
+        char buffer[8];
+
+        g_signal_connect (stream, "data-consumed", G_CALLBACK (on_data_consumed), &consumed);
+
+        /* Data is only consumed once it's read or skipped */
+        soup_body_input_stream_http2_add_data (bistream, (guint8*)"12345678", 8);
+        g_assert_cmpuint (consumed, ==, 0);
+
+        g_assert_cmpint (g_input_stream_read (stream, buffer, 3, NULL, NULL), ==, 3);
+        g_assert_cmpuint (consumed, ==, 3);
+
+        g_assert_cmpint (g_input_stream_skip (stream, 2, NULL, NULL), ==, 2);
+        g_assert_cmpuint (consumed, ==, 5);
+
+        g_assert_cmpint (g_input_stream_read (stream, buffer, sizeof (buffer), NULL, NULL), ==, 3);
+        g_assert_cmpuint (consumed, ==, 8);
+
+        soup_body_input_stream_http2_complete (bistream);
+        g_assert_cmpint (g_input_stream_read (stream, buffer, sizeof (buffer), NULL, NULL), ==, 0);
+        g_assert_cmpuint (consumed, ==, 8);
+
+        g_object_unref (stream);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -123,6 +161,7 @@ main (int argc, char **argv)
 	g_test_add_func ("/body_stream/large_data", do_large_data_test);
         g_test_add_func ("/body_stream/multiple_chunks", do_multiple_chunk_test);
         g_test_add_func ("/body_stream/skip_async", do_skip_async_test);
+        g_test_add_func ("/body_stream/data_consumed", do_data_consumed_test);
 
 	ret = g_test_run ();
 
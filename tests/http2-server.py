@@ -67,6 +67,18 @@ async def large():
 
     return generate_data()
 
+@app.route('/large-fast')
+async def large_fast():
+    set_timeout()
+
+    async def generate_data():
+        # As fast as flow control allows, 32MB in total
+        chunk = b'A' * 65536
+        for i in range(512):
+            yield chunk
+
+    return generate_data()
+
 @app.route('/echo_query')
 async def echo_query():
     set_timeout()
@@ -21,6 +21,7 @@
 #include "soup-connection.h"
 #include "soup-message-private.h"
 #include "soup-body-input-stream-http2.h"
+#include "soup-client-message-io-http2.h"
 
 typedef struct {
         SoupSession *session;
@@ -106,6 +107,141 @@ do_large_test (Test *test, gconstpointer data)
         g_object_unref (msg);
 }
 
+/* Size hardcoded to match http2-server.py's response */
+#define LARGE_FAST_SIZE (512 * 65536)
+
+static void
+do_flow_control_window_test (Test *test, gconstpointer data)
+{
+        SoupMessage *msg = soup_message_new (SOUP_METHOD_GET, "https://127.0.0.1:5000/large-fast");
+        SoupClientMessageIO *io;
+        GInputStream *stream;
+        char buffer[65536];
+        gssize nread;
+        gsize total = 0;
+        gint32 max_window_size = 0;
+        GError *error = NULL;
+
+        stream = soup_session_send (test->session, msg, NULL, &error);
+        g_assert_no_error (error);
+        io = soup_message_get_io_data (msg);
+
+        /* The server sends as fast as the window allows, so the
+         * window is what limits the transfer and it must grow, up
+         * to its cap.
+         */
+        while ((nread = g_input_stream_read (stream, buffer, sizeof (buffer), NULL, &error)) > 0) {
+                gint32 window_size = soup_client_message_io_http2_get_stream_window_size (io);
+
+                g_assert_cmpint (window_size, <=, MAX_STREAM_WINDOW_SIZE);
+                g_assert_cmpint (soup_client_message_io_http2_get_connection_window_size (io), <=, MAX_CONNECTION_WINDOW_SIZE);
+                max_window_size = MAX (max_window_size, window_size);
+                total += nread;
+        }
+        g_assert_no_error (error);
+        g_assert_cmpuint (total, ==, LARGE_FAST_SIZE);
+        g_assert_cmpint (max_window_size, >, MIN_STREAM_WINDOW_SIZE);
+
+        g_object_unref (stream);
+        g_object_unref (msg);
+}
+
+typedef struct {
+        SoupMessageMetrics *metrics;
+        guint64 received;
+        guint idle_ticks;
+} ReceivedWatch;
+
+static gboolean
+received_watch_tick (ReceivedWatch *watch)
+{
+        guint64 received = soup_message_metrics_get_response_body_bytes_received (watch->metrics);
+
+        if (received == watch->received) {
+                watch->idle_ticks++;
+        } else {
+                watch->received = received;
+                watch->idle_ticks = 0;
+        }
+
+        return G_SOURCE_CONTINUE;
+}
+
+/* Runs the I/O until the response body fills the stream window of
+ * @io or stops arriving, whichever happens first.
+ */
+static guint64
+wait_for_stream_window_full (SoupClientMessageIO *io,
+                             SoupMessageMetrics  *metrics)
+{
+        ReceivedWatch watch = { metrics, 0, 0 };
+        guint tick_id;
+
+        tick_id = g_timeout_add (50, (GSourceFunc)received_watch_tick, &watch);
+        while (soup_message_metrics_get_response_body_bytes_received (metrics) < (guint64)soup_client_message_io_http2_get_stream_window_size (io) &&
+               watch.idle_ticks < 10)
+                g_main_context_iteration (NULL, TRUE);
+        g_source_remove (tick_id);
+
+        /* Anything the last frames triggered */
+        while (g_main_context_iteration (NULL, FALSE));
+
+        return soup_message_metrics_get_response_body_bytes_received (metrics);
+}
+
+static void
+do_flow_control_slow_reader_test (Test *test, gconstpointer data)
+{
+        SoupMessage *msg = soup_message_new (SOUP_METHOD_GET, "https://127.0.0.1:5000/large-fast");
+        SoupClientMessageIO *io;
+        SoupMessageMetrics *metrics;
+        GInputStream *stream;
+        char buffer[65536];
+        gssize nread;
+        gsize total = 0;
+        guint window_updates;
+        guint64 received;
+        gint32 window_size;
+        GError *error = NULL;
+
+        soup_message_add_flags (msg, SOUP_MESSAGE_COLLECT_METRICS);
+        stream = soup_session_send (test->session, msg, NULL, &error);
+        g_assert_no_error (error);
+        io = soup_message_get_io_data (msg);
+        metrics = soup_message_get_metrics (msg);
+        window_updates = soup_client_message_io_http2_get_window_updates_sent (io);
+
+        /* Nothing is read, so once the stream window is full the
+         * server gets no more credit and stops sending.
+         */
+        received = wait_for_stream_window_full (io, metrics);
+        g_assert_cmpuint (received, >, 0);
+        g_assert_cmpuint (soup_client_message_io_http2_get_window_updates_sent (io), ==, window_updates);
+
+        /* The DATA frame headers add less than 1% */
+        window_size = soup_client_message_io_http2_get_stream_window_size (io);
+        g_assert_cmpuint (received, <=, window_size + window_size / 100);
+
+        /* Reading gives the credit back, at the latest once half
+         * the window has been read.
+         */
+        while (soup_client_message_io_http2_get_window_updates_sent (io) == window_updates) {
+                nread = g_input_stream_read (stream, buffer, sizeof (buffer), NULL, &error);
+                g_assert_no_error (error);
+                g_assert_cmpint (nread, >, 0);
+                total += nread;
+                g_assert_cmpuint (total, <=, window_size / 2 + sizeof (buffer));
+        }
+
+        while ((nread = g_input_stream_read (stream, buffer, sizeof (buffer), NULL, &error)) > 0)
+                total += nread;
+        g_assert_no_error (error);
+        g_assert_cmpuint (total, ==, LARGE_FAST_SIZE);
+
+        g_object_unref (stream);
+        g_object_unref (msg);
+}
+
 static GBytes *
 read_stream_to_bytes_sync (GInputStream *stream)
 {
@@ -964,6 +1100,14 @@ main (int argc, char **argv)
                     setup_session,
                     do_large_test,
                     teardown_session);
+        g_test_add ("/http2/flow-control/window", Test, NULL,
+                    setup_session,
+                    do_flow_control_window_test,
+                    teardown_session);
+        g_test_add ("/http2/flow-control/slow-reader", Test, NULL,
+                    setup_session,
+                    do_flow_control_slow_reader_test,
+                    teardown_session);
         g_test_add ("/http2/multiplexing/async", Test, NULL,
                     setup_session,
                     do_multi_message_async_test,
@@ -463,6 +463,75 @@ do_logger_preconnect_test (void)
         soup_test_session_abort_unref (session);
 }
 
+static void
+json_printer (SoupLogger         *logger,
+              SoupLoggerLogLevel  level,
+              char                direction,
+              const char         *data,
+              GPtrArray          *lines)
+{
+        g_ptr_array_add (lines, g_strdup_printf ("%c%s", direction, data));
+}
+
+static void
+do_logger_json_test (void)
+{
+        SoupSession *session;
+        SoupLogger *logger;
+        SoupMessage *msg;
+        GPtrArray *lines;
+        const char *line;
+        int i;
+
+        session = soup_test_session_new (NULL);
+
+        lines = g_ptr_array_new_with_free_func (g_free);
+        logger = soup_logger_new (SOUP_LOGGER_LOG_BODY);
+        g_object_set (logger,
+                      "output-format", SOUP_LOGGER_OUTPUT_JSON,
+                      "sample-interval", 2,
+                      NULL);
+        soup_logger_set_printer (logger, (SoupLoggerPrinter)json_printer, lines, NULL);
+        soup_session_add_feature (session, SOUP_SESSION_FEATURE (logger));
+
+        for (i = 0; i < 3; i++) {
+                msg = soup_message_new_from_uri ("GET", base_uri);
+                soup_message_headers_append (soup_message_get_request_headers (msg),
+                                             "X-Quoted", "a \"quoted\" value");
+                soup_test_session_send_message (session, msg);
+                g_object_unref (msg);
+        }
+
+        soup_logger_flush (logger);
+
+        /* Only the first and third messages are sampled */
+        g_assert_cmpuint (lines->len, ==, 4);
+
+        line = lines->pdata[0];
+        g_assert_cmpint (line[0], ==, '>');
+        g_assert_true (g_str_has_prefix (line + 1, "{\"timestamp\":"));
+        g_assert_nonnull (strstr (line, "\"direction\":\"request\",\"message\":1,"));
+        g_assert_nonnull (strstr (line, "\"method\":\"GET\",\"path\":\"/\""));
+        g_assert_nonnull (strstr (line, "[\"X-Quoted\",\"a \\\"quoted\\\" value\"]"));
+
+        line = lines->pdata[1];
+        g_assert_cmpint (line[0], ==, '<');
+        g_assert_nonnull (strstr (line, "\"direction\":\"response\",\"message\":1,"));
+        g_assert_nonnull (strstr (line, "\"status\":200,\"reason\":\"OK\""));
+        g_assert_nonnull (strstr (line, "[\"Content-Type\",\"text/plain\"]"));
+        /* Bodies are never logged in JSON mode */
+        g_assert_null (strstr (line, "Lorem ipsum"));
+
+        g_assert_nonnull (strstr (lines->pdata[2], "\"message\":3,"));
+        g_assert_nonnull (strstr (lines->pdata[3], "\"message\":3,"));
+
+        g_assert_cmpuint (soup_logger_get_dropped_records (logger), ==, 0);
+
+        g_object_unref (logger);
+        soup_test_session_abort_unref (session);
+        g_ptr_array_unref (lines);
+}
+
 static void
 server_callback (SoupServer        *server,
                  SoupServerMessage *msg,
@@ -499,6 +568,7 @@ main (int argc, char **argv)
         g_test_add_func ("/logger/filters", do_logger_filters_test);
         g_test_add_func ("/logger/cookies", do_logger_cookies_test);
         g_test_add_func ("/logger/preconnect", do_logger_preconnect_test);
+        g_test_add_func ("/logger/json", do_logger_json_test);
 
         ret = g_test_run ();
 
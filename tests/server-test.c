@@ -924,6 +924,94 @@ early_respond_callback (SoupServer        *server,
 		soup_server_message_set_status (msg, SOUP_STATUS_FORBIDDEN, NULL);
 }
 
+static void
+body_stream_spliced (GObject      *source,
+		     GAsyncResult *result,
+		     gpointer      user_data)
+{
+	GError *error = NULL;
+
+	g_output_stream_splice_finish (G_OUTPUT_STREAM (source), result, &error);
+	g_assert_no_error (error);
+}
+
+static void
+early_body_stream_callback (SoupServer        *server,
+			    SoupServerMessage *msg,
+			    const char        *path,
+			    GHashTable        *query,
+			    gpointer           data)
+{
+	GInputStream *stream;
+	GOutputStream *ostream;
+
+	stream = soup_server_message_get_request_body_stream (msg);
+	g_assert_nonnull (stream);
+
+	ostream = g_memory_output_stream_new_resizable ();
+	g_object_set_data_full (G_OBJECT (msg), "body-ostream", ostream, g_object_unref);
+	g_output_stream_splice_async (ostream, stream,
+				      G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+				      G_PRIORITY_DEFAULT, NULL,
+				      body_stream_spliced, NULL);
+	g_object_unref (stream);
+}
+
+static void
+body_stream_callback (SoupServer        *server,
+		      SoupServerMessage *msg,
+		      const char        *path,
+		      GHashTable        *query,
+		      gpointer           data)
+{
+	GMemoryOutputStream *ostream;
+	char *md5;
+
+	/* The body went to the stream, not to the message */
+	g_assert_cmpint (soup_server_message_get_request_body (msg)->length, ==, 0);
+
+	ostream = g_object_get_data (G_OBJECT (msg), "body-ostream");
+	md5 = g_compute_checksum_for_data (G_CHECKSUM_MD5,
+					   g_memory_output_stream_get_data (ostream),
+					   g_memory_output_stream_get_data_size (ostream));
+	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (msg, "text/plain", SOUP_MEMORY_TAKE,
+					  md5, strlen (md5));
+}
+
+static void
+do_early_body_stream_test (ServerData *sd, gconstpointer test_data)
+{
+	SoupSession *session;
+	SoupMessage *msg;
+	GBytes *index, *body;
+	char *md5;
+	guint i;
+
+	server_add_early_handler (sd, NULL, early_body_stream_callback, NULL, NULL);
+	server_add_handler (sd, NULL, body_stream_callback, NULL, NULL);
+
+	session = soup_test_session_new (NULL);
+	index = soup_test_get_index ();
+	md5 = g_compute_checksum_for_bytes (G_CHECKSUM_MD5, index);
+
+	/* Twice, to check the connection is reusable afterwards */
+	for (i = 0; i < 2; i++) {
+		msg = soup_message_new_from_uri ("POST", sd->base_uri);
+		soup_message_set_request_body_from_bytes (msg, "text/plain", index);
+		body = soup_test_session_async_send (session, msg, NULL, NULL);
+
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		g_assert_cmpmem (md5, strlen (md5), g_bytes_get_data (body, NULL), g_bytes_get_size (body));
+
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	g_free (md5);
+	soup_test_session_abort_unref (session);
+}
+
 static void
 do_early_respond_test (ServerData *sd, gconstpointer test_data)
 {
@@ -1293,6 +1381,542 @@ do_steal_connect_test (ServerData *sd, gconstpointer test_data)
 	g_free (proxy_uri_str);
 }
 
+static void
+route_callback (SoupServer        *server,
+		SoupServerMessage *msg,
+		const char        *path,
+		GHashTable        *query,
+		gpointer           data)
+{
+	const char *id = soup_server_message_get_path_param (msg, "id");
+	const char *post = soup_server_message_get_path_param (msg, "post");
+	char *body;
+
+	soup_message_headers_append (soup_server_message_get_response_headers (msg),
+				     "X-Handled-By", data);
+
+	g_assert_null (soup_server_message_get_path_param (msg, "missing"));
+	body = g_strdup_printf ("%s %s", id ? id : "-", post ? post : "-");
+	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (msg, "text/plain",
+					  SOUP_MEMORY_TAKE, body, strlen (body));
+}
+
+static void
+do_routes_test (ServerData *sd, gconstpointer test_data)
+{
+	static const struct {
+		const char *method;
+		const char *path;
+		const char *handled_by;
+		const char *body;
+	} tests[] = {
+		{ "GET", "/users/42", "user", "42 -" },
+		{ "GET", "/users/42/", "user", "42 -" },
+		{ "GET", "/users/me", "me", "- -" },
+		{ "GET", "/users/me/posts/7", "post", "me 7" },
+		{ "GET", "/users/42/posts/7?foo=bar", "post", "42 7" },
+		{ "GET", "/users/42/posts/7/comments", "post", "42 7" },
+		{ "POST", "/users/42", "create", "42 -" },
+		{ "GET", "/users", "server_callback", "index" },
+		{ "GET", "/users/", "server_callback", "index" },
+		{ "POST", "/users/me", "me", "- -" },
+		{ "GET", "/other", "server_callback", "index" }
+	};
+	SoupSession *session;
+	guint i;
+
+	soup_server_add_route (sd->server, NULL, "/users/{id}", route_callback, "user", NULL);
+	soup_server_add_route (sd->server, SOUP_METHOD_POST, "/users/{id}", route_callback, "create", NULL);
+	soup_server_add_route (sd->server, NULL, "/users/{id}/posts/{post}", route_callback, "post", NULL);
+	server_add_handler (sd, "/users/me", route_callback, "me", NULL);
+
+	session = soup_test_session_new (NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		SoupMessage *msg;
+		GUri *uri;
+		GBytes *body;
+
+		debug_printf (1, "  %s %s\n", tests[i].method, tests[i].path);
+
+		uri = g_uri_parse_relative (sd->base_uri, tests[i].path, SOUP_HTTP_URI_FLAGS, NULL);
+		msg = soup_message_new_from_uri (tests[i].method, uri);
+		body = soup_test_session_async_send (session, msg, NULL, NULL);
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		soup_test_assert_handled_by (msg, tests[i].handled_by);
+		g_assert_cmpmem (g_bytes_get_data (body, NULL), g_bytes_get_size (body),
+				 tests[i].body, strlen (tests[i].body));
+		g_bytes_unref (body);
+		g_object_unref (msg);
+		g_uri_unref (uri);
+	}
+
+	/* Removing the method-specific route falls back to the generic one */
+	soup_server_remove_route (sd->server, SOUP_METHOD_POST, "/users/{id}");
+	{
+		SoupMessage *msg;
+		GUri *uri;
+		GBytes *body;
+
+		uri = g_uri_parse_relative (sd->base_uri, "/users/42", SOUP_HTTP_URI_FLAGS, NULL);
+		msg = soup_message_new_from_uri (SOUP_METHOD_POST, uri);
+		body = soup_test_session_async_send (session, msg, NULL, NULL);
+		soup_test_assert_handled_by (msg, "user");
+		g_bytes_unref (body);
+		g_object_unref (msg);
+		g_uri_unref (uri);
+	}
+
+	soup_server_remove_route (sd->server, NULL, "/users/{id}");
+	soup_server_remove_route (sd->server, NULL, "/users/{id}/posts/{post}");
+
+	soup_test_session_abort_unref (session);
+}
+
+static void
+status_line_callback (SoupServer        *server,
+		      SoupServerMessage *msg,
+		      const char        *path,
+		      GHashTable        *query,
+		      gpointer           data)
+{
+	if (!strcmp (path, "/custom"))
+		soup_server_message_set_status (msg, SOUP_STATUS_OK, "Very OK");
+	else if (!strcmp (path, "/unknown"))
+		soup_server_message_set_status (msg, 299, NULL);
+	else
+		soup_server_message_set_status (msg, SOUP_STATUS_ACCEPTED, NULL);
+}
+
+static void
+do_status_line_test (ServerData *sd, gconstpointer test_data)
+{
+	static const struct {
+		const char *path;
+		SoupHTTPVersion version;
+		guint status;
+		const char *reason_phrase;
+	} tests[] = {
+		{ "/standard", SOUP_HTTP_1_1, SOUP_STATUS_ACCEPTED, "Accepted" },
+		{ "/standard", SOUP_HTTP_1_0, SOUP_STATUS_ACCEPTED, "Accepted" },
+		{ "/custom", SOUP_HTTP_1_1, SOUP_STATUS_OK, "Very OK" },
+		{ "/unknown", SOUP_HTTP_1_0, 299, "Unknown Error" }
+	};
+	SoupSession *session;
+	guint i;
+
+	server_add_handler (sd, NULL, status_line_callback, NULL, NULL);
+
+	session = soup_test_session_new (NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		SoupMessage *msg;
+		GUri *uri;
+		GBytes *body;
+		GDateTime *date;
+
+		uri = g_uri_parse_relative (sd->base_uri, tests[i].path, SOUP_HTTP_URI_FLAGS, NULL);
+		msg = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		soup_message_set_http_version (msg, tests[i].version);
+		body = soup_test_session_async_send (session, msg, NULL, NULL);
+
+		soup_test_assert_message_status (msg, tests[i].status);
+		g_assert_cmpstr (soup_message_get_reason_phrase (msg), ==, tests[i].reason_phrase);
+		g_assert_cmpint (soup_message_get_http_version (msg), ==, tests[i].version);
+
+		date = soup_date_time_new_from_http_string (soup_message_headers_get_one (soup_message_get_response_headers (msg), "Date"));
+		g_assert_nonnull (date);
+		g_date_time_unref (date);
+
+		g_bytes_unref (body);
+		g_object_unref (msg);
+		g_uri_unref (uri);
+	}
+
+	soup_test_session_abort_unref (session);
+}
+
+typedef struct {
+	SoupServer *server;
+	SoupServerMessage *msg;
+	int handled;
+	gboolean overlapped;
+	gboolean close_slow;
+} PipelineData;
+
+static gboolean
+pipeline_unpause (gpointer user_data)
+{
+	PipelineData *pd = user_data;
+
+	soup_server_message_set_status (pd->msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (pd->msg, "text/plain",
+					  SOUP_MEMORY_STATIC, "/slow", 5);
+	if (pd->close_slow) {
+		soup_message_headers_append (soup_server_message_get_response_headers (pd->msg),
+					     "Connection", "close");
+	}
+	soup_server_unpause_message (pd->server, pd->msg);
+	pd->msg = NULL;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+pipeline_callback (SoupServer        *server,
+		   SoupServerMessage *msg,
+		   const char        *path,
+		   GHashTable        *query,
+		   gpointer           data)
+{
+	PipelineData *pd = data;
+
+	g_atomic_int_inc (&pd->handled);
+
+	if (!strcmp (path, "/slow")) {
+		GSource *source;
+
+		pd->server = server;
+		pd->msg = msg;
+		soup_server_pause_message (server, msg);
+
+		source = g_timeout_source_new (200);
+		g_source_set_callback (source, pipeline_unpause, pd, NULL);
+		g_source_attach (source, g_main_context_get_thread_default ());
+		g_source_unref (source);
+		return;
+	}
+
+	/* Read ahead while the response to /slow is still pending */
+	if (pd->msg)
+		pd->overlapped = TRUE;
+
+	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (msg, "text/plain",
+					  SOUP_MEMORY_COPY, path, strlen (path));
+}
+
+static void
+do_pipelining_test (ServerData *sd, gconstpointer test_data)
+{
+	static const char *paths[] = { "/slow", "/one", "/two", "/three" };
+	PipelineData pd = { NULL, NULL, 0, FALSE };
+	GSocketClient *client;
+	GSocketConnection *conn;
+	GInputStream *istream;
+	GString *requests;
+	GByteArray *response;
+	char buffer[1024];
+	gssize nread;
+	const char *p;
+	guint i;
+	GError *error = NULL;
+
+	g_object_set (sd->server, "pipeline-depth", 4, NULL);
+	server_add_handler (sd, NULL, pipeline_callback, &pd, NULL);
+
+	requests = g_string_new (NULL);
+	for (i = 0; i < G_N_ELEMENTS (paths); i++) {
+		g_string_append_printf (requests,
+					"GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n%s\r\n",
+					paths[i],
+					i == G_N_ELEMENTS (paths) - 1 ? "Connection: close\r\n" : "");
+	}
+
+	client = g_socket_client_new ();
+	conn = g_socket_client_connect_to_host (client, g_uri_get_host (sd->base_uri),
+						g_uri_get_port (sd->base_uri), NULL, &error);
+	g_assert_no_error (error);
+
+	g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (conn)),
+				   requests->str, requests->len, NULL, NULL, &error);
+	g_assert_no_error (error);
+
+	/* The last request closes the connection, so read until EOF */
+	response = g_byte_array_new ();
+	istream = g_io_stream_get_input_stream (G_IO_STREAM (conn));
+	while ((nread = g_input_stream_read (istream, buffer, sizeof (buffer), NULL, &error)) > 0)
+		g_byte_array_append (response, (guint8 *)buffer, nread);
+	g_assert_no_error (error);
+	g_byte_array_append (response, (guint8 *)"", 1);
+
+	debug_printf (2, "%s\n", (char *)response->data);
+
+	/* Every request was answered, in order */
+	p = (const char *)response->data;
+	for (i = 0; i < G_N_ELEMENTS (paths); i++) {
+		g_assert_true (g_str_has_prefix (p, "HTTP/1.1 200 OK\r\n"));
+		p = strstr (p, "\r\n\r\n");
+		g_assert_nonnull (p);
+		p += 4;
+		g_assert_true (g_str_has_prefix (p, paths[i]));
+		p += strlen (paths[i]);
+	}
+	g_assert_cmpstr (p, ==, "");
+
+	g_assert_cmpint (g_atomic_int_get (&pd.handled), ==, G_N_ELEMENTS (paths));
+	g_assert_true (pd.overlapped);
+
+	g_byte_array_free (response, TRUE);
+	g_string_free (requests, TRUE);
+	g_object_unref (conn);
+	g_object_unref (client);
+}
+
+static void
+pipeline_request_aborted (SoupServer        *server,
+			  SoupServerMessage *msg,
+			  int               *n_aborted)
+{
+	g_atomic_int_inc (n_aborted);
+}
+
+static void
+do_pipelining_close_test (ServerData *sd, gconstpointer test_data)
+{
+	static const char *requests =
+		"GET /slow HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+		"GET /one HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+		"GET /two HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+	PipelineData pd = { NULL, NULL, 0, FALSE, TRUE };
+	GSocketClient *client;
+	GSocketConnection *conn;
+	GInputStream *istream;
+	GString *response;
+	char buffer[1024];
+	gssize nread;
+	int n_aborted = 0;
+	GError *error = NULL;
+
+	g_object_set (sd->server, "pipeline-depth", 4, NULL);
+	server_add_handler (sd, NULL, pipeline_callback, &pd, NULL);
+	g_signal_connect (sd->server, "request-aborted",
+			  G_CALLBACK (pipeline_request_aborted), &n_aborted);
+
+	client = g_socket_client_new ();
+	conn = g_socket_client_connect_to_host (client, g_uri_get_host (sd->base_uri),
+						g_uri_get_port (sd->base_uri), NULL, &error);
+	g_assert_no_error (error);
+
+	/* The handler of /slow only closes the connection once the
+	 * requests after it were read and handled...
+	 */
+	g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (conn)),
+				   requests, strlen (requests), NULL, NULL, &error);
+	g_assert_no_error (error);
+
+	/* ...which still ends the connection after its response */
+	response = g_string_new (NULL);
+	istream = g_io_stream_get_input_stream (G_IO_STREAM (conn));
+	while ((nread = g_input_stream_read (istream, buffer, sizeof (buffer), NULL, &error)) > 0)
+		g_string_append_len (response, buffer, nread);
+	g_assert_no_error (error);
+
+	debug_printf (2, "%s\n", response->str);
+
+	g_assert_true (g_str_has_prefix (response->str, "HTTP/1.1 200 OK\r\n"));
+	g_assert_nonnull (strstr (response->str, "Connection: close\r\n"));
+	g_assert_true (g_str_has_suffix (response->str, "\r\n\r\n/slow"));
+	g_assert_true (pd.overlapped);
+
+	/* The requests read ahead are aborted, once each */
+	g_assert_cmpint (g_atomic_int_get (&pd.handled), ==, 3);
+	while (g_atomic_int_get (&n_aborted) < 2)
+		g_usleep (1000);
+	g_usleep (10000);
+	g_assert_cmpint (g_atomic_int_get (&n_aborted), ==, 2);
+
+	g_string_free (response, TRUE);
+	g_object_unref (conn);
+	g_object_unref (client);
+}
+
+static char *
+read_raw_response (GIOStream *stream)
+{
+	GInputStream *istream = g_io_stream_get_input_stream (stream);
+	GString *response;
+	const char *end, *length;
+	char buffer[1024];
+	gssize nread;
+	GError *error = NULL;
+
+	response = g_string_new (NULL);
+	while (TRUE) {
+		end = strstr (response->str, "\r\n\r\n");
+		if (end) {
+			length = strstr (response->str, "Content-Length: ");
+			if (length && length < end &&
+			    response->len >= (end + 4 - response->str) + g_ascii_strtoull (length + 16, NULL, 10))
+				break;
+		}
+
+		nread = g_input_stream_read (istream, buffer, sizeof (buffer), NULL, &error);
+		g_assert_no_error (error);
+		if (nread == 0)
+			break;
+		g_string_append_len (response, buffer, nread);
+	}
+
+	return g_string_free (response, FALSE);
+}
+
+static GIOStream *
+send_raw_request (GSocketClient *client,
+		  GIOStream     *stream,
+		  GUri          *uri,
+		  const char    *path)
+{
+	char *request;
+	GError *error = NULL;
+
+	if (!stream) {
+		stream = G_IO_STREAM (g_socket_client_connect_to_host (client, g_uri_get_host (uri),
+								       g_uri_get_port (uri), NULL, &error));
+		g_assert_no_error (error);
+	}
+
+	request = g_strdup_printf ("GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", path);
+	g_output_stream_write_all (g_io_stream_get_output_stream (stream),
+				   request, strlen (request), NULL, NULL, &error);
+	g_assert_no_error (error);
+	g_free (request);
+
+	return stream;
+}
+
+static void
+do_admission_test (ServerData *sd, gconstpointer test_data)
+{
+	PipelineData pd = { NULL, NULL, 0, FALSE };
+	GSocketClient *client;
+	GIOStream *conn1, *conn2;
+	char *response;
+
+	g_object_set (sd->server, "max-in-flight", 1, NULL);
+	server_add_handler (sd, NULL, pipeline_callback, &pd, NULL);
+
+	client = g_socket_client_new ();
+
+	/* Make sure both connections have been accepted */
+	conn1 = send_raw_request (client, NULL, sd->base_uri, "/one");
+	response = read_raw_response (conn1);
+	g_assert_true (g_str_has_prefix (response, "HTTP/1.1 200 OK\r\n"));
+	g_free (response);
+	conn2 = send_raw_request (client, NULL, sd->base_uri, "/two");
+	response = read_raw_response (conn2);
+	g_assert_true (g_str_has_prefix (response, "HTTP/1.1 200 OK\r\n"));
+	g_free (response);
+	g_assert_cmpuint (soup_server_get_n_connections (sd->server), ==, 2);
+
+	/* The first request keeps the only slot busy for a while... */
+	send_raw_request (client, conn1, sd->base_uri, "/slow");
+	while (soup_server_get_n_in_flight (sd->server) == 0)
+		g_usleep (1000);
+
+	/* ...so the second one is turned away without reaching the handler */
+	send_raw_request (client, conn2, sd->base_uri, "/three");
+	response = read_raw_response (conn2);
+	g_assert_true (g_str_has_prefix (response, "HTTP/1.1 503 Service Unavailable\r\n"));
+	g_assert_nonnull (strstr (response, "Retry-After: 1\r\n"));
+	g_assert_nonnull (strstr (response, "Connection: close\r\n"));
+	g_free (response);
+	g_assert_cmpuint (soup_server_get_n_rejected (sd->server), ==, 1);
+	g_assert_cmpint (g_atomic_int_get (&pd.handled), ==, 3);
+
+	response = read_raw_response (conn1);
+	g_assert_true (g_str_has_prefix (response, "HTTP/1.1 200 OK\r\n"));
+	g_assert_true (g_str_has_suffix (response, "/slow"));
+	g_free (response);
+
+	g_object_unref (conn2);
+	g_object_unref (conn1);
+	g_object_unref (client);
+}
+
+static void
+assert_closed_by_server (GIOStream  *stream,
+			 const char *data,
+			 gint64      min_delay)
+{
+	GInputStream *istream = g_io_stream_get_input_stream (stream);
+	char buffer[1024];
+	gssize nread;
+	gint64 start;
+	GError *error = NULL;
+
+	start = g_get_monotonic_time ();
+	if (data) {
+		g_output_stream_write_all (g_io_stream_get_output_stream (stream),
+					   data, strlen (data), NULL, NULL, &error);
+		g_assert_no_error (error);
+	}
+
+	nread = g_input_stream_read (istream, buffer, sizeof (buffer), NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (nread, ==, 0);
+	g_assert_cmpint (g_get_monotonic_time () - start, >=, min_delay);
+}
+
+static void
+do_timeouts_test (ServerData *sd, gconstpointer test_data)
+{
+	PipelineData pd = { NULL, NULL, 0, FALSE };
+	GSocketClient *client;
+	GIOStream *conn;
+	char *response;
+
+	g_object_set (sd->server,
+		      "idle-timeout", 1,
+		      "header-timeout", 1,
+		      "body-timeout", 1,
+		      NULL);
+	server_add_handler (sd, NULL, pipeline_callback, &pd, NULL);
+
+	client = g_socket_client_new ();
+	/* Fail rather than hang if the server never closes */
+	g_socket_client_set_timeout (client, 10);
+
+	/* An idle keep-alive connection is closed */
+	conn = send_raw_request (client, NULL, sd->base_uri, "/one");
+	response = read_raw_response (conn);
+	g_assert_true (g_str_has_prefix (response, "HTTP/1.1 200 OK\r\n"));
+	g_free (response);
+	assert_closed_by_server (conn, NULL, G_TIME_SPAN_SECOND);
+	g_object_unref (conn);
+
+	/* So is one whose client never finishes the headers... */
+	conn = G_IO_STREAM (g_socket_client_connect_to_host (client, g_uri_get_host (sd->base_uri),
+							     g_uri_get_port (sd->base_uri), NULL, NULL));
+	g_assert_nonnull (conn);
+	assert_closed_by_server (conn, "GET /two HTTP/1.1\r\nHost: 127.0.0.1\r\n", G_TIME_SPAN_SECOND);
+	g_object_unref (conn);
+
+	/* ...or the body */
+	conn = G_IO_STREAM (g_socket_client_connect_to_host (client, g_uri_get_host (sd->base_uri),
+							     g_uri_get_port (sd->base_uri), NULL, NULL));
+	g_assert_nonnull (conn);
+	assert_closed_by_server (conn, "POST /three HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 10\r\n\r\nabc",
+				 G_TIME_SPAN_SECOND);
+	g_object_unref (conn);
+
+	/* Without a header timeout, a request started when the
+	 * connection was about to be idle for too long gets another
+	 * idle timeout to finish its headers.
+	 */
+	g_object_set (sd->server, "header-timeout", 0, NULL);
+	conn = G_IO_STREAM (g_socket_client_connect_to_host (client, g_uri_get_host (sd->base_uri),
+							     g_uri_get_port (sd->base_uri), NULL, NULL));
+	g_assert_nonnull (conn);
+	assert_closed_by_server (conn, "GET /four HTTP/1.1\r\n", 2 * G_TIME_SPAN_SECOND);
+	g_object_unref (conn);
+
+	g_assert_cmpint (g_atomic_int_get (&pd.handled), ==, 1);
+
+	g_object_unref (client);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1323,12 +1947,26 @@ main (int argc, char **argv)
 		    server_setup_nohandler, do_fail_500_test, server_teardown);
 	g_test_add ("/server/early/stream", ServerData, NULL,
 		    server_setup_nohandler, do_early_stream_test, server_teardown);
+	g_test_add ("/server/early/body-stream", ServerData, NULL,
+		    server_setup_nohandler, do_early_body_stream_test, server_teardown);
 	g_test_add ("/server/early/respond", ServerData, NULL,
 		    server_setup, do_early_respond_test, server_teardown);
 	g_test_add ("/server/early/multi", ServerData, NULL,
 		    server_setup_nohandler, do_early_multi_test, server_teardown);
 	g_test_add ("/server/steal/CONNECT", ServerData, NULL,
 		    server_setup, do_steal_connect_test, server_teardown);
+	g_test_add ("/server/routes", ServerData, NULL,
+		    server_setup, do_routes_test, server_teardown);
+	g_test_add ("/server/status-line", ServerData, NULL,
+		    server_setup_nohandler, do_status_line_test, server_teardown);
+	g_test_add ("/server/pipelining", ServerData, NULL,
+		    server_setup_nohandler, do_pipelining_test, server_teardown);
+	g_test_add ("/server/pipelining/close", ServerData, NULL,
+		    server_setup_nohandler, do_pipelining_close_test, server_teardown);
+	g_test_add ("/server/admission", ServerData, NULL,
+		    server_setup_nohandler, do_admission_test, server_teardown);
+	g_test_add ("/server/timeouts", ServerData, NULL,
+		    server_setup_nohandler, do_timeouts_test, server_teardown);
 
 	ret = g_test_run ();
 
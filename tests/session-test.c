@@ -9,6 +9,7 @@ static gboolean timeout;
 static GMainLoop *loop;
 static SoupMessagePriority expected_priorities[3];
 static GBytes *index_bytes;
+static int io_threads_active, io_threads_max_active;
 
 static gboolean
 timeout_cb (gpointer user_data)
@@ -19,6 +20,21 @@ timeout_cb (gpointer user_data)
 	return FALSE;
 }
 
+typedef struct {
+	SoupServer *server;
+	SoupServerMessage *msg;
+} IOThreadsResponse;
+
+static gboolean
+io_threads_respond (IOThreadsResponse *response)
+{
+	g_atomic_int_add (&io_threads_active, -1);
+	soup_server_unpause_message (response->server, response->msg);
+	g_free (response);
+
+	return FALSE;
+}
+
 static void
 server_handler (SoupServer        *server,
 		SoupServerMessage *msg,
@@ -34,6 +50,27 @@ server_handler (SoupServer        *server,
 		g_source_set_callback (timer, timeout_cb, &timeout, NULL);
 		g_source_attach (timer, context);
 		g_source_unref (timer);
+	} else if (!strcmp (path, "/io-threads")) {
+		IOThreadsResponse *response;
+		GSource *timer;
+		int active;
+
+		/* Each connection of the client has at most one request
+		 * in flight, so the requests being handled at once give
+		 * a lower bound of its open connections.
+		 */
+		active = g_atomic_int_add (&io_threads_active, 1) + 1;
+		if (active > g_atomic_int_get (&io_threads_max_active))
+			g_atomic_int_set (&io_threads_max_active, active);
+
+		response = g_new (IOThreadsResponse, 1);
+		response->server = server;
+		response->msg = msg;
+		soup_server_pause_message (server, msg);
+		timer = g_timeout_source_new (20);
+		g_source_set_callback (timer, (GSourceFunc)io_threads_respond, response, NULL);
+		g_source_attach (timer, g_main_context_get_thread_default ());
+		g_source_unref (timer);
 	} else if (!strcmp (path, "/index.txt")) {
 		soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
 		soup_server_message_set_response (msg, "text/plain",
@@ -465,6 +502,354 @@ do_queue_order_test (void)
 	soup_test_session_abort_unref (session);
 }
 
+static void
+do_metrics_registry_test (void)
+{
+	SoupSession *session;
+	SoupMetricsRegistry *registry;
+	GVariant *snapshot, *hosts, *host, *scheduler, *value;
+	char *host_key, *expected, *prometheus;
+	guint64 count, sum, p50, p90, p99, max;
+	int i;
+
+	session = soup_test_session_new (NULL);
+	registry = soup_metrics_registry_new ();
+	soup_session_add_feature (session, SOUP_SESSION_FEATURE (registry));
+
+	for (i = 0; i < 3; i++) {
+		SoupMessage *msg;
+		GBytes *body;
+
+		msg = soup_message_new_from_uri ("GET", base_uri);
+		body = soup_test_session_async_send (session, msg, NULL, NULL);
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	host_key = g_strdup_printf ("http://%s:%d", g_uri_get_host (base_uri), g_uri_get_port (base_uri));
+
+	snapshot = g_variant_ref_sink (soup_metrics_registry_snapshot (registry));
+	hosts = g_variant_lookup_value (snapshot, "hosts", G_VARIANT_TYPE ("a{sa{sv}}"));
+	host = g_variant_lookup_value (hosts, host_key, G_VARIANT_TYPE ("a{sv}"));
+	g_assert_nonnull (host);
+
+	value = g_variant_lookup_value (host, "requests", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), ==, 3);
+	g_variant_unref (value);
+	value = g_variant_lookup_value (host, "connections-opened", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), ==, 1);
+	g_variant_unref (value);
+	value = g_variant_lookup_value (host, "connections-reused", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), ==, 2);
+	g_variant_unref (value);
+	value = g_variant_lookup_value (host, "bytes-received", G_VARIANT_TYPE_UINT64);
+	/* Three "ok\r\n" bodies plus their headers */
+	g_assert_cmpuint (g_variant_get_uint64 (value), >, 3 * 4);
+	g_variant_unref (value);
+
+	value = g_variant_lookup_value (host, "total", G_VARIANT_TYPE ("(tttttt)"));
+	g_variant_get (value, "(tttttt)", &count, &sum, &p50, &p90, &p99, &max);
+	g_assert_cmpuint (count, ==, 3);
+	g_assert_cmpuint (p50, <=, p90);
+	g_assert_cmpuint (p90, <=, p99);
+	g_assert_cmpuint (p99, <=, max);
+	g_assert_cmpuint (max, <=, sum);
+	g_variant_unref (value);
+
+	value = g_variant_lookup_value (host, "connect", G_VARIANT_TYPE ("(tttttt)"));
+	g_variant_get (value, "(tttttt)", &count, &sum, &p50, &p90, &p99, &max);
+	g_assert_cmpuint (count, ==, 1);
+	g_variant_unref (value);
+
+	g_variant_unref (host);
+	g_variant_unref (hosts);
+
+	scheduler = g_variant_lookup_value (snapshot, "scheduler", G_VARIANT_TYPE ("a{sv}"));
+	value = g_variant_lookup_value (scheduler, "queue-runs", G_VARIANT_TYPE ("(tttttt)"));
+	g_variant_get (value, "(tttttt)", &count, &sum, &p50, &p90, &p99, &max);
+	g_assert_cmpuint (count, >, 0);
+	g_variant_unref (value);
+	value = g_variant_lookup_value (scheduler, "queue-kicks", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), >, 0);
+	g_variant_unref (value);
+	value = g_variant_lookup_value (scheduler, "items-scanned", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), >=, 3);
+	g_variant_unref (value);
+	value = g_variant_lookup_value (scheduler, "cleanup-passes", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), >, 0);
+	g_variant_unref (value);
+	value = g_variant_lookup_value (scheduler, "requeues", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), ==, 0);
+	g_variant_unref (value);
+	g_variant_unref (scheduler);
+	g_variant_unref (snapshot);
+
+	prometheus = soup_metrics_registry_to_prometheus (registry);
+	expected = g_strdup_printf ("soup_requests_total{host=\"%s\"} 3\n", host_key);
+	g_assert_nonnull (strstr (prometheus, expected));
+	g_assert_nonnull (strstr (prometheus, "# TYPE soup_request_phase_seconds summary\n"));
+	g_free (expected);
+	g_free (prometheus);
+
+	soup_metrics_registry_reset (registry);
+	snapshot = g_variant_ref_sink (soup_metrics_registry_snapshot (registry));
+	hosts = g_variant_lookup_value (snapshot, "hosts", G_VARIANT_TYPE ("a{sa{sv}}"));
+	g_assert_cmpuint (g_variant_n_children (hosts), ==, 0);
+	g_variant_unref (hosts);
+	g_variant_unref (snapshot);
+
+	g_free (host_key);
+	g_object_unref (registry);
+	soup_test_session_abort_unref (session);
+}
+
+static gpointer
+thread_safe_send_thread (SoupSession *session)
+{
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		SoupMessage *msg;
+		GBytes *body;
+		GError *error = NULL;
+
+		msg = soup_message_new_from_uri ("GET", base_uri);
+		body = soup_session_send_and_read (session, msg, NULL, &error);
+		g_assert_no_error (error);
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		g_assert_cmpmem (g_bytes_get_data (body, NULL), g_bytes_get_size (body), "ok\r\n", 4);
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	return NULL;
+}
+
+static void
+thread_safe_send_ready (SoupSession   *session,
+			GAsyncResult  *result,
+			GInputStream **stream)
+{
+	GError *error = NULL;
+
+	g_assert_true (g_main_context_is_owner (g_main_context_default ()));
+	*stream = soup_session_send_finish (session, result, &error);
+	g_assert_no_error (error);
+}
+
+static void
+do_thread_safe_test (void)
+{
+	SoupSession *session;
+	SoupCookieJar *jar;
+	SoupMessage *msg;
+	GInputStream *stream = NULL;
+	GThread *threads[4];
+	char buffer[16];
+	gsize n_read;
+	guint i;
+
+	session = soup_test_session_new ("thread-safe", TRUE, NULL);
+	g_assert_true (soup_session_get_thread_safe (session));
+
+	jar = soup_cookie_jar_new ();
+	soup_session_add_feature (session, SOUP_SESSION_FEATURE (jar));
+	g_assert_true (soup_session_get_feature (session, SOUP_TYPE_COOKIE_JAR) == SOUP_SESSION_FEATURE (jar));
+
+	for (i = 0; i < G_N_ELEMENTS (threads); i++)
+		threads[i] = g_thread_new ("send", (GThreadFunc)thread_safe_send_thread, session);
+	for (i = 0; i < G_N_ELEMENTS (threads); i++)
+		g_thread_join (threads[i]);
+
+	/* The callback is invoked in the caller context */
+	msg = soup_message_new_from_uri ("GET", base_uri);
+	soup_session_send_async (session, msg, G_PRIORITY_DEFAULT, NULL,
+				 (GAsyncReadyCallback)thread_safe_send_ready, &stream);
+	while (!stream)
+		g_main_context_iteration (NULL, TRUE);
+	soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+	g_assert_true (g_input_stream_read_all (stream, buffer, sizeof (buffer), &n_read, NULL, NULL));
+	g_assert_cmpmem (buffer, n_read, "ok\r\n", 4);
+	g_object_unref (stream);
+	g_object_unref (msg);
+
+	/* The body is read through the session thread as it's asked for */
+	msg = soup_message_new_from_uri ("GET", base_uri);
+	stream = soup_session_send (session, msg, NULL, NULL);
+	g_assert_nonnull (stream);
+	soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+	g_assert_false (G_IS_MEMORY_INPUT_STREAM (stream));
+	g_assert_true (g_input_stream_read_all (stream, buffer, sizeof (buffer), &n_read, NULL, NULL));
+	g_assert_cmpmem (buffer, n_read, "ok\r\n", 4);
+	g_assert_true (g_input_stream_close (stream, NULL, NULL));
+	g_object_unref (stream);
+	g_object_unref (msg);
+
+	soup_session_remove_feature (session, SOUP_SESSION_FEATURE (jar));
+	g_assert_false (soup_session_has_feature (session, SOUP_TYPE_COOKIE_JAR));
+	g_object_unref (jar);
+
+	/* Operations may still hold the session in its thread for a bit */
+	soup_session_abort (session);
+	g_object_unref (session);
+}
+
+typedef struct {
+	SoupSession *session;
+	GUri *uri;
+	GThread *io_thread;
+} IOThreadsSend;
+
+static void
+io_threads_got_headers (SoupMessage   *msg,
+			IOThreadsSend *send)
+{
+	/* Emitted in the I/O thread owning the host of the message */
+	g_assert_true (send->io_thread == NULL || send->io_thread == g_thread_self ());
+	send->io_thread = g_thread_self ();
+}
+
+static gpointer
+io_threads_send_thread (IOThreadsSend *send)
+{
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		SoupMessage *msg;
+		GBytes *body;
+		GError *error = NULL;
+
+		msg = soup_message_new_from_uri ("GET", send->uri);
+		g_signal_connect (msg, "got-headers",
+				  G_CALLBACK (io_threads_got_headers), send);
+		body = soup_session_send_and_read (send->session, msg, NULL, &error);
+		g_assert_no_error (error);
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		g_assert_cmpmem (g_bytes_get_data (body, NULL), g_bytes_get_size (body), "ok\r\n", 4);
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	return NULL;
+}
+
+static void
+io_threads_printer (SoupLogger         *logger,
+		    SoupLoggerLogLevel  level,
+		    char                direction,
+		    const char         *data,
+		    gpointer            user_data)
+{
+	if (direction == '>' && g_str_has_prefix (data, "GET "))
+		g_atomic_int_inc ((int *)user_data);
+}
+
+static void
+do_io_threads_test (void)
+{
+	SoupSession *session;
+	SoupLogger *logger;
+	int logged_requests = 0;
+	IOThreadsSend sends[4];
+	GThread *threads[4];
+	GUri *uri, *localhost_uri;
+	guint i;
+
+	/* Several I/O threads imply a thread-safe session */
+	session = soup_test_session_new ("io-threads", 3,
+					 "max-conns", 2,
+					 NULL);
+	g_assert_true (soup_session_get_thread_safe (session));
+	g_assert_cmpuint (soup_session_get_io_threads (session), ==, 3);
+
+	/* The logger is used from all the I/O threads */
+	logger = soup_logger_new (SOUP_LOGGER_LOG_BODY);
+	soup_logger_set_printer (logger, io_threads_printer, &logged_requests, NULL);
+	soup_session_add_feature (session, SOUP_SESSION_FEATURE (logger));
+	g_assert_true (soup_session_has_feature (session, SOUP_TYPE_LOGGER));
+	g_object_unref (logger);
+
+	/* Two hosts for the same server, owned by different threads
+	 * ("127.0.0.1" and "localhost" hash to different threads out
+	 * of 3, whatever the port), sharing the global connection
+	 * limit.
+	 */
+	uri = g_uri_parse_relative (base_uri, "/io-threads", SOUP_HTTP_URI_FLAGS, NULL);
+	localhost_uri = soup_uri_copy (uri, SOUP_URI_HOST, "localhost", SOUP_URI_NONE);
+	g_atomic_int_set (&io_threads_max_active, 0);
+	for (i = 0; i < G_N_ELEMENTS (threads); i++) {
+		sends[i].session = session;
+		sends[i].uri = i % 2 ? localhost_uri : uri;
+		sends[i].io_thread = NULL;
+		threads[i] = g_thread_new ("send", (GThreadFunc)io_threads_send_thread, &sends[i]);
+	}
+	for (i = 0; i < G_N_ELEMENTS (threads); i++) {
+		g_thread_join (threads[i]);
+		g_assert_nonnull (sends[i].io_thread);
+	}
+	g_uri_unref (localhost_uri);
+	g_uri_unref (uri);
+
+	/* Each host always in the same thread, each in its own */
+	g_assert_true (sends[0].io_thread == sends[2].io_thread);
+	g_assert_true (sends[1].io_thread == sends[3].io_thread);
+	g_assert_true (sends[0].io_thread != sends[1].io_thread);
+
+	/* The server never had more than max-conns connections busy */
+	g_assert_cmpint (g_atomic_int_get (&io_threads_max_active), >=, 1);
+	g_assert_cmpint (g_atomic_int_get (&io_threads_max_active), <=, 2);
+
+	g_assert_cmpint (g_atomic_int_get (&logged_requests), ==, G_N_ELEMENTS (threads) * 5);
+
+	soup_session_abort (session);
+	g_object_unref (session);
+}
+
+static void
+do_io_threads_remove_feature_test (void)
+{
+	SoupSession *session;
+	SoupCookieJar *jar;
+	IOThreadsSend sends[4];
+	GThread *threads[4];
+	GUri *localhost_uri;
+	guint i;
+
+	session = soup_test_session_new ("io-threads", 3, NULL);
+	jar = soup_cookie_jar_new ();
+	soup_session_add_feature (session, SOUP_SESSION_FEATURE (jar));
+	g_object_add_weak_pointer (G_OBJECT (jar), (gpointer *)&jar);
+	g_object_unref (jar);
+
+	localhost_uri = soup_uri_copy (base_uri, SOUP_URI_HOST, "localhost", SOUP_URI_NONE);
+	for (i = 0; i < G_N_ELEMENTS (threads); i++) {
+		sends[i].session = session;
+		sends[i].uri = i % 2 ? localhost_uri : base_uri;
+		sends[i].io_thread = NULL;
+		threads[i] = g_thread_new ("send", (GThreadFunc)io_threads_send_thread, &sends[i]);
+	}
+
+	/* Removed while messages are queued in every thread: they
+	 * keep using it until they are done, and the session lets it
+	 * go once no thread uses it anymore.
+	 */
+	g_usleep (1000);
+	soup_session_remove_feature_by_type (session, SOUP_TYPE_COOKIE_JAR);
+	g_assert_false (soup_session_has_feature (session, SOUP_TYPE_COOKIE_JAR));
+
+	for (i = 0; i < G_N_ELEMENTS (threads); i++)
+		g_thread_join (threads[i]);
+	g_uri_unref (localhost_uri);
+
+	/* Every thread has dropped it once it is idle again */
+	soup_session_abort (session);
+	while (g_atomic_pointer_get (&jar))
+		g_usleep (1000);
+
+	g_object_unref (session);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -485,6 +870,10 @@ main (int argc, char **argv)
 	g_test_add_func ("/session/property", do_property_tests);
 	g_test_add_func ("/session/features", do_features_test);
 	g_test_add_func ("/session/queue-order", do_queue_order_test);
+	g_test_add_func ("/session/metrics-registry", do_metrics_registry_test);
+	g_test_add_func ("/session/thread-safe", do_thread_safe_test);
+	g_test_add_func ("/session/io-threads", do_io_threads_test);
+	g_test_add_func ("/session/io-threads/remove-feature", do_io_threads_remove_feature_test);
 
 	ret = g_test_run ();
 
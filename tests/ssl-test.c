@@ -686,6 +686,61 @@ do_tls_interaction_preconnect_test (gconstpointer data)
         g_object_unref (certificate);
 }
 
+static void
+do_session_resumption_test (void)
+{
+	SoupSession *session;
+	SoupMetricsRegistry *registry;
+	GVariant *snapshot, *hosts, *host, *value;
+	char *host_key;
+	guint64 resumptions;
+	int i;
+
+	SOUP_TEST_SKIP_IF_NO_TLS;
+
+	session = soup_test_session_new (NULL);
+	registry = soup_metrics_registry_new ();
+	soup_session_add_feature (session, SOUP_SESSION_FEATURE (registry));
+
+	for (i = 0; i < 2; i++) {
+		SoupMessage *msg;
+		GBytes *body;
+
+		msg = soup_message_new_from_uri ("GET", uri);
+		soup_message_add_flags (msg, SOUP_MESSAGE_NEW_CONNECTION);
+		body = soup_session_send_and_read (session, msg, NULL, NULL);
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	host_key = g_strdup_printf ("https://%s:%d", g_uri_get_host (uri), g_uri_get_port (uri));
+	snapshot = g_variant_ref_sink (soup_metrics_registry_snapshot (registry));
+	hosts = g_variant_lookup_value (snapshot, "hosts", G_VARIANT_TYPE ("a{sa{sv}}"));
+	host = g_variant_lookup_value (hosts, host_key, G_VARIANT_TYPE ("a{sv}"));
+	g_assert_nonnull (host);
+
+	value = g_variant_lookup_value (host, "tls-handshakes", G_VARIANT_TYPE_UINT64);
+	g_assert_cmpuint (g_variant_get_uint64 (value), ==, 2);
+	g_variant_unref (value);
+
+	/* Whether the resumption can be seen depends on the TLS backend,
+	 * but the first connection never has anything to resume.
+	 */
+	value = g_variant_lookup_value (host, "tls-resumptions", G_VARIANT_TYPE_UINT64);
+	resumptions = g_variant_get_uint64 (value);
+	g_assert_cmpuint (resumptions, <=, 1);
+	debug_printf (1, "  %" G_GUINT64_FORMAT " resumed session(s)\n", resumptions);
+	g_variant_unref (value);
+
+	g_variant_unref (host);
+	g_variant_unref (hosts);
+	g_variant_unref (snapshot);
+	g_free (host_key);
+	g_object_unref (registry);
+	soup_test_session_abort_unref (session);
+}
+
 static void
 server_handler (SoupServer        *server,
 		SoupServerMessage *msg,
@@ -726,6 +781,7 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/ssl/tls-interaction", server, do_tls_interaction_test);
         g_test_add_data_func ("/ssl/tls-interaction-msg", server, do_tls_interaction_msg_test);
         g_test_add_data_func ("/ssl/tls-interaction/preconnect", server, do_tls_interaction_preconnect_test);
+	g_test_add_func ("/ssl/session-resumption", do_session_resumption_test);
 
 	for (i = 0; i < G_N_ELEMENTS (strictness_tests); i++) {
 		g_test_add_data_func (strictness_tests[i].name,
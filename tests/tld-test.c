@@ -177,6 +177,49 @@ do_non_inet_tests (void)
 	}
 }
 
+static void
+do_cache_tests (void)
+{
+	guint64 hits, misses, old_hits, old_misses;
+	char *hostname;
+	const char *base_domain;
+	GError *error = NULL;
+
+	soup_tld_get_cache_stats (&old_hits, &old_misses);
+
+	hostname = g_strdup ("www.cache.example.org");
+	base_domain = soup_tld_get_base_domain (hostname, NULL);
+	g_assert_cmpstr (base_domain, ==, "example.org");
+	g_assert_true (base_domain == hostname + 10);
+	g_free (hostname);
+
+	/* The cached result points into the hostname it is asked for */
+	hostname = g_strdup ("www.cache.example.org");
+	base_domain = soup_tld_get_base_domain (hostname, NULL);
+	g_assert_cmpstr (base_domain, ==, "example.org");
+	g_assert_true (base_domain == hostname + 10);
+	g_free (hostname);
+
+	soup_tld_get_cache_stats (&hits, &misses);
+	g_assert_cmpuint (hits - old_hits, ==, 1);
+	g_assert_cmpuint (misses - old_misses, ==, 1);
+
+	/* Errors are cached too */
+	g_assert_null (soup_tld_get_base_domain ("127.0.0.2", &error));
+	g_assert_error (error, SOUP_TLD_ERROR, SOUP_TLD_ERROR_IS_IP_ADDRESS);
+	g_clear_error (&error);
+	g_assert_null (soup_tld_get_base_domain ("127.0.0.2", &error));
+	g_assert_error (error, SOUP_TLD_ERROR, SOUP_TLD_ERROR_IS_IP_ADDRESS);
+	g_clear_error (&error);
+
+	g_assert_false (soup_tld_domain_is_public_suffix ("www.cache.example.org"));
+	g_assert_false (soup_tld_domain_is_public_suffix ("www.cache.example.org"));
+
+	soup_tld_get_cache_stats (&old_hits, &old_misses);
+	g_assert_cmpuint (old_hits - hits, ==, 2);
+	g_assert_cmpuint (old_misses - misses, ==, 2);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -186,6 +229,7 @@ main (int argc, char **argv)
 
 	g_test_add_func ("/tld/inet", do_inet_tests);
 	g_test_add_func ("/tld/non-inet", do_non_inet_tests);
+	g_test_add_func ("/tld/cache", do_cache_tests);
 
 	ret = g_test_run ();
 